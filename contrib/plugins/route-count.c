@@ -0,0 +1,62 @@
+/*
+ * Count route changes per output interface, printed when unloaded.
+ *
+ *   cc -shared -fPIC -o route-count.so route-count.c
+ *   install -m 644 route-count.so /tmp/route-count.so.new
+ *   mv /tmp/route-count.so.new $PLUGINS/route-count.so
+ *
+ * The plugin only needs the headers, nothing is linked from the host.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <netevent/plugin.h>
+
+#define SLOTS	256
+
+struct counts
+{
+	unsigned long added[SLOTS];
+	unsigned long removed[SLOTS];
+};
+
+static int rc_init(void **state)
+{
+	*state = calloc(1, sizeof(struct counts));
+	return *state == NULL;
+}
+
+static void rc_event(void *state, const struct netevent *ev)
+{
+	struct counts *c = state;
+	unsigned int slot = ev->u.route.oif % SLOTS;
+
+	if (ev->removed)
+		c->removed[slot]++;
+	else
+		c->added[slot]++;
+}
+
+static void rc_exit(void *state)
+{
+	struct counts *c = state;
+	int i;
+
+	for (i=0; i<SLOTS; i++) {
+		if (c->added[i] || c->removed[i])
+			printf("route-count: oif %d added %lu removed %lu\n",
+			       i, c->added[i], c->removed[i]);
+	}
+
+	free(c);
+}
+
+const struct netevent_plugin netevent_plugin = {
+	.abi = NETEVENT_PLUGIN_ABI,
+	.name = "route-count",
+	.interest = NETEVENT_INTEREST(NETEVENT_ROUTE),
+	.init = rc_init,
+	.event = rc_event,
+	.exit = rc_exit,
+};
@@ -0,0 +1,58 @@
+#ifndef __NETEVENT_COALESCE__
+#define __NETEVENT_COALESCE__
+
+/**
+ * @file coalesce.h Event coalescing and flap damping
+ *
+ * Sits between the decoders and the console. The first transition of
+ * an object is printed right away and opens a window, further
+ * transitions inside the window are folded into a single summary line
+ * when it closes. With damping enabled every state change adds a
+ * penalty that decays exponentially, objects above the suppress
+ * threshold stay silent until the penalty falls below the reuse limit.
+ *
+ */
+
+#include <stdint.h>
+
+#define COALESCE_LINK		1
+#define COALESCE_ROUTE		2
+
+#define DAMP_PENALTY		1000
+#define DAMP_SUPPRESS		2000
+#define DAMP_REUSE		750
+#define DAMP_MAX_PENALTY	12000
+#define DAMP_FORGET		10
+
+struct coalesce_key
+{
+	unsigned char kind;
+	unsigned char family;
+	unsigned char prefixlen;
+	unsigned char pad;
+	uint32_t id;
+	unsigned char addr[16];
+};
+
+/**
+* @short Enable the coalescing stage
+*
+* @param window seconds to fold repeated transitions, 0 disables windows
+* @param half_life damping half-life in seconds, 0 disables damping
+* @return 0 on success, -1 on error
+*/
+int coalesce_init(unsigned int window, unsigned int half_life);
+
+int coalesce_enabled(void);
+
+/**
+* @short Offer an event to the coalescing stage
+*
+* @param label object name used in summaries, e.g. "eth3"
+* @param state new state of the object, e.g. "UP"
+* @return 1 if the event was absorbed and must not be printed, 0 otherwise
+*/
+int coalesce_event(const struct coalesce_key *key, const char *label,
+		   const char *state, int color);
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef __NETEVENT_CONNTRACK__
+#define __NETEVENT_CONNTRACK__
+
+/**
+ * @file conntrack.h Connection tracking event source
+ *
+ * A NETLINK_NETFILTER socket subscribed to the ctnetlink groups, next to
+ * the rtnetlink and nl80211 ones. Flow setups run far above route and
+ * link rates, so the socket gets a large receive buffer and is drained
+ * CT_BATCH datagrams per recvmmsg(), up to CT_ROUNDS batches per wakeup.
+ * Overruns are counted, not fatal. A spec picks what is reported:
+ *
+ *   [new][:update][:destroy][:proto=P[/P...]][:sample=N][:agg=SECS]
+ *   [:prefix=V4/V6][:rcvbuf=KB]
+ *
+ * Without event names new and destroy are followed. proto installs a
+ * classic BPF filter on the socket so the kernel drops other protocols
+ * before they are queued. sample=N keeps one flow in N, chosen by a hash
+ * of its original tuple so the new and destroy events of a flow are kept
+ * together. agg=SECS prints no flow lines, events are counted per
+ * protocol, destination port and source and destination prefixes of
+ * prefix bits, 24/64 by default, and the counts printed every SECS.
+ *
+ * Messages are decoded into struct ct_flow, the original direction of
+ * the flow with the counters of both.
+ *
+ */
+
+#include <stdint.h>
+#include <linux/netlink.h>
+
+#define CT_NEW			0
+#define CT_UPDATE		1
+#define CT_DESTROY		2
+
+#define CT_PORTS		0x01
+#define CT_COUNTERS		0x02
+
+#define CT_RCVBUF		(16 << 20)
+#define CT_BATCH		64	/* datagrams per recvmmsg() */
+#define CT_ROUNDS		16	/* batches per wakeup */
+#define CT_BUF_SIZE		4096
+#define CT_PROTOS_MAX		8
+#define CT_AGG_MAX		4096	/* aggregates per interval */
+
+struct ct_flow
+{
+	uint8_t event;		/* CT_NEW, CT_UPDATE or CT_DESTROY */
+	uint8_t family;
+	uint8_t proto;
+	uint8_t state;		/* TCP conntrack state, 0 otherwise */
+	uint16_t sport;		/* host order */
+	uint16_t dport;
+	uint32_t mark;
+	uint32_t flags;		/* CT_PORTS, CT_COUNTERS */
+	uint64_t packets;	/* both directions */
+	uint64_t bytes;
+	uint8_t src[16];
+	uint8_t dst[16];
+};
+
+/**
+* @short Parse the spec given to --conntrack
+* @return 0 on success, -1 with errno EINVAL
+*/
+int conntrack_setup(const char *spec);
+
+int conntrack_enabled(void);
+
+/**
+* @short Open, filter and subscribe the socket, add it to the loop
+* @return 0 on success, -1 on error with errno set
+*/
+int conntrack_init(void);
+
+/**
+* @short Decode a ctnetlink event
+* @return 0 on success, -1 if nlh is not a conntrack event
+*/
+int conntrack_decode(const struct nlmsghdr *nlh, struct ct_flow *f);
+
+/**
+* @short Print event, sampling and overrun counts
+*/
+void conntrack_report(void);
+
+#endif
@@ -20,12 +20,50 @@
 
 #define OPT_UNKNOWN 	0
 #define OPT_COLOR 	1
+#define OPT_NEIGH_EXPIRY	2
+
+#define MAX_SINKS	8
+
+/**
+ * @short Printed event as seen by output sinks
+ *
+ * type and ifindex describe the message being decoded when the line
+ * was printed, 0 when it came from a timer or summary.
+ */
+struct console_event
+{
+	struct timeval tv;
+	int type;
+	int ifindex;
+	int color;
+	const char *msg;
+	size_t len;
+};
+
+typedef void (*console_sink_t)(const struct console_event *ev);
+
+/**
+* @short Register a sink that receives every printed line
+* @return 0 on success, -1 with errno set to ENOMEM when full
+*/
+int console_add_sink(console_sink_t sink);
+
+/**
+* @short Set the event context reported to sinks for following lines
+*/
+void console_set_context(int type, int ifindex);
 
 int enable_color_output(void);
+void disable_color_output(void);
 void console_exit_cleanup(void);
 
 int eprintf(int color, char *format, ...);
 
+/**
+* @short Print a line already built by the caller, without formatting
+*/
+int eputs(int color, const char *line);
+
 #define tprintf(args...) eprintf(NONE, ##args)
 
 #endif /* __NETVENT_CONSOLE__ */
@@ -0,0 +1,53 @@
+#ifndef __NETEVENT_CQM__
+#define __NETEVENT_CQM__
+
+/**
+ * @file cqm.h Connection quality monitoring through nl80211 CQM
+ *
+ * Instead of polling station signal, thresholds are handed to the
+ * driver with NL80211_CMD_SET_CQM and crossings come back as
+ * NL80211_CMD_NOTIFY_CQM. A spec configures one interface:
+ *
+ *   IFNAME:rssi=DBM[:hyst=DB][:step=DB][:txe=PCT/PKTS/SECS]
+ *
+ * rssi is the initial threshold. With step, every notification moves
+ * the thresholds to the reported level plus and minus step, so each
+ * change of step dB is pushed by the kernel. Drivers without threshold
+ * lists keep the single rssi threshold. txe reports TX failures above
+ * PCT percent over at least PKTS packets within SECS seconds.
+ *
+ * The configuration is sent again on connect and roam events, the
+ * kernel drops it when the link goes away.
+ *
+ */
+
+#include <netlink/attr.h>
+
+#define CQM_MAX		16
+
+/**
+* @short Add an interface configuration
+* @return 0 on success, -1 with errno EINVAL or ENOSPC
+*/
+int cqm_add(const char *spec);
+
+int cqm_enabled(void);
+
+/**
+* @short Arm the interfaces present once the nl80211 family is known
+* @return 0 on success, -1 on error with errno set
+*/
+int cqm_init(void);
+
+/**
+* @short Re-arm on NOTIFY_CQM, CONNECT and ROAM events
+*/
+void cqm_event(int cmd, struct nlattr *tb[]);
+
+/**
+* @short Describe a NL80211_ATTR_CQM payload to buf
+* @return length of the description
+*/
+int cqm_format(char *buf, size_t size, struct nlattr *cqm, struct nlattr *mac);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef __NETEVENT_CTL__
+#define __NETEVENT_CTL__
+
+/**
+ * @file ctl.h Local query and control socket
+ *
+ * A Unix stream socket that reads one request line per connection,
+ * answers with one line of JSON and closes. Requests are a type
+ * followed by optional selectors:
+ *
+ *   links | addrs | routes | neighbors | stations
+ *   [on IFNAME] [ADDR[/LEN]] [within PREFIX] [table N] [refresh]
+ *
+ * for instance "neighbor 10.1.2.3 on eth0", "routes within 10.0.0.0/8
+ * in table 100" or "stations on wlan0". "reload" rereads the --config
+ * file like SIGHUP. refresh has the event loop thread dump the slice
+ * the query selects, by interface, family and route table, see
+ * state_resync(), and the answer includes what it changed.
+ *
+ * A thread owns the socket and its clients and keeps its own copy of
+ * the state tables. The event loop thread, the only writer of the
+ * tables, pushes each change on a lock-free list, see state_watch(),
+ * and the control thread takes them in before answering. Queries are
+ * matched and rendered there and written out CTL_CHUNK bytes at a time,
+ * so neither a large answer nor a slow client holds the receive path.
+ *
+ */
+
+#define CTL_REQUEST_MAX		256
+#define CTL_TIMEOUT		1	/* seconds of client I/O */
+#define CTL_CHUNK		65536	/* bytes of answer written at once */
+#define CTL_UPDATE_MS		1000	/* changes are taken in at least this often */
+
+typedef int (*ctl_reload_t)(void);
+
+/**
+* @short Listen on path and start the control thread
+*
+* The state must be enabled, see state_init().
+*
+* @param reload called by the "reload" request, 0 on success
+* @return 0 on success, -1 on error with errno set
+*/
+int ctl_init(const char *path, ctl_reload_t reload);
+
+/**
+* @short Remove the socket
+*/
+void ctl_close(void);
+
+#endif
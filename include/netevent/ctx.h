@@ -0,0 +1,135 @@
+#ifndef __NETEVENT_CTX__
+#define __NETEVENT_CTX__
+
+/**
+ * @file ctx.h Embeddable non-blocking event source
+ *
+ * A context owns its netlink sockets, receive buffer and callbacks and
+ * nothing else, so any number of them can live in one process and be
+ * driven by a foreign event loop. Events are decoded into struct
+ * netevent and handed to the callback registered for their type,
+ * nothing is printed.
+ *
+ * netevent_ctx_fd() is a single descriptor that polls readable while
+ * any socket of the context has data. On readiness call
+ * netevent_process(), a return equal to the budget means more may be
+ * pending. A context is not thread-safe, use one per thread.
+ *
+ */
+
+#include <stdint.h>
+#include <net/if.h>
+#include <linux/netlink.h>
+
+#define NETEVENT_LINK		0
+#define NETEVENT_ADDR		1
+#define NETEVENT_ROUTE		2
+#define NETEVENT_NEIGH		3
+#define NETEVENT_WIRELESS	4	/* nl80211 notifications */
+#define NETEVENT_OVERRUN	5	/* receive queue overflowed, events lost */
+#define NETEVENT_TYPES		6
+
+#define NETEVENT_LLADDR_LEN	32
+
+struct netevent_ctx;
+
+struct netevent
+{
+	int type;
+	int removed;		/* RTM_DEL* */
+	int ifindex;
+	int family;
+	const struct nlmsghdr *nlh;	/* valid during the callback only */
+
+	union {
+		struct {
+			unsigned int flags;
+			unsigned int change;
+			unsigned int mtu;
+			char ifname[IFNAMSIZ];
+			unsigned char lladdr[NETEVENT_LLADDR_LEN];
+			int lladdr_len;
+		} link;
+
+		struct {
+			unsigned char prefixlen;
+			unsigned char addr[16];
+		} addr;
+
+		struct {
+			unsigned char dst_len;
+			unsigned char dst[16];
+			unsigned char gw[16];
+			int has_gw;
+			int oif;
+			uint32_t table;
+			uint32_t priority;
+		} route;
+
+		struct {
+			uint16_t state;
+			unsigned char addr[16];
+			unsigned char lladdr[NETEVENT_LLADDR_LEN];
+			int lladdr_len;
+		} neigh;
+
+		struct {
+			uint8_t cmd;	/* NL80211_CMD_* */
+			uint32_t wiphy;
+			unsigned char mac[6];
+			int has_mac;
+		} wireless;
+	} u;
+};
+
+typedef void (*netevent_cb_t)(struct netevent_ctx *ctx,
+			      const struct netevent *ev, void *data);
+
+/**
+* @short Create a context with no sources
+* @return NULL on error with errno set
+*/
+struct netevent_ctx * netevent_ctx_new(void);
+
+void netevent_ctx_free(struct netevent_ctx *ctx);
+
+/**
+* @short Descriptor to poll for readability
+*/
+int netevent_ctx_fd(struct netevent_ctx *ctx);
+
+/**
+* @short Register the callback for an event type, NULL to remove it
+*
+* Subscribes the context to the netlink groups of the type, removal
+* unsubscribes it. The NETEVENT_WIRELESS callback opens the nl80211
+* socket, which blocks while the family is resolved, and removing it
+* closes that socket, leaving the nl80211 groups.
+*
+* @return 0 on success, -1 on error with errno set
+*/
+int netevent_on(struct netevent_ctx *ctx, int type, netevent_cb_t cb,
+		void *data);
+
+/**
+* @short Read and dispatch up to budget pending datagrams
+*
+* Never blocks. Callbacks run from here and must not free the context.
+*
+* @return number of datagrams handled, -1 on error with errno set
+*/
+int netevent_process(struct netevent_ctx *ctx, int budget);
+
+/**
+* @short Decode an rtnetlink message
+* @return 0 on success, -1 when nlh is not a link, address, route or
+* neighbor message
+*/
+int netevent_decode(const struct nlmsghdr *nlh, struct netevent *ev);
+
+/**
+* @short Decode an nl80211 notification from its parsed attributes
+*/
+void netevent_decode_wireless(struct netevent *ev, int cmd, struct nlattr *tb[]);
+
+#endif
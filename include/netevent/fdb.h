@@ -0,0 +1,58 @@
+#ifndef __NETEVENT_FDB__
+#define __NETEVENT_FDB__
+
+/**
+ * @file fdb.h Bridge and VXLAN forwarding database
+ *
+ * AF_BRIDGE neighbor messages are forwarding entries, not IP neighbors.
+ * They are kept in their own table keyed by bridge, VLAN or VNI and
+ * MAC, with small fixed-size entries carved from chunks so that
+ * hundreds of thousands of MACs stay cheap. VTEP addresses are interned
+ * and entries only hold their index.
+ *
+ * A MAC showing up behind another port or VTEP is reported as a move.
+ * When a VTEP withdraws its MACs, the first FDB_BURST removals are
+ * printed and the rest are folded into one line after FDB_BURST_WINDOW
+ * seconds.
+ *
+ */
+
+#include <stdint.h>
+
+#include <linux/netlink.h>
+
+#include <netevent/hash.h>
+
+#define FDB_CHUNK		4096	/* entries allocated at once */
+#define FDB_BURST		8
+#define FDB_BURST_WINDOW	1
+
+#define FDB_VLAN		0
+#define FDB_VNI			1
+
+struct fdb_entry
+{
+	struct hnode node;
+	int32_t bridge;		/* master, or the device itself */
+	int32_t port;
+	uint32_t segment;	/* VLAN or VNI, by kind */
+	uint16_t vtep;		/* VTEP index, 0 for local ports */
+	uint8_t mac[6];
+	uint8_t kind;
+	uint8_t flags;		/* NTF_* */
+	uint16_t state;		/* NUD_* */
+};
+
+int fdb_init(void);
+
+/**
+* @short Track an AF_BRIDGE RTM_NEWNEIGH or RTM_DELNEIGH
+*/
+int handle_fdb_msg(struct nlmsghdr *nlh, int n);
+
+/**
+* @short Print entry, move and per-VLAN/VNI counts
+*/
+void fdb_report(void);
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef __NETEVENT_FMT__
+#define __NETEVENT_FMT__
+
+/**
+ * @file fmt.h Address, MAC and interface name encoders
+ *
+ * Table-driven replacements for inet_ntop, ether_ntoa_r and
+ * if_indextoname that write straight into the caller's buffer. Each
+ * encoder NUL terminates and returns the end of the string, so a line
+ * is built by chaining calls on one pointer. The output matches the
+ * libc functions, lowercase hex without leading zeros for MACs.
+ *
+ * Interface names are cached, if_indextoname costs an ioctl. A cached
+ * name is refreshed by link messages and otherwise trusted for
+ * FMT_IFNAME_TTL, which also keeps the name of a deleted interface for
+ * the route and address removals that follow it. Addresses are not
+ * cached, encoding one is cheaper than looking it up.
+ *
+ * Buffers hold at least the FMT_*_LEN of what is written.
+ *
+ */
+
+#include <stddef.h>
+#include <net/if.h>
+
+#define FMT_IPV4_LEN		16
+#define FMT_IPV6_LEN		46
+#define FMT_MAC_LEN		18
+#define FMT_IFNAME_LEN		IFNAMSIZ
+
+#define FMT_IFNAME_TTL		10	/* seconds */
+#define FMT_IFNAME_SLOTS	64	/* a power of 2 */
+
+char * fmt_str(char *p, const char *s);
+char * fmt_uint(char *p, unsigned int v);
+
+char * fmt_ipv4(char *p, const void *addr);
+
+/**
+* @short RFC 5952 form, with inet_ntop's dotted tail for mapped addresses
+*/
+char * fmt_ipv6(char *p, const void *addr);
+
+/**
+* @short AF_INET or AF_INET6 address
+*
+* Other families produce an empty string.
+*/
+char * fmt_inet(char *p, int family, const void *addr);
+
+char * fmt_mac(char *p, const void *mac);
+
+/**
+* @short Uppercase hex, two digits per byte
+*/
+char * fmt_hex(char *p, const void *data, size_t len);
+
+/**
+* @short Cached interface name, "ifN" when the index is unknown
+*/
+char * fmt_ifname(char *p, int ifindex);
+
+/**
+* @short Refresh the cached name from a link message
+*/
+void fmt_ifname_update(int ifindex, const char *name);
+
+#endif
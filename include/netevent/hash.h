@@ -0,0 +1,77 @@
+#ifndef __NETEVENT_HASH__
+#define __NETEVENT_HASH__
+
+/**
+ * @file hash.h Intrusive chained hash table
+ *
+ * Entries embed a struct hnode and are recovered with hnode_entry().
+ * The table only stores hashes and chains, key comparison is left to
+ * the owner through the cmp callback.
+ *
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define hnode_entry(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+struct hnode
+{
+	struct hnode *next;
+	uint32_t hash;
+};
+
+typedef int (*hcmp_t)(const struct hnode *n, const void *key);
+
+struct htable
+{
+	struct hnode **buckets;
+	unsigned int size;
+	unsigned int count;
+	hcmp_t cmp;
+};
+
+#define htable_for_each(t, i, n) \
+	for ((i) = 0; (i) < (t)->size; (i)++) \
+		for ((n) = (t)->buckets[(i)]; (n); (n) = (n)->next)
+
+/**
+* @short Initialize hash table
+*
+* @param size initial number of buckets, rounded up to a power of two
+* @param cmp returns 0 when node n matches key
+* @return 0 on success, -1 on error with errno set
+*/
+int htable_init(struct htable *t, unsigned int size, hcmp_t cmp);
+
+/**
+* @short Release bucket array. Entries are owned by the caller.
+*/
+void htable_free(struct htable *t);
+
+struct hnode * htable_find(struct htable *t, uint32_t hash, const void *key);
+
+/**
+* @short Insert node, growing the table when the load factor exceeds 1
+*/
+void htable_insert(struct htable *t, struct hnode *n, uint32_t hash);
+
+/**
+* @return 0 if the node was unlinked, -1 if it was not in the table
+*/
+int htable_remove(struct htable *t, struct hnode *n);
+
+uint32_t hash_bytes(const void *data, size_t len, uint32_t seed);
+
+static inline uint32_t hash_u32(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+#endif
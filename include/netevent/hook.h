@@ -0,0 +1,66 @@
+#ifndef __NETEVENT_HOOK__
+#define __NETEVENT_HOOK__
+
+/**
+ * @file hook.h Commands run on matching events
+ *
+ * A hook is written as "TYPE ACTION [MATCH] [max N] [timeout SECS] run
+ * COMMAND", for instance "link down eth0 run /etc/net/down.sh" or
+ * "route new default run /etc/net/gw.sh". TYPE is link, addr, route or
+ * neigh, ACTION is up or down for links and new or del for all types.
+ * MATCH is an interface name, or default for routes.
+ *
+ * Commands never fork from the daemon. A pool of helper processes,
+ * spawned once, receives jobs over a pipe, posix_spawns "/bin/sh -c
+ * COMMAND" with the event in NETEVENT_* environment variables, kills
+ * the process group when the timeout expires and reports back. A hook
+ * runs at most max commands at once, the rest wait in a queue where an
+ * invocation identical to one already waiting is dropped.
+ *
+ */
+
+#include <stddef.h>
+
+#define HOOK_MAX		32
+#define HOOK_HELPERS		4
+#define HOOK_HELPERS_MAX	16
+#define HOOK_QUEUE		256
+#define HOOK_TIMEOUT		10	/* seconds */
+#define HOOK_CONCURRENCY	1
+#define HOOK_MSG_MAX		2048	/* below PIPE_BUF, writes are atomic */
+
+/* A helper runs as "neteventd --hook-helper SLOT" with these fds */
+#define HOOK_HELPER_ARG		"--hook-helper"
+#define HOOK_JOB_FD		3
+#define HOOK_RESULT_FD		4
+
+/**
+* @short Add a hook from its description
+* @return 0 on success, -1 with errno set to EINVAL or ENOMEM
+*/
+int hook_add(const char *spec);
+
+int hook_enabled(void);
+
+/**
+* @short Spawn the helpers and add their result pipes to the loop
+* @return 0 on success, -1 on error with errno set
+*/
+int hook_init(int helpers);
+
+/**
+* @short Match an rtnetlink datagram against the hooks
+*
+* Suitable as an ev_handler_t.
+*/
+int hook_rt_event(void *data, size_t len);
+
+void hook_report(void);
+
+/**
+* @short Main loop of helper process slot
+* @return exit status of the helper
+*/
+int hook_helper(int slot);
+
+#endif
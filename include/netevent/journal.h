@@ -0,0 +1,108 @@
+#ifndef __NETEVENT_JOURNAL__
+#define __NETEVENT_JOURNAL__
+
+/**
+ * @file journal.h Durable event journal
+ *
+ * Printed events are appended to memory-mapped segment files in a
+ * journal directory. Segments are named after the sequence number of
+ * their first record and rotate by size and age.
+ *
+ * Records are delta encoded against the previous record: timestamps and
+ * ifindex as varints, interface names interned to small ids. Every
+ * JOURNAL_SYNC_EVERY records a sync marker resets that state and is
+ * added to the index file, a flat array of struct journal_idx sorted by
+ * sequence and time. Readers binary search the index, map the segment
+ * and decode forward from the sync point.
+ *
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define JOURNAL_MAGIC		0x314a454eU	/* "NEJ1" */
+#define JOURNAL_VERSION		1
+
+#define JOURNAL_SYNC_EVERY	256
+#define JOURNAL_MAX_NAMES	64
+#define JOURNAL_SEG_SIZE	(16 << 20)
+#define JOURNAL_SEG_AGE		3600
+
+#define JOURNAL_INDEX		"index"
+
+#define JREC_EVENT		0
+#define JREC_NAME		1
+#define JREC_SYNC		2
+
+struct journal_seg_hdr
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t hdr_len;
+	uint64_t base_seq;
+	uint64_t created;
+	uint64_t used;
+	uint64_t count;
+	uint32_t sealed;
+	uint32_t pad;
+};
+
+struct journal_idx
+{
+	uint64_t ts;
+	uint64_t seq;
+	uint64_t seg;
+	uint64_t offset;
+};
+
+struct journal_record
+{
+	uint64_t seq;
+	uint64_t ts;		/* microseconds since the epoch */
+	int type;
+	int ifindex;
+	const char *ifname;
+	const char *msg;
+	size_t len;
+};
+
+struct journal_reader;
+
+/**
+* @short Start journaling printed events into dir
+*
+* @param max_size segment size in bytes, 0 for JOURNAL_SEG_SIZE
+* @param max_age segment age in seconds, 0 for JOURNAL_SEG_AGE
+* @return 0 on success, -1 on error with errno set
+*/
+int journal_init(const char *dir, size_t max_size, unsigned int max_age);
+
+void journal_close(void);
+
+struct journal_reader * journal_open(const char *dir);
+
+/**
+* @short Position the reader at the first record with seq >= seq
+* @return 0 on success, -1 if the journal is empty
+*/
+int journal_seek_seq(struct journal_reader *r, uint64_t seq);
+
+/**
+* @short Position the reader at the first record with ts >= ts
+* @return 0 on success, -1 if the journal is empty
+*/
+int journal_seek_time(struct journal_reader *r, uint64_t ts);
+
+/**
+* @short Decode the next record
+*
+* rec->ifname and rec->msg point into the mapped segment and are valid
+* until the next call. rec->msg is not NUL terminated.
+*
+* @return 1 if a record was read, 0 at the end of the journal, -1 on error
+*/
+int journal_next(struct journal_reader *r, struct journal_record *rec);
+
+void journal_reader_close(struct journal_reader *r);
+
+#endif
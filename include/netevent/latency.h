@@ -0,0 +1,87 @@
+#ifndef __NETEVENT_LATENCY__
+#define __NETEVENT_LATENCY__
+
+/**
+ * @file latency.h Event latency checkpoints and histograms
+ *
+ * Each received datagram carries its SO_TIMESTAMPNS kernel enqueue time
+ * and monotonic checkpoints taken at recv, decode, the handler handing
+ * the event to the console, and the first sink write. Stage latencies go into log2
+ * microsecond histograms that are reported every interval, and can be
+ * appended to every printed line as a trace field.
+ *
+ * Netlink sockets accept SO_TIMESTAMPNS but do not stamp datagrams. The
+ * queue stage is then unknown and the total is measured from recv.
+ *
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#define LAT_QUEUE		0	/* kernel enqueue to recv */
+#define LAT_DECODE		1	/* recv to decode */
+#define LAT_DISPATCH		2	/* decode to the handler's output */
+#define LAT_SINK		3	/* output formatted, to first sink write */
+#define LAT_TOTAL		4	/* kernel enqueue, or recv, to first sink write */
+#define LAT_STAGES		5
+
+#define LAT_BUCKETS		24	/* bucket i holds [2^(i-1), 2^i) us */
+
+/**
+* @short Enable latency tracking
+*
+* @param interval seconds between histogram reports, 0 for none
+* @param trace append a trace field to printed lines
+* @return 0 on success, -1 on error
+*/
+int latency_init(unsigned int interval, int trace);
+
+int latency_enabled(void);
+
+/**
+* @short Enable SO_TIMESTAMPNS on a socket when latency tracking is on
+*/
+int latency_socket(int fd);
+
+/**
+* @short recv() that also records the kernel timestamp of the datagram
+*/
+ssize_t latency_recv(int fd, void *buf, size_t len, int flags);
+
+/**
+* @short Kernel timestamp from SCM_TIMESTAMPNS in msg, 0 if missing
+*/
+uint64_t latency_cmsg(struct msghdr *msg);
+
+/**
+* @short Start a new event received now, kernel is CLOCK_REALTIME in ns
+*/
+void latency_received(uint64_t kernel);
+
+/**
+* @short Start a new event received earlier, by a reader thread
+*/
+void latency_received_at(uint64_t kernel, uint64_t real, uint64_t mono);
+
+/**
+* @short Record the LAT_DECODE or LAT_DISPATCH checkpoint, first one wins
+*/
+void latency_mark(int stage);
+
+/**
+* @short Record the sink checkpoint and append the trace field to msg
+*
+* The field is inserted before a trailing newline.
+*/
+void latency_sink(char *msg, size_t size);
+
+/**
+* @short The current event is fully handled, account its latencies
+*/
+void latency_done(void);
+
+void latency_report(void);
+
+#endif
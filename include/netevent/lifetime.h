@@ -0,0 +1,34 @@
+#ifndef __NETEVENT_LIFETIME__
+#define __NETEVENT_LIFETIME__
+
+/**
+ * @file lifetime.h Address lifetime and neighbor reachability tracking
+ *
+ * Preferred and valid lifetimes from ifa_cacheinfo are armed on the
+ * timer wheel, so deprecation and expiry are reported when they happen
+ * rather than when the kernel finally deletes the address.
+ *
+ */
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_addr.h>
+#include <linux/neighbour.h>
+
+#define INFINITY_LIFE_TIME	0xFFFFFFFFU
+
+/**
+* @short Initialize tracking tables
+*
+* @param track_neigh also predict when REACHABLE neighbors go stale
+* @return 0 on success, -1 on error
+*/
+int lifetime_init(int track_neigh);
+
+void lifetime_addr_update(int type, int family, int ifindex, int prefixlen,
+			  const void *addr, const struct ifa_cacheinfo *ci);
+
+void lifetime_neigh_update(int type, const struct ndmsg *ndm, const void *addr,
+			   const struct nda_cacheinfo *ci);
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef __NETEVENT_LOOP__
+#define __NETEVENT_LOOP__
+
+/**
+ * @file loop.h Event loop backends
+ *
+ * Netlink sockets are added with a receive callback that is handed whole
+ * datagrams, other descriptors with a readiness callback. The epoll
+ * backend waits and then recv()s, one syscall each. The io_uring backend
+ * keeps a multishot recvmsg armed on every netlink socket, backed by a
+ * provided buffer ring, so a single io_uring_enter() can return many
+ * filled buffers.
+ *
+ * io_uring is only available when built with liburing, and falls back
+ * to epoll when the running kernel does not support it.
+ *
+ */
+
+#include <stddef.h>
+#include <sys/socket.h>
+
+#define LOOP_EPOLL		0
+#define LOOP_URING		1
+
+#define LOOP_MAX_SOURCES	16
+
+/* Receive buffer size, at least RTNL_RCVBUF */
+#define LOOP_BUF_SIZE		8192
+
+/* Provided buffers shared by all netlink sockets, a power of 2 */
+#define LOOP_RING_ENTRIES	64
+#define LOOP_RING_DEPTH		32
+#define LOOP_BGID		0
+
+/**
+ * @short Receive callback, returns non-zero to stop the loop
+ */
+typedef int (*loop_recv_t)(void *data, void *buf, size_t len);
+
+/**
+ * @short Readiness callback, returns non-zero to stop the loop
+ */
+typedef int (*loop_ready_t)(void *data, int fd);
+
+struct loop_source
+{
+	int fd;
+	loop_recv_t recv;
+	loop_ready_t ready;
+	void *data;
+	int poll_only;		/* no multishot recvmsg, poll and recv() */
+	struct msghdr msg;
+};
+
+struct loop_stats
+{
+	unsigned long waits;	/* epoll_wait() or io_uring_enter() */
+	unsigned long recvs;	/* recv() */
+	unsigned long datagrams;
+	unsigned long overruns;	/* ENOBUFS, the kernel dropped events */
+	unsigned long truncated; /* larger than the buffer, dropped */
+};
+
+/**
+* @short Initialize the event loop
+*
+* @param backend preferred backend, LOOP_EPOLL or LOOP_URING
+* @return the backend in use, or -1 on error with errno set
+*/
+int loop_init(int backend);
+
+void loop_exit(void);
+
+const char * loop_backend_name(void);
+
+/**
+* @short Receive datagrams from fd and hand them to fn
+* @return 0 on success, -1 on error with errno set
+*/
+int loop_add_recv(int fd, loop_recv_t fn, void *data);
+
+/**
+* @short Call fn whenever fd is readable
+* @return 0 on success, -1 on error with errno set
+*/
+int loop_add_fd(int fd, loop_ready_t fn, void *data);
+
+/**
+* @short Wait up to timeout milliseconds, -1 for ever, and dispatch
+* @return number of events handled, -1 on error with errno set
+*/
+int loop_run_once(int timeout);
+
+void loop_get_stats(struct loop_stats *st);
+
+/**
+* @short Account a receive queue overrun of a netlink socket
+*
+* Reported at powers of two, the state is resynced from a timer. count
+* is the overruns of that socket so far.
+*/
+void loop_overrun(const char *name, unsigned long count);
+
+/* recv() and dispatch datagrams from a receive source until it is empty */
+int loop_source_recv(struct loop_source *s, struct loop_stats *st);
+
+/* io_uring backend, see loop_uring.c */
+int uring_init(void);
+void uring_exit(void);
+int uring_add(struct loop_source *s);
+int uring_run_once(int timeout, struct loop_stats *st);
+
+#endif
@@ -3,5 +3,6 @@
 
 #include <netevent/events.h>
 #include <netevent/rtnl.h>
+#include <netevent/ctx.h>
 
 #endif
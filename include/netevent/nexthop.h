@@ -0,0 +1,107 @@
+#ifndef __NETEVENT_NEXTHOP__
+#define __NETEVENT_NEXTHOP__
+
+/**
+ * @file nexthop.h Nexthop objects and shared multipath sets
+ *
+ * Nexthop objects (RTM_NEWNEXTHOP) and legacy RTA_MULTIPATH path sets
+ * are kept once, keyed by id or content, and routes only hold a
+ * reference count on them. Path memory is proportional to the number
+ * of distinct paths, not to the number of routes using them; each such
+ * route only records which nexthop or path set it holds, so a replace
+ * releases the one it held before.
+ *
+ */
+
+#include <stdint.h>
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/nexthop.h>
+
+#include <netevent/hash.h>
+
+struct nh_entry
+{
+	struct hnode node;
+	uint32_t id;
+	unsigned char family;
+	unsigned char blackhole;
+	unsigned char has_gw;
+	uint16_t group_type;
+	int oif;
+	unsigned char gw[16];
+	unsigned int ngroup;
+	struct nexthop_grp *group;
+	unsigned long routes;
+};
+
+/* What identifies a route to the kernel */
+struct route_key
+{
+	unsigned char family;
+	unsigned char dst_len;
+	unsigned char tos;
+	unsigned char pad;
+	uint32_t table;
+	uint32_t prio;
+	unsigned char dst[16];
+};
+
+struct mpath_entry
+{
+	struct hnode node;
+	unsigned int id;
+	unsigned char family;
+	unsigned int npaths;
+	unsigned long routes;
+	int len;
+	unsigned char data[];
+};
+
+int nexthop_init(void);
+
+int handle_nexthop_msg(struct nlmsghdr *nlh, int n);
+
+struct nh_entry * nexthop_lookup(uint32_t id);
+
+/**
+* @short Account route rk using nexthop object id, or its removal
+*
+* A route that already held a nexthop or a path set releases it first.
+*
+* @param nlh the RTM_NEWROUTE or RTM_DELROUTE message
+* @return 1 if the route is a re-announcement caused by a nexthop change
+* that was already reported, 0 otherwise
+*/
+int nexthop_route_ref(const struct route_key *rk, uint32_t id,
+		      const struct nlmsghdr *nlh);
+
+/**
+* @short Intern (RTM_NEWROUTE) or release (RTM_DELROUTE) the RTA_MULTIPATH
+* set of route rk
+*
+* @return the shared entry, or NULL if it was released or unknown
+*/
+struct mpath_entry * mpath_route_ref(const struct route_key *rk, int family,
+				     void *data, int len, int type);
+
+/**
+* @short Route rk went away or no longer uses a nexthop object or path set
+*/
+void route_ref_release(const struct route_key *rk);
+
+/**
+* @short Append " nhid N <description>" to buf
+* @return new length of buf
+*/
+int format_nexthop_id(char *buf, size_t size, int len, uint32_t id);
+
+/**
+* @short Append " nexthop via X dev Y weight W ..." for an RTA_MULTIPATH payload
+* @return new length of buf
+*/
+int format_multipath(char *buf, size_t size, int len, int family,
+		     void *data, int plen);
+
+#endif
@@ -6,8 +6,77 @@
 #include <netlink/genl/family.h>
 #include <netlink/genl/ctrl.h>
 
-int nl80211_socket_init();
+/* Event types seen by console sinks, kept clear of rtnetlink types */
+#define NL80211_EVENT_BASE	0x1000
+#define NL80211_EVENT_TYPE(cmd)	(NL80211_EVENT_BASE + (cmd))
+
+#define NL80211_RCVBUF		32768
+#define NL80211_GROUPS_MAX	16
+#define NL80211_READY_MAX	4
+
+typedef void (*nl80211_ready_fn)(int family);
+
+/**
+* @short Open the nl80211 event socket
+*
+* Nothing is asked of generic netlink here. The family and its groups
+* are looked up with one CTRL_CMD_GETFAMILY answered on this socket, so
+* through the event loop, and kept up to date by the nlctrl notify
+* group. With lazy set the groups are only joined while a wireless
+* interface is in the link table, see nl80211_rt_event(), otherwise as
+* soon as the family is known.
+*
+* @return the socket descriptor, -1 on error with errno set
+*/
+int nl80211_socket_init(int lazy);
+
+/**
+* @short Follow wireless interfaces in rtnetlink link messages
+*
+* Suitable as an ev_handler_t.
+*/
+int nl80211_rt_event(void *data, size_t len);
+
+/**
+* @short Whether wireless events are wanted, a wireless interface exists
+*/
+int nl80211_active(void);
+
+/**
+* @short Join every multicast group of the nl80211 family fid on nlsk
+*/
+int nl80211_register_multicast_groups(struct nl_sock * nlsk, int fid);
 int nl80211_socket_close(struct nl_sock * nlsk);
+
+/**
+* @short Call fn with the family id once the family is known
+*
+* Right away if it already is, otherwise from the loop when the
+* CTRL_CMD_GETFAMILY answer or a CTRL_CMD_NEWFAMILY notification comes,
+* and again each time the family is registered anew.
+*
+* @return 0 on success, -1 with errno ENOSPC
+*/
+int nl80211_when_ready(nl80211_ready_fn fn);
+
+/**
+* @short Socket for nl80211 requests and dumps, opened on first use
+*
+* Callers set their own NL_CB_VALID callback before each request, and
+* reset it once the answer is in, the socket is shared.
+*
+* @param family set to the nl80211 family id
+* @return NULL on error with errno set, ENOENT while the family is not
+* known yet, see nl80211_when_ready()
+*/
+struct nl_sock * nl80211_cmd_socket(int *family);
 int nl80211_msg_rx(int nlsk);
 
+/**
+* @short Handle a datagram received from the nl80211 socket elsewhere
+*
+* Suitable as a reader_fn_t callback.
+*/
+int nl80211_feed(void *data, void *buf, size_t len);
+
 #endif
@@ -0,0 +1,78 @@
+#ifndef __NETEVENT_PLUGIN__
+#define __NETEVENT_PLUGIN__
+
+/**
+ * @file plugin.h Loadable handler plugins
+ *
+ * A plugin is a shared object exporting a struct netevent_plugin named
+ * netevent_plugin. The host loads every .so in its plugin directory and
+ * hands it the decoded events of the types in its interest mask, in
+ * the daemon's own thread. The directory is watched: a plugin is loaded
+ * when it appears, reloaded when it is replaced and unloaded when it is
+ * removed. Install with a rename so the host never sees a partial file.
+ *
+ * Every callback is timed. A plugin that overruns its time budget on
+ * PLUGIN_STRIKES consecutive events is disabled until it is reloaded.
+ * A plugin that crashes takes the daemon with it, the budget only
+ * guards against slow ones.
+ *
+ * NETEVENT_PLUGIN_ABI changes whenever this structure or struct
+ * netevent changes layout. Plugins built for another ABI are refused.
+ *
+ */
+
+#include <stdint.h>
+
+#include <netevent/ctx.h>
+
+#define NETEVENT_PLUGIN_ABI	1
+#define NETEVENT_PLUGIN_SYM	"netevent_plugin"
+#define NETEVENT_INTEREST(type)	(1U << (type))
+
+struct netevent_plugin
+{
+	unsigned int abi;	/* NETEVENT_PLUGIN_ABI */
+	const char *name;
+	unsigned int interest;	/* NETEVENT_INTEREST() of each type */
+
+	/* Optional, non-zero refuses the load */
+	int (*init)(void **state);
+	void (*event)(void *state, const struct netevent *ev);
+	/* Optional */
+	void (*exit)(void *state);
+};
+
+#define PLUGIN_MAX		16
+#define PLUGIN_BUDGET		1000	/* us per event */
+#define PLUGIN_STRIKES		8
+
+/**
+* @short Load the plugins in dir and watch it for changes
+*
+* @param budget_us time budget of one plugin callback
+* @return 0 on success, -1 on error with errno set
+*/
+int plugin_init(const char *dir, unsigned int budget_us);
+
+/**
+* @short Unload every plugin
+*/
+void plugin_close(void);
+
+int plugin_enabled(void);
+
+/**
+* @short Decode an rtnetlink datagram and hand it to the plugins
+*
+* Suitable as an ev_handler_t.
+*/
+int plugin_rt_event(void *data, size_t len);
+
+void plugin_push(const struct netevent *ev);
+
+/**
+* @short Print per-plugin counters
+*/
+void plugin_report(void);
+
+#endif
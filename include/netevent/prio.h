@@ -0,0 +1,57 @@
+#ifndef __NETEVENT_PRIO__
+#define __NETEVENT_PRIO__
+
+/**
+ * @file prio.h Priority classes of rtnetlink groups
+ *
+ * Subscriptions are split across one socket per class, each with its own
+ * receive buffer, so a neighbor storm overruns only the neigh socket and
+ * link and route changes are still delivered. When any class socket is
+ * readable, classes are drained in priority order, up to their weight in
+ * datagrams per round. Receive queue overruns are counted per class
+ * and, with the state enabled, resync the object types of the class.
+ *
+ */
+
+#include <netevent/events.h>
+
+#define PRIO_LINK		0	/* link, address and ifinfo */
+#define PRIO_ROUTE		1	/* routes and nexthops */
+#define PRIO_NEIGH		2
+#define PRIO_CLASSES		3
+
+/* Rounds per wakeup, so timers and nl80211 are not starved */
+#define PRIO_ROUNDS		16
+
+extern const char *prio_names[PRIO_CLASSES];
+
+/**
+* @short Override the receive buffer size of a class, in bytes
+*/
+void prio_set_rcvbuf(int class, int bytes);
+
+/**
+* @short Create a socket for each class with groups in filter
+*
+* Sockets are added to the event loop, datagrams are pushed to h.
+*
+* @return 0 on success, -1 on error with errno set
+*/
+int prio_init(int filter, struct event_handler *h);
+
+/**
+* @short Move the class sockets from groups old to filter
+*
+* A class that had no groups at prio_init() has no socket and cannot
+* gain any, that fails with ENOENT before any socket is changed.
+*
+* @return 0 on success, -1 on error with errno set
+*/
+int prio_set_filter(int old, int filter);
+
+/**
+* @short Print datagram and overrun counters per class
+*/
+void prio_report(void);
+
+#endif
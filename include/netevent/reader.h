@@ -0,0 +1,51 @@
+#ifndef __NETEVENT_READER__
+#define __NETEVENT_READER__
+
+/**
+ * @file reader.h Per-source reader threads
+ *
+ * Each source socket gets a thread that only receives datagrams, with
+ * their SO_TIMESTAMPNS kernel receive time, into a single producer queue.
+ * The merge stage runs in the event loop thread and hands datagrams to
+ * the source callbacks in timestamp order across all sources.
+ *
+ * A datagram is released once every other source has a later one queued
+ * or nothing in flight, neither a datagram in its socket nor one its
+ * thread is queueing, or else once it is READER_MERGE_WINDOW old. Sockets
+ * that do not stamp datagrams, netlink among them, are ordered by the
+ * time the reader thread received them. Reader threads can be pinned to
+ * a CPU and run with SCHED_FIFO priority.
+ *
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define READER_MAX		4
+#define READER_QUEUE_LEN	1024	/* per source, a power of 2 */
+#define READER_BUF_SIZE		32768
+#define READER_MERGE_WINDOW	2000000ULL	/* ns */
+
+/**
+ * @short Datagram callback, buf is only valid during the call
+ * @return non-zero to stop the event loop
+ */
+typedef int (*reader_fn_t)(void *data, void *buf, size_t len);
+
+/**
+* @short Add a source read by its own thread
+*
+* @param cpu CPU to pin the thread to, -1 for any
+* @param prio SCHED_FIFO priority, 0 to keep the default policy
+* @return 0 on success, -1 on error with errno set
+*/
+int reader_add(const char *name, int fd, reader_fn_t fn, void *data,
+	       int cpu, int prio);
+
+/**
+* @short Start the reader threads and add the merge stage to the loop
+* @return 0 on success, -1 on error with errno set
+*/
+int reader_start(void);
+
+#endif
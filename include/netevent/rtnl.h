@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdarg.h>
 #include <errno.h>
 #include <string.h>
@@ -27,9 +28,17 @@
 
 #define DEFAULT_FILTER	(RTMGRP_LINK | RTMGRP_NOTIFY | RTMGRP_NEIGH | RTMGRP_IPV6_IFADDR | RTMGRP_IPV6_ROUTE | RTMGRP_IPV6_MROUTE | RTMGRP_IPV6_IFINFO | RTMGRP_IPV4_IFADDR | RTMGRP_IPV4_ROUTE | RTMGRP_IPV4_MROUTE);
 
+/* Large enough for wide ECMP routes in a single datagram */
+#define RTNL_RCVBUF	8192
 
 int parse_rt_event( void *data, size_t n);
 
+/**
+* @short Index rtattrs by type into tb, which must hold max entries
+* @return number of attributes found
+*/
+int parse_rt_attrs(struct rtattr *tb[], int max, struct rtattr *data, int len);
+
 /**
 * @author rferreira
 * @short Create netlink socket
@@ -41,6 +50,76 @@ int parse_rt_event( void *data, size_t n);
 */
 int setup_rtsocket(int filter);
 
+/**
+* @short Change the groups of a bound socket from old to filter
+*
+* Joins and leaves only the groups that differ, the socket keeps
+* receiving the others throughout.
+*
+* @return 0 on success, -1 on error with errno set
+*/
+int rtnl_set_filter(int fd, int old, int filter);
+
+/**
+* @short RTMGRP_* bit of a group name
+* @return 0 when name is not a known group
+*/
+int rtnl_group_bit(const char *name);
+
 int recv_rtnl_msg(struct event_handler *h, int sknl);
 
+typedef int (*rtnl_dump_fn)(struct nlmsghdr *nlh, void *data);
+
+/* Dumps flagged NLM_F_DUMP_INTR are made again up to this many times */
+#define RTNL_DUMP_RETRIES	4
+
+/**
+ * Narrows a dump to a slice, zero fields match anything. The socket asks
+ * for NETLINK_GET_STRICT_CHK so the kernel filters by family, ifindex of
+ * addresses and neighbors, output interface and table of routes, and
+ * master of links and neighbors. A link ifindex is a single RTM_GETLINK.
+ * Replies are matched again here, kernels without strict checking send
+ * everything.
+ */
+struct rtnl_filter
+{
+	int family;
+	int ifindex;
+	int master;		/* links and neighbors */
+	uint32_t table;		/* routes */
+};
+
+/**
+* @short Dump every object of a RTM_GET* type on a private socket
+*
+* fn is called on each message in turn, a non-zero return stops the
+* dump. When the kernel flags the dump NLM_F_DUMP_INTR, fn is called
+* with a NULL nlh to drop what it has, and the dump is made again. The
+* last of RTNL_DUMP_RETRIES attempts is kept as it is, the events that
+* follow repair it.
+*
+* @return 0 on success, -1 on error with errno set
+*/
+int rtnl_dump(int type, rtnl_dump_fn fn, void *data);
+
+/**
+* @short rtnl_dump() of the slice f only, NULL for everything
+* @return 0 on success, -1 on error with errno set, EINVAL when f does
+* not apply to type
+*/
+int rtnl_dump_filter(int type, const struct rtnl_filter *f,
+		     rtnl_dump_fn fn, void *data);
+
+/**
+* @short Whether a link, address, route or neighbor message is in f
+*/
+int rtnl_filter_match(const struct rtnl_filter *f, const struct nlmsghdr *nlh);
+
+/**
+* @short Push a received datagram to the event_handler in data
+*
+* Suitable as a loop_recv_t callback.
+*/
+int rtnl_dispatch(void *data, void *buf, size_t len);
+
 #endif
@@ -0,0 +1,338 @@
+#ifndef __NETEVENT_SHM__
+#define __NETEVENT_SHM__
+
+/**
+ * @file shm.h Shared memory export of links, addresses and neighbors
+ *
+ * The daemon mirrors interfaces, addresses and neighbors into a file,
+ * usually under /dev/shm, that other processes map read-only. Lookups
+ * are plain loads, no syscall and no lock.
+ *
+ * The region is a struct shm_header followed by three tables of fixed
+ * size buckets, each holding SHM_SLOTS entries behind a sequence
+ * counter. The daemon is the only writer: it makes the counter odd,
+ * updates the bucket, then makes it even again. A reader copies the
+ * entry out and retries when the counter was odd or moved meanwhile.
+ *
+ * Links hash by ifindex, addresses by family and address alone so that
+ * "is this address local" is one lookup, neighbors by ifindex, family
+ * and address. The bucket counts and offsets are read from the header,
+ * only the entry layouts are fixed by the version.
+ *
+ * The file is replaced at every start. A reader mapping an old one sees
+ * SHM_LIVE cleared once that daemon has exited and should map the path
+ * again.
+ *
+ * Everything below the writer API is inline so that readers only need
+ * this header.
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#define SHM_MAGIC		"NESHM\0\0\0"
+#define SHM_VERSION		1
+
+#define SHM_SLOTS		4
+#define SHM_LINK_BUCKETS	256
+#define SHM_ADDR_BUCKETS	1024
+#define SHM_NEIGH_BUCKETS	4096
+
+#define SHM_LIVE		0x1	/* the writer is running */
+
+#define SHM_SPIN		1000	/* read attempts before EAGAIN */
+
+struct shm_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;
+	uint32_t size;		/* bytes of the whole region */
+	uint32_t slots;
+	uint32_t link_buckets;	/* powers of two */
+	uint32_t addr_buckets;
+	uint32_t neigh_buckets;
+	uint32_t link_off;	/* from the start of the region */
+	uint32_t addr_off;
+	uint32_t neigh_off;
+	uint32_t pid;
+	uint32_t pad;
+	uint64_t generation;	/* bumped on every change */
+	uint64_t dropped;	/* entries that found their bucket full */
+};
+
+/* Slots with ifindex 0 are free */
+struct shm_link
+{
+	int32_t ifindex;
+	uint32_t flags;		/* IFF_* */
+	uint32_t mtu;
+	char ifname[16];
+	uint8_t lladdr[6];
+	uint8_t pad[2];
+};
+
+struct shm_addr
+{
+	int32_t ifindex;
+	uint8_t family;
+	uint8_t prefixlen;
+	uint8_t pad[2];
+	uint8_t addr[16];
+};
+
+struct shm_neigh
+{
+	int32_t ifindex;
+	uint16_t state;		/* NUD_* */
+	uint8_t family;
+	uint8_t pad;
+	uint8_t addr[16];
+	uint8_t lladdr[6];
+	uint8_t pad2[2];
+};
+
+struct shm_link_bucket
+{
+	uint32_t seq;
+	uint32_t pad;
+	struct shm_link e[SHM_SLOTS];
+};
+
+struct shm_addr_bucket
+{
+	uint32_t seq;
+	uint32_t pad;
+	struct shm_addr e[SHM_SLOTS];
+};
+
+struct shm_neigh_bucket
+{
+	uint32_t seq;
+	uint32_t pad;
+	struct shm_neigh e[SHM_SLOTS];
+};
+
+/**
+* @short Create the region at path and fill it from a dump
+*
+* Only the object types with a group in filter are exported.
+*
+* @return 0 on success, -1 on error with errno set
+*/
+int shm_init(const char *path, int filter);
+
+/**
+* @short Keep the region current from an rtnetlink datagram
+*
+* Suitable as an ev_handler_t.
+*/
+int shm_rt_event(void *data, size_t len);
+
+/**
+* @short Clear SHM_LIVE and unmap
+*/
+void shm_close(void);
+
+/* FNV-1a over the ifindex, family and address */
+static inline uint32_t shm_hash(int32_t ifindex, int family,
+				const void *addr, size_t len)
+{
+	const uint8_t *p = addr;
+	uint32_t h = 2166136261u;
+	size_t i;
+
+	for (i=0; i<4; i++) {
+		h ^= (uint32_t) ifindex >> (8 * i) & 0xff;
+		h *= 16777619u;
+	}
+
+	h ^= family;
+	h *= 16777619u;
+
+	for (i=0; i<len; i++) {
+		h ^= p[i];
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+static inline size_t shm_addr_len(int family)
+{
+	return family == AF_INET6 ? 16 : 4;
+}
+
+static inline uint32_t shm_read_begin(const uint32_t *seq)
+{
+	return __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+}
+
+static inline int shm_read_retry(const uint32_t *seq, uint32_t start)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return (start & 1) || __atomic_load_n(seq, __ATOMIC_RELAXED) != start;
+}
+
+/**
+* @short Map the region at path read-only
+* @return NULL on error with errno set
+*/
+static inline const struct shm_header * shm_map(const char *path)
+{
+	const struct shm_header *h;
+	struct stat st;
+	int fd;
+
+	if ( (fd = open(path, O_RDONLY | O_CLOEXEC)) == -1 )
+		return NULL;
+
+	if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(*h)) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	h = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (h == MAP_FAILED)
+		return NULL;
+
+	if (memcmp(h->magic, SHM_MAGIC, 8) != 0 || h->version != SHM_VERSION
+	    || h->size != (uint32_t) st.st_size) {
+		munmap((void *) h, st.st_size);
+		errno = EPROTO;
+		return NULL;
+	}
+
+	return h;
+}
+
+static inline void shm_unmap(const struct shm_header *h)
+{
+	munmap((void *) h, h->size);
+}
+
+/**
+* @short Copy the link of ifindex to out
+* @return 0 if found, -1 with errno ENOENT, or EAGAIN if the bucket kept
+*	  changing
+*/
+static inline int shm_link_lookup(const struct shm_header *h, int32_t ifindex,
+				  struct shm_link *out)
+{
+	const struct shm_link_bucket *b = (const void *) ((const char *) h + h->link_off);
+	uint32_t seq;
+	int i, n, found;
+
+	b += shm_hash(ifindex, 0, NULL, 0) & (h->link_buckets - 1);
+
+	for (n=0; n<SHM_SPIN; n++) {
+		seq = shm_read_begin(&b->seq);
+		found = 0;
+		for (i=0; i<SHM_SLOTS; i++) {
+			if (b->e[i].ifindex == ifindex) {
+				*out = b->e[i];
+				found = 1;
+				break;
+			}
+		}
+		if (shm_read_retry(&b->seq, seq))
+			continue;
+		if (found)
+			return 0;
+		errno = ENOENT;
+		return -1;
+	}
+
+	errno = EAGAIN;
+	return -1;
+}
+
+/**
+* @short Copy a local address to out, the first interface holding it
+* @return as shm_link_lookup()
+*/
+static inline int shm_addr_lookup(const struct shm_header *h, int family,
+				  const void *addr, struct shm_addr *out)
+{
+	const struct shm_addr_bucket *b = (const void *) ((const char *) h + h->addr_off);
+	size_t len = shm_addr_len(family);
+	uint32_t seq;
+	int i, n, found;
+
+	b += shm_hash(0, family, addr, len) & (h->addr_buckets - 1);
+
+	for (n=0; n<SHM_SPIN; n++) {
+		seq = shm_read_begin(&b->seq);
+		found = 0;
+		for (i=0; i<SHM_SLOTS; i++) {
+			if (b->e[i].ifindex && b->e[i].family == family
+			    && memcmp(b->e[i].addr, addr, len) == 0) {
+				*out = b->e[i];
+				found = 1;
+				break;
+			}
+		}
+		if (shm_read_retry(&b->seq, seq))
+			continue;
+		if (found)
+			return 0;
+		errno = ENOENT;
+		return -1;
+	}
+
+	errno = EAGAIN;
+	return -1;
+}
+
+/**
+* @short Copy the neighbor addr on ifindex to out
+*
+* out->state & NUD_REACHABLE answers "is it reachable".
+*
+* @return as shm_link_lookup()
+*/
+static inline int shm_neigh_lookup(const struct shm_header *h, int32_t ifindex,
+				   int family, const void *addr,
+				   struct shm_neigh *out)
+{
+	const struct shm_neigh_bucket *b = (const void *) ((const char *) h + h->neigh_off);
+	size_t len = shm_addr_len(family);
+	uint32_t seq;
+	int i, n, found;
+
+	b += shm_hash(ifindex, family, addr, len) & (h->neigh_buckets - 1);
+
+	for (n=0; n<SHM_SPIN; n++) {
+		seq = shm_read_begin(&b->seq);
+		found = 0;
+		for (i=0; i<SHM_SLOTS; i++) {
+			if (b->e[i].ifindex == ifindex && b->e[i].family == family
+			    && memcmp(b->e[i].addr, addr, len) == 0) {
+				*out = b->e[i];
+				found = 1;
+				break;
+			}
+		}
+		if (shm_read_retry(&b->seq, seq))
+			continue;
+		if (found)
+			return 0;
+		errno = ENOENT;
+		return -1;
+	}
+
+	errno = EAGAIN;
+	return -1;
+}
+
+#endif
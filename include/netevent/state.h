@@ -0,0 +1,163 @@
+#ifndef __NETEVENT_STATE__
+#define __NETEVENT_STATE__
+
+/**
+ * @file state.h Link, address, route and neighbor state across restarts
+ *
+ * The daemon keeps the last message of every link, address, route and
+ * neighbor it has seen. Fields that move on their own, counters,
+ * cacheinfo and expiry timers, are zeroed in the stored copy so that
+ * two messages for an unchanged object compare equal byte for byte.
+ *
+ * On exit the state is written to a snapshot: a header with a
+ * generation number, then records sorted by key, usable in place once
+ * mapped. At startup the snapshot is reconciled with a fresh dump in a
+ * single sorted merge. What appeared, changed or vanished while the
+ * daemon was down is pushed to the event handler as ordinary events,
+ * everything else enters the state silently.
+ *
+ * Keys sort by type, family, interface or route table, then address
+ * and prefix length, so the routes of a prefix are contiguous. Bridge
+ * forwarding entries are also keyed by VLAN, VNI and remote, one MAC
+ * may be learnt in several VLANs and VXLAN floods to several remotes.
+ *
+ * A slice of one type, narrowed by a struct rtnl_filter, can be dumped
+ * again and reconciled the same way, when an overrun may have lost its
+ * events or before answering a query.
+ *
+ * Wireless stations are tracked from nl80211 events under the
+ * NETEVENT_WIRELESS type, keyed by interface and MAC. They are not
+ * part of the snapshot.
+ *
+ * The state belongs to the event loop thread, read it from there. Other
+ * threads keep their own copy current through state_watch().
+ *
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <linux/netlink.h>
+
+#include <netevent/events.h>
+#include <netevent/ctx.h>
+
+#define STATE_MAGIC	"NESTATE2"
+#define STATE_RESYNC_DELAY	1	/* seconds from an overrun to the dump */
+
+struct rtnl_filter;
+
+struct state_key
+{
+	uint8_t type;		/* NETEVENT_LINK ... NETEVENT_NEIGH */
+	uint8_t family;
+	uint16_t vlan;		/* big endian, AF_BRIDGE neighbors */
+	uint32_t id;		/* big endian ifindex, or route table */
+	uint8_t addr[16];	/* lladdr for AF_BRIDGE neighbors and stations */
+	uint8_t plen;
+	uint8_t tos;
+	uint8_t pad2[2];
+	uint32_t prio;		/* big endian route priority */
+	uint32_t vni;		/* big endian, AF_BRIDGE neighbors */
+	uint8_t dst[16];	/* remote of AF_BRIDGE neighbors, VXLAN flooding */
+};
+
+struct state_header
+{
+	char magic[8];
+	uint64_t generation;
+	uint64_t count;
+	uint64_t size;		/* bytes of records after the header */
+};
+
+/* Followed by the message, len bytes padded to NLMSG_ALIGNTO */
+struct state_record
+{
+	struct state_key key;
+	uint32_t len;
+};
+
+/**
+* @short Key of a link, address, route or neighbor message
+* @return 0 on success, -1 for other messages
+*/
+int state_key(const struct nlmsghdr *nlh, struct state_key *key);
+
+typedef void (*state_fn_t)(const struct state_key *key,
+			   const struct nlmsghdr *nlh, void *data);
+
+/**
+* @short Load the snapshot at path and reconcile it with the kernel
+*
+* Only the object types with a group in filter are dumped. Differences
+* are pushed to h. A missing snapshot, or a NULL path, is not an error,
+* the dump then only fills the state.
+*
+* @return 0 on success, -1 on error with errno set
+*/
+int state_init(const char *path, int filter, struct event_handler *h);
+
+int state_enabled(void);
+
+/**
+* @short Keep the state current from an rtnetlink datagram
+*
+* Suitable as an ev_handler_t.
+*/
+int state_rt_event(void *data, size_t len);
+
+/**
+* @short Track stations from an nl80211 event
+*/
+void state_wireless_event(const struct netevent *ev);
+
+/**
+* @short Stored message of a link, address, route or neighbor key
+* @return NULL if unknown
+*/
+const struct nlmsghdr * state_find(const struct state_key *key);
+
+/**
+* @short Call fn on every entry of a type, in no particular order
+*
+* nlh is NULL for stations.
+*/
+void state_foreach(int type, state_fn_t fn, void *data);
+
+typedef void (*state_watch_t)(const struct state_key *key,
+			      const struct nlmsghdr *nlh, int removed,
+			      void *data);
+
+/**
+* @short Call fn on every entry stored, replaced or removed
+*
+* fn runs on the event loop thread, right after the change. nlh is the
+* stored copy, NULL for stations, and only valid during the call. One
+* watcher at most, NULL removes it.
+*/
+void state_watch(state_watch_t fn, void *data);
+
+/**
+* @short Dump a slice again and push how it differs from the state
+*
+* type is NETEVENT_LINK ... NETEVENT_NEIGH, f narrows the dump, NULL
+* for all of the type. Entries of the slice the kernel no longer has
+* are pushed as deletions.
+*
+* @return 0 on success, -1 on error with errno set
+*/
+int state_resync(int type, const struct rtnl_filter *f);
+
+/**
+* @short Resync whole types, a mask of 1 << NETEVENT_*, from a timer
+*
+* Types outside the dump filter are ignored, ~0U resyncs everything.
+*/
+void state_resync_later(unsigned int types);
+
+/**
+* @short Write the snapshot with the next generation number
+*/
+void state_close(void);
+
+#endif
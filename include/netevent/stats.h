@@ -0,0 +1,48 @@
+#ifndef __NETEVENT_STATS__
+#define __NETEVENT_STATS__
+
+/**
+ * @file stats.h Interface counter sampling
+ *
+ * Every interval one RTM_GETSTATS dump asks the kernel for the
+ * IFLA_STATS_LINK_64 counters of all interfaces at once, new ones are
+ * picked up by the next dump. The dump runs on its own non-blocking
+ * socket served by the event loop, replies are folded into per
+ * interface rates as they arrive.
+ *
+ * Interfaces that moved traffic during the interval get a rate line.
+ * Thresholds, given as NAME=RATE with NAME one of the counters below
+ * and RATE per second with an optional k, M or G suffix, are reported
+ * when a rate goes above them and when it falls back.
+ *
+ */
+
+#include <stdint.h>
+
+#define STATS_THRESHOLDS_MAX	8
+#define STATS_RCVBUF		(1 << 20)
+#define STATS_DUMP_TIMEOUT	10	/* seconds */
+
+#define STATS_RX_PACKETS	0
+#define STATS_TX_PACKETS	1
+#define STATS_RX_BYTES		2
+#define STATS_TX_BYTES		3
+#define STATS_RX_ERRORS		4
+#define STATS_TX_ERRORS		5
+#define STATS_RX_DROPPED	6
+#define STATS_TX_DROPPED	7
+#define STATS_FIELDS		8
+
+/**
+* @short Add a threshold, "rx_bytes=100M" for instance
+* @return 0 on success, -1 with errno EINVAL or ENOSPC
+*/
+int stats_add_threshold(const char *spec);
+
+/**
+* @short Sample every interval seconds from the event loop
+* @return 0 on success, -1 on error with errno set
+*/
+int stats_init(unsigned int interval);
+
+#endif
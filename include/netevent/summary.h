@@ -0,0 +1,69 @@
+#ifndef __NETEVENT_SUMMARY__
+#define __NETEVENT_SUMMARY__
+
+/**
+ * @file summary.h Storm-mode aggregated statistics
+ *
+ * Instead of a line per event, events are counted per type and their
+ * interfaces, prefixes and MACs are fed to fixed-size heavy-hitter
+ * sketches. A top-N report is printed every interval. Memory use does
+ * not depend on the number of distinct keys.
+ *
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SUMMARY_IF		0
+#define SUMMARY_PREFIX		1
+#define SUMMARY_MAC		2
+#define SUMMARY_KEYS		3
+
+#define SUMMARY_EV_LINK		0
+#define SUMMARY_EV_ADDR		1
+#define SUMMARY_EV_ROUTE	2
+#define SUMMARY_EV_NEIGH	3
+#define SUMMARY_EV_NEXTHOP	4
+#define SUMMARY_EV_OTHER	5
+#define SUMMARY_EV_WIRELESS	6
+#define SUMMARY_EV_TYPES	7
+
+/* Count-Min dimensions and Space-Saving capacity, per key class */
+#define CM_DEPTH		4
+#define CM_WIDTH		2048
+#define HH_SLOTS		32
+#define HH_KEY_LEN		18
+
+#define SUMMARY_TOP_N		5
+
+/**
+* @short Enable summary mode, reporting every interval seconds
+* @return 0 on success, -1 on error
+*/
+int summary_init(unsigned int interval);
+
+int summary_enabled(void);
+
+/**
+* @short Account one event of the given SUMMARY_EV_* type
+*/
+void summary_count(int type);
+
+/**
+* @short Feed a key to the SUMMARY_IF/PREFIX/MAC sketch
+*
+* Interface keys are the ifindex in host order, prefix keys are
+* family, prefix length and address, MAC keys are the 6 byte address.
+*/
+void summary_key(int class, const void *key, size_t len);
+
+void summary_ifindex(int ifindex);
+void summary_prefix(int family, int prefixlen, const void *addr);
+void summary_mac(const void *mac);
+
+/**
+* @short Event handler for rtnetlink messages in summary mode
+*/
+int summary_rt_event(void *data, size_t n);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef __NETEVENT_SURVEY__
+#define __NETEVENT_SURVEY__
+
+/**
+ * @file survey.h Channel utilization sampling through nl80211 surveys
+ *
+ * Every interval the wireless interfaces are listed and, for each
+ * wiphy, one NL80211_CMD_GET_SURVEY dump is made through its first
+ * interface: the survey belongs to the radio, so interfaces sharing it
+ * also share the dump.
+ *
+ * The counters of NL80211_SURVEY_INFO are cumulative milliseconds. The
+ * busy, rx and tx shares of the channel time elapsed since the previous
+ * sample are emitted per channel, with the noise floor. Channels that
+ * were not visited during the interval are skipped. Nothing is asked
+ * while no wireless interface exists, see nl80211_active().
+ *
+ */
+
+#define SURVEY_WIPHYS_MAX	16
+
+/**
+* @short Sample every interval seconds from the timer wheel, from the
+* moment the nl80211 family is known
+* @return 0 on success, -1 on error with errno set
+*/
+int survey_init(unsigned int interval);
+
+#endif
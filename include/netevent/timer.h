@@ -0,0 +1,70 @@
+#ifndef __NETEVENT_TIMER__
+#define __NETEVENT_TIMER__
+
+/**
+ * @file timer.h Hierarchical timer wheel
+ *
+ * One second ticks driven by a single timerfd. Adding, removing and
+ * expiring a timer is O(1), timers further away than the first level
+ * are cascaded down as the wheel turns.
+ *
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TW_L0_BITS	8
+#define TW_LN_BITS	6
+#define TW_LEVELS	4
+#define TW_L0_SIZE	(1 << TW_L0_BITS)
+#define TW_LN_SIZE	(1 << TW_LN_BITS)
+
+/* Largest delay the wheel covers directly, longer timers are re-queued */
+#define TW_MAX_DELAY	((1ULL << (TW_L0_BITS + (TW_LEVELS - 1) * TW_LN_BITS)) - 1)
+
+#define timer_entry(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+struct timer;
+
+typedef void (*timer_fn_t)(struct timer *t);
+
+struct timer
+{
+	struct timer *next;
+	struct timer **pprev;
+	uint64_t expires;
+	timer_fn_t fn;
+};
+
+/**
+* @short Create the wheel and its timerfd
+* @return timerfd to poll for readability, -1 on error
+*/
+int timer_init(void);
+
+void timer_setup(struct timer *t, timer_fn_t fn);
+
+/**
+* @short (Re)arm timer to fire in secs seconds
+*/
+void timer_add(struct timer *t, unsigned int secs);
+
+void timer_del(struct timer *t);
+
+static inline int timer_pending(const struct timer *t)
+{
+	return t->pprev != 0;
+}
+
+/**
+* @short Current wheel time, in seconds since timer_init()
+*/
+uint64_t timer_now(void);
+
+/**
+* @short Consume timerfd expirations and run due timers
+*/
+void timer_run(int fd);
+
+#endif
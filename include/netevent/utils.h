@@ -1,8 +1,16 @@
 #ifndef __UTILS_H__
 #define __UTILS_H__
 
+#include <stddef.h>
 
 int zero_addr(const unsigned char *addr);
 char * print_binary_stream(char * buf, unsigned int buflen, const unsigned char * data, unsigned int len);
 
+/**
+* @short snprintf at buf+len, clamped so len never runs past size
+* @return new length of buf
+*/
+int strappend(char *buf, size_t size, int len, const char *fmt, ...)
+	__attribute__((format(printf, 4, 5)));
+
 #endif
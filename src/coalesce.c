@@ -0,0 +1,248 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include <netevent/coalesce.h>
+#include <netevent/hash.h>
+#include <netevent/timer.h>
+#include <netevent/console.h>
+
+#define LABEL_LEN	64
+#define STATE_LEN	16
+
+struct coalesce_entry
+{
+	struct hnode node;
+	struct coalesce_key key;
+	struct timer window;
+	struct timer damp;
+	char label[LABEL_LEN];
+	char state[STATE_LEN];
+	int color;
+	unsigned int count;
+	unsigned int absorbed;
+	int suppressed;
+	double penalty;
+	double updated;
+};
+
+static struct htable coalesce_table;
+static unsigned int coalesce_window;
+static unsigned int damp_half_life;
+
+static int coalesce_cmp(const struct hnode *n, const void *key)
+{
+	return memcmp(&hnode_entry(n, struct coalesce_entry, node)->key, key,
+		      sizeof(struct coalesce_key));
+}
+
+static double now_secs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void penalty_decay(struct coalesce_entry *e, double now)
+{
+	if (damp_half_life && e->penalty > 0)
+		e->penalty *= exp2(-(now - e->updated) / damp_half_life);
+
+	e->updated = now;
+}
+
+/* Seconds until the penalty decays down to limit */
+static unsigned int penalty_eta(const struct coalesce_entry *e, double limit)
+{
+	if (!damp_half_life || e->penalty <= limit)
+		return 0;
+
+	return (unsigned int) ceil(damp_half_life * log2(e->penalty / limit));
+}
+
+static void coalesce_free(struct coalesce_entry *e)
+{
+	timer_del(&e->window);
+	timer_del(&e->damp);
+	htable_remove(&coalesce_table, &e->node);
+	free(e);
+}
+
+/**
+ * @short Keep the entry while it still carries history, drop it otherwise
+ *
+ * An idle entry is only useful for its penalty and last state, so it is
+ * held for a half-life or until the penalty is negligible, keeping the
+ * table bounded by the set of recently active objects.
+ */
+static void coalesce_gc(struct coalesce_entry *e)
+{
+	unsigned int eta;
+	double now;
+
+	if (timer_pending(&e->window) || e->suppressed)
+		return;
+
+	now = now_secs();
+	penalty_decay(e, now);
+	eta = penalty_eta(e, DAMP_FORGET);
+
+	/* The last state is needed to tell whether the next event is a flap */
+	if (damp_half_life && eta < damp_half_life)
+		eta = damp_half_life;
+
+	if (eta == 0)
+		coalesce_free(e);
+	else
+		timer_add(&e->damp, eta);
+}
+
+static void window_expired(struct timer *t)
+{
+	struct coalesce_entry *e = timer_entry(t, struct coalesce_entry, window);
+
+	if (e->count > 1 && !e->suppressed) {
+		eprintf(e->color, "%s flapped %u times in %us, now %s\n",
+			e->label, e->count, coalesce_window, e->state);
+	}
+
+	coalesce_gc(e);
+}
+
+static void damp_expired(struct timer *t)
+{
+	struct coalesce_entry *e = timer_entry(t, struct coalesce_entry, damp);
+	unsigned int eta;
+
+	penalty_decay(e, now_secs());
+
+	if (!e->suppressed) {
+		/* Hold time is over, keep it only while the penalty matters */
+		eta = penalty_eta(e, DAMP_FORGET);
+		if (eta)
+			timer_add(&e->damp, eta);
+		else
+			coalesce_free(e);
+		return;
+	}
+
+	eta = penalty_eta(e, DAMP_REUSE);
+
+	if (eta) {
+		timer_add(&e->damp, eta);
+		return;
+	}
+
+	e->suppressed = 0;
+	eprintf(e->color, "%s released from flap damping after %u suppressed "
+		"changes, now %s\n", e->label, e->absorbed, e->state);
+
+	coalesce_gc(e);
+}
+
+int coalesce_init(unsigned int window, unsigned int half_life)
+{
+	coalesce_window = window;
+	damp_half_life = half_life;
+
+	return htable_init(&coalesce_table, 256, coalesce_cmp);
+}
+
+int coalesce_enabled(void)
+{
+	return coalesce_table.buckets != NULL;
+}
+
+int coalesce_event(const struct coalesce_key *key, const char *label,
+		   const char *state, int color)
+{
+	struct coalesce_entry *e;
+	struct hnode *n;
+	uint32_t hash;
+	unsigned int eta;
+	int flap;
+
+	if (coalesce_table.buckets == NULL)
+		return 0;
+
+	hash = hash_bytes(key, sizeof(*key), 0);
+	n = htable_find(&coalesce_table, hash, key);
+	e = n ? hnode_entry(n, struct coalesce_entry, node) : NULL;
+
+	if (e == NULL) {
+		e = calloc(1, sizeof(*e));
+		if (e == NULL)
+			return 0;
+
+		e->key = *key;
+		timer_setup(&e->window, window_expired);
+		timer_setup(&e->damp, damp_expired);
+		htable_insert(&coalesce_table, &e->node, hash);
+	}
+
+	flap = e->state[0] && strcmp(e->state, state);
+
+	snprintf(e->label, sizeof(e->label), "%s", label);
+	snprintf(e->state, sizeof(e->state), "%s", state);
+	e->color = color;
+
+	if (damp_half_life) {
+		penalty_decay(e, now_secs());
+		if (flap)
+			e->penalty += DAMP_PENALTY;
+		if (e->penalty > DAMP_MAX_PENALTY)
+			e->penalty = DAMP_MAX_PENALTY;
+	}
+
+	if (e->suppressed) {
+		e->absorbed++;
+		eta = penalty_eta(e, DAMP_REUSE);
+		timer_add(&e->damp, eta ? eta : 1);
+		return 1;
+	}
+
+	if (damp_half_life && e->penalty >= DAMP_SUPPRESS) {
+		e->suppressed = 1;
+		e->absorbed = 0;
+		timer_del(&e->window);
+		eprintf(YELLOW, "%s suppressed by flap damping, now %s\n",
+			e->label, e->state);
+		timer_add(&e->damp, penalty_eta(e, DAMP_REUSE));
+		return 1;
+	}
+
+	if (coalesce_window == 0) {
+		coalesce_gc(e);
+		return 0;
+	}
+
+	if (timer_pending(&e->window)) {
+		e->count++;
+		return 1;
+	}
+
+	e->count = 1;
+	timer_del(&e->damp);
+	timer_add(&e->window, coalesce_window);
+
+	return 0;
+}
@@ -0,0 +1,679 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/filter.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
+#include <linux/netfilter/nf_conntrack_tcp.h>
+
+#include <netevent/conntrack.h>
+#include <netevent/loop.h>
+#include <netevent/timer.h>
+#include <netevent/hash.h>
+#include <netevent/console.h>
+#include <netevent/fmt.h>
+#include <netevent/utils.h>
+
+/* Aggregation key, addresses cut to the prefix */
+struct ct_key
+{
+	uint8_t family;
+	uint8_t proto;
+	uint16_t dport;
+	uint8_t src[16];
+	uint8_t dst[16];
+};
+
+struct ct_agg
+{
+	struct hnode node;
+	struct ct_key key;
+	unsigned long events[3];
+	uint64_t packets;
+	uint64_t bytes;
+};
+
+static int enabled;
+static int ct_fd = -1;
+static unsigned int groups;
+static uint8_t protos[CT_PROTOS_MAX];
+static int nprotos;
+static unsigned int sample = 1;
+static unsigned int agg_interval;
+static unsigned int prefix4 = 24, prefix6 = 64;
+static int rcvbuf = CT_RCVBUF;
+
+static struct htable agg_table;
+static struct ct_agg agg_pool[CT_AGG_MAX];
+static unsigned int nagg;
+static unsigned long agg_full;
+static struct timer agg_timer;
+
+static unsigned long events, sampled_out, overruns;
+
+static const char *event_names[] = { "New", "Updated", "Destroyed" };
+
+static const char *tcp_states[TCP_CONNTRACK_MAX] = {
+	[TCP_CONNTRACK_NONE] = "NONE",
+	[TCP_CONNTRACK_SYN_SENT] = "SYN_SENT",
+	[TCP_CONNTRACK_SYN_RECV] = "SYN_RECV",
+	[TCP_CONNTRACK_ESTABLISHED] = "ESTABLISHED",
+	[TCP_CONNTRACK_FIN_WAIT] = "FIN_WAIT",
+	[TCP_CONNTRACK_CLOSE_WAIT] = "CLOSE_WAIT",
+	[TCP_CONNTRACK_LAST_ACK] = "LAST_ACK",
+	[TCP_CONNTRACK_TIME_WAIT] = "TIME_WAIT",
+	[TCP_CONNTRACK_CLOSE] = "CLOSE",
+	[TCP_CONNTRACK_SYN_SENT2] = "SYN_SENT2",
+};
+
+static const struct {
+	const char *name;
+	uint8_t proto;
+} proto_names[] = {
+	{ "tcp", IPPROTO_TCP },
+	{ "udp", IPPROTO_UDP },
+	{ "icmp", IPPROTO_ICMP },
+	{ "icmpv6", IPPROTO_ICMPV6 },
+	{ "sctp", IPPROTO_SCTP },
+	{ "udplite", IPPROTO_UDPLITE },
+	{ "dccp", IPPROTO_DCCP },
+	{ "gre", IPPROTO_GRE },
+};
+
+#define NPROTO_NAMES	(sizeof(proto_names) / sizeof(proto_names[0]))
+
+static char * fmt_proto(char *p, uint8_t proto)
+{
+	unsigned int i;
+
+	for (i=0; i<NPROTO_NAMES; i++) {
+		if (proto_names[i].proto == proto)
+			return fmt_str(p, proto_names[i].name);
+	}
+
+	p = fmt_str(p, "proto ");
+	return fmt_uint(p, proto);
+}
+
+static int parse_proto(const char *s)
+{
+	unsigned int i;
+	char *end;
+	long v;
+
+	for (i=0; i<NPROTO_NAMES; i++) {
+		if (strcmp(proto_names[i].name, s) == 0)
+			return proto_names[i].proto;
+	}
+
+	v = strtol(s, &end, 10);
+	if (*s == '\0' || *end != '\0' || v <= 0 || v > 255)
+		return -1;
+
+	return v;
+}
+
+int conntrack_enabled(void)
+{
+	return enabled;
+}
+
+int conntrack_setup(const char *spec)
+{
+	char buf[256], *tok, *save, *val, *p, *psave;
+	int proto;
+
+	if (strlen(spec) >= sizeof(buf))
+		goto invalid;
+	strcpy(buf, spec);
+
+	for (tok = strtok_r(buf, ":", &save); tok; tok = strtok_r(NULL, ":", &save)) {
+		if (strcmp(tok, "new") == 0) {
+			groups |= 1 << NFNLGRP_CONNTRACK_NEW;
+			continue;
+		} else if (strcmp(tok, "update") == 0) {
+			groups |= 1 << NFNLGRP_CONNTRACK_UPDATE;
+			continue;
+		} else if (strcmp(tok, "destroy") == 0) {
+			groups |= 1 << NFNLGRP_CONNTRACK_DESTROY;
+			continue;
+		}
+
+		if ( (val = strchr(tok, '=')) == NULL )
+			goto invalid;
+		*val++ = '\0';
+
+		if (strcmp(tok, "proto") == 0) {
+			for (p = strtok_r(val, "/", &psave); p; p = strtok_r(NULL, "/", &psave)) {
+				if (nprotos == CT_PROTOS_MAX || (proto = parse_proto(p)) == -1)
+					goto invalid;
+				protos[nprotos++] = proto;
+			}
+		} else if (strcmp(tok, "sample") == 0) {
+			if ( (sample = atoi(val)) == 0 )
+				goto invalid;
+		} else if (strcmp(tok, "agg") == 0) {
+			if ( (agg_interval = atoi(val)) == 0 )
+				goto invalid;
+		} else if (strcmp(tok, "prefix") == 0) {
+			if (sscanf(val, "%u/%u", &prefix4, &prefix6) != 2
+			    || prefix4 > 32 || prefix6 > 128)
+				goto invalid;
+		} else if (strcmp(tok, "rcvbuf") == 0) {
+			if ( (rcvbuf = atoi(val) << 10) <= 0 )
+				goto invalid;
+		} else {
+			goto invalid;
+		}
+	}
+
+	if (groups == 0)
+		groups = 1 << NFNLGRP_CONNTRACK_NEW | 1 << NFNLGRP_CONNTRACK_DESTROY;
+
+	enabled = 1;
+
+	return 0;
+
+invalid:
+	errno = EINVAL;
+	return -1;
+}
+
+/* Like parse_rt_attrs(), ctnetlink sets NLA_F_NESTED on nests */
+static void ct_parse(struct rtattr *tb[], int max, struct rtattr *rta, int len)
+{
+	int type;
+
+	memset(tb, 0, sizeof(struct rtattr *) * max);
+
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		type = rta->rta_type & NLA_TYPE_MASK;
+		if (type < max)
+			tb[type] = rta;
+	}
+}
+
+static void ct_parse_nested(struct rtattr *tb[], int max, struct rtattr *rta)
+{
+	ct_parse(tb, max, RTA_DATA(rta), RTA_PAYLOAD(rta));
+}
+
+static uint64_t ct_get_be64(struct rtattr *rta)
+{
+	uint64_t v;
+
+	memcpy(&v, RTA_DATA(rta), sizeof(v));
+	return be64toh(v);
+}
+
+static void ct_counters(struct ct_flow *f, struct rtattr *rta)
+{
+	struct rtattr *tb[CTA_COUNTERS_MAX + 1];
+
+	ct_parse_nested(tb, CTA_COUNTERS_MAX + 1, rta);
+
+	if (tb[CTA_COUNTERS_PACKETS] && tb[CTA_COUNTERS_BYTES]) {
+		f->packets += ct_get_be64(tb[CTA_COUNTERS_PACKETS]);
+		f->bytes += ct_get_be64(tb[CTA_COUNTERS_BYTES]);
+		f->flags |= CT_COUNTERS;
+	}
+}
+
+int conntrack_decode(const struct nlmsghdr *nlh, struct ct_flow *f)
+{
+	struct nfgenmsg *nfg = NLMSG_DATA(nlh);
+	struct rtattr *tb[CTA_MAX + 1], *tuple[CTA_TUPLE_MAX + 1];
+	struct rtattr *ip[CTA_IP_MAX + 1], *proto[CTA_PROTO_MAX + 1];
+	struct rtattr *info[CTA_PROTOINFO_MAX + 1], *tcp[CTA_PROTOINFO_TCP_MAX + 1];
+	unsigned int alen = 4;
+	int src = CTA_IP_V4_SRC, dst = CTA_IP_V4_DST;
+
+	if (NFNL_SUBSYS_ID(nlh->nlmsg_type) != NFNL_SUBSYS_CTNETLINK
+	    || nlh->nlmsg_len < NLMSG_SPACE(sizeof(*nfg)))
+		return -1;
+
+	memset(f, 0, sizeof(*f));
+
+	switch (NFNL_MSG_TYPE(nlh->nlmsg_type)) {
+	case IPCTNL_MSG_CT_NEW:
+		if (nlh->nlmsg_flags & (NLM_F_CREATE | NLM_F_EXCL))
+			f->event = CT_NEW;
+		else
+			f->event = CT_UPDATE;
+		break;
+	case IPCTNL_MSG_CT_DELETE:
+		f->event = CT_DESTROY;
+		break;
+	default:
+		return -1;
+	}
+
+	ct_parse(tb, CTA_MAX + 1, (struct rtattr *) ((char *) nfg + NLMSG_ALIGN(sizeof(*nfg))),
+		 nlh->nlmsg_len - NLMSG_SPACE(sizeof(*nfg)));
+
+	if (tb[CTA_TUPLE_ORIG] == NULL)
+		return -1;
+
+	ct_parse_nested(tuple, CTA_TUPLE_MAX + 1, tb[CTA_TUPLE_ORIG]);
+	if (tuple[CTA_TUPLE_IP] == NULL || tuple[CTA_TUPLE_PROTO] == NULL)
+		return -1;
+
+	f->family = nfg->nfgen_family;
+	if (f->family == AF_INET6) {
+		alen = 16;
+		src = CTA_IP_V6_SRC;
+		dst = CTA_IP_V6_DST;
+	}
+
+	ct_parse_nested(ip, CTA_IP_MAX + 1, tuple[CTA_TUPLE_IP]);
+	if (ip[src] == NULL || ip[dst] == NULL
+	    || RTA_PAYLOAD(ip[src]) < alen || RTA_PAYLOAD(ip[dst]) < alen)
+		return -1;
+	memcpy(f->src, RTA_DATA(ip[src]), alen);
+	memcpy(f->dst, RTA_DATA(ip[dst]), alen);
+
+	ct_parse_nested(proto, CTA_PROTO_MAX + 1, tuple[CTA_TUPLE_PROTO]);
+	if (proto[CTA_PROTO_NUM] == NULL)
+		return -1;
+	f->proto = *(uint8_t *) RTA_DATA(proto[CTA_PROTO_NUM]);
+
+	if (proto[CTA_PROTO_SRC_PORT] && proto[CTA_PROTO_DST_PORT]) {
+		f->sport = ntohs(*(uint16_t *) RTA_DATA(proto[CTA_PROTO_SRC_PORT]));
+		f->dport = ntohs(*(uint16_t *) RTA_DATA(proto[CTA_PROTO_DST_PORT]));
+		f->flags |= CT_PORTS;
+	}
+
+	if (tb[CTA_MARK])
+		f->mark = ntohl(*(uint32_t *) RTA_DATA(tb[CTA_MARK]));
+
+	if (tb[CTA_COUNTERS_ORIG])
+		ct_counters(f, tb[CTA_COUNTERS_ORIG]);
+	if (tb[CTA_COUNTERS_REPLY])
+		ct_counters(f, tb[CTA_COUNTERS_REPLY]);
+
+	if (tb[CTA_PROTOINFO]) {
+		ct_parse_nested(info, CTA_PROTOINFO_MAX + 1, tb[CTA_PROTOINFO]);
+		if (info[CTA_PROTOINFO_TCP]) {
+			ct_parse_nested(tcp, CTA_PROTOINFO_TCP_MAX + 1,
+					info[CTA_PROTOINFO_TCP]);
+			if (tcp[CTA_PROTOINFO_TCP_STATE])
+				f->state = *(uint8_t *) RTA_DATA(tcp[CTA_PROTOINFO_TCP_STATE]);
+		}
+	}
+
+	return 0;
+}
+
+static char * fmt_endpoint(char *p, const struct ct_flow *f, const uint8_t *addr,
+			   uint16_t port)
+{
+	if (!(f->flags & CT_PORTS))
+		return fmt_inet(p, f->family, addr);
+
+	if (f->family == AF_INET6) {
+		p = fmt_str(p, "[");
+		p = fmt_inet(p, f->family, addr);
+		p = fmt_str(p, "]");
+	} else {
+		p = fmt_inet(p, f->family, addr);
+	}
+
+	p = fmt_str(p, ":");
+	return fmt_uint(p, port);
+}
+
+static void print_flow(const struct ct_flow *f)
+{
+	static const int colors[] = { GREEN, YELLOW, RED };
+	char output[256], *p;
+
+	p = fmt_str(output, event_names[f->event]);
+	p = fmt_str(p, " ");
+	p = fmt_proto(p, f->proto);
+	p = fmt_str(p, " flow ");
+	p = fmt_endpoint(p, f, f->src, f->sport);
+	p = fmt_str(p, " -> ");
+	p = fmt_endpoint(p, f, f->dst, f->dport);
+
+	if (f->event == CT_UPDATE && f->proto == IPPROTO_TCP
+	    && f->state < TCP_CONNTRACK_MAX && tcp_states[f->state]) {
+		p = fmt_str(p, " ");
+		p = fmt_str(p, tcp_states[f->state]);
+	}
+
+	if (f->mark) {
+		p = fmt_str(p, " mark ");
+		p = fmt_uint(p, f->mark);
+	}
+
+	fmt_str(p, "\n");
+
+	/* Counters may not fit fmt_uint(), they are rare enough for snprintf */
+	if (f->event == CT_DESTROY && (f->flags & CT_COUNTERS))
+		snprintf(p, output + sizeof(output) - p, ", %llu packets, %llu bytes\n",
+			 (unsigned long long) f->packets, (unsigned long long) f->bytes);
+
+	eputs(colors[f->event], output);
+}
+
+static int agg_cmp(const struct hnode *n, const void *key)
+{
+	const struct ct_agg *a = hnode_entry(n, struct ct_agg, node);
+
+	return memcmp(&a->key, key, sizeof(a->key));
+}
+
+static void mask_prefix(uint8_t *addr, unsigned int len, unsigned int bits)
+{
+	unsigned int i;
+
+	for (i=bits/8; i<len; i++) {
+		if (i == bits/8 && bits % 8)
+			addr[i] &= 0xff << (8 - bits % 8);
+		else
+			addr[i] = 0;
+	}
+}
+
+static void agg_flow(const struct ct_flow *f)
+{
+	struct ct_key key;
+	struct ct_agg *a;
+	struct hnode *n;
+	uint32_t hash;
+	unsigned int alen = (f->family == AF_INET6) ? 16 : 4;
+
+	memset(&key, 0, sizeof(key));
+	key.family = f->family;
+	key.proto = f->proto;
+	key.dport = f->dport;
+	memcpy(key.src, f->src, alen);
+	memcpy(key.dst, f->dst, alen);
+	mask_prefix(key.src, alen, alen == 16 ? prefix6 : prefix4);
+	mask_prefix(key.dst, alen, alen == 16 ? prefix6 : prefix4);
+
+	hash = hash_bytes(&key, sizeof(key), 0);
+
+	if ( (n = htable_find(&agg_table, hash, &key)) != NULL ) {
+		a = hnode_entry(n, struct ct_agg, node);
+	} else {
+		if (nagg == CT_AGG_MAX) {
+			agg_full++;
+			return;
+		}
+		a = &agg_pool[nagg++];
+		memset(a, 0, sizeof(*a));
+		a->key = key;
+		htable_insert(&agg_table, &a->node, hash);
+	}
+
+	a->events[f->event]++;
+	a->packets += f->packets;
+	a->bytes += f->bytes;
+}
+
+static void agg_flush(struct timer *t)
+{
+	struct ct_agg *a;
+	unsigned int i, bits;
+	char output[256], *p;
+	int len;
+
+	timer_add(t, agg_interval);
+
+	for (i=0; i<nagg; i++) {
+		a = &agg_pool[i];
+		bits = (a->key.family == AF_INET6) ? prefix6 : prefix4;
+
+		p = fmt_str(output, "Flows ");
+		p = fmt_inet(p, a->key.family, a->key.src);
+		p = fmt_str(p, "/");
+		p = fmt_uint(p, bits);
+		p = fmt_str(p, " -> ");
+		p = fmt_inet(p, a->key.family, a->key.dst);
+		p = fmt_str(p, "/");
+		p = fmt_uint(p, bits);
+		p = fmt_str(p, " ");
+		p = fmt_proto(p, a->key.proto);
+		if (a->key.dport) {
+			p = fmt_str(p, "/");
+			p = fmt_uint(p, a->key.dport);
+		}
+
+		len = p - output;
+		len = strappend(output, sizeof(output), len, ": %lu new, %lu updated, %lu destroyed",
+				a->events[CT_NEW], a->events[CT_UPDATE], a->events[CT_DESTROY]);
+		if (a->packets)
+			len = strappend(output, sizeof(output), len, ", %llu packets, %llu bytes",
+					(unsigned long long) a->packets,
+					(unsigned long long) a->bytes);
+		if (sample > 1)
+			len = strappend(output, sizeof(output), len, ", 1 in %u sampled", sample);
+		strappend(output, sizeof(output), len, "\n");
+
+		eputs(NONE, output);
+	}
+
+	if (agg_full)
+		tprintf("Flows: %lu events not aggregated, more than %u aggregates\n",
+			agg_full, CT_AGG_MAX);
+
+	/* Start the next interval empty */
+	htable_free(&agg_table);
+	htable_init(&agg_table, 256, agg_cmp);
+	nagg = 0;
+	agg_full = 0;
+}
+
+static int sample_flow(const struct ct_flow *f)
+{
+	uint32_t seed = ((uint32_t) f->sport << 16 | f->dport) ^ f->proto;
+
+	return hash_bytes(f->src, sizeof(f->src) + sizeof(f->dst), seed) % sample == 0;
+}
+
+static void ct_datagram(char *buf, int len)
+{
+	struct nlmsghdr *nlh;
+	struct ct_flow f;
+
+	for (nlh = (struct nlmsghdr *) buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+		if (conntrack_decode(nlh, &f) == -1)
+			continue;
+
+		events++;
+
+		if (sample > 1 && !sample_flow(&f)) {
+			sampled_out++;
+			continue;
+		}
+
+		if (agg_interval)
+			agg_flow(&f);
+		else
+			print_flow(&f);
+	}
+}
+
+static void ct_overrun(void)
+{
+	overruns++;
+
+	/* Storms overrun often, report at powers of two */
+	if ((overruns & (overruns - 1)) == 0)
+		tprintf("Receive queue overrun on conntrack socket, %lu so far\n",
+			overruns);
+}
+
+static int ct_ready(void *data, int fd)
+{
+	static char bufs[CT_BATCH][CT_BUF_SIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+	static struct mmsghdr msgs[CT_BATCH];
+	static struct iovec iovs[CT_BATCH];
+	int round, i, n;
+
+	for (round=0; round<CT_ROUNDS; round++) {
+		for (i=0; i<CT_BATCH; i++) {
+			iovs[i].iov_base = bufs[i];
+			iovs[i].iov_len = CT_BUF_SIZE;
+			memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		n = recvmmsg(fd, msgs, CT_BATCH, MSG_DONTWAIT, NULL);
+
+		if (n == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			if (errno == ENOBUFS) {
+				ct_overrun();
+				continue;
+			}
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		for (i=0; i<n; i++) {
+			if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+				continue;
+			ct_datagram(bufs[i], msgs[i].msg_len);
+		}
+
+		if (n < CT_BATCH)
+			break;
+	}
+
+	return 0;
+}
+
+/*
+ * Walk CTA_TUPLE_ORIG, CTA_TUPLE_PROTO and CTA_PROTO_NUM with the
+ * netlink attribute extensions and accept the listed protocols only.
+ */
+static int ct_attach_filter(void)
+{
+	struct sock_filter code[14 + CT_PROTOS_MAX];
+	struct sock_fprog prog;
+	int i, n = 0, reject = 12 + nprotos, accept = reject + 1;
+
+	code[n++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_IMM,
+			NLMSG_HDRLEN + NLMSG_ALIGN(sizeof(struct nfgenmsg)));
+	code[n++] = (struct sock_filter) BPF_STMT(BPF_LDX | BPF_IMM, CTA_TUPLE_ORIG);
+	code[n++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+						  SKF_AD_OFF + SKF_AD_NLATTR);
+	code[n] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0,
+						reject - n - 1, 0), n++;
+	code[n++] = (struct sock_filter) BPF_STMT(BPF_LDX | BPF_IMM, CTA_TUPLE_PROTO);
+	code[n++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+						  SKF_AD_OFF + SKF_AD_NLATTR_NEST);
+	code[n] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0,
+						reject - n - 1, 0), n++;
+	code[n++] = (struct sock_filter) BPF_STMT(BPF_LDX | BPF_IMM, CTA_PROTO_NUM);
+	code[n++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+						  SKF_AD_OFF + SKF_AD_NLATTR_NEST);
+	code[n] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0,
+						reject - n - 1, 0), n++;
+
+	/* X = offset of CTA_PROTO_NUM, load its u8 payload */
+	code[n++] = (struct sock_filter) BPF_STMT(BPF_MISC | BPF_TAX, 0);
+	code[n++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_B | BPF_IND, NLA_HDRLEN);
+
+	for (i=0; i<nprotos; i++, n++)
+		code[n] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+							protos[i], accept - n - 1, 0);
+
+	code[n++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, 0);
+	code[n++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+
+	prog.len = n;
+	prog.filter = code;
+
+	return setsockopt(ct_fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+}
+
+int conntrack_init(void)
+{
+	struct sockaddr_nl addr;
+	int group;
+
+	if ( (ct_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK,
+			     NETLINK_NETFILTER)) == -1 )
+		return -1;
+
+	/* Beyond net.core.rmem_max needs CAP_NET_ADMIN */
+	if (setsockopt(ct_fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) == -1)
+		setsockopt(ct_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	/* Filter before subscribing, nothing unfiltered gets queued */
+	if (nprotos && ct_attach_filter() == -1)
+		goto error;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+
+	if (bind(ct_fd, (struct sockaddr *) &addr, sizeof(addr)) == -1)
+		goto error;
+
+	for (group=NFNLGRP_CONNTRACK_NEW; group<=NFNLGRP_CONNTRACK_DESTROY; group++) {
+		if ( (groups & (1 << group))
+		     && setsockopt(ct_fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP,
+				   &group, sizeof(group)) == -1 )
+			goto error;
+	}
+
+	if (agg_interval) {
+		if (htable_init(&agg_table, 256, agg_cmp) == -1)
+			goto error;
+		timer_setup(&agg_timer, agg_flush);
+		timer_add(&agg_timer, agg_interval);
+	}
+
+	if (loop_add_fd(ct_fd, ct_ready, NULL) == -1)
+		goto error;
+
+	return 0;
+
+error:
+	close(ct_fd);
+	ct_fd = -1;
+
+	return -1;
+}
+
+void conntrack_report(void)
+{
+	if (ct_fd == -1)
+		return;
+
+	tprintf("Conntrack: %lu events, %lu sampled out, %lu overruns\n",
+		events, sampled_out, overruns);
+}
@@ -1,7 +1,60 @@
+#include <string.h>
+#include <unistd.h>
+
 #include <netevent/console.h>
+#include <netevent/latency.h>
+
+#include "probes.h"
 
 static int color_output=0;
 
+static console_sink_t sinks[MAX_SINKS];
+static int ctx_type, ctx_ifindex;
+
+int console_add_sink(console_sink_t sink)
+{
+	int i;
+
+	for (i=0; i<MAX_SINKS && sinks[i]; i++)
+		;;
+
+	if (i == MAX_SINKS) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	sinks[i] = sink;
+
+	return 0;
+}
+
+void console_set_context(int type, int ifindex)
+{
+	ctx_type = type;
+	ctx_ifindex = ifindex;
+}
+
+static void console_dispatch(struct timeval *tv, int color, char *msg)
+{
+	struct console_event ev;
+	int i;
+
+	if (sinks[0] == NULL)
+		return;
+
+	ev.tv = *tv;
+	ev.type = ctx_type;
+	ev.ifindex = ctx_ifindex;
+	ev.color = color;
+	ev.msg = msg;
+	ev.len = strlen(msg);
+
+	for (i=0; i<MAX_SINKS && sinks[i]; i++) {
+		sinks[i](&ev);
+		PROBE2(sink, i, ev.len);
+	}
+}
+
 void console_exit_cleanup(void)
 {
 	fflush(stdout);
@@ -54,23 +107,43 @@ int enable_color_output(void)
 	return color_output;
 }
 
-int eprintf(int color, char *format, ...)
+void disable_color_output(void)
 {
-	va_list argp;
-	char msg[2048], timestamp[20];
-	struct timeval tv;
+	color_output = 0;
+}
+
+/* [HH:MM:SS.uuuuuu], localtime only runs when the second changes */
+static void format_timestamp(char *buf, const struct timeval *tv)
+{
+	static time_t sec = -1;
+	static char hms[16];
 	struct tm *t;
+	long usec = tv->tv_usec;
+	int i;
+
+	if (tv->tv_sec != sec) {
+		t = localtime(&tv->tv_sec);
+		sprintf(hms, "[%02d:%02d:%02d.", t->tm_hour, t->tm_min, t->tm_sec);
+		sec = tv->tv_sec;
+	}
+
+	memcpy(buf, hms, 10);
+	for (i=15; i>9; i--, usec/=10)
+		buf[i] = '0' + usec % 10;
+	buf[16] = ']';
+	buf[17] = '\0';
+}
+
+static int console_emit(int color, char *msg, size_t size)
+{
+	char timestamp[20];
+	struct timeval tv;
 	char fg[13]="", fg_reset[]="\e[0m";
 
 	gettimeofday(&tv, NULL);
-	t = localtime(&tv.tv_sec);
-
-	sprintf(timestamp,"[%02d:%02d:%02d.%06ld]",
-		t->tm_hour, t->tm_min, t->tm_sec, tv.tv_usec);
+	format_timestamp(timestamp, &tv);
 
-	va_start(argp, format);
-	vsnprintf(msg, sizeof(msg), format, argp);
-	va_end(argp);
+	latency_sink(msg, size);
 
 	if(color_output && (color != NONE)) {
 		colorize(fg, color);
@@ -79,5 +152,36 @@ int eprintf(int color, char *format, ...)
 	printf("%s%s %s%s", fg, timestamp, msg, fg_reset);
 	fflush(stdout);
 
+	PROBE2(output, msg, ctx_type);
+
+	console_dispatch(&tv, color, msg);
+
 	return 0;
 }
+
+int eprintf(int color, char *format, ...)
+{
+	va_list argp;
+	char msg[2048];
+
+	/* The handler is done deciding, the event goes out */
+	latency_mark(LAT_DISPATCH);
+
+	va_start(argp, format);
+	vsnprintf(msg, sizeof(msg), format, argp);
+	va_end(argp);
+
+	return console_emit(color, msg, sizeof(msg));
+}
+
+int eputs(int color, const char *line)
+{
+	char msg[2048];
+	size_t len = strnlen(line, sizeof(msg) - 1);
+
+	latency_mark(LAT_DISPATCH);
+	memcpy(msg, line, len);
+	msg[len] = '\0';
+
+	return console_emit(color, msg, sizeof(msg));
+}
@@ -0,0 +1,309 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <net/if.h>
+
+#include <netlink/netlink.h>
+#include <netlink/genl/genl.h>
+
+#include <linux/nl80211.h>
+
+#include <netevent/cqm.h>
+#include <netevent/nl80211.h>
+#include <netevent/console.h>
+#include <netevent/utils.h>
+#include <netevent/fmt.h>
+
+struct cqm_conf
+{
+	char ifname[IFNAMSIZ];
+	int rssi;
+	unsigned int hyst;
+	unsigned int step;
+	unsigned int txe_rate;
+	unsigned int txe_pkts;
+	unsigned int txe_intvl;
+	int single;		/* the driver takes one threshold only */
+};
+
+static struct cqm_conf confs[CQM_MAX];
+static int nconfs;
+
+static struct nl_sock *cqm_sock;
+static int nl80211_id = -1;
+
+int cqm_enabled(void)
+{
+	return nconfs > 0;
+}
+
+int cqm_add(const char *spec)
+{
+	struct cqm_conf *c = &confs[nconfs];
+	char buf[256], *tok, *save, *val;
+	int has_rssi = 0;
+
+	if (nconfs == CQM_MAX) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	if (strlen(spec) >= sizeof(buf))
+		goto invalid;
+	strcpy(buf, spec);
+
+	memset(c, 0, sizeof(*c));
+
+	if ( (tok = strtok_r(buf, ":", &save)) == NULL || strlen(tok) >= IFNAMSIZ )
+		goto invalid;
+	strcpy(c->ifname, tok);
+
+	while ( (tok = strtok_r(NULL, ":", &save)) != NULL ) {
+		if ( (val = strchr(tok, '=')) == NULL )
+			goto invalid;
+		*val++ = '\0';
+
+		if (strcmp(tok, "rssi") == 0) {
+			c->rssi = atoi(val);
+			has_rssi = 1;
+		} else if (strcmp(tok, "hyst") == 0) {
+			c->hyst = atoi(val);
+		} else if (strcmp(tok, "step") == 0) {
+			c->step = atoi(val);
+		} else if (strcmp(tok, "txe") == 0) {
+			if (sscanf(val, "%u/%u/%u", &c->txe_rate, &c->txe_pkts,
+				   &c->txe_intvl) != 3 || c->txe_rate > 100)
+				goto invalid;
+		} else {
+			goto invalid;
+		}
+	}
+
+	if (!has_rssi && c->txe_rate == 0)
+		goto invalid;
+
+	/* rssi=0 would disable RSSI monitoring */
+	if (has_rssi && c->rssi >= 0)
+		goto invalid;
+
+	nconfs++;
+
+	return 0;
+
+invalid:
+	errno = EINVAL;
+	return -1;
+}
+
+static struct cqm_conf * cqm_lookup(int ifindex)
+{
+	char ifname[IFNAMSIZ];
+	int i;
+
+	if (if_indextoname(ifindex, ifname) == NULL)
+		return NULL;
+
+	for (i=0; i<nconfs; i++) {
+		if (strcmp(confs[i].ifname, ifname) == 0)
+			return &confs[i];
+	}
+
+	return NULL;
+}
+
+/**
+ * @short Send NL80211_CMD_SET_CQM with RSSI thresholds or TX error
+ * reporting, and wait for the answer
+ *
+ * The kernel takes one of the two per request, RSSI first, so they
+ * always travel apart.
+ *
+ * @param thold thresholds in ascending order, one or two, NULL for TXE
+ * @return 0 on success, a negative libnl error otherwise
+ */
+static int cqm_set(int ifindex, const struct cqm_conf *c, const int32_t *thold,
+		   int n)
+{
+	struct nl_msg *msg;
+	struct nlattr *nest;
+	int err = -NLE_NOMEM;
+
+	if (cqm_sock == NULL)
+		return -NLE_BAD_SOCK;
+
+	if ( (msg = nlmsg_alloc()) == NULL )
+		return err;
+
+	if (genlmsg_put(msg, NL_AUTO_PORT, NL_AUTO_SEQ, nl80211_id, 0, 0,
+			NL80211_CMD_SET_CQM, 0) == NULL
+	    || nla_put_u32(msg, NL80211_ATTR_IFINDEX, ifindex) < 0
+	    || (nest = nla_nest_start(msg, NL80211_ATTR_CQM)) == NULL)
+		goto out;
+
+	if (thold) {
+		if (nla_put(msg, NL80211_ATTR_CQM_RSSI_THOLD, n * sizeof(*thold),
+			    thold) < 0
+		    || nla_put_u32(msg, NL80211_ATTR_CQM_RSSI_HYST, c->hyst) < 0)
+			goto out;
+	} else {
+		if (nla_put_u32(msg, NL80211_ATTR_CQM_TXE_RATE, c->txe_rate) < 0
+		    || nla_put_u32(msg, NL80211_ATTR_CQM_TXE_PKTS, c->txe_pkts) < 0
+		    || nla_put_u32(msg, NL80211_ATTR_CQM_TXE_INTVL, c->txe_intvl) < 0)
+			goto out;
+	}
+
+	nla_nest_end(msg, nest);
+
+	if ( (err = nl_send_auto_complete(cqm_sock, msg)) >= 0 )
+		err = nl_wait_for_ack(cqm_sock);
+
+out:
+	nlmsg_free(msg);
+
+	return err;
+}
+
+/* has_level: a NOTIFY_CQM moved the level, only the RSSI window follows */
+static void cqm_arm(int ifindex, struct cqm_conf *c, int level, int has_level)
+{
+	int32_t thold[2];
+	int err;
+
+	/* Move the window around the level the driver just reported */
+	if (has_level && c->step && !c->single) {
+		thold[0] = level - c->step;
+		thold[1] = level + c->step;
+		if ( (err = cqm_set(ifindex, c, thold, 2)) >= 0 )
+			return;
+
+		tprintf("CQM on %s: no threshold lists (%s), keeping %d dBm\n",
+			c->ifname, nl_geterror(err), c->rssi);
+		c->single = 1;
+	}
+
+	thold[0] = c->rssi;
+	if ((c->rssi || has_level)
+	    && (err = cqm_set(ifindex, c, thold, 1)) < 0)
+		tprintf("CQM on %s: %s\n", c->ifname, nl_geterror(err));
+
+	if (!has_level && c->txe_rate
+	    && (err = cqm_set(ifindex, c, NULL, 0)) < 0)
+		tprintf("CQM TX errors on %s: %s\n", c->ifname, nl_geterror(err));
+}
+
+void cqm_event(int cmd, struct nlattr *tb[])
+{
+	struct nlattr *cqm[NL80211_ATTR_CQM_MAX + 1];
+	struct cqm_conf *c;
+	int ifindex;
+
+	if (tb[NL80211_ATTR_IFINDEX] == NULL)
+		return;
+
+	ifindex = nla_get_u32(tb[NL80211_ATTR_IFINDEX]);
+
+	switch (cmd) {
+	case NL80211_CMD_CONNECT:
+	case NL80211_CMD_ROAM:
+		if ( (c = cqm_lookup(ifindex)) != NULL )
+			cqm_arm(ifindex, c, 0, 0);
+		break;
+	case NL80211_CMD_NOTIFY_CQM:
+		if (tb[NL80211_ATTR_CQM] == NULL
+		    || nla_parse_nested(cqm, NL80211_ATTR_CQM_MAX,
+					tb[NL80211_ATTR_CQM], NULL) < 0
+		    || cqm[NL80211_ATTR_CQM_RSSI_LEVEL] == NULL)
+			break;
+		if ( (c = cqm_lookup(ifindex)) != NULL && c->step && !c->single )
+			cqm_arm(ifindex, c,
+				(int32_t) nla_get_u32(cqm[NL80211_ATTR_CQM_RSSI_LEVEL]), 1);
+		break;
+	}
+}
+
+int cqm_format(char *buf, size_t size, struct nlattr *attr, struct nlattr *mac)
+{
+	struct nlattr *cqm[NL80211_ATTR_CQM_MAX + 1];
+	char mac_str[18] = "";
+	int len = 0;
+
+	buf[0] = '\0';
+
+	if (attr == NULL || nla_parse_nested(cqm, NL80211_ATTR_CQM_MAX, attr, NULL) < 0)
+		return 0;
+
+	if (mac)
+		fmt_mac(mac_str, nla_data(mac));
+
+	if (cqm[NL80211_ATTR_CQM_RSSI_THRESHOLD_EVENT]) {
+		switch (nla_get_u32(cqm[NL80211_ATTR_CQM_RSSI_THRESHOLD_EVENT])) {
+		case NL80211_CQM_RSSI_THRESHOLD_EVENT_LOW:
+			len = strappend(buf, size, len, "signal low");
+			break;
+		case NL80211_CQM_RSSI_THRESHOLD_EVENT_HIGH:
+			len = strappend(buf, size, len, "signal high");
+			break;
+		case NL80211_CQM_RSSI_BEACON_LOSS_EVENT:
+			len = strappend(buf, size, len, "beacon loss");
+			break;
+		}
+		if (cqm[NL80211_ATTR_CQM_RSSI_LEVEL])
+			len = strappend(buf, size, len, " at %d dBm",
+					(int32_t) nla_get_u32(cqm[NL80211_ATTR_CQM_RSSI_LEVEL]));
+	} else if (cqm[NL80211_ATTR_CQM_BEACON_LOSS_EVENT]) {
+		len = strappend(buf, size, len, "beacon loss");
+	} else if (cqm[NL80211_ATTR_CQM_PKT_LOSS_EVENT]) {
+		len = strappend(buf, size, len, "%u packets lost to %s",
+				nla_get_u32(cqm[NL80211_ATTR_CQM_PKT_LOSS_EVENT]),
+				mac_str);
+	} else if (cqm[NL80211_ATTR_CQM_TXE_RATE]) {
+		len = strappend(buf, size, len, "tx failures to %s: %u%%",
+				mac_str, nla_get_u32(cqm[NL80211_ATTR_CQM_TXE_RATE]));
+		if (cqm[NL80211_ATTR_CQM_TXE_PKTS] && cqm[NL80211_ATTR_CQM_TXE_INTVL])
+			len = strappend(buf, size, len, " of %u packets in %us",
+					nla_get_u32(cqm[NL80211_ATTR_CQM_TXE_PKTS]),
+					nla_get_u32(cqm[NL80211_ATTR_CQM_TXE_INTVL]));
+	}
+
+	return len;
+}
+
+/* The family is known, from the loop or right from cqm_init() */
+static void cqm_ready(int family)
+{
+	unsigned int ifindex;
+	int i;
+
+	if ( (cqm_sock = nl80211_cmd_socket(&nl80211_id)) == NULL ) {
+		tprintf("CQM: %s\n", strerror(errno));
+		return;
+	}
+
+	/* Interfaces that are not there yet are armed when they connect */
+	for (i=0; i<nconfs; i++) {
+		if ( (ifindex = if_nametoindex(confs[i].ifname)) != 0 )
+			cqm_arm(ifindex, &confs[i], 0, 0);
+	}
+}
+
+int cqm_init(void)
+{
+	return nl80211_when_ready(cqm_ready);
+}
@@ -0,0 +1,734 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+
+#include <linux/neighbour.h>
+
+#include <netevent/ctl.h>
+#include <netevent/state.h>
+#include <netevent/rtnl.h>
+#include <netevent/hash.h>
+#include <netevent/loop.h>
+#include <netevent/fmt.h>
+
+#define CTL_RELOAD	-1
+
+struct ctl_query
+{
+	int type;		/* NETEVENT_*, or CTL_RELOAD */
+	int ifindex;		/* 0 for any */
+	int family;		/* of addr, 0 when there is none */
+	unsigned char addr[16];
+	int plen;
+	int within;		/* addr/plen contains, rather than equals */
+	int has_table;
+	uint32_t table;
+	int refresh;		/* queue a dump of the type */
+};
+
+/* Written to the client every CTL_CHUNK bytes */
+struct ctl_buf
+{
+	int fd;
+	size_t len;
+	int count;
+	int err;
+	char p[CTL_CHUNK];
+};
+
+/*
+ * An entry of the copy the control thread answers from. The loop thread
+ * allocates one for every change of the state and pushes it on changes,
+ * the control thread moves them into its table, so neither ever waits
+ * on the other.
+ */
+struct ctl_entry
+{
+	struct hnode node;
+	struct ctl_entry *change;	/* next older change */
+	struct state_key key;
+	int removed;
+	uint32_t len;			/* of msg, 0 for stations */
+	unsigned char msg[];
+};
+
+struct ctl_walk
+{
+	const struct ctl_query *q;
+	struct ctl_buf *b;
+};
+
+static const struct {
+	const char *prefix;
+	int type;
+} ctl_types[] = {
+	{ "link", NETEVENT_LINK },
+	{ "interface", NETEVENT_LINK },
+	{ "addr", NETEVENT_ADDR },
+	{ "route", NETEVENT_ROUTE },
+	{ "neigh", NETEVENT_NEIGH },
+	{ "station", NETEVENT_WIRELESS },
+	{ "reload", CTL_RELOAD },
+};
+
+static const char *nud_names[] = {
+	"INCOMPLETE", "REACHABLE", "STALE", "DELAY",
+	"PROBE", "FAILED", "NOARP", "PERMANENT",
+};
+
+static int ctl_fd = -1;
+static int req_efd = -1, resp_efd = -1;
+static const char *ctl_path;
+static ctl_reload_t ctl_reload;
+static pthread_t ctl_thread;
+
+/* Owned by the control thread, filled from changes */
+static struct htable copy;
+static struct ctl_entry *changes;
+
+/* Asked of the loop thread through req_efd, answered on resp_efd */
+static int refresh_type = -1;
+static struct rtnl_filter refresh_filter;
+static int refresh_ok;
+static int reload_pending;
+static int reload_ok;
+
+static int copy_cmp(const struct hnode *n, const void *key)
+{
+	const struct ctl_entry *e = hnode_entry(n, struct ctl_entry, node);
+
+	return memcmp(&e->key, key, sizeof(e->key));
+}
+
+static struct ctl_entry * copy_find(const struct state_key *key)
+{
+	struct hnode *n;
+
+	n = htable_find(&copy, hash_bytes(key, sizeof(*key), 0), key);
+
+	return n ? hnode_entry(n, struct ctl_entry, node) : NULL;
+}
+
+/* e replaces the entry of its key, or removes it */
+static void copy_put(struct ctl_entry *e)
+{
+	struct ctl_entry *old;
+
+	if ( (old = copy_find(&e->key)) != NULL ) {
+		htable_remove(&copy, &old->node);
+		free(old);
+	}
+
+	if (e->removed)
+		free(e);
+	else
+		htable_insert(&copy, &e->node, hash_bytes(&e->key, sizeof(e->key), 0));
+}
+
+static struct ctl_entry * entry_new(const struct state_key *key,
+				    const struct nlmsghdr *nlh, int removed)
+{
+	uint32_t len = (nlh && !removed) ? nlh->nlmsg_len : 0;
+	struct ctl_entry *e;
+
+	if ( (e = malloc(sizeof(*e) + len)) == NULL )
+		return NULL;
+
+	e->key = *key;
+	e->removed = removed;
+	e->len = len;
+	if (len)
+		memcpy(e->msg, nlh, len);
+
+	return e;
+}
+
+/* Loop thread, see state_watch(). A change lost to ENOMEM stays lost
+ * until the entry changes again. */
+static void ctl_watch(const struct state_key *key, const struct nlmsghdr *nlh,
+		      int removed, void *data)
+{
+	struct ctl_entry *e;
+
+	if ( (e = entry_new(key, nlh, removed)) == NULL )
+		return;
+
+	e->change = __atomic_load_n(&changes, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&changes, &e->change, e, 1,
+					    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+}
+
+/* Control thread, apply the changes in the order they were made */
+static void copy_update(void)
+{
+	struct ctl_entry *e, *next, *older = NULL;
+
+	e = __atomic_exchange_n(&changes, NULL, __ATOMIC_ACQUIRE);
+
+	for (; e; e = next) {
+		next = e->change;
+		e->change = older;
+		older = e;
+	}
+
+	for (e = older; e; e = next) {
+		next = e->change;
+		copy_put(e);
+	}
+}
+
+/* Main thread, before the control thread runs */
+static void copy_fill(const struct state_key *key, const struct nlmsghdr *nlh,
+		      void *data)
+{
+	struct ctl_entry *e;
+
+	if ( (e = entry_new(key, nlh, 0)) != NULL )
+		copy_put(e);
+}
+
+static void buf_flush(struct ctl_buf *b)
+{
+	size_t off;
+	ssize_t ret;
+
+	for (off = 0; off < b->len && !b->err; off += ret) {
+		if ( (ret = write(b->fd, b->p + off, b->len - off)) <= 0 ) {
+			b->err = ret ? errno : EPIPE;
+			break;
+		}
+	}
+
+	b->len = 0;
+}
+
+static char * buf_reserve(struct ctl_buf *b, size_t n)
+{
+	if (b->len + n > sizeof(b->p))
+		buf_flush(b);
+
+	return b->err ? NULL : b->p + b->len;
+}
+
+/* JSON string of at most IFNAMSIZ bytes */
+static char * json_name(char *p, const char *s)
+{
+	*p++ = '"';
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			*p++ = '\\';
+		*p++ = (unsigned char) *s < 0x20 ? '?' : *s;
+	}
+	*p++ = '"';
+
+	return p;
+}
+
+static char * json_key(char *p, const char *key)
+{
+	*p++ = ',';
+	*p++ = '"';
+	p = fmt_str(p, key);
+	*p++ = '"';
+	*p++ = ':';
+
+	return p;
+}
+
+/* Named from the copy, the name cache of fmt belongs to the loop */
+static char * json_dev(char *p, int ifindex)
+{
+	char name[IFNAMSIZ + 8];
+	struct state_key key;
+	struct ctl_entry *e;
+	struct netevent ev;
+
+	memset(&key, 0, sizeof(key));
+	key.type = NETEVENT_LINK;
+	key.id = htonl(ifindex);
+
+	if ( (e = copy_find(&key)) != NULL && e->len
+	     && netevent_decode((struct nlmsghdr *) e->msg, &ev) == 0 )
+		strcpy(name, ev.u.link.ifname);
+	else if (if_indextoname(ifindex, name) == NULL)
+		*fmt_uint(fmt_str(name, "if"), ifindex) = '\0';
+
+	p = fmt_str(p, ",\"dev\":");
+
+	return json_name(p, name);
+}
+
+static int prefix_match(const unsigned char *a, const unsigned char *prefix,
+			int plen)
+{
+	int bytes = plen / 8, bits = plen % 8;
+
+	if (memcmp(a, prefix, bytes) != 0)
+		return 0;
+
+	return bits == 0
+		|| ((a[bytes] ^ prefix[bytes]) & (0xff << (8 - bits))) == 0;
+}
+
+/* Whether addr/plen of an entry is selected by q */
+static int addr_match(const struct ctl_query *q, int family,
+		      const unsigned char *addr, int plen)
+{
+	if (q->family == 0)
+		return 1;
+
+	if (family != q->family)
+		return 0;
+
+	if (q->within)
+		return plen >= q->plen && prefix_match(addr, q->addr, q->plen);
+
+	return memcmp(addr, q->addr, 16) == 0 && (q->plen < 0 || plen == q->plen);
+}
+
+static void ctl_emit(const struct state_key *key, const struct nlmsghdr *nlh,
+		     void *data)
+{
+	struct ctl_walk *w = data;
+	const struct ctl_query *q = w->q;
+	struct netevent ev;
+	int ifindex, i;
+	char *p;
+
+	if (nlh) {
+		if (netevent_decode(nlh, &ev) == -1)
+			return;
+		ifindex = ev.ifindex;
+	} else {
+		ifindex = ntohl(key->id);
+	}
+
+	if (q->ifindex && q->ifindex != ifindex)
+		return;
+
+	if ( (p = buf_reserve(w->b, 512)) == NULL )
+		return;
+
+	*p++ = w->b->count++ ? ',' : '[';
+
+	switch (key->type) {
+	case NETEVENT_LINK:
+		p = fmt_str(p, "{\"ifindex\":");
+		p = fmt_uint(p, ifindex);
+		p = fmt_str(p, ",\"ifname\":");
+		p = json_name(p, ev.u.link.ifname);
+		p = fmt_str(p, (ev.u.link.flags & IFF_UP) ? ",\"up\":true" : ",\"up\":false");
+		p = fmt_str(p, ",\"mtu\":");
+		p = fmt_uint(p, ev.u.link.mtu);
+		if (ev.u.link.lladdr_len == 6) {
+			p = fmt_str(p, ",\"lladdr\":\"");
+			p = fmt_mac(p, ev.u.link.lladdr);
+			*p++ = '"';
+		}
+		break;
+
+	case NETEVENT_ADDR:
+		if (!addr_match(q, ev.family, ev.u.addr.addr, ev.u.addr.prefixlen))
+			goto skip;
+		p = fmt_str(p, "{\"addr\":\"");
+		p = fmt_inet(p, ev.family, ev.u.addr.addr);
+		p = fmt_str(p, "\",\"prefixlen\":");
+		p = fmt_uint(p, ev.u.addr.prefixlen);
+		p = json_dev(p, ifindex);
+		break;
+
+	case NETEVENT_ROUTE:
+		if ((q->has_table && ev.u.route.table != q->table)
+		    || !addr_match(q, ev.family, ev.u.route.dst, ev.u.route.dst_len))
+			goto skip;
+		p = fmt_str(p, "{\"dst\":\"");
+		p = fmt_inet(p, ev.family, ev.u.route.dst);
+		*p++ = '/';
+		p = fmt_uint(p, ev.u.route.dst_len);
+		p = fmt_str(p, "\",\"table\":");
+		p = fmt_uint(p, ev.u.route.table);
+		p = fmt_str(p, ",\"metric\":");
+		p = fmt_uint(p, ev.u.route.priority);
+		if (ev.u.route.has_gw) {
+			p = json_key(p, "gateway");
+			*p++ = '"';
+			p = fmt_inet(p, ev.family, ev.u.route.gw);
+			*p++ = '"';
+		}
+		if (ev.u.route.oif)
+			p = json_dev(p, ev.u.route.oif);
+		break;
+
+	case NETEVENT_NEIGH:
+		if (!addr_match(q, ev.family, ev.u.neigh.addr,
+				ev.family == AF_INET ? 32 : 128))
+			goto skip;
+		p = fmt_str(p, "{\"addr\":\"");
+		if (ev.family == AF_INET || ev.family == AF_INET6)
+			p = fmt_inet(p, ev.family, ev.u.neigh.addr);
+		*p++ = '"';
+		if (ev.u.neigh.lladdr_len == 6) {
+			p = fmt_str(p, ",\"lladdr\":\"");
+			p = fmt_mac(p, ev.u.neigh.lladdr);
+			*p++ = '"';
+		}
+		p = fmt_str(p, ",\"state\":\"");
+		for (i=0; i<8 && !(ev.u.neigh.state & (1 << i)); i++)
+			;;
+		p = fmt_str(p, i < 8 ? nud_names[i] : "NONE");
+		*p++ = '"';
+		p = json_dev(p, ifindex);
+		break;
+
+	case NETEVENT_WIRELESS:
+		p = fmt_str(p, "{\"mac\":\"");
+		p = fmt_mac(p, key->addr);
+		*p++ = '"';
+		p = json_dev(p, ifindex);
+		break;
+	}
+
+	*p++ = '}';
+	w->b->len = p - w->b->p;
+	return;
+
+skip:
+	w->b->count--;
+}
+
+static void ctl_reply(struct ctl_buf *b, const char *s)
+{
+	char *p;
+
+	if ( (p = buf_reserve(b, strlen(s))) != NULL ) {
+		memcpy(p, s, strlen(s));
+		b->len += strlen(s);
+	}
+}
+
+/* Control thread, from the copy */
+static void ctl_answer(const struct ctl_query *q, struct ctl_buf *b)
+{
+	struct ctl_walk w = { q, b };
+	struct state_key key;
+	struct ctl_entry *e;
+	struct hnode *n;
+	uint64_t one = 1;
+	unsigned int i;
+	char *p;
+
+	b->len = 0;
+	b->count = 0;
+	b->err = 0;
+
+	if (q->type == CTL_RELOAD) {
+		__atomic_store_n(&reload_pending, 1, __ATOMIC_RELEASE);
+		write(req_efd, &one, sizeof(one));
+		read(resp_efd, &one, sizeof(one));
+
+		ctl_reply(b, __atomic_load_n(&reload_ok, __ATOMIC_ACQUIRE) ?
+			  "{\"reloaded\":true}\n" : "{\"error\":\"reload failed\"}\n");
+		buf_flush(b);
+		return;
+	}
+
+	/* The loop dumps the slice, its changes are queued before the reply */
+	if (q->refresh && q->type != NETEVENT_WIRELESS) {
+		memset(&refresh_filter, 0, sizeof(refresh_filter));
+		refresh_filter.ifindex = q->ifindex;
+
+		if (q->type != NETEVENT_LINK)
+			refresh_filter.family = q->family;
+		if (q->type == NETEVENT_ROUTE && q->has_table)
+			refresh_filter.table = q->table;
+
+		__atomic_store_n(&refresh_type, q->type, __ATOMIC_RELEASE);
+		write(req_efd, &one, sizeof(one));
+		read(resp_efd, &one, sizeof(one));
+
+		if (!__atomic_load_n(&refresh_ok, __ATOMIC_ACQUIRE)) {
+			ctl_reply(b, "{\"error\":\"refresh failed\"}\n");
+			buf_flush(b);
+			return;
+		}
+	}
+
+	copy_update();
+
+	/* A neighbor on a known interface is a single lookup */
+	if (q->type == NETEVENT_NEIGH && q->ifindex && q->family && !q->within) {
+		memset(&key, 0, sizeof(key));
+		key.type = NETEVENT_NEIGH;
+		key.family = q->family;
+		key.id = htonl(q->ifindex);
+		memcpy(key.addr, q->addr, 16);
+
+		if ( (e = copy_find(&key)) != NULL && e->len )
+			ctl_emit(&e->key, (struct nlmsghdr *) e->msg, &w);
+	} else {
+		htable_for_each(&copy, i, n) {
+			e = hnode_entry(n, struct ctl_entry, node);
+			if (e->key.type == q->type)
+				ctl_emit(&e->key, e->len ? (struct nlmsghdr *) e->msg
+						: NULL, &w);
+			if (b->err)
+				return;
+		}
+	}
+
+	if ( (p = buf_reserve(b, 3)) != NULL ) {
+		if (b->count == 0)
+			*p++ = '[';
+		*p++ = ']';
+		*p++ = '\n';
+		b->len = p - b->p;
+	}
+	buf_flush(b);
+}
+
+/* Loop thread, what the control thread asked for */
+static int ctl_ready(void *data, int fd)
+{
+	uint64_t n = 1;
+	int type;
+
+	if (read(fd, &n, sizeof(n)) != sizeof(n))
+		return 0;
+
+	if ( (type = __atomic_exchange_n(&refresh_type, -1, __ATOMIC_ACQUIRE)) != -1 ) {
+		__atomic_store_n(&refresh_ok,
+				 state_resync(type, &refresh_filter) == 0,
+				 __ATOMIC_RELEASE);
+		write(resp_efd, &n, sizeof(n));
+	}
+
+	if (__atomic_exchange_n(&reload_pending, 0, __ATOMIC_ACQUIRE)) {
+		__atomic_store_n(&reload_ok, ctl_reload && ctl_reload() == 0,
+				 __ATOMIC_RELEASE);
+		write(resp_efd, &n, sizeof(n));
+	}
+
+	return 0;
+}
+
+static int parse_addr(char *s, struct ctl_query *q)
+{
+	char *slash = strchr(s, '/');
+
+	q->plen = -1;
+
+	if (slash) {
+		*slash = '\0';
+		q->plen = atoi(slash + 1);
+	}
+
+	memset(q->addr, 0, sizeof(q->addr));
+
+	if (inet_pton(AF_INET, s, q->addr) == 1)
+		q->family = AF_INET;
+	else if (inet_pton(AF_INET6, s, q->addr) == 1)
+		q->family = AF_INET6;
+	else
+		return -1;
+
+	if (q->plen > (q->family == AF_INET ? 32 : 128))
+		return -1;
+
+	return 0;
+}
+
+static const char * parse_query(char *line, struct ctl_query *q)
+{
+	char *tok, *save;
+	unsigned int i;
+
+	memset(q, 0, sizeof(*q));
+	q->plen = -1;
+
+	if ( (tok = strtok_r(line, " \t\r\n", &save)) == NULL )
+		return "empty request";
+
+	for (i=0; i<sizeof(ctl_types)/sizeof(ctl_types[0]); i++) {
+		if (strncmp(tok, ctl_types[i].prefix, strlen(ctl_types[i].prefix)) == 0)
+			break;
+	}
+
+	if (i == sizeof(ctl_types)/sizeof(ctl_types[0]))
+		return "unknown request";
+	q->type = ctl_types[i].type;
+
+	while ( (tok = strtok_r(NULL, " \t\r\n", &save)) != NULL ) {
+		if (strcmp(tok, "in") == 0) {
+			continue;
+		} else if (strcmp(tok, "on") == 0 || strcmp(tok, "dev") == 0) {
+			if ( (tok = strtok_r(NULL, " \t\r\n", &save)) == NULL
+			     || (q->ifindex = if_nametoindex(tok)) == 0 )
+				return "unknown interface";
+		} else if (strcmp(tok, "table") == 0) {
+			if ( (tok = strtok_r(NULL, " \t\r\n", &save)) == NULL )
+				return "table needs a number";
+			q->table = strtoul(tok, NULL, 10);
+			q->has_table = 1;
+		} else if (strcmp(tok, "refresh") == 0) {
+			q->refresh = 1;
+		} else if (strcmp(tok, "within") == 0) {
+			if ( (tok = strtok_r(NULL, " \t\r\n", &save)) == NULL
+			     || parse_addr(tok, q) == -1 )
+				return "within needs a prefix";
+			if (q->plen < 0)
+				q->plen = (q->family == AF_INET) ? 32 : 128;
+			q->within = 1;
+		} else if (parse_addr(tok, q) == -1) {
+			return "invalid selector";
+		}
+	}
+
+	return NULL;
+}
+
+static void ctl_client(int fd, struct ctl_buf *b)
+{
+	struct timeval tv = { CTL_TIMEOUT, 0 };
+	char req[CTL_REQUEST_MAX], msg[CTL_REQUEST_MAX];
+	struct ctl_query q;
+	const char *err;
+	size_t len = 0;
+	ssize_t ret;
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	while (len < sizeof(req) - 1
+	       && (ret = read(fd, req + len, sizeof(req) - 1 - len)) > 0) {
+		len += ret;
+		if (memchr(req + len - ret, '\n', ret))
+			break;
+	}
+	req[len] = '\0';
+
+	if ( (err = parse_query(req, &q)) != NULL ) {
+		len = snprintf(msg, sizeof(msg), "{\"error\":\"%s\"}\n", err);
+		write(fd, msg, len);
+		return;
+	}
+
+	b->fd = fd;
+	ctl_answer(&q, b);
+}
+
+static void * ctl_main(void *arg)
+{
+	static struct ctl_buf b;
+	struct pollfd pfd = { ctl_fd, POLLIN, 0 };
+	int fd;
+
+	for (;;) {
+		/* Changes pile up between queries, take them in regularly */
+		if (poll(&pfd, 1, CTL_UPDATE_MS) <= 0) {
+			copy_update();
+			continue;
+		}
+
+		if ( (fd = accept4(ctl_fd, NULL, NULL, SOCK_CLOEXEC)) == -1 ) {
+			if (errno == EMFILE || errno == ENFILE)
+				sleep(1);
+			continue;
+		}
+
+		ctl_client(fd, &b);
+		close(fd);
+	}
+
+	return NULL;
+}
+
+int ctl_init(const char *path, ctl_reload_t reload)
+{
+	struct sockaddr_un sun;
+	sigset_t all, old;
+	int err, type;
+
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	ctl_path = path;
+	ctl_reload = reload;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strcpy(sun.sun_path, path);
+
+	if ( (ctl_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1 )
+		return -1;
+
+	unlink(path);
+
+	if (bind(ctl_fd, (struct sockaddr *) &sun, sizeof(sun)) == -1
+	    || listen(ctl_fd, 16) == -1)
+		return -1;
+
+	if ( (req_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1
+	     || (resp_efd = eventfd(0, EFD_CLOEXEC)) == -1
+	     || loop_add_fd(req_efd, ctl_ready, NULL) == -1 )
+		return -1;
+
+	if (htable_init(&copy, 1024, copy_cmp) == -1)
+		return -1;
+
+	for (type = NETEVENT_LINK; type <= NETEVENT_WIRELESS; type++)
+		state_foreach(type, copy_fill, NULL);
+	state_watch(ctl_watch, NULL);
+
+	/* Signals are for the loop thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	err = pthread_create(&ctl_thread, NULL, ctl_main, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (err) {
+		errno = err;
+		return -1;
+	}
+
+	pthread_setname_np(ctl_thread, "ctl");
+
+	return 0;
+}
+
+void ctl_close(void)
+{
+	if (ctl_path)
+		unlink(ctl_path);
+}
@@ -0,0 +1,427 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#include <netevent/ctx.h>
+#include <netevent/rtnl.h>
+#include <netevent/nl80211.h>
+
+#include <linux/nl80211.h>
+
+struct netevent_ctx
+{
+	int epfd;
+	int rtfd;
+	struct nl_sock *genl;
+	int genl_fd;
+	int genl_family;
+	netevent_cb_t cb[NETEVENT_TYPES];
+	void *data[NETEVENT_TYPES];
+	unsigned char buf[NL80211_RCVBUF];
+};
+
+/* rtnetlink groups behind each type, 0 terminated */
+static const int type_groups[NETEVENT_WIRELESS][3] = {
+	[NETEVENT_LINK] = { RTNLGRP_LINK },
+	[NETEVENT_ADDR] = { RTNLGRP_IPV4_IFADDR, RTNLGRP_IPV6_IFADDR },
+	[NETEVENT_ROUTE] = { RTNLGRP_IPV4_ROUTE, RTNLGRP_IPV6_ROUTE },
+	[NETEVENT_NEIGH] = { RTNLGRP_NEIGH },
+};
+
+static int ctx_watch(struct netevent_ctx *ctx, int fd)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+
+	return epoll_ctl(ctx->epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+struct netevent_ctx * netevent_ctx_new(void)
+{
+	struct netevent_ctx *ctx;
+
+	if ( (ctx = calloc(1, sizeof(*ctx))) == NULL )
+		return NULL;
+
+	ctx->rtfd = -1;
+	ctx->genl_fd = -1;
+
+	if ( (ctx->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1 )
+		goto fail;
+
+	if ( (ctx->rtfd = setup_rtsocket(0)) == -1 )
+		goto fail;
+
+	if (ctx_watch(ctx, ctx->rtfd) == -1)
+		goto fail;
+
+	return ctx;
+
+fail:
+	netevent_ctx_free(ctx);
+	return NULL;
+}
+
+void netevent_ctx_free(struct netevent_ctx *ctx)
+{
+	int err = errno;
+
+	if (ctx == NULL)
+		return;
+
+	if (ctx->genl)
+		nl_socket_free(ctx->genl);
+	if (ctx->rtfd != -1)
+		close(ctx->rtfd);
+	if (ctx->epfd != -1)
+		close(ctx->epfd);
+
+	free(ctx);
+	errno = err;
+}
+
+int netevent_ctx_fd(struct netevent_ctx *ctx)
+{
+	return ctx->epfd;
+}
+
+static int ctx_wireless_open(struct netevent_ctx *ctx)
+{
+	struct nl_sock *sk;
+	int id;
+
+	if ( (sk = nl_socket_alloc()) == NULL ) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	if (genl_connect(sk) < 0) {
+		errno = ECONNREFUSED;
+		goto fail;
+	}
+
+	if ( (id = genl_ctrl_resolve(sk, "nl80211")) < 0 ) {
+		errno = ENOENT;
+		goto fail;
+	}
+
+	nl80211_register_multicast_groups(sk, id);
+
+	ctx->genl = sk;
+	ctx->genl_family = id;
+	ctx->genl_fd = nl_socket_get_fd(sk);
+
+	return ctx_watch(ctx, ctx->genl_fd);
+
+fail:
+	nl_socket_free(sk);
+	return -1;
+}
+
+/* Closing the socket leaves the nl80211 groups */
+static void ctx_wireless_close(struct netevent_ctx *ctx)
+{
+	epoll_ctl(ctx->epfd, EPOLL_CTL_DEL, ctx->genl_fd, NULL);
+	nl_socket_free(ctx->genl);
+	ctx->genl = NULL;
+	ctx->genl_fd = -1;
+}
+
+int netevent_on(struct netevent_ctx *ctx, int type, netevent_cb_t cb,
+		void *data)
+{
+	const int *group;
+	int opt;
+
+	if (type < 0 || type >= NETEVENT_TYPES) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (type == NETEVENT_WIRELESS && cb && ctx->genl == NULL
+	    && ctx_wireless_open(ctx) == -1)
+		return -1;
+
+	if (type == NETEVENT_WIRELESS && !cb && ctx->genl)
+		ctx_wireless_close(ctx);
+
+	if (type < NETEVENT_WIRELESS && !ctx->cb[type] != !cb) {
+		opt = cb ? NETLINK_ADD_MEMBERSHIP : NETLINK_DROP_MEMBERSHIP;
+
+		for (group = type_groups[type]; *group; group++) {
+			if (setsockopt(ctx->rtfd, SOL_NETLINK, opt, group,
+				       sizeof(*group)) == -1)
+				return -1;
+		}
+	}
+
+	ctx->cb[type] = cb;
+	ctx->data[type] = data;
+
+	return 0;
+}
+
+static void ctx_emit(struct netevent_ctx *ctx, struct netevent *ev)
+{
+	if (ctx->cb[ev->type])
+		ctx->cb[ev->type](ctx, ev, ctx->data[ev->type]);
+}
+
+static int rta_copy(void *to, size_t size, struct rtattr *rta)
+{
+	size_t len = RTA_PAYLOAD(rta);
+
+	if (len > size)
+		len = size;
+	memcpy(to, RTA_DATA(rta), len);
+
+	return len;
+}
+
+static void decode_link(struct netevent *ev, struct nlmsghdr *nlh)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+	struct rtattr *tb[IFLA_MAX + 1];
+
+	parse_rt_attrs(tb, IFLA_MAX + 1, IFLA_RTA(ifi), IFLA_PAYLOAD(nlh));
+
+	ev->type = NETEVENT_LINK;
+	ev->ifindex = ifi->ifi_index;
+	ev->family = ifi->ifi_family;
+	ev->u.link.flags = ifi->ifi_flags;
+	ev->u.link.change = ifi->ifi_change;
+
+	if (tb[IFLA_IFNAME])
+		rta_copy(ev->u.link.ifname, IFNAMSIZ - 1, tb[IFLA_IFNAME]);
+	if (tb[IFLA_MTU])
+		rta_copy(&ev->u.link.mtu, sizeof(ev->u.link.mtu), tb[IFLA_MTU]);
+	if (tb[IFLA_ADDRESS])
+		ev->u.link.lladdr_len = rta_copy(ev->u.link.lladdr,
+				NETEVENT_LLADDR_LEN, tb[IFLA_ADDRESS]);
+}
+
+static void decode_addr(struct netevent *ev, struct nlmsghdr *nlh)
+{
+	struct ifaddrmsg *ifa = NLMSG_DATA(nlh);
+	struct rtattr *tb[IFA_MAX + 1];
+
+	parse_rt_attrs(tb, IFA_MAX + 1, IFA_RTA(ifa), IFA_PAYLOAD(nlh));
+
+	ev->type = NETEVENT_ADDR;
+	ev->ifindex = ifa->ifa_index;
+	ev->family = ifa->ifa_family;
+	ev->u.addr.prefixlen = ifa->ifa_prefixlen;
+
+	/* IFA_ADDRESS is the peer on point-to-point links */
+	if (tb[IFA_LOCAL])
+		rta_copy(ev->u.addr.addr, 16, tb[IFA_LOCAL]);
+	else if (tb[IFA_ADDRESS])
+		rta_copy(ev->u.addr.addr, 16, tb[IFA_ADDRESS]);
+}
+
+static void decode_route(struct netevent *ev, struct nlmsghdr *nlh)
+{
+	struct rtmsg *rtm = NLMSG_DATA(nlh);
+	struct rtattr *tb[RTA_MAX + 1];
+
+	parse_rt_attrs(tb, RTA_MAX + 1, RTM_RTA(rtm), RTM_PAYLOAD(nlh));
+
+	ev->type = NETEVENT_ROUTE;
+	ev->family = rtm->rtm_family;
+	ev->u.route.dst_len = rtm->rtm_dst_len;
+	ev->u.route.table = rtm->rtm_table;
+
+	if (tb[RTA_TABLE])
+		rta_copy(&ev->u.route.table, 4, tb[RTA_TABLE]);
+	if (tb[RTA_DST])
+		rta_copy(ev->u.route.dst, 16, tb[RTA_DST]);
+	if (tb[RTA_GATEWAY]) {
+		rta_copy(ev->u.route.gw, 16, tb[RTA_GATEWAY]);
+		ev->u.route.has_gw = 1;
+	}
+	if (tb[RTA_OIF]) {
+		rta_copy(&ev->u.route.oif, 4, tb[RTA_OIF]);
+		ev->ifindex = ev->u.route.oif;
+	}
+	if (tb[RTA_PRIORITY])
+		rta_copy(&ev->u.route.priority, 4, tb[RTA_PRIORITY]);
+}
+
+static void decode_neigh(struct netevent *ev, struct nlmsghdr *nlh)
+{
+	struct ndmsg *ndm = NLMSG_DATA(nlh);
+	struct rtattr *tb[NDA_MAX + 1];
+
+	parse_rt_attrs(tb, NDA_MAX + 1, RTM_RTA(ndm), RTM_PAYLOAD(nlh));
+
+	ev->type = NETEVENT_NEIGH;
+	ev->ifindex = ndm->ndm_ifindex;
+	ev->family = ndm->ndm_family;
+	ev->u.neigh.state = ndm->ndm_state;
+
+	if (tb[NDA_DST])
+		rta_copy(ev->u.neigh.addr, 16, tb[NDA_DST]);
+	if (tb[NDA_LLADDR])
+		ev->u.neigh.lladdr_len = rta_copy(ev->u.neigh.lladdr,
+				NETEVENT_LLADDR_LEN, tb[NDA_LLADDR]);
+}
+
+int netevent_decode(const struct nlmsghdr *nlh, struct netevent *ev)
+{
+	struct nlmsghdr *msg = (struct nlmsghdr *) nlh;
+
+	memset(ev, 0, sizeof(*ev));
+	ev->nlh = nlh;
+
+	switch (nlh->nlmsg_type) {
+	case RTM_DELLINK:
+		ev->removed = 1;
+	case RTM_NEWLINK:
+		decode_link(ev, msg);
+		break;
+	case RTM_DELADDR:
+		ev->removed = 1;
+	case RTM_NEWADDR:
+		decode_addr(ev, msg);
+		break;
+	case RTM_DELROUTE:
+		ev->removed = 1;
+	case RTM_NEWROUTE:
+		decode_route(ev, msg);
+		break;
+	case RTM_DELNEIGH:
+		ev->removed = 1;
+	case RTM_NEWNEIGH:
+		decode_neigh(ev, msg);
+		break;
+	default:
+		return -1;
+	}
+
+	return 0;
+}
+
+void netevent_decode_wireless(struct netevent *ev, int cmd, struct nlattr *tb[])
+{
+	memset(ev, 0, sizeof(*ev));
+	ev->type = NETEVENT_WIRELESS;
+	ev->u.wireless.cmd = cmd;
+
+	if (tb[NL80211_ATTR_IFINDEX])
+		ev->ifindex = nla_get_u32(tb[NL80211_ATTR_IFINDEX]);
+	if (tb[NL80211_ATTR_WIPHY])
+		ev->u.wireless.wiphy = nla_get_u32(tb[NL80211_ATTR_WIPHY]);
+	if (tb[NL80211_ATTR_MAC] && nla_len(tb[NL80211_ATTR_MAC]) >= 6) {
+		memcpy(ev->u.wireless.mac, nla_data(tb[NL80211_ATTR_MAC]), 6);
+		ev->u.wireless.has_mac = 1;
+	}
+}
+
+static void ctx_rtnl_msg(struct netevent_ctx *ctx, struct nlmsghdr *nlh)
+{
+	struct netevent ev;
+
+	if (netevent_decode(nlh, &ev) == 0)
+		ctx_emit(ctx, &ev);
+}
+
+static void ctx_genl_msg(struct netevent_ctx *ctx, struct nlmsghdr *nlh)
+{
+	struct nlattr *tb[NL80211_ATTR_MAX + 1];
+	struct genlmsghdr *gh = NLMSG_DATA(nlh);
+	struct netevent ev;
+
+	if (nlh->nlmsg_type != ctx->genl_family)
+		return;
+
+	nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gh, 0),
+		  genlmsg_attrlen(gh, 0), NULL);
+
+	netevent_decode_wireless(&ev, gh->cmd, tb);
+	ev.nlh = nlh;
+
+	ctx_emit(ctx, &ev);
+}
+
+/* One datagram from fd, 1 if handled, 0 when there is none */
+static int ctx_read(struct netevent_ctx *ctx, int fd, int wireless)
+{
+	struct netevent ev;
+	struct nlmsghdr *nlh;
+	ssize_t n;
+
+	do {
+		n = recv(fd, ctx->buf, sizeof(ctx->buf), MSG_DONTWAIT);
+	} while (n == -1 && errno == EINTR);
+
+	if (n == -1) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return 0;
+		if (errno != ENOBUFS)
+			return -1;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.type = NETEVENT_OVERRUN;
+		ctx_emit(ctx, &ev);
+		return 1;
+	}
+
+	for (nlh = (struct nlmsghdr *) ctx->buf; NLMSG_OK(nlh, n);
+	     nlh = NLMSG_NEXT(nlh, n)) {
+		if (wireless)
+			ctx_genl_msg(ctx, nlh);
+		else
+			ctx_rtnl_msg(ctx, nlh);
+	}
+
+	return 1;
+}
+
+int netevent_process(struct netevent_ctx *ctx, int budget)
+{
+	int n = 0, ret, busy;
+
+	while (n < budget) {
+		busy = 0;
+
+		if ( (ret = ctx_read(ctx, ctx->rtfd, 0)) == -1 )
+			return -1;
+		n += ret;
+		busy += ret;
+
+		if (ctx->genl_fd != -1 && n < budget) {
+			if ( (ret = ctx_read(ctx, ctx->genl_fd, 1)) == -1 )
+				return -1;
+			n += ret;
+			busy += ret;
+		}
+
+		if (!busy)
+			break;
+	}
+
+	return n;
+}
@@ -1,6 +1,8 @@
 #include <errno.h>
 #include <netevent/events.h>
 
+#include "probes.h"
+
 void event_init(struct event_handler *h)
 {
 	int i;
@@ -32,8 +34,18 @@ void event_push(struct event_handler *h, void *buf, size_t len)
 	int i;
 
 	for ( i=0; i<MAX_HANDLERS; i++) {
-		if ( h->sync[i] != NULL ) {
+		if ( h->sync[i] == NULL )
+			continue;
+
+#ifdef ENABLE_USDT
+		if (PROBE_ENABLED(event_handler)) {
+			uint64_t start = probe_clock();
+
 			h->sync[i](buf, len);
+			PROBE3(event_handler, i, len, probe_clock() - start);
+			continue;
 		}
+#endif
+		h->sync[i](buf, len);
 	}
 }
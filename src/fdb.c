@@ -0,0 +1,532 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/socket.h>
+
+#include <linux/rtnetlink.h>
+#include <linux/neighbour.h>
+#include <linux/if_link.h>
+
+#include <netevent/fdb.h>
+#include <netevent/rtnl.h>
+#include <netevent/timer.h>
+#include <netevent/console.h>
+#include <netevent/fmt.h>
+
+#define FDB_VTEPS_MAX	65535
+
+struct fdb_key
+{
+	int32_t bridge;
+	uint32_t segment;
+	uint8_t mac[6];
+	uint8_t kind;
+	uint8_t pad;
+	uint16_t vtep;		/* only for the all-zero flood entries */
+	uint16_t pad2;
+};
+
+struct fdb_vtep
+{
+	struct hnode node;
+	uint16_t index;
+	uint8_t family;
+	uint8_t addr[16];
+	unsigned long macs;
+	unsigned long withdrawn;	/* removals in the current burst */
+	struct timer burst;
+};
+
+/* VXLAN devices omit NDA_VNI for entries in their own VNI */
+struct fdb_vxlan
+{
+	struct hnode node;
+	int ifindex;
+	uint32_t vni;
+};
+
+struct fdb_segment
+{
+	struct hnode node;
+	uint32_t id;		/* kind << 24 | VLAN or VNI */
+	unsigned long macs;
+};
+
+static struct htable fdb_table;
+static struct htable vtep_table;
+static struct htable segment_table;
+static struct htable vxlan_table;
+
+static struct fdb_vtep **vteps;
+static unsigned int nvteps = 1;	/* index 0 means local */
+
+/* Free entries, chained through node.next */
+static struct hnode *free_entries;
+
+static unsigned long moves;
+
+static const uint8_t zero_mac[6];
+
+static void make_key(struct fdb_key *k, const struct fdb_entry *e)
+{
+	memset(k, 0, sizeof(*k));
+	k->bridge = e->bridge;
+	k->segment = e->segment;
+	memcpy(k->mac, e->mac, sizeof(k->mac));
+	k->kind = e->kind;
+
+	/* Flood entries list every remote VTEP under the zero MAC */
+	if (memcmp(e->mac, zero_mac, sizeof(zero_mac)) == 0)
+		k->vtep = e->vtep;
+}
+
+static int fdb_cmp(const struct hnode *n, const void *key)
+{
+	const struct fdb_entry *e = hnode_entry(n, struct fdb_entry, node);
+	struct fdb_key k;
+
+	make_key(&k, e);
+
+	return memcmp(&k, key, sizeof(k));
+}
+
+struct vtep_key
+{
+	uint8_t family;
+	const uint8_t *addr;
+};
+
+static int vtep_cmp(const struct hnode *n, const void *key)
+{
+	const struct fdb_vtep *v = hnode_entry(n, struct fdb_vtep, node);
+	const struct vtep_key *k = key;
+
+	return v->family != k->family
+		|| memcmp(v->addr, k->addr, k->family == AF_INET6 ? 16 : 4);
+}
+
+static int vxlan_cmp(const struct hnode *n, const void *key)
+{
+	const struct fdb_vxlan *x = hnode_entry(n, struct fdb_vxlan, node);
+
+	return x->ifindex != *(const int *) key;
+}
+
+static int segment_cmp(const struct hnode *n, const void *key)
+{
+	const struct fdb_segment *s = hnode_entry(n, struct fdb_segment, node);
+
+	return s->id != *(const uint32_t *) key;
+}
+
+int fdb_init(void)
+{
+	vteps = calloc(64, sizeof(*vteps));
+	if (vteps == NULL)
+		return -1;
+
+	if (htable_init(&fdb_table, 1024, fdb_cmp) < 0
+	    || htable_init(&vtep_table, 64, vtep_cmp) < 0
+	    || htable_init(&vxlan_table, 64, vxlan_cmp) < 0)
+		return -1;
+
+	return htable_init(&segment_table, 64, segment_cmp);
+}
+
+static struct fdb_entry * entry_alloc(void)
+{
+	struct fdb_entry *chunk;
+	struct hnode *n;
+	unsigned int i;
+
+	if (free_entries == NULL) {
+		chunk = malloc(FDB_CHUNK * sizeof(*chunk));
+		if (chunk == NULL)
+			return NULL;
+		for (i=0; i<FDB_CHUNK; i++) {
+			chunk[i].node.next = free_entries;
+			free_entries = &chunk[i].node;
+		}
+	}
+
+	n = free_entries;
+	free_entries = n->next;
+
+	return hnode_entry(n, struct fdb_entry, node);
+}
+
+static void entry_free(struct fdb_entry *e)
+{
+	e->node.next = free_entries;
+	free_entries = &e->node;
+}
+
+static uint32_t parse_vxlan_id(struct nlmsghdr *nlh)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+	struct rtattr *tb[IFLA_MAX + 1], *info[IFLA_INFO_MAX + 1];
+	struct rtattr *vx[IFLA_VXLAN_MAX + 1];
+
+	parse_rt_attrs(tb, IFLA_MAX + 1, IFLA_RTA(ifi), IFLA_PAYLOAD(nlh));
+	if (tb[IFLA_LINKINFO] == NULL)
+		return 0;
+
+	parse_rt_attrs(info, IFLA_INFO_MAX + 1, RTA_DATA(tb[IFLA_LINKINFO]),
+		       RTA_PAYLOAD(tb[IFLA_LINKINFO]));
+	if (info[IFLA_INFO_KIND] == NULL || info[IFLA_INFO_DATA] == NULL
+	    || strcmp(RTA_DATA(info[IFLA_INFO_KIND]), "vxlan") != 0)
+		return 0;
+
+	parse_rt_attrs(vx, IFLA_VXLAN_MAX + 1, RTA_DATA(info[IFLA_INFO_DATA]),
+		       RTA_PAYLOAD(info[IFLA_INFO_DATA]));
+
+	return vx[IFLA_VXLAN_ID] ? *(uint32_t *) RTA_DATA(vx[IFLA_VXLAN_ID]) : 0;
+}
+
+/* Ask the kernel once per device, 0 if it is not a VXLAN device */
+static uint32_t vxlan_vni(int ifindex)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct ifinfomsg ifi;
+	} req;
+	char buf[32768] __attribute__((aligned(NLMSG_ALIGNTO)));
+	struct fdb_vxlan *x;
+	struct hnode *n;
+	int sk, len;
+
+	if ( (n = htable_find(&vxlan_table, hash_u32(ifindex), &ifindex)) != NULL )
+		return hnode_entry(n, struct fdb_vxlan, node)->vni;
+
+	if ( (x = calloc(1, sizeof(*x))) == NULL )
+		return 0;
+	x->ifindex = ifindex;
+
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifi));
+	req.nlh.nlmsg_type = RTM_GETLINK;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST;
+	req.ifi.ifi_index = ifindex;
+
+	if ( (sk = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)) != -1 ) {
+		if (send(sk, &req, req.nlh.nlmsg_len, 0) != -1
+		    && (len = recv(sk, buf, sizeof(buf), 0)) > 0
+		    && NLMSG_OK((struct nlmsghdr *) buf, len)
+		    && ((struct nlmsghdr *) buf)->nlmsg_type == RTM_NEWLINK)
+			x->vni = parse_vxlan_id((struct nlmsghdr *) buf);
+		close(sk);
+	}
+
+	htable_insert(&vxlan_table, &x->node, hash_u32(ifindex));
+
+	return x->vni;
+}
+
+static char * fmt_vtep(char *p, unsigned int index)
+{
+	const struct fdb_vtep *v = vteps[index];
+
+	return fmt_inet(p, v->family, v->addr);
+}
+
+static void burst_expired(struct timer *t)
+{
+	struct fdb_vtep *v = timer_entry(t, struct fdb_vtep, burst);
+	char output[256], *p;
+
+	if (v->withdrawn > FDB_BURST) {
+		p = fmt_str(output, "Removed ");
+		p = fmt_uint(p, v->withdrawn - FDB_BURST);
+		p = fmt_str(p, " more fdb entries via ");
+		p = fmt_vtep(p, v->index);
+		p = fmt_str(p, ", ");
+		p = fmt_uint(p, v->macs);
+		fmt_str(p, " left\n");
+		eputs(RED, output);
+	}
+
+	v->withdrawn = 0;
+}
+
+static unsigned int vtep_intern(int family, const uint8_t *addr)
+{
+	struct vtep_key key = { family, addr };
+	struct fdb_vtep *v, **grown;
+	struct hnode *n;
+	uint32_t hash;
+	size_t alen = family == AF_INET6 ? 16 : 4;
+
+	hash = hash_bytes(addr, alen, family);
+	if ( (n = htable_find(&vtep_table, hash, &key)) != NULL )
+		return hnode_entry(n, struct fdb_vtep, node)->index;
+
+	if (nvteps > FDB_VTEPS_MAX)
+		return 0;
+
+	if ((nvteps & (nvteps - 1)) == 0 && nvteps >= 64) {
+		grown = realloc(vteps, 2 * nvteps * sizeof(*vteps));
+		if (grown == NULL)
+			return 0;
+		vteps = grown;
+	}
+
+	v = calloc(1, sizeof(*v));
+	if (v == NULL)
+		return 0;
+
+	v->index = nvteps;
+	v->family = family;
+	memcpy(v->addr, addr, alen);
+	timer_setup(&v->burst, burst_expired);
+	vteps[nvteps++] = v;
+	htable_insert(&vtep_table, &v->node, hash);
+
+	return v->index;
+}
+
+static void segment_account(const struct fdb_entry *e, int delta)
+{
+	uint32_t id = (uint32_t) e->kind << 24 | (e->segment & 0xffffff);
+	struct fdb_segment *s;
+	struct hnode *n;
+
+	n = htable_find(&segment_table, hash_u32(id), &id);
+	s = n ? hnode_entry(n, struct fdb_segment, node) : NULL;
+
+	if (delta < 0) {
+		if (s && --s->macs == 0) {
+			htable_remove(&segment_table, &s->node);
+			free(s);
+		}
+		return;
+	}
+
+	if (s == NULL) {
+		if ( (s = calloc(1, sizeof(*s))) == NULL )
+			return;
+		s->id = id;
+		htable_insert(&segment_table, &s->node, hash_u32(id));
+	}
+	s->macs++;
+}
+
+static char * fmt_location(char *p, const struct fdb_entry *e)
+{
+	if (e->vtep)
+		return fmt_vtep(p, e->vtep);
+
+	return fmt_ifname(p, e->port);
+}
+
+static void print_fdb_event(const struct fdb_entry *e,
+			    const struct fdb_entry *old, char *action, int color)
+{
+	char output[256], *p;
+
+	p = fmt_str(output, action);
+	p = fmt_str(p, " fdb ");
+	p = fmt_mac(p, e->mac);
+
+	if (e->kind == FDB_VNI) {
+		p = fmt_str(p, " vni ");
+		p = fmt_uint(p, e->segment);
+	} else if (e->segment) {
+		p = fmt_str(p, " vlan ");
+		p = fmt_uint(p, e->segment);
+	}
+
+	p = fmt_str(p, " on ");
+	p = fmt_ifname(p, e->bridge);
+
+	if (old) {
+		p = fmt_str(p, " from ");
+		p = fmt_location(p, old);
+		p = fmt_str(p, " to ");
+		p = fmt_location(p, e);
+	} else {
+		if (e->port != e->bridge) {
+			p = fmt_str(p, " port ");
+			p = fmt_ifname(p, e->port);
+		}
+		if (e->vtep) {
+			p = fmt_str(p, " via ");
+			p = fmt_vtep(p, e->vtep);
+		}
+	}
+
+	fmt_str(p, "\n");
+
+	eputs(color, output);
+}
+
+static int fdb_fill(struct fdb_entry *e, struct ndmsg *ndm, struct rtattr *tb[])
+{
+	int alen;
+
+	if (tb[NDA_LLADDR] == NULL || RTA_PAYLOAD(tb[NDA_LLADDR]) != 6)
+		return -1;
+
+	memset(e, 0, sizeof(*e));
+	memcpy(e->mac, RTA_DATA(tb[NDA_LLADDR]), sizeof(e->mac));
+	e->port = ndm->ndm_ifindex;
+	e->bridge = ndm->ndm_ifindex;
+	e->flags = ndm->ndm_flags;
+	e->state = ndm->ndm_state;
+
+	if (tb[NDA_MASTER])
+		e->bridge = *(uint32_t *) RTA_DATA(tb[NDA_MASTER]);
+
+	if (tb[NDA_VNI]) {
+		e->kind = FDB_VNI;
+		e->segment = *(uint32_t *) RTA_DATA(tb[NDA_VNI]);
+	} else if (tb[NDA_VLAN]) {
+		e->kind = FDB_VLAN;
+		e->segment = *(uint16_t *) RTA_DATA(tb[NDA_VLAN]);
+	} else if (tb[NDA_DST] && (e->segment = vxlan_vni(e->port)) != 0) {
+		e->kind = FDB_VNI;
+	}
+
+	if (tb[NDA_DST]) {
+		alen = RTA_PAYLOAD(tb[NDA_DST]);
+		if (alen == 4 || alen == 16)
+			e->vtep = vtep_intern(alen == 4 ? AF_INET : AF_INET6,
+					      RTA_DATA(tb[NDA_DST]));
+	}
+
+	return 0;
+}
+
+int handle_fdb_msg(struct nlmsghdr *nlh, int n)
+{
+	struct ndmsg *ndm = NLMSG_DATA(nlh);
+	struct rtattr *tb[NDA_MAX + 1], *rta;
+	struct fdb_entry tmp, *e;
+	struct fdb_vtep *v;
+	struct fdb_key key;
+	struct hnode *node;
+	int len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*ndm));
+	uint32_t hash;
+
+	if (len < 0 || fdb_table.buckets == NULL)
+		return -1;
+
+	rta = (struct rtattr *) ((char *) ndm + NLMSG_ALIGN(sizeof(*ndm)));
+	parse_rt_attrs(tb, NDA_MAX + 1, rta, len);
+
+	if (fdb_fill(&tmp, ndm, tb) < 0)
+		return -1;
+
+	make_key(&key, &tmp);
+	hash = hash_bytes(&key, sizeof(key), 0);
+	node = htable_find(&fdb_table, hash, &key);
+	e = node ? hnode_entry(node, struct fdb_entry, node) : NULL;
+
+	if (nlh->nlmsg_type == RTM_DELNEIGH) {
+		if (e == NULL)
+			return 0;
+
+		if (e->vtep) {
+			v = vteps[e->vtep];
+			v->macs--;
+			if (!timer_pending(&v->burst))
+				timer_add(&v->burst, FDB_BURST_WINDOW);
+			if (++v->withdrawn <= FDB_BURST)
+				print_fdb_event(e, NULL, "Removed", RED);
+		} else {
+			print_fdb_event(e, NULL, "Removed", RED);
+		}
+
+		segment_account(e, -1);
+		htable_remove(&fdb_table, &e->node);
+		entry_free(e);
+		return 0;
+	}
+
+	if (e) {
+		if (e->port != tmp.port || e->vtep != tmp.vtep) {
+			moves++;
+			print_fdb_event(&tmp, e, "Moved", YELLOW);
+		} else if (e->state != tmp.state || e->flags != tmp.flags) {
+			print_fdb_event(&tmp, NULL, "Updated", YELLOW);
+		}
+
+		if (e->vtep)
+			vteps[e->vtep]->macs--;
+		if (tmp.vtep)
+			vteps[tmp.vtep]->macs++;
+
+		tmp.node = e->node;
+		*e = tmp;
+		return 0;
+	}
+
+	if ( (e = entry_alloc()) == NULL )
+		return -1;
+
+	*e = tmp;
+	if (e->vtep)
+		vteps[e->vtep]->macs++;
+	segment_account(e, 1);
+	htable_insert(&fdb_table, &e->node, hash);
+	print_fdb_event(e, NULL, "Added", GREEN);
+
+	return 0;
+}
+
+static int segment_sort(const void *a, const void *b)
+{
+	const struct fdb_segment *x = *(struct fdb_segment * const *) a;
+	const struct fdb_segment *y = *(struct fdb_segment * const *) b;
+
+	return (x->id > y->id) - (x->id < y->id);
+}
+
+void fdb_report(void)
+{
+	struct fdb_segment **v, *s;
+	struct hnode *n;
+	unsigned int i, count = 0;
+
+	if (fdb_table.buckets == NULL || (fdb_table.count == 0 && moves == 0))
+		return;
+
+	tprintf("FDB: %u entries, %u VTEPs, %lu moves\n",
+		fdb_table.count, nvteps - 1, moves);
+
+	v = malloc(segment_table.count * sizeof(*v));
+	if (v == NULL)
+		return;
+
+	htable_for_each(&segment_table, i, n)
+		v[count++] = hnode_entry(n, struct fdb_segment, node);
+
+	qsort(v, count, sizeof(*v), segment_sort);
+
+	for (i=0; i<count; i++) {
+		s = v[i];
+		tprintf("  %s %u: %lu MACs\n", (s->id >> 24) == FDB_VNI ? "vni" : "vlan",
+			s->id & 0xffffff, s->macs);
+	}
+
+	free(v);
+}
@@ -0,0 +1,267 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <sys/socket.h>
+#include <net/if.h>
+
+#include <netevent/fmt.h>
+
+/*
+ * Entries are copied with a fixed width and the pointer advanced by
+ * the real length, so encoding a byte is two loads and no branches.
+ */
+struct fmt_digits
+{
+	char s[4];
+	unsigned char len;
+};
+
+static struct fmt_digits dec[256];	/* "0".."255" */
+static struct fmt_digits hex[256];	/* "0".."ff", as %x */
+static char hex2[256][2];		/* "00".."ff", as %02x */
+static char hex2u[256][2];		/* "00".."FF", as %02X */
+
+struct ifname_slot
+{
+	int ifindex;
+	unsigned char len;
+	time_t expires;
+	char name[IFNAMSIZ];
+};
+
+static struct ifname_slot ifnames[FMT_IFNAME_SLOTS];
+
+__attribute__((constructor))
+static void fmt_tables(void)
+{
+	static const char digits[] = "0123456789abcdef";
+	static const char digitsu[] = "0123456789ABCDEF";
+	int i;
+
+	for (i=0; i<256; i++) {
+		dec[i].len = sprintf(dec[i].s, "%d", i);
+		hex[i].len = sprintf(hex[i].s, "%x", i);
+
+		hex2[i][0] = digits[i >> 4];
+		hex2[i][1] = digits[i & 0xf];
+		hex2u[i][0] = digitsu[i >> 4];
+		hex2u[i][1] = digitsu[i & 0xf];
+	}
+}
+
+char * fmt_str(char *p, const char *s)
+{
+	return stpcpy(p, s);
+}
+
+char * fmt_uint(char *p, unsigned int v)
+{
+	char tmp[10];
+	int n = 0;
+
+	do {
+		tmp[n++] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+
+	while (n)
+		*p++ = tmp[--n];
+	*p = '\0';
+
+	return p;
+}
+
+static inline char * put_dec(char *p, unsigned char b)
+{
+	memcpy(p, dec[b].s, 4);
+	return p + dec[b].len;
+}
+
+static inline char * put_hex(char *p, unsigned char b)
+{
+	memcpy(p, hex[b].s, 2);
+	return p + hex[b].len;
+}
+
+char * fmt_ipv4(char *p, const void *addr)
+{
+	const unsigned char *a = addr;
+
+	p = put_dec(p, a[0]);
+	*p++ = '.';
+	p = put_dec(p, a[1]);
+	*p++ = '.';
+	p = put_dec(p, a[2]);
+	*p++ = '.';
+	p = put_dec(p, a[3]);
+	*p = '\0';
+
+	return p;
+}
+
+/* One group in %x form */
+static inline char * put_group(char *p, const unsigned char *g)
+{
+	if (g[0] == 0)
+		return put_hex(p, g[1]);
+
+	p = put_hex(p, g[0]);
+	memcpy(p, hex2[g[1]], 2);
+
+	return p + 2;
+}
+
+char * fmt_ipv6(char *p, const void *addr)
+{
+	const unsigned char *a = addr;
+	int i, run = 0, base = -1, len = 0;
+
+	/* Longest run of two or more zero groups, the first on a tie */
+	for (i=0; i<8; i++) {
+		if (a[2*i] | a[2*i + 1]) {
+			run = 0;
+			continue;
+		}
+		if (++run > len && run > 1) {
+			len = run;
+			base = i - run + 1;
+		}
+	}
+
+	for (i=0; i<8; i++) {
+		if (base != -1 && i >= base && i < base + len) {
+			if (i == base)
+				*p++ = ':';
+			continue;
+		}
+
+		if (i != 0)
+			*p++ = ':';
+
+		/* IPv4-compatible and IPv4-mapped, as inet_ntop prints them */
+		if (i == 6 && base == 0
+		    && (len == 6 || (len == 5 && a[10] == 0xff && a[11] == 0xff)))
+			return fmt_ipv4(p, a + 12);
+
+		p = put_group(p, a + 2*i);
+	}
+
+	if (base != -1 && base + len == 8)
+		*p++ = ':';
+	*p = '\0';
+
+	return p;
+}
+
+char * fmt_inet(char *p, int family, const void *addr)
+{
+	if (family == AF_INET)
+		return fmt_ipv4(p, addr);
+
+	if (family == AF_INET6)
+		return fmt_ipv6(p, addr);
+
+	*p = '\0';
+	return p;
+}
+
+char * fmt_mac(char *p, const void *mac)
+{
+	const unsigned char *m = mac;
+
+	p = put_hex(p, m[0]);
+	*p++ = ':';
+	p = put_hex(p, m[1]);
+	*p++ = ':';
+	p = put_hex(p, m[2]);
+	*p++ = ':';
+	p = put_hex(p, m[3]);
+	*p++ = ':';
+	p = put_hex(p, m[4]);
+	*p++ = ':';
+	p = put_hex(p, m[5]);
+	*p = '\0';
+
+	return p;
+}
+
+char * fmt_hex(char *p, const void *data, size_t len)
+{
+	const unsigned char *d = data;
+	size_t i;
+
+	for (i=0; i<len; i++, p+=2)
+		memcpy(p, hex2u[d[i]], 2);
+	*p = '\0';
+
+	return p;
+}
+
+static time_t coarse_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return ts.tv_sec;
+}
+
+static void ifname_store(struct ifname_slot *s, int ifindex, const char *name)
+{
+	size_t len = strnlen(name, IFNAMSIZ - 1);
+
+	memcpy(s->name, name, len);
+	s->name[len] = '\0';
+	s->len = len;
+	s->ifindex = ifindex;
+	s->expires = coarse_now() + FMT_IFNAME_TTL;
+}
+
+char * fmt_ifname(char *p, int ifindex)
+{
+	struct ifname_slot *s = &ifnames[ifindex & (FMT_IFNAME_SLOTS - 1)];
+	char name[IFNAMSIZ];
+
+	if (ifindex <= 0)
+		goto unknown;
+
+	if (s->ifindex != ifindex || coarse_now() >= s->expires) {
+		if (if_indextoname(ifindex, name) == NULL) {
+			if (s->ifindex == ifindex)
+				s->ifindex = 0;
+			goto unknown;
+		}
+		ifname_store(s, ifindex, name);
+	}
+
+	memcpy(p, s->name, s->len + 1);
+
+	return p + s->len;
+
+unknown:
+	p = fmt_str(p, "if");
+	return fmt_uint(p, ifindex);
+}
+
+void fmt_ifname_update(int ifindex, const char *name)
+{
+	if (ifindex > 0)
+		ifname_store(&ifnames[ifindex & (FMT_IFNAME_SLOTS - 1)],
+			     ifindex, name);
+}
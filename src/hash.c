@@ -0,0 +1,131 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+
+#include <netevent/hash.h>
+
+static unsigned int round_pow2(unsigned int n)
+{
+	unsigned int s = 16;
+
+	while (s < n)
+		s <<= 1;
+
+	return s;
+}
+
+int htable_init(struct htable *t, unsigned int size, hcmp_t cmp)
+{
+	t->size = round_pow2(size);
+	t->count = 0;
+	t->cmp = cmp;
+	t->buckets = calloc(t->size, sizeof(struct hnode *));
+
+	if (t->buckets == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	return 0;
+}
+
+void htable_free(struct htable *t)
+{
+	free(t->buckets);
+	t->buckets = NULL;
+	t->size = t->count = 0;
+}
+
+static void htable_grow(struct htable *t)
+{
+	struct hnode **nb, *n, *next;
+	unsigned int i, nsize = t->size << 1;
+
+	nb = calloc(nsize, sizeof(struct hnode *));
+
+	/* Stay at the current size if we can't grow, chains just get longer */
+	if (nb == NULL)
+		return;
+
+	for (i=0; i<t->size; i++) {
+		for (n = t->buckets[i]; n; n = next) {
+			next = n->next;
+			n->next = nb[n->hash & (nsize - 1)];
+			nb[n->hash & (nsize - 1)] = n;
+		}
+	}
+
+	free(t->buckets);
+	t->buckets = nb;
+	t->size = nsize;
+}
+
+struct hnode * htable_find(struct htable *t, uint32_t hash, const void *key)
+{
+	struct hnode *n;
+
+	for (n = t->buckets[hash & (t->size - 1)]; n; n = n->next) {
+		if (n->hash == hash && t->cmp(n, key) == 0)
+			return n;
+	}
+
+	return NULL;
+}
+
+void htable_insert(struct htable *t, struct hnode *n, uint32_t hash)
+{
+	struct hnode **b;
+
+	if (t->count >= t->size)
+		htable_grow(t);
+
+	b = &t->buckets[hash & (t->size - 1)];
+	n->hash = hash;
+	n->next = *b;
+	*b = n;
+	t->count++;
+}
+
+int htable_remove(struct htable *t, struct hnode *n)
+{
+	struct hnode **p;
+
+	for (p = &t->buckets[n->hash & (t->size - 1)]; *p; p = &(*p)->next) {
+		if (*p == n) {
+			*p = n->next;
+			n->next = NULL;
+			t->count--;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/* FNV-1a, good enough for addresses and short keys */
+uint32_t hash_bytes(const void *data, size_t len, uint32_t seed)
+{
+	const unsigned char *p = data;
+	uint32_t h = 2166136261u ^ seed;
+
+	while (len--) {
+		h ^= *p++;
+		h *= 16777619u;
+	}
+
+	return h;
+}
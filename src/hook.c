@@ -0,0 +1,763 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
+#include <stdint.h>
+
+#include <sys/wait.h>
+#include <sys/syscall.h>
+
+#include <netevent/hook.h>
+#include <netevent/ctx.h>
+#include <netevent/fmt.h>
+#include <netevent/loop.h>
+#include <netevent/timer.h>
+#include <netevent/console.h>
+
+#define HOOK_UP		0
+#define HOOK_DOWN	1
+#define HOOK_NEW	2
+#define HOOK_DEL	3
+
+#define HOOK_ENV_MAX	256
+#define HOOK_REAP	1	/* seconds between checks for dead helpers */
+
+extern char **environ;
+
+struct hook
+{
+	int type;
+	int action;
+	char match[IFNAMSIZ];
+	int max;
+	unsigned int timeout;
+	char *cmd;
+
+	int running;
+	unsigned long runs;
+	unsigned long coalesced;
+	unsigned long dropped;
+	unsigned long timeouts;
+	unsigned long failures;
+};
+
+/* Job, data holds the command then NAME=VALUE strings, NUL terminated */
+struct hook_msg
+{
+	uint32_t id;
+	uint32_t timeout_ms;
+	uint32_t len;
+	char data[HOOK_MSG_MAX - 3 * sizeof(uint32_t)];
+};
+
+struct hook_result
+{
+	uint32_t slot;
+	uint32_t id;
+	int32_t status;
+	uint32_t ms;
+	uint32_t timed_out;
+};
+
+struct hook_job
+{
+	int hook;
+	struct hook_msg msg;
+};
+
+struct helper
+{
+	pid_t pid;
+	int job_fd;
+	int busy;
+	int hook;
+	uint32_t id;
+};
+
+static const char *type_names[] = {
+	[NETEVENT_LINK] = "link",
+	[NETEVENT_ADDR] = "addr",
+	[NETEVENT_ROUTE] = "route",
+	[NETEVENT_NEIGH] = "neigh",
+};
+
+static const char *action_names[] = {
+	[HOOK_UP] = "up",
+	[HOOK_DOWN] = "down",
+	[HOOK_NEW] = "new",
+	[HOOK_DEL] = "del",
+};
+
+static struct hook hooks[HOOK_MAX];
+static int nhooks;
+
+static struct helper helpers[HOOK_HELPERS_MAX];
+static int nhelpers;
+static int result_rd = -1, result_wr = -1;
+static unsigned long respawns;
+
+static struct hook_job *queue[HOOK_QUEUE];
+static int queued;
+static uint32_t next_id;
+
+static struct timer reap_timer;
+
+static int lookup(const char **names, int n, const char *name)
+{
+	int i;
+
+	for (i=0; i<n; i++) {
+		if (names[i] && strcmp(names[i], name) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+int hook_add(const char *spec)
+{
+	char buf[256], *tok, *save;
+	const char *run, *cmd;
+	struct hook *h;
+
+	if (nhooks == HOOK_MAX || (run = strstr(spec, " run ")) == NULL
+	    || run - spec >= (int) sizeof(buf)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (cmd = run + 5; *cmd == ' '; cmd++)
+		;;
+
+	if (*cmd == 0)
+		goto invalid;
+
+	memcpy(buf, spec, run - spec);
+	buf[run - spec] = 0;
+
+	h = &hooks[nhooks];
+	memset(h, 0, sizeof(*h));
+	h->max = HOOK_CONCURRENCY;
+	h->timeout = HOOK_TIMEOUT;
+
+	if ( (tok = strtok_r(buf, " ", &save)) == NULL
+	     || (h->type = lookup(type_names, NETEVENT_NEIGH + 1, tok)) == -1 )
+		goto invalid;
+
+	if ( (tok = strtok_r(NULL, " ", &save)) == NULL
+	     || (h->action = lookup(action_names, HOOK_DEL + 1, tok)) == -1
+	     || (h->action <= HOOK_DOWN && h->type != NETEVENT_LINK) )
+		goto invalid;
+
+	while ( (tok = strtok_r(NULL, " ", &save)) != NULL ) {
+		if (strcmp(tok, "max") == 0) {
+			if ( (tok = strtok_r(NULL, " ", &save)) == NULL
+			     || (h->max = atoi(tok)) <= 0 )
+				goto invalid;
+		} else if (strcmp(tok, "timeout") == 0) {
+			if ( (tok = strtok_r(NULL, " ", &save)) == NULL
+			     || atoi(tok) <= 0 )
+				goto invalid;
+			h->timeout = atoi(tok);
+		} else if (h->match[0] == 0 && strlen(tok) < IFNAMSIZ) {
+			strcpy(h->match, tok);
+		} else {
+			goto invalid;
+		}
+	}
+
+	if ( (h->cmd = strdup(cmd)) == NULL )
+		return -1;
+
+	nhooks++;
+
+	return 0;
+
+invalid:
+	errno = EINVAL;
+	return -1;
+}
+
+int hook_enabled(void)
+{
+	return nhooks > 0;
+}
+
+static int hook_matches(const struct hook *h, const struct netevent *ev,
+			const char *ifname)
+{
+	if (h->type != ev->type)
+		return 0;
+
+	switch (h->action) {
+	case HOOK_UP:
+		if (ev->removed || !(ev->u.link.change & IFF_UP)
+		    || !(ev->u.link.flags & IFF_UP))
+			return 0;
+		break;
+	case HOOK_DOWN:
+		if (ev->removed || !(ev->u.link.change & IFF_UP)
+		    || (ev->u.link.flags & IFF_UP))
+			return 0;
+		break;
+	case HOOK_NEW:
+		if (ev->removed)
+			return 0;
+		break;
+	case HOOK_DEL:
+		if (!ev->removed)
+			return 0;
+		break;
+	}
+
+	if (h->match[0] == 0)
+		return 1;
+
+	if (ev->type == NETEVENT_ROUTE && strcmp(h->match, "default") == 0)
+		return ev->u.route.dst_len == 0;
+
+	return strcmp(h->match, ifname) == 0;
+}
+
+static int msg_put(struct hook_msg *m, const char *name, const char *value)
+{
+	size_t room = sizeof(m->data) - m->len;
+	int n;
+
+	n = snprintf(m->data + m->len, room, "%s%s", name, value);
+	if (n < 0 || (size_t) n >= room)
+		return -1;
+
+	m->len += n + 1;
+
+	return 0;
+}
+
+static int msg_build(struct hook_msg *m, const struct hook *h,
+		     const struct netevent *ev, const char *ifname)
+{
+	char buf[64], *p;
+	int ret;
+
+	m->len = 0;
+	m->timeout_ms = h->timeout * 1000;
+
+	ret = msg_put(m, "", h->cmd);
+
+	p = fmt_str(buf, type_names[h->type]);
+	*p++ = ' ';
+	fmt_str(p, action_names[h->action]);
+	ret |= msg_put(m, "NETEVENT_EVENT=", buf);
+
+	if (ev->ifindex > 0) {
+		fmt_uint(buf, ev->ifindex);
+		ret |= msg_put(m, "NETEVENT_IFINDEX=", buf);
+		ret |= msg_put(m, "NETEVENT_IFNAME=", ifname);
+	}
+
+	switch (ev->type) {
+	case NETEVENT_LINK:
+		fmt_uint(buf, ev->u.link.mtu);
+		ret |= msg_put(m, "NETEVENT_MTU=", buf);
+		if (ev->u.link.lladdr_len == 6) {
+			fmt_mac(buf, ev->u.link.lladdr);
+			ret |= msg_put(m, "NETEVENT_LLADDR=", buf);
+		}
+		break;
+
+	case NETEVENT_ADDR:
+		fmt_inet(buf, ev->family, ev->u.addr.addr);
+		ret |= msg_put(m, "NETEVENT_ADDR=", buf);
+		fmt_uint(buf, ev->u.addr.prefixlen);
+		ret |= msg_put(m, "NETEVENT_PREFIXLEN=", buf);
+		break;
+
+	case NETEVENT_ROUTE:
+		fmt_inet(buf, ev->family, ev->u.route.dst);
+		ret |= msg_put(m, "NETEVENT_DST=", buf);
+		fmt_uint(buf, ev->u.route.dst_len);
+		ret |= msg_put(m, "NETEVENT_PREFIXLEN=", buf);
+		if (ev->u.route.has_gw) {
+			fmt_inet(buf, ev->family, ev->u.route.gw);
+			ret |= msg_put(m, "NETEVENT_GATEWAY=", buf);
+		}
+		fmt_uint(buf, ev->u.route.table);
+		ret |= msg_put(m, "NETEVENT_TABLE=", buf);
+		break;
+
+	case NETEVENT_NEIGH:
+		fmt_inet(buf, ev->family, ev->u.neigh.addr);
+		ret |= msg_put(m, "NETEVENT_ADDR=", buf);
+		if (ev->u.neigh.lladdr_len == 6) {
+			fmt_mac(buf, ev->u.neigh.lladdr);
+			ret |= msg_put(m, "NETEVENT_LLADDR=", buf);
+		}
+		fmt_uint(buf, ev->u.neigh.state);
+		ret |= msg_put(m, "NETEVENT_STATE=", buf);
+		break;
+	}
+
+	return ret;
+}
+
+static void hook_enqueue(int idx, const struct hook_job *tmpl)
+{
+	struct hook_job *job;
+	size_t size;
+	int i;
+
+	for (i=0; i<queued; i++) {
+		job = queue[i];
+		if (job->hook == idx && job->msg.len == tmpl->msg.len
+		    && memcmp(job->msg.data, tmpl->msg.data, tmpl->msg.len) == 0) {
+			hooks[idx].coalesced++;
+			return;
+		}
+	}
+
+	size = offsetof(struct hook_job, msg.data) + tmpl->msg.len;
+
+	if (queued == HOOK_QUEUE || (job = malloc(size)) == NULL) {
+		hooks[idx].dropped++;
+		return;
+	}
+
+	memcpy(job, tmpl, size);
+	queue[queued++] = job;
+}
+
+static int fd_above(int fd, int min)
+{
+	int n;
+
+	if (fd >= min)
+		return fd;
+
+	n = fcntl(fd, F_DUPFD_CLOEXEC, min);
+	close(fd);
+
+	return n;
+}
+
+static int helper_spawn(int slot)
+{
+	struct helper *hp = &helpers[slot];
+	posix_spawn_file_actions_t fa;
+	posix_spawnattr_t attr;
+	sigset_t none, dfl;
+	char arg[16];
+	char *argv[] = { "neteventd", HOOK_HELPER_ARG, arg, NULL };
+	int job[2], ret;
+
+	if (pipe2(job, O_CLOEXEC) == -1)
+		return -1;
+
+	/* dup2() onto its own number would leave the fd close-on-exec */
+	if ( (job[0] = fd_above(job[0], HOOK_RESULT_FD + 1)) == -1 ) {
+		close(job[1]);
+		return -1;
+	}
+
+	snprintf(arg, sizeof(arg), "%d", slot);
+
+	posix_spawn_file_actions_init(&fa);
+	posix_spawn_file_actions_adddup2(&fa, job[0], HOOK_JOB_FD);
+	posix_spawn_file_actions_adddup2(&fa, result_wr, HOOK_RESULT_FD);
+
+	/* Nothing the daemon blocks or ignores is passed on */
+	sigemptyset(&none);
+	sigemptyset(&dfl);
+	sigaddset(&dfl, SIGPIPE);
+	sigaddset(&dfl, SIGINT);
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setsigmask(&attr, &none);
+	posix_spawnattr_setsigdefault(&attr, &dfl);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK
+				 | POSIX_SPAWN_SETSIGDEF);
+
+	ret = posix_spawn(&hp->pid, "/proc/self/exe", &fa, &attr, argv, environ);
+
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&fa);
+	close(job[0]);
+
+	if (ret != 0) {
+		close(job[1]);
+		hp->pid = 0;
+		errno = ret;
+		return -1;
+	}
+
+	hp->job_fd = job[1];
+	hp->busy = 0;
+
+	return 0;
+}
+
+static void helper_done(struct helper *hp)
+{
+	hp->busy = 0;
+	hooks[hp->hook].running--;
+}
+
+static void helper_restart(int slot)
+{
+	struct helper *hp = &helpers[slot];
+
+	if (hp->busy) {
+		hooks[hp->hook].failures++;
+		helper_done(hp);
+	}
+
+	if (hp->pid > 0) {
+		close(hp->job_fd);
+		kill(hp->pid, SIGKILL);
+		waitpid(hp->pid, NULL, 0);
+		hp->pid = 0;
+	}
+
+	respawns++;
+
+	if (helper_spawn(slot) == -1)
+		tprintf("Hook helper %d: %s\n", slot, strerror(errno));
+}
+
+static struct helper * helper_idle(void)
+{
+	int i;
+
+	for (i=0; i<nhelpers; i++) {
+		if (helpers[i].pid > 0 && !helpers[i].busy)
+			return &helpers[i];
+	}
+
+	return NULL;
+}
+
+static void hook_dispatch(void)
+{
+	struct hook_job *job;
+	struct helper *hp;
+	struct hook *h;
+	size_t size;
+	int i = 0;
+
+	while (i < queued) {
+		job = queue[i];
+		h = &hooks[job->hook];
+
+		if (h->running >= h->max) {
+			i++;
+			continue;
+		}
+
+		if ( (hp = helper_idle()) == NULL )
+			return;
+
+		job->msg.id = ++next_id;
+		size = offsetof(struct hook_msg, data) + job->msg.len;
+
+		if (write(hp->job_fd, &job->msg, size) != (ssize_t) size) {
+			helper_restart(hp - helpers);
+			continue;
+		}
+
+		hp->busy = 1;
+		hp->hook = job->hook;
+		hp->id = job->msg.id;
+		h->running++;
+		h->runs++;
+
+		free(job);
+		memmove(&queue[i], &queue[i + 1], (queued - i - 1) * sizeof(*queue));
+		queued--;
+	}
+}
+
+static int hook_result_ready(void *data, int fd)
+{
+	struct hook_result res[64];
+	struct helper *hp;
+	struct hook *h;
+	ssize_t n;
+	int i;
+
+	while ( (n = read(fd, res, sizeof(res))) > 0 ) {
+		for (i=0; i < n / (ssize_t) sizeof(*res); i++) {
+			if (res[i].slot >= (uint32_t) nhelpers)
+				continue;
+
+			hp = &helpers[res[i].slot];
+			if (!hp->busy || hp->id != res[i].id)
+				continue;
+
+			h = &hooks[hp->hook];
+			helper_done(hp);
+
+			if (res[i].timed_out) {
+				h->timeouts++;
+				tprintf("Hook \"%s\" killed after %us\n",
+					h->cmd, h->timeout);
+			} else if (res[i].status != 0) {
+				h->failures++;
+			}
+		}
+	}
+
+	hook_dispatch();
+
+	return 0;
+}
+
+static void hook_reap(struct timer *t)
+{
+	int i;
+
+	for (i=0; i<nhelpers; i++) {
+		if (helpers[i].pid == 0) {
+			helper_restart(i);
+		} else if (waitpid(helpers[i].pid, NULL, WNOHANG) == helpers[i].pid) {
+			helpers[i].pid = 0;
+			close(helpers[i].job_fd);
+			tprintf("Hook helper %d died, respawning\n", i);
+			helper_restart(i);
+		}
+	}
+
+	hook_dispatch();
+	timer_add(t, HOOK_REAP);
+}
+
+int hook_init(int n)
+{
+	int fds[2], i;
+
+	if (n < 1 || n > HOOK_HELPERS_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* A helper killed mid-write must not take the daemon with it */
+	signal(SIGPIPE, SIG_IGN);
+
+	if (pipe2(fds, O_CLOEXEC | O_NONBLOCK) == -1)
+		return -1;
+
+	result_rd = fds[0];
+	if ( (result_wr = fd_above(fds[1], HOOK_RESULT_FD + 1)) == -1
+	     || fcntl(result_wr, F_SETFL, 0) == -1
+	     || loop_add_fd(result_rd, hook_result_ready, NULL) == -1 )
+		return -1;
+
+	for (i=0; i<n; i++) {
+		if (helper_spawn(i) == -1)
+			return -1;
+	}
+	nhelpers = n;
+
+	timer_setup(&reap_timer, hook_reap);
+	timer_add(&reap_timer, HOOK_REAP);
+
+	return 0;
+}
+
+int hook_rt_event(void *data, size_t len)
+{
+	struct nlmsghdr *nlh;
+	struct netevent ev;
+	struct hook_job job;
+	char ifname[IFNAMSIZ + 8];
+	int n = len, i;
+
+	for (nlh = data; NLMSG_OK(nlh, n); nlh = NLMSG_NEXT(nlh, n)) {
+		if (netevent_decode(nlh, &ev) != 0)
+			continue;
+
+		ifname[0] = 0;
+		if (ev.ifindex > 0)
+			fmt_ifname(ifname, ev.ifindex);
+
+		for (i=0; i<nhooks; i++) {
+			if (!hook_matches(&hooks[i], &ev, ifname))
+				continue;
+
+			job.hook = i;
+			if (msg_build(&job.msg, &hooks[i], &ev, ifname) == -1) {
+				hooks[i].dropped++;
+				continue;
+			}
+
+			hook_enqueue(i, &job);
+		}
+	}
+
+	hook_dispatch();
+
+	return 0;
+}
+
+void hook_report(void)
+{
+	struct hook *h;
+	int i;
+
+	for (i=0; i<nhooks; i++) {
+		h = &hooks[i];
+		tprintf("hook %s %s%s%s: %lu runs, %lu coalesced, %lu dropped, "
+			"%lu timed out, %lu failed\n", type_names[h->type],
+			action_names[h->action], h->match[0] ? " " : "",
+			h->match, h->runs, h->coalesced, h->dropped,
+			h->timeouts, h->failures);
+	}
+
+	if (respawns)
+		tprintf("hook helpers respawned %lu times\n", respawns);
+}
+
+static int64_t elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (int64_t) (now.tv_sec - start->tv_sec) * 1000
+		+ (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static void helper_run(struct hook_msg *m, struct hook_result *r,
+		       const sigset_t *chld)
+{
+	char *argv[] = { "sh", "-c", m->data, NULL };
+	char *envp[HOOK_ENV_MAX], **e, *p;
+	posix_spawnattr_t attr;
+	struct timespec start, ts;
+	sigset_t none, dfl;
+	int64_t left;
+	pid_t pid;
+	int n = 0, status = 0;
+
+	for (e = environ; *e && n < HOOK_ENV_MAX / 2; e++)
+		envp[n++] = *e;
+
+	for (p = m->data + strlen(m->data) + 1; p < m->data + m->len
+	     && n < HOOK_ENV_MAX - 1; p += strlen(p) + 1)
+		envp[n++] = p;
+	envp[n] = NULL;
+
+	/* Own process group so a timeout kills the whole pipeline. SIGPIPE
+	 * and SIGINT are ignored here and would stay so across exec, which
+	 * breaks pipelines in the command */
+	sigemptyset(&none);
+	sigemptyset(&dfl);
+	sigaddset(&dfl, SIGPIPE);
+	sigaddset(&dfl, SIGINT);
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setsigmask(&attr, &none);
+	posix_spawnattr_setsigdefault(&attr, &dfl);
+	posix_spawnattr_setpgroup(&attr, 0);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK
+				 | POSIX_SPAWN_SETSIGDEF
+				 | POSIX_SPAWN_SETPGROUP);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (posix_spawn(&pid, "/bin/sh", NULL, &attr, argv, envp) != 0) {
+		posix_spawnattr_destroy(&attr);
+		r->status = 127 << 8;
+		return;
+	}
+	posix_spawnattr_destroy(&attr);
+
+	while (waitpid(pid, &status, WNOHANG) == 0) {
+		if ( (left = m->timeout_ms - elapsed_ms(&start)) <= 0 ) {
+			kill(-pid, SIGKILL);
+			waitpid(pid, &status, 0);
+			r->timed_out = 1;
+			break;
+		}
+
+		ts.tv_sec = left / 1000;
+		ts.tv_nsec = (left % 1000) * 1000000;
+		sigtimedwait(chld, NULL, &ts);
+	}
+
+	r->status = status;
+	r->ms = elapsed_ms(&start);
+}
+
+static ssize_t read_full(int fd, void *buf, size_t len)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < len) {
+		n = read(fd, (char *) buf + done, len - done);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return n;
+		done += n;
+	}
+
+	return done;
+}
+
+int hook_helper(int slot)
+{
+	struct hook_msg m;
+	struct hook_result r;
+	sigset_t chld;
+	size_t hdr = offsetof(struct hook_msg, data);
+
+	fcntl(HOOK_JOB_FD, F_SETFD, FD_CLOEXEC);
+	fcntl(HOOK_RESULT_FD, F_SETFD, FD_CLOEXEC);
+#ifdef SYS_close_range
+	syscall(SYS_close_range, HOOK_RESULT_FD + 1, ~0U, 0);
+#endif
+
+	/* SIGCHLD stays pending for sigtimedwait() */
+	sigemptyset(&chld);
+	sigaddset(&chld, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &chld, NULL);
+	signal(SIGINT, SIG_IGN);
+
+	while (read_full(HOOK_JOB_FD, &m, hdr) == (ssize_t) hdr) {
+		if (m.len > sizeof(m.data)
+		    || read_full(HOOK_JOB_FD, m.data, m.len) != (ssize_t) m.len)
+			break;
+		m.data[sizeof(m.data) - 1] = 0;
+
+		memset(&r, 0, sizeof(r));
+		r.slot = slot;
+		r.id = m.id;
+
+		helper_run(&m, &r, &chld);
+
+		if (write(HOOK_RESULT_FD, &r, sizeof(r)) != sizeof(r))
+			break;
+	}
+
+	return 0;
+}
@@ -20,6 +20,7 @@
 #include <netevent/iw.h>
 #include <netevent/console.h>
 #include <netevent/utils.h>
+#include <netevent/fmt.h>
 
 #include <netinet/ether.h>
 
@@ -29,7 +30,7 @@ struct iw_range * get_iw_range(int ifindex)
 	struct iw_range * range;
 	int skfd;
 
-	if_indextoname(ifindex, ifname);
+	fmt_ifname(ifname, ifindex);
 
 	skfd = iw_sockets_open();
 
@@ -64,7 +65,7 @@ int handle_wireless_event(int ifindex, struct iw_event * iwe)
 	char * udata, * pdata;
 	unsigned int ulen;
 
-	if_indextoname(ifindex, ifname);
+	fmt_ifname(ifname, ifindex);
 
 	switch (iwe->cmd)
 	{
@@ -106,7 +107,7 @@ int handle_wireless_event(int ifindex, struct iw_event * iwe)
 		if (!zero_addr((unsigned char *) ap_addr)) {
 			tprintf("%s Lost Association\n", ifname);
 		} else {
-			ether_ntoa_r(ap_addr, ap_str);
+			fmt_mac(ap_str, ap_addr);
 			tprintf("New AP Address [%s] on %s\n", ap_str ,ifname);
 		}
 		break;
@@ -114,7 +115,8 @@ int handle_wireless_event(int ifindex, struct iw_event * iwe)
 		udata = iwe->u.data.pointer;
 		ulen = iwe->u.data.length;
 
-		pdata = print_binary_stream(buffer, 8, udata, ulen);
+		/* Leading 4 bytes only */
+		pdata = print_binary_stream(buffer, 9, udata, ulen);
 		tprintf("%s received an Association Response (0x%s...)\n", ifname, pdata);
 		break;
 	default:
@@ -130,7 +132,7 @@ int handle_wireless_attr(int ifindex, char * data, int len)
 	char ifname[IFNAMSIZ];
 	struct stream_descr stream;
 
-	if_indextoname(ifindex, ifname);
+	fmt_ifname(ifname, ifindex);
 	iw_init_event_stream(&stream, data, len);
 
 	while(iw_extract_event_stream(&stream, &iwe, WIRELESS_EXT) > 0) {
@@ -0,0 +1,677 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <dirent.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <net/if.h>
+
+#include <netevent/journal.h>
+#include <netevent/console.h>
+
+#define VARINT_MAX	10
+
+/* Worst case for one event on top of its text: sync, name and header */
+#define RECORD_OVERHEAD	(1 + (1 + 2 * VARINT_MAX + IFNAMSIZ) + 1 + 5 * VARINT_MAX)
+
+struct journal_name
+{
+	int ifindex;
+	unsigned int id;
+};
+
+struct journal_reader
+{
+	char *dir;
+	int idx_fd;
+	struct journal_idx *idx;
+	size_t nidx;
+	size_t idx_len;
+
+	uint64_t seg;
+	int seg_seen;		/* seg is valid, base 0 is a real segment */
+	int seg_open;
+	unsigned char *map;
+	size_t map_len;
+	struct journal_seg_hdr *hdr;
+
+	uint64_t off;
+	uint64_t seq;
+	uint64_t prev_ts;
+	int prev_ifindex;
+	char names[JOURNAL_MAX_NAMES + 1][IFNAMSIZ];
+
+	int pending;
+	struct journal_record rec;
+};
+
+static char *jdir;
+static size_t seg_max;
+static unsigned int seg_age;
+static int idx_fd = -1;
+static int seg_fd = -1;
+static unsigned char *seg_map;
+static struct journal_seg_hdr *seg_hdr;
+static uint64_t next_seq;
+
+static uint64_t prev_ts;
+static int prev_ifindex;
+static unsigned int block_count;
+static struct journal_name names[JOURNAL_MAX_NAMES];
+static unsigned int nnames;
+
+static int put_varint(unsigned char *p, uint64_t v)
+{
+	int n = 0;
+
+	while (v >= 0x80) {
+		p[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	p[n++] = v;
+
+	return n;
+}
+
+static int get_varint(const unsigned char *p, const unsigned char *end,
+		      uint64_t *v)
+{
+	uint64_t r = 0;
+	int n = 0, shift = 0;
+
+	while (p + n < end && n < VARINT_MAX) {
+		r |= (uint64_t) (p[n] & 0x7f) << shift;
+		if (!(p[n++] & 0x80)) {
+			*v = r;
+			return n;
+		}
+		shift += 7;
+	}
+
+	return 0;
+}
+
+static uint64_t zigzag(int64_t v)
+{
+	return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+	return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+static void seg_path(char *buf, size_t len, const char *dir, uint64_t base)
+{
+	snprintf(buf, len, "%s/%016llx.seg", dir, (unsigned long long) base);
+}
+
+static void seg_seal(void)
+{
+	if (seg_map == NULL)
+		return;
+
+	seg_hdr->sealed = 1;
+	msync(seg_map, seg_hdr->used, MS_ASYNC);
+	ftruncate(seg_fd, seg_hdr->used);
+	munmap(seg_map, seg_max);
+	close(seg_fd);
+
+	seg_map = NULL;
+	seg_hdr = NULL;
+	seg_fd = -1;
+}
+
+static int seg_create(void)
+{
+	struct journal_seg_hdr hdr;
+	char path[4096];
+
+	seg_path(path, sizeof(path), jdir, next_seq);
+
+	/* Never truncate, the only file recovery leaves at next_seq is an
+	 * empty segment, which is taken over */
+	seg_fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (seg_fd < 0 && errno == EEXIST) {
+		seg_fd = open(path, O_RDWR | O_CLOEXEC);
+		if (seg_fd < 0)
+			return -1;
+		if (pread(seg_fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)
+		    || hdr.magic != JOURNAL_MAGIC || hdr.count != 0) {
+			errno = EEXIST;
+			goto err;
+		}
+	}
+	if (seg_fd < 0)
+		return -1;
+
+	if (ftruncate(seg_fd, seg_max) < 0)
+		goto err;
+
+	seg_map = mmap(NULL, seg_max, PROT_READ | PROT_WRITE, MAP_SHARED,
+		       seg_fd, 0);
+	if (seg_map == MAP_FAILED)
+		goto err;
+
+	seg_hdr = (struct journal_seg_hdr *) seg_map;
+	memset(seg_hdr, 0, sizeof(*seg_hdr));
+	seg_hdr->magic = JOURNAL_MAGIC;
+	seg_hdr->version = JOURNAL_VERSION;
+	seg_hdr->hdr_len = sizeof(*seg_hdr);
+	seg_hdr->base_seq = next_seq;
+	seg_hdr->created = time(NULL);
+	seg_hdr->used = sizeof(*seg_hdr);
+
+	block_count = 0;
+
+	return 0;
+err:
+	close(seg_fd);
+	seg_fd = -1;
+	seg_map = NULL;
+	return -1;
+}
+
+/* Seal a segment left open and return the sequence that follows it */
+static uint64_t seg_recover(uint64_t base)
+{
+	struct journal_seg_hdr hdr;
+	char path[4096];
+	uint64_t end = base + 1;
+	int fd;
+
+	seg_path(path, sizeof(path), jdir, base);
+	fd = open(path, O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+
+	/* An unreadable segment is kept, the journal moves past its name */
+	if (pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr)
+	    && hdr.magic == JOURNAL_MAGIC) {
+		end = hdr.base_seq + hdr.count;
+		if (!hdr.sealed) {
+			hdr.sealed = 1;
+			pwrite(fd, &hdr, sizeof(hdr), 0);
+			ftruncate(fd, hdr.used);
+		}
+	}
+
+	close(fd);
+
+	return end;
+}
+
+/**
+ * @short Recover the next sequence number from the index and the segments
+ *
+ * The index may be missing or behind the segments, every segment file
+ * is looked at so none is ever reused. The previous segment is sealed,
+ * a restart always opens a new one.
+ */
+static void journal_recover(void)
+{
+	struct journal_idx last;
+	struct dirent *de;
+	struct stat st;
+	unsigned long long base;
+	uint64_t end;
+	char tail;
+	DIR *d;
+	off_t n;
+
+	if (fstat(idx_fd, &st) == 0 && st.st_size >= (off_t) sizeof(last)) {
+		n = st.st_size / sizeof(last);
+		if (pread(idx_fd, &last, sizeof(last), (n - 1) * sizeof(last))
+		    == sizeof(last))
+			next_seq = last.seq;
+	}
+
+	if ( (d = opendir(jdir)) == NULL )
+		return;
+
+	while ( (de = readdir(d)) != NULL ) {
+		if (strlen(de->d_name) != 20
+		    || sscanf(de->d_name, "%16llx.se%c", &base, &tail) != 2
+		    || tail != 'g')
+			continue;
+
+		if ( (end = seg_recover(base)) > next_seq )
+			next_seq = end;
+	}
+
+	closedir(d);
+}
+
+static void index_add(uint64_t ts, uint64_t offset)
+{
+	struct journal_idx e;
+
+	e.ts = ts;
+	e.seq = next_seq;
+	e.seg = seg_hdr->base_seq;
+	e.offset = offset;
+
+	write(idx_fd, &e, sizeof(e));
+}
+
+static unsigned int name_id(int ifindex, unsigned char *p, int *len)
+{
+	char ifname[IFNAMSIZ];
+	unsigned int i, id;
+	size_t nlen;
+
+	if (ifindex <= 0)
+		return 0;
+
+	for (i=0; i<nnames; i++) {
+		if (names[i].ifindex == ifindex)
+			return names[i].id;
+	}
+
+	if (nnames == JOURNAL_MAX_NAMES || if_indextoname(ifindex, ifname) == NULL)
+		return 0;
+
+	id = ++nnames;
+	names[id - 1].ifindex = ifindex;
+	names[id - 1].id = id;
+
+	nlen = strlen(ifname);
+	p[(*len)++] = JREC_NAME;
+	*len += put_varint(p + *len, id);
+	*len += put_varint(p + *len, nlen);
+	memcpy(p + *len, ifname, nlen);
+	*len += nlen;
+
+	return id;
+}
+
+static void journal_sink(const struct console_event *ev)
+{
+	unsigned char *p;
+	uint64_t ts, off;
+	unsigned int id;
+	size_t len = ev->len;
+	int n = 0;
+
+	if (len && ev->msg[len - 1] == '\n')
+		len--;
+
+	if (len + RECORD_OVERHEAD > seg_max - sizeof(struct journal_seg_hdr))
+		return;
+
+	ts = (uint64_t) ev->tv.tv_sec * 1000000 + ev->tv.tv_usec;
+
+	if (seg_map && (seg_hdr->used + len + RECORD_OVERHEAD > seg_max
+			|| time(NULL) - seg_hdr->created >= seg_age))
+		seg_seal();
+
+	if (seg_map == NULL && seg_create() < 0)
+		return;
+
+	off = seg_hdr->used;
+	p = seg_map + off;
+
+	if (block_count == 0) {
+		p[n++] = JREC_SYNC;
+		prev_ts = 0;
+		prev_ifindex = 0;
+		nnames = 0;
+		index_add(ts, off);
+	}
+
+	id = name_id(ev->ifindex, p, &n);
+
+	p[n++] = JREC_EVENT;
+	n += put_varint(p + n, zigzag((int64_t) (ts - prev_ts)));
+	n += put_varint(p + n, zigzag((int64_t) ev->ifindex - prev_ifindex));
+	n += put_varint(p + n, ev->type);
+	n += put_varint(p + n, id);
+	n += put_varint(p + n, len);
+	memcpy(p + n, ev->msg, len);
+	n += len;
+
+	/* Readers trust everything below used, publish it last */
+	__sync_synchronize();
+	seg_hdr->used = off + n;
+	seg_hdr->count++;
+
+	prev_ts = ts;
+	prev_ifindex = ev->ifindex;
+	next_seq++;
+	block_count = (block_count + 1) % JOURNAL_SYNC_EVERY;
+}
+
+int journal_init(const char *dir, size_t max_size, unsigned int max_age)
+{
+	char path[4096];
+
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+		return -1;
+
+	jdir = strdup(dir);
+	seg_max = max_size ? max_size : JOURNAL_SEG_SIZE;
+	seg_age = max_age ? max_age : JOURNAL_SEG_AGE;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, JOURNAL_INDEX);
+	idx_fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (idx_fd < 0)
+		return -1;
+
+	journal_recover();
+
+	return console_add_sink(journal_sink);
+}
+
+void journal_close(void)
+{
+	seg_seal();
+
+	if (idx_fd >= 0)
+		close(idx_fd);
+	idx_fd = -1;
+}
+
+/* Reader */
+
+static int reader_load_index(struct journal_reader *r)
+{
+	struct stat st;
+	size_t len;
+
+	if (fstat(r->idx_fd, &st) < 0)
+		return -1;
+
+	len = st.st_size - st.st_size % sizeof(struct journal_idx);
+	if (len == r->idx_len)
+		return 0;
+
+	if (r->idx)
+		munmap(r->idx, r->idx_len);
+
+	r->idx = NULL;
+	r->idx_len = r->nidx = 0;
+
+	if (len == 0)
+		return 0;
+
+	r->idx = mmap(NULL, len, PROT_READ, MAP_SHARED, r->idx_fd, 0);
+	if (r->idx == MAP_FAILED) {
+		r->idx = NULL;
+		return -1;
+	}
+
+	r->idx_len = len;
+	r->nidx = len / sizeof(struct journal_idx);
+
+	return 0;
+}
+
+static void reader_unmap(struct journal_reader *r)
+{
+	if (r->map)
+		munmap(r->map, r->map_len);
+
+	r->map = NULL;
+	r->hdr = NULL;
+	r->seg_open = 0;
+}
+
+static int reader_map(struct journal_reader *r, const struct journal_idx *e)
+{
+	struct stat st;
+	char path[4096];
+	int fd;
+
+	reader_unmap(r);
+
+	r->seg = e->seg;
+	r->seg_seen = 1;
+	r->off = e->offset;
+	r->seq = e->seq;
+	r->pending = 0;
+
+	seg_path(path, sizeof(path), r->dir, e->seg);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(*r->hdr)) {
+		close(fd);
+		return -1;
+	}
+
+	r->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (r->map == MAP_FAILED) {
+		r->map = NULL;
+		return -1;
+	}
+
+	r->map_len = st.st_size;
+	r->hdr = (struct journal_seg_hdr *) r->map;
+	r->seg_open = 1;
+
+	if (r->hdr->magic != JOURNAL_MAGIC) {
+		reader_unmap(r);
+		return -1;
+	}
+
+	return 0;
+}
+
+struct journal_reader * journal_open(const char *dir)
+{
+	struct journal_reader *r;
+	char path[4096];
+
+	r = calloc(1, sizeof(*r));
+	if (r == NULL)
+		return NULL;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, JOURNAL_INDEX);
+	r->idx_fd = open(path, O_RDONLY | O_CLOEXEC);
+	r->dir = strdup(dir);
+
+	if (r->idx_fd < 0 || r->dir == NULL || reader_load_index(r) < 0) {
+		journal_reader_close(r);
+		return NULL;
+	}
+
+	return r;
+}
+
+void journal_reader_close(struct journal_reader *r)
+{
+	reader_unmap(r);
+
+	if (r->idx)
+		munmap(r->idx, r->idx_len);
+	if (r->idx_fd >= 0)
+		close(r->idx_fd);
+
+	free(r->dir);
+	free(r);
+}
+
+/* Last index entry whose key is <= target, or the first one */
+static const struct journal_idx * index_search(struct journal_reader *r,
+					       uint64_t target, int by_time)
+{
+	size_t lo = 0, hi = r->nidx, mid;
+	uint64_t key;
+
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		key = by_time ? r->idx[mid].ts : r->idx[mid].seq;
+		if (key <= target)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return &r->idx[lo];
+}
+
+static int reader_seek(struct journal_reader *r, uint64_t target, int by_time)
+{
+	const struct journal_idx *e;
+	struct journal_record rec;
+	int ret;
+
+	reader_load_index(r);
+	if (r->nidx == 0)
+		return -1;
+
+	e = index_search(r, target, by_time);
+
+	/* A missing segment just means starting from the next one */
+	if (reader_map(r, e) < 0)
+		r->seg_open = 0;
+
+	while ((ret = journal_next(r, &rec)) == 1) {
+		if ((by_time ? rec.ts : rec.seq) >= target) {
+			r->rec = rec;
+			r->pending = 1;
+			break;
+		}
+	}
+
+	return ret < 0 ? -1 : 0;
+}
+
+int journal_seek_seq(struct journal_reader *r, uint64_t seq)
+{
+	return reader_seek(r, seq, 0);
+}
+
+int journal_seek_time(struct journal_reader *r, uint64_t ts)
+{
+	return reader_seek(r, ts, 1);
+}
+
+static int reader_next_segment(struct journal_reader *r)
+{
+	size_t lo = 0, hi, mid;
+
+	reader_load_index(r);
+
+	/* First index entry of the following segment, or the first one */
+	hi = r->nidx;
+	while (r->seg_seen && lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (r->idx[mid].seg <= r->seg)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == r->nidx)
+		return 0;
+
+	if (reader_map(r, &r->idx[lo]) < 0) {
+		r->seg = r->idx[lo].seg;
+		r->seg_seen = 1;
+	}
+
+	return 1;
+}
+
+int journal_next(struct journal_reader *r, struct journal_record *rec)
+{
+	const unsigned char *p, *end;
+	uint64_t v[5];
+	int i, n;
+
+	if (r->pending) {
+		*rec = r->rec;
+		r->pending = 0;
+		return 1;
+	}
+
+	for (;;) {
+		if (!r->seg_open) {
+			if (!reader_next_segment(r))
+				return 0;
+			continue;
+		}
+
+		__sync_synchronize();
+		end = r->map + (r->hdr->used < r->map_len ?
+				r->hdr->used : r->map_len);
+		p = r->map + r->off;
+
+		if (p >= end) {
+			if (r->hdr->sealed && reader_next_segment(r))
+				continue;
+			return 0;
+		}
+
+		switch (*p++) {
+		case JREC_SYNC:
+			r->prev_ts = 0;
+			r->prev_ifindex = 0;
+			r->off++;
+			break;
+		case JREC_NAME:
+			if ((n = get_varint(p, end, &v[0])) == 0)
+				return -1;
+			p += n;
+			if ((n = get_varint(p, end, &v[1])) == 0)
+				return -1;
+			p += n;
+			if (p + v[1] > end || v[0] == 0 || v[0] > JOURNAL_MAX_NAMES)
+				return -1;
+			snprintf(r->names[v[0]], IFNAMSIZ, "%.*s",
+				 (int) v[1], (const char *) p);
+			r->off = p + v[1] - r->map;
+			break;
+		case JREC_EVENT:
+			for (i=0; i<5; i++) {
+				if ((n = get_varint(p, end, &v[i])) == 0)
+					return -1;
+				p += n;
+			}
+			if (p + v[4] > end || v[3] > JOURNAL_MAX_NAMES)
+				return -1;
+
+			r->prev_ts += unzigzag(v[0]);
+			r->prev_ifindex += unzigzag(v[1]);
+
+			rec->seq = r->seq++;
+			rec->ts = r->prev_ts;
+			rec->ifindex = r->prev_ifindex;
+			rec->type = v[2];
+			rec->ifname = v[3] ? r->names[v[3]] : NULL;
+			rec->msg = (const char *) p;
+			rec->len = v[4];
+
+			r->off = p + v[4] - r->map;
+			return 1;
+		default:
+			return -1;
+		}
+	}
+}
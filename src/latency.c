@@ -0,0 +1,281 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/socket.h>
+
+#include <netevent/latency.h>
+#include <netevent/timer.h>
+#include <netevent/console.h>
+#include <netevent/utils.h>
+
+/* Checkpoints of the event being handled, in ns */
+struct lat_event
+{
+	int active;
+	int sunk;
+	int stamped;		/* kernel timestamp available */
+	uint64_t queue;		/* kernel to recv, from CLOCK_REALTIME */
+	uint64_t recv;		/* CLOCK_MONOTONIC from here on */
+	uint64_t decode;
+	uint64_t dispatch;
+	uint64_t sink;
+};
+
+struct lat_hist
+{
+	unsigned long count[LAT_BUCKETS];
+	unsigned long n;
+	uint64_t max;
+};
+
+static int enabled;
+static int trace;
+static unsigned int interval;
+static struct timer report_timer;
+static struct lat_event cur;
+static struct lat_hist hist[LAT_STAGES];
+
+static const char *stage_names[LAT_STAGES] = {
+	"queue", "decode", "dispatch", "sink", "total"
+};
+
+static uint64_t clock_ns(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void hist_add(struct lat_hist *h, uint64_t ns)
+{
+	uint64_t us = ns / 1000;
+	int b = 0;
+
+	while (us && b < LAT_BUCKETS - 1) {
+		us >>= 1;
+		b++;
+	}
+
+	h->count[b]++;
+	h->n++;
+	if (ns > h->max)
+		h->max = ns;
+}
+
+/* Upper bound in us of the bucket holding the given fraction */
+static unsigned long hist_quantile(struct lat_hist *h, double q)
+{
+	unsigned long seen = 0, want = h->n * q;
+	int b;
+
+	for (b=0; b<LAT_BUCKETS; b++) {
+		seen += h->count[b];
+		if (seen > want)
+			break;
+	}
+
+	return 1UL << b;
+}
+
+static uint64_t delta(uint64_t from, uint64_t to)
+{
+	return (from && to > from) ? to - from : 0;
+}
+
+static void report_expired(struct timer *t)
+{
+	latency_report();
+	memset(hist, 0, sizeof(hist));
+	timer_add(t, interval);
+}
+
+int latency_init(unsigned int secs, int with_trace)
+{
+	enabled = 1;
+	trace = with_trace;
+	interval = secs;
+
+	if (interval) {
+		timer_setup(&report_timer, report_expired);
+		timer_add(&report_timer, interval);
+	}
+
+	return 0;
+}
+
+int latency_enabled(void)
+{
+	return enabled;
+}
+
+int latency_socket(int fd)
+{
+	int on = 1;
+
+	if (!enabled)
+		return 0;
+
+	return setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+}
+
+uint64_t latency_cmsg(struct msghdr *msg)
+{
+	struct cmsghdr *cmsg;
+	struct timespec *ts;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET
+		    && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+			ts = (struct timespec *) CMSG_DATA(cmsg);
+			return (uint64_t) ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+		}
+	}
+
+	return 0;
+}
+
+ssize_t latency_recv(int fd, void *buf, size_t len, int flags)
+{
+	char cbuf[CMSG_SPACE(sizeof(struct timespec))];
+	struct msghdr msg;
+	struct iovec iov;
+	ssize_t n;
+
+	if (!enabled)
+		return recv(fd, buf, len, flags);
+
+	iov.iov_base = buf;
+	iov.iov_len = len;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+
+	if ( (n = recvmsg(fd, &msg, flags)) > 0 )
+		latency_received(latency_cmsg(&msg));
+
+	return n;
+}
+
+void latency_received_at(uint64_t kernel, uint64_t real, uint64_t mono)
+{
+	if (!enabled)
+		return;
+
+	if (cur.active)
+		latency_done();
+
+	memset(&cur, 0, sizeof(cur));
+	cur.active = 1;
+	cur.stamped = (kernel != 0);
+	cur.queue = delta(kernel, real);
+	cur.recv = mono;
+}
+
+void latency_received(uint64_t kernel)
+{
+	latency_received_at(kernel, clock_ns(CLOCK_REALTIME),
+			    clock_ns(CLOCK_MONOTONIC));
+}
+
+void latency_mark(int stage)
+{
+	if (!cur.active)
+		return;
+
+	if (stage == LAT_DECODE && cur.decode == 0)
+		cur.decode = clock_ns(CLOCK_MONOTONIC);
+	else if (stage == LAT_DISPATCH && cur.dispatch == 0)
+		cur.dispatch = clock_ns(CLOCK_MONOTONIC);
+}
+
+void latency_sink(char *msg, size_t size)
+{
+	char field[96], queue[32] = "";
+	size_t len;
+	int nl;
+
+	if (!cur.active)
+		return;
+
+	if (!cur.sunk) {
+		cur.sink = clock_ns(CLOCK_MONOTONIC);
+		cur.sunk = 1;
+	}
+
+	if (!trace)
+		return;
+
+	if (cur.stamped)
+		snprintf(queue, sizeof(queue), "queue %lluus ",
+			 (unsigned long long) cur.queue / 1000);
+
+	snprintf(field, sizeof(field),
+		 " {%sdecode %lluus dispatch %lluus sink %lluus}", queue,
+		 (unsigned long long) delta(cur.recv, cur.decode) / 1000,
+		 (unsigned long long) delta(cur.decode, cur.dispatch) / 1000,
+		 (unsigned long long) delta(cur.dispatch, cur.sink) / 1000);
+
+	len = strlen(msg);
+	nl = (len && msg[len - 1] == '\n');
+	if (nl)
+		msg[--len] = '\0';
+
+	strappend(msg, size, len, "%s%s", field, nl ? "\n" : "");
+}
+
+void latency_done(void)
+{
+	if (!cur.active)
+		return;
+
+	cur.active = 0;
+
+	if (cur.stamped)
+		hist_add(&hist[LAT_QUEUE], cur.queue);
+	if (cur.decode)
+		hist_add(&hist[LAT_DECODE], delta(cur.recv, cur.decode));
+	if (cur.dispatch)
+		hist_add(&hist[LAT_DISPATCH], delta(cur.decode, cur.dispatch));
+	if (cur.sunk) {
+		hist_add(&hist[LAT_SINK], delta(cur.dispatch, cur.sink));
+		hist_add(&hist[LAT_TOTAL], cur.queue + delta(cur.recv, cur.sink));
+	}
+}
+
+void latency_report(void)
+{
+	struct lat_hist *h;
+	int i;
+
+	for (i=0; i<LAT_STAGES; i++) {
+		h = &hist[i];
+		if (h->n == 0)
+			continue;
+
+		tprintf("latency %s: %lu events, p50 <%luus p99 <%luus max %lluus\n",
+			stage_names[i], h->n, hist_quantile(h, 0.5),
+			hist_quantile(h, 0.99), (unsigned long long) h->max / 1000);
+	}
+}
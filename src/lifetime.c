@@ -0,0 +1,270 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+#include <net/if.h>
+
+#include <netevent/lifetime.h>
+#include <netevent/timer.h>
+#include <netevent/hash.h>
+#include <netevent/console.h>
+#include <netevent/fmt.h>
+
+#define NEIGH_BASE_REACHABLE_MS	30000
+#define USER_HZ			100
+
+struct life_key
+{
+	unsigned char family;
+	unsigned char prefixlen;
+	int ifindex;
+	unsigned char addr[16];
+};
+
+struct addr_life
+{
+	struct hnode node;
+	struct life_key key;
+	struct timer preferred;
+	struct timer valid;
+};
+
+struct neigh_life
+{
+	struct hnode node;
+	struct life_key key;
+	struct timer reachable;
+};
+
+static struct htable addr_table;
+static struct htable neigh_table;
+static int neigh_tracking;
+static unsigned int neigh_max_reachable;
+
+static int addr_cmp(const struct hnode *n, const void *key)
+{
+	return memcmp(&hnode_entry(n, struct addr_life, node)->key, key,
+		      sizeof(struct life_key));
+}
+
+static int neigh_cmp(const struct hnode *n, const void *key)
+{
+	return memcmp(&hnode_entry(n, struct neigh_life, node)->key, key,
+		      sizeof(struct life_key));
+}
+
+static void make_key(struct life_key *k, int family, int ifindex,
+		     int prefixlen, const void *addr)
+{
+	memset(k, 0, sizeof(*k));
+	k->family = family;
+	k->prefixlen = prefixlen;
+	k->ifindex = ifindex;
+	memcpy(k->addr, addr, family == AF_INET6 ? 16 : 4);
+}
+
+static void format_key(const struct life_key *k, char *addr, char *ifname)
+{
+	fmt_inet(addr, k->family, k->addr);
+	fmt_ifname(ifname, k->ifindex);
+}
+
+/*
+ * The kernel randomizes reachable time between 0.5 and 1.5 times the
+ * base, so an entry that was not confirmed within 1.5 times the base
+ * has certainly gone stale.
+ */
+static unsigned int read_base_reachable(void)
+{
+	FILE *f;
+	unsigned int ms = NEIGH_BASE_REACHABLE_MS;
+
+	f = fopen("/proc/sys/net/ipv4/neigh/default/base_reachable_time_ms", "r");
+	if (f) {
+		if (fscanf(f, "%u", &ms) != 1)
+			ms = NEIGH_BASE_REACHABLE_MS;
+		fclose(f);
+	}
+
+	return (ms * 3 / 2 + 999) / 1000;
+}
+
+int lifetime_init(int track_neigh)
+{
+	if (htable_init(&addr_table, 256, addr_cmp) < 0)
+		return -1;
+
+	neigh_tracking = track_neigh;
+	if (!track_neigh)
+		return 0;
+
+	neigh_max_reachable = read_base_reachable();
+
+	return htable_init(&neigh_table, 1024, neigh_cmp);
+}
+
+static void addr_life_free(struct addr_life *al)
+{
+	timer_del(&al->preferred);
+	timer_del(&al->valid);
+	htable_remove(&addr_table, &al->node);
+	free(al);
+}
+
+static void addr_preferred_expired(struct timer *t)
+{
+	struct addr_life *al = timer_entry(t, struct addr_life, preferred);
+	char addr[INET6_ADDRSTRLEN], ifname[IFNAMSIZ];
+
+	format_key(&al->key, addr, ifname);
+	eprintf(YELLOW, "Address %s/%d on dev %s deprecated\n",
+		addr, al->key.prefixlen, ifname);
+}
+
+static void addr_valid_expired(struct timer *t)
+{
+	struct addr_life *al = timer_entry(t, struct addr_life, valid);
+	char addr[INET6_ADDRSTRLEN], ifname[IFNAMSIZ];
+
+	format_key(&al->key, addr, ifname);
+	eprintf(RED, "Address %s/%d on dev %s expired\n",
+		addr, al->key.prefixlen, ifname);
+
+	addr_life_free(al);
+}
+
+void lifetime_addr_update(int type, int family, int ifindex, int prefixlen,
+			  const void *addr, const struct ifa_cacheinfo *ci)
+{
+	struct life_key key;
+	struct addr_life *al;
+	struct hnode *n;
+	uint32_t hash;
+
+	if (addr_table.buckets == NULL)
+		return;
+
+	make_key(&key, family, ifindex, prefixlen, addr);
+	hash = hash_bytes(&key, sizeof(key), 0);
+	n = htable_find(&addr_table, hash, &key);
+	al = n ? hnode_entry(n, struct addr_life, node) : NULL;
+
+	if (type == RTM_DELADDR) {
+		if (al)
+			addr_life_free(al);
+		return;
+	}
+
+	/* Permanent addresses are not worth an entry */
+	if (ci->ifa_valid == INFINITY_LIFE_TIME
+	    && ci->ifa_prefered == INFINITY_LIFE_TIME) {
+		if (al)
+			addr_life_free(al);
+		return;
+	}
+
+	if (al == NULL) {
+		al = malloc(sizeof(*al));
+		if (al == NULL)
+			return;
+
+		al->key = key;
+		timer_setup(&al->preferred, addr_preferred_expired);
+		timer_setup(&al->valid, addr_valid_expired);
+		htable_insert(&addr_table, &al->node, hash);
+	}
+
+	if (ci->ifa_prefered == INFINITY_LIFE_TIME) {
+		timer_del(&al->preferred);
+	} else if (ci->ifa_prefered == 0) {
+		/* Deprecated before the wheel caught it */
+		if (timer_pending(&al->preferred)) {
+			timer_del(&al->preferred);
+			addr_preferred_expired(&al->preferred);
+		}
+	} else {
+		timer_add(&al->preferred, ci->ifa_prefered);
+	}
+
+	if (ci->ifa_valid == INFINITY_LIFE_TIME)
+		timer_del(&al->valid);
+	else
+		timer_add(&al->valid, ci->ifa_valid);
+}
+
+static void neigh_life_free(struct neigh_life *nl)
+{
+	timer_del(&nl->reachable);
+	htable_remove(&neigh_table, &nl->node);
+	free(nl);
+}
+
+static void neigh_reachable_expired(struct timer *t)
+{
+	struct neigh_life *nl = timer_entry(t, struct neigh_life, reachable);
+	char addr[INET6_ADDRSTRLEN], ifname[IFNAMSIZ];
+
+	format_key(&nl->key, addr, ifname);
+	eprintf(YELLOW, "Neighbor [%s] on %s reachable time elapsed\n",
+		addr, ifname);
+
+	neigh_life_free(nl);
+}
+
+void lifetime_neigh_update(int type, const struct ndmsg *ndm, const void *addr,
+			   const struct nda_cacheinfo *ci)
+{
+	struct life_key key;
+	struct neigh_life *nl;
+	struct hnode *n;
+	unsigned int age;
+	uint32_t hash;
+
+	if (!neigh_tracking || addr == NULL)
+		return;
+
+	if (ndm->ndm_family != AF_INET && ndm->ndm_family != AF_INET6)
+		return;
+
+	make_key(&key, ndm->ndm_family, ndm->ndm_ifindex, 0, addr);
+	hash = hash_bytes(&key, sizeof(key), 0);
+	n = htable_find(&neigh_table, hash, &key);
+	nl = n ? hnode_entry(n, struct neigh_life, node) : NULL;
+
+	if (type != RTM_NEWNEIGH || !(ndm->ndm_state & NUD_REACHABLE)) {
+		if (nl)
+			neigh_life_free(nl);
+		return;
+	}
+
+	if (nl == NULL) {
+		nl = malloc(sizeof(*nl));
+		if (nl == NULL)
+			return;
+
+		nl->key = key;
+		timer_setup(&nl->reachable, neigh_reachable_expired);
+		htable_insert(&neigh_table, &nl->node, hash);
+	}
+
+	age = ci ? ci->ndm_confirmed / USER_HZ : 0;
+
+	timer_add(&nl->reachable, age < neigh_max_reachable ?
+		  neigh_max_reachable - age : 1);
+}
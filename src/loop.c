@@ -0,0 +1,227 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <netevent/loop.h>
+#include <netevent/latency.h>
+#include <netevent/console.h>
+#include <netevent/state.h>
+
+#include "probes.h"
+
+static struct loop_source sources[LOOP_MAX_SOURCES];
+static int nsources;
+static int backend = -1;
+static int epfd = -1;
+static struct loop_stats stats;
+
+static const char *backend_names[] = { "epoll", "io_uring" };
+
+void loop_overrun(const char *name, unsigned long count)
+{
+	/* Storms overrun often, report at powers of two */
+	if ((count & (count - 1)) == 0)
+		tprintf("Receive queue overrun on %s socket, %lu so far\n",
+			name, count);
+
+	state_resync_later(~0U);
+}
+
+int loop_source_recv(struct loop_source *s, struct loop_stats *st)
+{
+	char buf[LOOP_BUF_SIZE];
+	int bytes;
+
+	/* One wakeup may stand for many datagrams, read until empty */
+	for (;;) {
+		PROBE1(recv_entry, s->fd);
+		bytes = latency_recv(s->fd, buf, sizeof(buf), MSG_DONTWAIT | MSG_TRUNC);
+		PROBE2(recv_exit, s->fd, bytes);
+		st->recvs++;
+
+		if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+
+		/* Events were lost, the socket itself is fine */
+		if (bytes < 0 && errno == ENOBUFS) {
+			loop_overrun("netlink", ++st->overruns);
+			continue;
+		}
+
+		if (bytes <= 0) {
+			if (bytes == 0)
+				errno = ECONNRESET;
+			return -1;
+		}
+
+		/* MSG_TRUNC returns the real length, the rest is lost */
+		if ((size_t) bytes > sizeof(buf)) {
+			st->truncated++;
+			fprintf(stderr, "Truncated netlink datagram of %d bytes\n",
+				bytes);
+			continue;
+		}
+
+		st->datagrams++;
+		if (s->recv(s->data, buf, bytes))
+			return -1;
+	}
+}
+
+static int epoll_add(struct loop_source *s)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = s;
+
+	return epoll_ctl(epfd, EPOLL_CTL_ADD, s->fd, &ev);
+}
+
+static int epoll_run_once(int timeout)
+{
+	struct epoll_event evs[LOOP_MAX_SOURCES];
+	struct loop_source *s;
+	int i, n, ret;
+
+	n = epoll_wait(epfd, evs, LOOP_MAX_SOURCES, timeout);
+	stats.waits++;
+
+	if (n == -1)
+		return (errno == EINTR) ? 0 : -1;
+
+	for (i=0; i<n; i++) {
+		s = evs[i].data.ptr;
+
+		if (s->recv)
+			ret = loop_source_recv(s, &stats);
+		else
+			ret = s->ready(s->data, s->fd);
+
+		if (ret)
+			return -1;
+	}
+
+	return n;
+}
+
+int loop_init(int prefer)
+{
+	memset(&stats, 0, sizeof(stats));
+	nsources = 0;
+
+#ifdef HAVE_LIBURING
+	if (prefer == LOOP_URING && uring_init() == 0) {
+		backend = LOOP_URING;
+		return backend;
+	}
+#endif
+
+	if ( (epfd = epoll_create1(EPOLL_CLOEXEC)) == -1 )
+		return -1;
+
+	backend = LOOP_EPOLL;
+	return backend;
+}
+
+void loop_exit(void)
+{
+#ifdef HAVE_LIBURING
+	if (backend == LOOP_URING)
+		uring_exit();
+#endif
+
+	if (epfd != -1)
+		close(epfd);
+
+	epfd = -1;
+	backend = -1;
+	nsources = 0;
+}
+
+const char * loop_backend_name(void)
+{
+	return (backend < 0) ? "none" : backend_names[backend];
+}
+
+static int loop_add(int fd, loop_recv_t recv, loop_ready_t ready, void *data)
+{
+	struct loop_source *s;
+
+	if (nsources == LOOP_MAX_SOURCES) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	s = &sources[nsources];
+	memset(s, 0, sizeof(*s));
+	s->fd = fd;
+	s->recv = recv;
+	s->ready = ready;
+	s->data = data;
+
+#ifdef HAVE_LIBURING
+	if (backend == LOOP_URING) {
+		if (uring_add(s) == -1)
+			return -1;
+		nsources++;
+		return 0;
+	}
+#endif
+
+	if (epoll_add(s) == -1)
+		return -1;
+
+	nsources++;
+	return 0;
+}
+
+int loop_add_recv(int fd, loop_recv_t fn, void *data)
+{
+	return loop_add(fd, fn, NULL, data);
+}
+
+int loop_add_fd(int fd, loop_ready_t fn, void *data)
+{
+	return loop_add(fd, NULL, fn, data);
+}
+
+int loop_run_once(int timeout)
+{
+#ifdef HAVE_LIBURING
+	if (backend == LOOP_URING)
+		return uring_run_once(timeout, &stats);
+#endif
+
+	return epoll_run_once(timeout);
+}
+
+void loop_get_stats(struct loop_stats *st)
+{
+	*st = stats;
+}
@@ -0,0 +1,285 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include <liburing.h>
+
+#include <netevent/loop.h>
+#include <netevent/latency.h>
+
+#include "probes.h"
+
+static struct io_uring ring;
+static struct io_uring_buf_ring *br;
+static unsigned char *bufs;
+
+/* Room for the io_uring_recvmsg_out header, sender and timestamp */
+#define URING_BUF_SIZE	(LOOP_BUF_SIZE + 128)
+
+/* Calls of a readiness callback per completion, bounds one that leaves
+ * its fd readable */
+#define URING_READY_ROUNDS	64
+
+static struct io_uring_sqe * uring_get_sqe(void)
+{
+	struct io_uring_sqe *sqe;
+
+	if ( (sqe = io_uring_get_sqe(&ring)) == NULL ) {
+		io_uring_submit(&ring);
+		sqe = io_uring_get_sqe(&ring);
+	}
+
+	return sqe;
+}
+
+static void uring_recycle(int bid)
+{
+	io_uring_buf_ring_add(br, bufs + bid * URING_BUF_SIZE, URING_BUF_SIZE,
+			      bid, io_uring_buf_ring_mask(LOOP_RING_ENTRIES), 0);
+	io_uring_buf_ring_advance(br, 1);
+}
+
+static int uring_arm(struct loop_source *s)
+{
+	struct io_uring_sqe *sqe;
+
+	if ( (sqe = uring_get_sqe()) == NULL ) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	if (s->recv && !s->poll_only) {
+		memset(&s->msg, 0, sizeof(s->msg));
+		s->msg.msg_namelen = sizeof(struct sockaddr_nl);
+		if (latency_enabled())
+			s->msg.msg_controllen = CMSG_SPACE(sizeof(struct timespec));
+
+		io_uring_prep_recvmsg_multishot(sqe, s->fd, &s->msg, 0);
+		sqe->flags |= IOSQE_BUFFER_SELECT;
+		sqe->buf_group = LOOP_BGID;
+	} else {
+		io_uring_prep_poll_multishot(sqe, s->fd, POLLIN);
+	}
+
+	io_uring_sqe_set_data(sqe, s);
+
+	return 0;
+}
+
+int uring_init(void)
+{
+	int i, ret;
+
+	if ( (ret = io_uring_queue_init(LOOP_RING_DEPTH, &ring, 0)) < 0 ) {
+		errno = -ret;
+		return -1;
+	}
+
+	br = io_uring_setup_buf_ring(&ring, LOOP_RING_ENTRIES, LOOP_BGID, 0, &ret);
+	if (br == NULL) {
+		io_uring_queue_exit(&ring);
+		errno = -ret;
+		return -1;
+	}
+
+	if ( (bufs = malloc(LOOP_RING_ENTRIES * URING_BUF_SIZE)) == NULL ) {
+		uring_exit();
+		return -1;
+	}
+
+	for (i=0; i<LOOP_RING_ENTRIES; i++)
+		io_uring_buf_ring_add(br, bufs + i * URING_BUF_SIZE, URING_BUF_SIZE,
+				      i, io_uring_buf_ring_mask(LOOP_RING_ENTRIES), i);
+	io_uring_buf_ring_advance(br, LOOP_RING_ENTRIES);
+
+	return 0;
+}
+
+void uring_exit(void)
+{
+	if (br)
+		io_uring_free_buf_ring(&ring, br, LOOP_RING_ENTRIES, LOOP_BGID);
+	io_uring_queue_exit(&ring);
+
+	free(bufs);
+	bufs = NULL;
+	br = NULL;
+}
+
+int uring_add(struct loop_source *s)
+{
+	return uring_arm(s);
+}
+
+static uint64_t uring_timestamp(struct io_uring_recvmsg_out *o,
+				struct msghdr *msg)
+{
+	struct cmsghdr *cmsg;
+	struct timespec *ts;
+
+	for (cmsg = io_uring_recvmsg_cmsg_firsthdr(o, msg); cmsg;
+	     cmsg = io_uring_recvmsg_cmsg_nexthdr(o, msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET
+		    && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+			ts = (struct timespec *) CMSG_DATA(cmsg);
+			return (uint64_t) ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+		}
+	}
+
+	return 0;
+}
+
+static int uring_recvmsg_done(struct loop_source *s, struct io_uring_cqe *cqe,
+			      struct loop_stats *st)
+{
+	struct io_uring_recvmsg_out *o;
+	unsigned char *buf;
+	int bid, ret = 0;
+
+	bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	buf = bufs + bid * URING_BUF_SIZE;
+
+	o = io_uring_recvmsg_validate(buf, cqe->res, &s->msg);
+	PROBE2(recv_exit, s->fd, cqe->res);
+
+	if (o && (o->flags & MSG_TRUNC)) {
+		st->truncated++;
+		fprintf(stderr, "Truncated netlink datagram of %u bytes\n",
+			o->payloadlen);
+	} else if (o) {
+		if (latency_enabled())
+			latency_received(uring_timestamp(o, &s->msg));
+
+		st->datagrams++;
+		ret = s->recv(s->data, io_uring_recvmsg_payload(o, &s->msg),
+			      io_uring_recvmsg_payload_length(o, cqe->res, &s->msg));
+	}
+
+	uring_recycle(bid);
+
+	return ret;
+}
+
+static int uring_readable(int fd)
+{
+	struct pollfd p = { .fd = fd, .events = POLLIN };
+
+	return poll(&p, 1, 0) == 1 && (p.revents & POLLIN);
+}
+
+static int uring_complete(struct io_uring_cqe *cqe, struct loop_stats *st)
+{
+	struct loop_source *s = io_uring_cqe_get_data(cqe);
+	int ret = 0, rounds = 0;
+
+	if (cqe->res < 0) {
+		switch (-cqe->res) {
+		case EINVAL:
+			/* Kernel without multishot recvmsg */
+			if (s->recv && !s->poll_only) {
+				s->poll_only = 1;
+				break;
+			}
+			errno = EINVAL;
+			return -1;
+		case ENOBUFS:
+			/* Either the ring is exhausted, buffers are back once
+			 * dispatched, or the socket overran. They look alike,
+			 * a needless resync is the cheaper mistake */
+			if (s->recv)
+				loop_overrun("netlink", ++st->overruns);
+			break;
+		case ECANCELED:
+			break;
+		default:
+			errno = -cqe->res;
+			return -1;
+		}
+	} else if (cqe->flags & IORING_CQE_F_BUFFER) {
+		ret = uring_recvmsg_done(s, cqe, st);
+	} else if (s->recv) {
+		ret = loop_source_recv(s, st);
+	} else {
+		/* A multishot poll fires on new data only, what is already
+		 * queued would wait for the next unrelated wakeup */
+		do {
+			ret = s->ready(s->data, s->fd);
+		} while (ret == 0 && ++rounds < URING_READY_ROUNDS
+			 && uring_readable(s->fd));
+	}
+
+	if (!(cqe->flags & IORING_CQE_F_MORE) && uring_arm(s) == -1)
+		return -1;
+
+	return ret ? -1 : 0;
+}
+
+static int uring_drain(struct loop_stats *st)
+{
+	struct io_uring_cqe *cqe;
+	int n = 0, ret;
+
+	while (io_uring_peek_cqe(&ring, &cqe) == 0) {
+		ret = uring_complete(cqe, st);
+		io_uring_cqe_seen(&ring, cqe);
+
+		if (ret)
+			return -1;
+		n++;
+	}
+
+	return n;
+}
+
+int uring_run_once(int timeout, struct loop_stats *st)
+{
+	struct io_uring_cqe *cqe;
+	struct __kernel_timespec ts;
+	int ret;
+
+	/* Completions already in the ring cost no syscall */
+	if ( (ret = uring_drain(st)) != 0 ) {
+		if (ret > 0 && io_uring_sq_ready(&ring)) {
+			io_uring_submit(&ring);
+			st->waits++;
+		}
+		return ret;
+	}
+
+	ts.tv_sec = timeout / 1000;
+	ts.tv_nsec = (timeout % 1000) * 1000000;
+
+	ret = io_uring_submit_and_wait_timeout(&ring, &cqe, 1,
+					       timeout < 0 ? NULL : &ts, NULL);
+	st->waits++;
+
+	if (ret == -ETIME || ret == -EINTR)
+		return 0;
+
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+
+	return uring_drain(st);
+}
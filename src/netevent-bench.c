@@ -0,0 +1,188 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Compare event loop backends: a child adds and removes addresses on the
+ * loopback device, the parent receives the notifications through each
+ * backend in turn and reports the syscalls it took. Needs CAP_NET_ADMIN,
+ * preferably run in a scratch network namespace.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/wait.h>
+#include <sys/socket.h>
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <netevent/rtnl.h>
+#include <netevent/loop.h>
+
+struct addr_req
+{
+	struct nlmsghdr nlh;
+	struct ifaddrmsg ifa;
+	char attrs[64];
+};
+
+static unsigned long received;
+
+static int count_addr(void *data, void *buf, size_t len)
+{
+	struct nlmsghdr *nlh;
+
+	for (nlh = buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+		if (nlh->nlmsg_type == RTM_NEWADDR || nlh->nlmsg_type == RTM_DELADDR)
+			received++;
+	}
+
+	return 0;
+}
+
+static void addr_request(int sk, int type, uint32_t addr)
+{
+	struct addr_req req;
+	struct rtattr *rta;
+
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+	req.nlh.nlmsg_type = type;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST;
+	if (type == RTM_NEWADDR)
+		req.nlh.nlmsg_flags |= NLM_F_CREATE | NLM_F_EXCL;
+
+	req.ifa.ifa_family = AF_INET;
+	req.ifa.ifa_prefixlen = 32;
+	req.ifa.ifa_index = 1;
+
+	rta = (struct rtattr *) ((char *) &req + NLMSG_ALIGN(req.nlh.nlmsg_len));
+	rta->rta_type = IFA_LOCAL;
+	rta->rta_len = RTA_LENGTH(sizeof(addr));
+	memcpy(RTA_DATA(rta), &addr, sizeof(addr));
+	req.nlh.nlmsg_len = NLMSG_ALIGN(req.nlh.nlmsg_len) + rta->rta_len;
+
+	send(sk, &req, req.nlh.nlmsg_len, 0);
+}
+
+static void generate(unsigned int count)
+{
+	unsigned int i;
+	uint32_t base = htonl(0xc6120000);	/* 198.18.0.0/15 */
+	int sk;
+
+	if ( (sk = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE)) == -1 ) {
+		perror("socket()");
+		exit(1);
+	}
+
+	for (i=0; i<count; i++)
+		addr_request(sk, RTM_NEWADDR, base + htonl(i));
+
+	for (i=0; i<count; i++)
+		addr_request(sk, RTM_DELADDR, base + htonl(i));
+
+	close(sk);
+	exit(0);
+}
+
+static double elapsed_ms(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) * 1e3
+		+ (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static int run(int backend, unsigned int count)
+{
+	struct loop_stats st;
+	struct timespec start;
+	unsigned long syscalls;
+	int sk, size = 4 << 20;
+	pid_t pid;
+	double ms;
+
+	if ( (sk = setup_rtsocket(RTMGRP_IPV4_IFADDR)) == -1 ) {
+		perror("setup_rtsocket()");
+		return -1;
+	}
+	setsockopt(sk, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+	if (loop_init(backend) != backend) {
+		printf("%-9s unavailable\n", backend == LOOP_URING ? "io_uring" : "epoll");
+		loop_exit();
+		close(sk);
+		return 0;
+	}
+
+	loop_add_recv(sk, count_addr, NULL);
+
+	received = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if ( (pid = fork()) == 0 )
+		generate(count);
+
+	while (received < 2 * count) {
+		if (loop_run_once(1000) <= 0)
+			break;
+	}
+
+	ms = elapsed_ms(&start);
+	waitpid(pid, NULL, 0);
+
+	loop_get_stats(&st);
+	syscalls = st.waits + st.recvs;
+
+	printf("%-9s %lu events, %lu datagrams, %lu syscalls (%.2f/event), %.1f ms\n",
+	       loop_backend_name(), received, st.datagrams, syscalls,
+	       received ? (double) syscalls / received : 0.0, ms);
+
+	loop_exit();
+	close(sk);
+
+	return received == 2 * count ? 0 : -1;
+}
+
+int main(int argc, char ** argv)
+{
+	unsigned int count = 10000;
+	int opt, ret = 0;
+
+	while((opt = getopt(argc, argv, "n:h")) != -1) {
+		switch(opt) {
+		case 'n':
+			count = atoi(optarg);
+			break;
+		default:
+			printf("Usage: netevent-bench [-n ADDRESSES]\n");
+			exit(opt != 'h');
+		}
+	}
+
+	ret |= run(LOOP_EPOLL, count);
+	ret |= run(LOOP_URING, count);
+
+	return ret ? 1 : 0;
+}
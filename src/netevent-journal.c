@@ -0,0 +1,126 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <netevent/journal.h>
+
+static void usage()
+{
+	printf("\nUsage: netevent-journal [OPTIONS] DIR\n"
+		"Options:\n"
+		"\t-s, --seq N\tresume from sequence number N\n"
+		"\t-t, --since SECS\tstart at the first event at or after SECS since the epoch\n"
+		"\t-f, --follow\tkeep waiting for new events\n"
+		"\t-h, --help\tdisplay this help and exit\n"
+		"\nThe cursor to resume from is printed on stderr on exit.\n"
+		);
+}
+
+static void print_record(const struct journal_record *rec)
+{
+	time_t secs = rec->ts / 1000000;
+	struct tm *t = localtime(&secs);
+
+	printf("%llu [%02d:%02d:%02d.%06ld] %.*s\n",
+		(unsigned long long) rec->seq, t->tm_hour, t->tm_min, t->tm_sec,
+		(long) (rec->ts % 1000000), (int) rec->len, rec->msg);
+}
+
+int main(int argc, char ** argv)
+{
+	struct journal_reader *r;
+	struct journal_record rec;
+	unsigned long long seq = 0, since = 0;
+	int opt, idx = 0, follow = 0, by_time = 0, ret;
+	uint64_t cursor = 0;
+
+	struct option lopts[] = {
+		{"seq", 1, 0, 's'},
+		{"since", 1, 0, 't'},
+		{"follow", 0, 0, 'f'},
+		{"help", 0, 0, 'h'},
+		{0, 0, 0, 0},
+	};
+
+	while((opt = getopt_long(argc, argv, "s:t:fh", lopts, &idx)) != -1) {
+		switch(opt) {
+		case 's':
+			seq = strtoull(optarg, NULL, 0);
+			break;
+		case 't':
+			since = strtoull(optarg, NULL, 0);
+			by_time = 1;
+			break;
+		case 'f':
+			follow = 1;
+			break;
+		case 'h':
+			usage();
+			exit(0);
+		default:
+			exit(1);
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage();
+		exit(1);
+	}
+
+	if ( (r = journal_open(argv[optind])) == NULL ) {
+		perror("journal_open()");
+		exit(1);
+	}
+
+	if (by_time)
+		journal_seek_time(r, since * 1000000);
+	else
+		journal_seek_seq(r, seq);
+
+	cursor = seq;
+
+	while (1) {
+		ret = journal_next(r, &rec);
+
+		if (ret == 1) {
+			print_record(&rec);
+			cursor = rec.seq + 1;
+			continue;
+		}
+
+		if (ret < 0) {
+			fprintf(stderr, "Corrupted journal record\n");
+			break;
+		}
+
+		if (!follow)
+			break;
+
+		fflush(stdout);
+		sleep(1);
+	}
+
+	fprintf(stderr, "cursor %llu\n", (unsigned long long) cursor);
+
+	journal_reader_close(r);
+
+	return ret < 0;
+}
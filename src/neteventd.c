@@ -36,6 +36,7 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/signalfd.h>
 
 #include <net/if.h>
 #include <net/ethernet.h>
@@ -52,12 +53,245 @@
 #include <netevent/rtnl.h>
 #include <netevent/iw.h>
 #include <netevent/nl80211.h>
+#include <netevent/nexthop.h>
+#include <netevent/timer.h>
+#include <netevent/lifetime.h>
+#include <netevent/coalesce.h>
+#include <netevent/summary.h>
+#include <netevent/journal.h>
+#include <netevent/loop.h>
+#include <netevent/reader.h>
+#include <netevent/prio.h>
+#include <netevent/latency.h>
+#include <netevent/plugin.h>
+#include <netevent/hook.h>
+#include <netevent/state.h>
+#include <netevent/ctl.h>
+#include <netevent/shm.h>
+#include <netevent/fdb.h>
+#include <netevent/stats.h>
+#include <netevent/cqm.h>
+#include <netevent/survey.h>
+#include <netevent/conntrack.h>
+
+#define OPT_JOURNAL_SIZE	256
+#define OPT_JOURNAL_AGE		257
+#define OPT_CPU			258
+#define OPT_FIFO		259
+#define OPT_RCVBUF		260
+#define OPT_TRACE		261
+#define OPT_PLUGIN_BUDGET	262
+#define OPT_HOOK_HELPERS	263
+#define OPT_CONTROL		264
+#define OPT_SHM			265
+#define OPT_STATS_THRESHOLD	266
+#define OPT_CQM			267
+#define OPT_SURVEY		268
+#define OPT_CONNTRACK		269
+
+#define SRC_RTNL		0
+#define SRC_NL80211		1
+#define SRC_MAX			2
+
+static unsigned int coalesce_window;
+static unsigned int damp_half_life;
+static unsigned int summary_interval;
+static const char *journal_dir;
+static size_t journal_size;
+static unsigned int journal_age;
+static int loop_backend = LOOP_URING;
+static int threaded;
+static int classes;
+static unsigned int latency_interval;
+static int latency_trace;
+static const char *plugin_dir;
+static unsigned int plugin_budget = PLUGIN_BUDGET;
+static int hook_helpers = HOOK_HELPERS;
+static const char *config_path;
+static const char *state_path;
+static const char *control_path;
+static const char *shm_path;
+static unsigned int stats_interval;
+static unsigned int survey_interval;
+static int rt_socket = -1;
+static int nl80211_links;	/* nl80211 follows link events, see nl80211_rt_event() */
+
+/* What a reload may change, the rest needs a restart */
+struct settings
+{
+	int filter;
+	int color;
+};
+
+/* From the command line, the --config file overrides them */
+static struct settings cmdline;
+static struct settings running;
+static int src_cpu[SRC_MAX] = { -1, -1 };
+static int src_prio[SRC_MAX];
+static const char *src_names[SRC_MAX] = { "rtnl", "nl80211" };
+static int class_rcvbuf[PRIO_CLASSES];
+static int quit;
+
+static int parse_config(const char *path, struct settings *s)
+{
+	char line[512], *key, *val, *save, *p;
+	int lineno = 0, bit;
+	FILE *f;
+
+	*s = cmdline;
+
+	if ( (f = fopen(path, "r")) == NULL ) {
+		tprintf("%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+
+		if ( (p = strchr(line, '#')) != NULL )
+			*p = '\0';
+
+		if ( (key = strtok_r(line, " \t\n", &save)) == NULL )
+			continue;
+
+		if (strcmp(key, "filter") == 0) {
+			s->filter = 0;
+			while ( (val = strtok_r(NULL, " \t\n", &save)) != NULL ) {
+				if ( (bit = rtnl_group_bit(val)) == 0 )
+					goto invalid;
+				s->filter |= bit;
+			}
+			if (s->filter == 0)
+				goto invalid;
+		} else if (strcmp(key, "color") == 0) {
+			val = strtok_r(NULL, " \t\n", &save);
+			if (val && strcmp(val, "on") == 0)
+				s->color = 1;
+			else if (val && strcmp(val, "off") == 0)
+				s->color = 0;
+			else
+				goto invalid;
+		} else {
+			goto invalid;
+		}
+	}
+
+	fclose(f);
+	return 0;
+
+invalid:
+	tprintf("%s:%d: invalid line\n", path, lineno);
+	fclose(f);
+	return -1;
+}
+
+static int set_filter(int old, int filter)
+{
+	if (classes)
+		return prio_set_filter(old, filter);
+
+	return rtnl_set_filter(rt_socket, old, filter);
+}
+
+/* What dumped or subscribed from the filter at startup and cannot follow */
+static const char * filter_bound(int filter)
+{
+	if (state_path || control_path)
+		return "the state";
+	if (shm_path)
+		return "the shm export";
+	if (nl80211_links && !(filter & RTMGRP_LINK))
+		return "wireless link tracking";
+
+	return NULL;
+}
+
+/*
+ * Sockets stay bound, only the groups that differ are joined or left.
+ * Everything that reads the settings runs in the loop thread, so
+ * swapping them between two iterations is atomic for the event path.
+ */
+static int apply_settings(const struct settings *s)
+{
+	struct settings next = *s;
+	const char *bound;
+	int err;
+
+	if (next.filter != running.filter
+	    && (bound = filter_bound(next.filter)) != NULL) {
+		tprintf("Filter change ignored, %s follows the startup filter, "
+			"restart to change it\n", bound);
+		next.filter = running.filter;
+	}
+
+	if (next.filter != running.filter
+	    && set_filter(running.filter, next.filter) == -1) {
+		err = errno;
+		/* Undo the groups changed before the failure */
+		set_filter(next.filter, running.filter);
+		errno = err;
+		return -1;
+	}
+
+	if (next.color && !running.color)
+		enable_color_output();
+	else if (!next.color && running.color)
+		disable_color_output();
+
+	running = next;
+
+	return 0;
+}
+
+static int reload_settings(void)
+{
+	struct settings next;
+
+	if (config_path == NULL) {
+		tprintf("Reload ignored, no --config file\n");
+		return -1;
+	}
+
+	if (parse_config(config_path, &next) == -1) {
+		tprintf("Keeping the running configuration\n");
+		return -1;
+	}
+
+	if (apply_settings(&next) == -1) {
+		tprintf("Reload of %s failed: %s\n", config_path, strerror(errno));
+		return -1;
+	}
+
+	tprintf("Reloaded %s\n", config_path);
+
+	return 0;
+}
+
+/* Signals arrive here, in the loop, never in the middle of an update */
+static int signal_ready(void *data, int fd)
+{
+	struct signalfd_siginfo si;
+
+	while (read(fd, &si, sizeof(si)) == sizeof(si)) {
+		if (si.ssi_signo == SIGHUP)
+			reload_settings();
+		else
+			quit = 1;
+	}
 
-#define MAXFD(X,Y) ((X>Y)?X:Y)
+	return 0;
+}
 
-static void signal_handler(int sig)
+static int nl80211_ready(void *data, int fd)
 {
-	exit(0);
+	nl80211_msg_rx(fd);
+	return 0;
+}
+
+static int timer_ready(void *data, int fd)
+{
+	timer_run(fd);
+	return 0;
 }
 
 static void usage()
@@ -65,6 +299,34 @@ static void usage()
 	printf("\nUsage: neteventd [OPTIONS] [FILTERS]]\n"
 		"Options:\n"
 		"\t-c, --color\tcontrol whether color is used\n"
+		"\t-C, --config FILE\tfilter and color settings, reloaded on SIGHUP\n"
+		"\t-n, --neigh-expiry\treport when reachable neighbors go stale\n"
+		"\t-w, --coalesce SECS\tfold link and route flaps within SECS\n"
+		"\t-d, --damping SECS\tflap damping with a SECS half-life\n"
+		"\t-s, --summary SECS\tprint top talkers every SECS instead of events\n"
+		"\t-j, --journal DIR\tappend events to a journal in DIR\n"
+		"\t    --journal-size MB\trotate journal segments at MB megabytes\n"
+		"\t    --journal-age SECS\trotate journal segments after SECS\n"
+		"\t-b, --backend NAME\tevent loop backend, io_uring (default) or epoll\n"
+		"\t-T, --threads\tread each source in its own thread\n"
+		"\t    --cpu SOURCE=CPU\tpin the rtnl or nl80211 reader to CPU\n"
+		"\t    --fifo SOURCE=PRIO\trun the reader with SCHED_FIFO priority PRIO\n"
+		"\t-P, --classes\tone socket per link, route and neigh class\n"
+		"\t    --rcvbuf CLASS=KB\treceive buffer size of a class socket\n"
+		"\t-L, --latency SECS\tprint event latency histograms every SECS\n"
+		"\t    --trace\tappend per-event latencies to every line\n"
+		"\t-p, --plugins DIR\tload handler plugins from DIR\n"
+		"\t    --plugin-budget US\tdisable plugins that keep taking over US\n"
+		"\t-x, --hook SPEC\trun a command on matching events, repeatable\n"
+		"\t    --hook-helpers N\tnumber of processes running hook commands\n"
+		"\t-S, --state FILE\tkeep state in FILE across restarts, report what changed\n"
+		"\t    --control PATH\tanswer state queries on a Unix socket at PATH\n"
+		"\t    --shm PATH\texport links, addresses and neighbors to PATH\n"
+		"\t-R, --stats SECS\tsample interface counters every SECS\n"
+		"\t    --stats-threshold NAME=RATE\treport a counter rate crossing RATE per second\n"
+		"\t    --cqm SPEC\tpush signal and TX failure thresholds to a wireless interface\n"
+		"\t    --survey SECS\tsample wireless channel utilization every SECS\n"
+		"\t    --conntrack SPEC\treport connection tracking events, new:destroy:proto=tcp:sample=N:agg=SECS\n"
 		"\t-h, --help\tdisplay this help and exit\n"
 		"\nFilters:\n"
 		"\tRTMGRP_LINK RTMGRP_NOTIFY RTMGRP_NEIGH RTMGRP_IPV6_IFADDR\n"
@@ -87,34 +349,15 @@ static void set_opt(int * opts, int opt)
 
 static void parse_filters(char **argv, int start, int stop, int * filter)
 {
-	int f = 0;
+	int f = 0, bit;
 	int pos = start;
 
 	for (pos=start; pos<stop; pos++) {
-		if (strcmp(argv[pos], "RTMGRP_LINK") == 0) {
-			f |= RTMGRP_LINK;
-		} else if (strcmp(argv[pos], "RTMGRP_NOTIFY") == 0) {
-			f |= RTMGRP_NOTIFY;
-		} else if (strcmp(argv[pos], "RTMGRP_NEIGH") == 0) {
-			f |= RTMGRP_NEIGH;
-		} else if (strcmp(argv[pos], "RTMGRP_IPV6_IFADDR") == 0) {
-			f |= RTMGRP_IPV6_IFADDR;
-		}  else if (strcmp(argv[pos], "RTMGRP_IPV6_ROUTE") == 0) {
-			f |= RTMGRP_IPV6_ROUTE;
-		}  else if (strcmp(argv[pos], "RTMGRP_IPV6_MROUTE") == 0) {
-			f |= RTMGRP_IPV6_MROUTE;
-		}  else if (strcmp(argv[pos], "RTMGRP_IPV6_IFINFO") == 0) {
-			f |= RTMGRP_IPV6_IFINFO;
-		}  else if (strcmp(argv[pos], "RTMGRP_IPV4_IFADDR") == 0) {
-			f |= RTMGRP_IPV4_IFADDR;
-		} else if (strcmp(argv[pos], "RTMGRP_IPV4_ROUTE") == 0) {
-			f |= RTMGRP_IPV4_ROUTE;
-		} else if (strcmp(argv[pos], "RTMGRP_IPV4_MROUTE") == 0) {
-			f |= RTMGRP_IPV4_MROUTE;
-		} else {
+		if ( (bit = rtnl_group_bit(argv[pos])) == 0 ) {
 			printf("Invalid argument: %s\n", argv[pos]);
 			exit(1);
 		}
+		f |= bit;
 	}
 	printf("Filter: ");
 	for (pos=start; pos<stop; pos++) {
@@ -124,22 +367,71 @@ static void parse_filters(char **argv, int start, int stop, int * filter)
 	*filter = f;
 }
 
+/* NAME=VALUE, for per-source and per-class settings */
+static void parse_name_value(char *arg, const char **names, int n, int *values)
+{
+	char *eq = strchr(arg, '=');
+	int i;
+
+	if (eq) {
+		for (i=0; i<n; i++) {
+			if (strncmp(arg, names[i], eq - arg) == 0
+			    && names[i][eq - arg] == '\0') {
+				values[i] = atoi(eq + 1);
+				return;
+			}
+		}
+	}
+
+	printf("Invalid argument: %s\n", arg);
+	exit(1);
+}
+
 static void parse_opts(int argc, char ** argv, int * opts, int * filter)
 {
 	int opt, idx=0;
 	struct option lopts[] = {
 		{"help", 0, 0, 'h'},
 		{"color", 0, 0, 'c'},
+		{"config", 1, 0, 'C'},
+		{"neigh-expiry", 0, 0, 'n'},
+		{"coalesce", 1, 0, 'w'},
+		{"damping", 1, 0, 'd'},
+		{"summary", 1, 0, 's'},
+		{"journal", 1, 0, 'j'},
+		{"backend", 1, 0, 'b'},
+		{"threads", 0, 0, 'T'},
+		{"cpu", 1, 0, OPT_CPU},
+		{"fifo", 1, 0, OPT_FIFO},
+		{"classes", 0, 0, 'P'},
+		{"rcvbuf", 1, 0, OPT_RCVBUF},
+		{"latency", 1, 0, 'L'},
+		{"trace", 0, 0, OPT_TRACE},
+		{"plugins", 1, 0, 'p'},
+		{"plugin-budget", 1, 0, OPT_PLUGIN_BUDGET},
+		{"hook", 1, 0, 'x'},
+		{"hook-helpers", 1, 0, OPT_HOOK_HELPERS},
+		{"state", 1, 0, 'S'},
+		{"control", 1, 0, OPT_CONTROL},
+		{"shm", 1, 0, OPT_SHM},
+		{"stats", 1, 0, 'R'},
+		{"stats-threshold", 1, 0, OPT_STATS_THRESHOLD},
+		{"cqm", 1, 0, OPT_CQM},
+		{"survey", 1, 0, OPT_SURVEY},
+		{"conntrack", 1, 0, OPT_CONNTRACK},
+		{"journal-size", 1, 0, OPT_JOURNAL_SIZE},
+		{"journal-age", 1, 0, OPT_JOURNAL_AGE},
+		{0, 0, 0, 0},
 	};
 
 	init_opts(opts);
 
-	if ( argc < 1 || argc > 5) {
+	if ( argc < 1 ) {
 		printf("Invalid arguments\n");
 		exit(1);
 	}
 
-	while((opt = getopt_long(argc, argv, "hc", lopts, &idx)) != -1) {
+	while((opt = getopt_long(argc, argv, "hcC:nw:d:s:j:b:TPL:p:x:S:R:", lopts, &idx)) != -1) {
 		switch(opt) {
 		case 0:
 			break;
@@ -151,6 +443,113 @@ static void parse_opts(int argc, char ** argv, int * opts, int * filter)
 			set_opt(opts, OPT_COLOR);
 			enable_color_output();
 			break;
+		case 'C':
+			config_path = optarg;
+			break;
+		case 'n':
+			set_opt(opts, OPT_NEIGH_EXPIRY);
+			break;
+		case 'w':
+			coalesce_window = atoi(optarg);
+			break;
+		case 'd':
+			damp_half_life = atoi(optarg);
+			break;
+		case 's':
+			summary_interval = atoi(optarg);
+			break;
+		case 'j':
+			journal_dir = optarg;
+			break;
+		case 'b':
+			if (strcmp(optarg, "epoll") == 0) {
+				loop_backend = LOOP_EPOLL;
+			} else if (strcmp(optarg, "io_uring") == 0) {
+				loop_backend = LOOP_URING;
+			} else {
+				printf("Invalid backend: %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'T':
+			threaded = 1;
+			break;
+		case OPT_CPU:
+			parse_name_value(optarg, src_names, SRC_MAX, src_cpu);
+			break;
+		case OPT_FIFO:
+			parse_name_value(optarg, src_names, SRC_MAX, src_prio);
+			break;
+		case 'P':
+			classes = 1;
+			break;
+		case OPT_RCVBUF:
+			parse_name_value(optarg, prio_names, PRIO_CLASSES, class_rcvbuf);
+			break;
+		case 'L':
+			latency_interval = atoi(optarg);
+			break;
+		case OPT_TRACE:
+			latency_trace = 1;
+			break;
+		case 'p':
+			plugin_dir = optarg;
+			break;
+		case OPT_PLUGIN_BUDGET:
+			plugin_budget = atoi(optarg);
+			break;
+		case 'x':
+			if (hook_add(optarg) == -1) {
+				printf("Invalid hook \"%s\": %s\n", optarg,
+				       strerror(errno));
+				exit(1);
+			}
+			break;
+		case OPT_HOOK_HELPERS:
+			hook_helpers = atoi(optarg);
+			break;
+		case 'S':
+			state_path = optarg;
+			break;
+		case OPT_CONTROL:
+			control_path = optarg;
+			break;
+		case OPT_SHM:
+			shm_path = optarg;
+			break;
+		case 'R':
+			stats_interval = atoi(optarg);
+			break;
+		case OPT_CQM:
+			if (cqm_add(optarg) == -1) {
+				printf("Invalid CQM spec \"%s\": %s\n", optarg,
+				       strerror(errno));
+				exit(1);
+			}
+			break;
+		case OPT_CONNTRACK:
+			if (conntrack_setup(optarg) == -1) {
+				printf("Invalid conntrack spec \"%s\": %s\n", optarg,
+				       strerror(errno));
+				exit(1);
+			}
+			break;
+		case OPT_SURVEY:
+			survey_interval = atoi(optarg);
+			break;
+		case OPT_STATS_THRESHOLD:
+			if (stats_add_threshold(optarg) == -1) {
+				printf("Invalid threshold \"%s\": %s\n", optarg,
+				       strerror(errno));
+				exit(1);
+			}
+			break;
+		case OPT_JOURNAL_SIZE:
+			journal_size = (size_t) atoi(optarg) << 20;
+			break;
+		case OPT_JOURNAL_AGE:
+			journal_age = atoi(optarg);
+			break;
 		default:
 			exit(1);
 			break;
@@ -160,78 +559,234 @@ static void parse_opts(int argc, char ** argv, int * opts, int * filter)
 	if (optind < argc) {
 		parse_filters(argv, optind, argc, filter);
 	}
+
+	if (threaded && classes) {
+		printf("--threads and --classes cannot be combined\n");
+		exit(1);
+	}
 }
 
 int main(int argc, char ** argv)
 {
-	int sknl, sknl80211, retval, maxfd;
+	int sknl = -1, sknl80211, tfd, sfd, retval, i;
+	sigset_t sigs;
 	struct event_handler ev_handler;
 
 	int opts, filter;
 
+	// Hook helpers are this binary re-executed
+	if (argc == 3 && strcmp(argv[1], HOOK_HELPER_ARG) == 0)
+		return hook_helper(atoi(argv[2]));
+
 	// default filter
 	filter = DEFAULT_FILTER;
 
 	parse_opts(argc, argv, &opts, &filter);
 
-	if ( (sknl=setup_rtsocket(filter)) == -1 ) {
+	cmdline.filter = filter;
+	cmdline.color = (opts & OPT_COLOR) != 0;
+	running = cmdline;
+
+	if (config_path) {
+		if (parse_config(config_path, &running) == -1)
+			exit(1);
+		if (running.color && !cmdline.color)
+			enable_color_output();
+		else if (!running.color && cmdline.color)
+			disable_color_output();
+		filter = running.filter;
+	}
+
+	if ( nexthop_init() == -1 || fdb_init() == -1 ) {
+		printf("Error %d: %s\n", errno, strerror(errno));
+		exit(1);
+	}
+
+	if ( (tfd=timer_init()) == -1
+	     || lifetime_init(opts & OPT_NEIGH_EXPIRY) == -1 ) {
+		printf("Error %d: %s\n", errno, strerror(errno));
+		exit(1);
+	}
+
+	if ( (coalesce_window || damp_half_life)
+	     && coalesce_init(coalesce_window, damp_half_life) == -1 ) {
+		printf("Error %d: %s\n", errno, strerror(errno));
+		exit(1);
+	}
+
+	if ( summary_interval && summary_init(summary_interval) == -1 ) {
 		printf("Error %d: %s\n", errno, strerror(errno));
 		exit(1);
 	}
 
-	sknl80211= nl80211_socket_init();
+	if ( (latency_interval || latency_trace)
+	     && latency_init(latency_interval, latency_trace) == -1 ) {
+		printf("Error %d: %s\n", errno, strerror(errno));
+		exit(1);
+	}
+
+	if ( journal_dir && journal_init(journal_dir, journal_size, journal_age) == -1 ) {
+		printf("Error %d: %s\n", errno, strerror(errno));
+		exit(1);
+	}
+
+	if ( !classes && (sknl=setup_rtsocket(filter)) == -1 ) {
+		printf("Error %d: %s\n", errno, strerror(errno));
+		exit(1);
+	}
+	rt_socket = sknl;
+
+	// Wireless waits for a wireless link, or for nothing without link events
+	if ( (sknl80211 = nl80211_socket_init(filter & RTMGRP_LINK)) == -1 )
+		tprintf("Wireless events unavailable: %s\n", strerror(errno));
+
+	if ( (sknl != -1 && latency_socket(sknl) == -1)
+	     || (sknl80211 != -1 && latency_socket(sknl80211) == -1) ) {
+		printf("Error %d: %s\n", errno, strerror(errno));
+		exit(1);
+	}
 
 	// Setup event handler
 	event_init(&ev_handler);
-	event_register(&ev_handler, parse_rt_event);
+	if (summary_enabled())
+		event_register(&ev_handler, summary_rt_event);
+	else
+		event_register(&ev_handler, parse_rt_event);
+	if (plugin_dir)
+		event_register(&ev_handler, plugin_rt_event);
+	if (hook_enabled())
+		event_register(&ev_handler, hook_rt_event);
+	if (state_path || control_path)
+		event_register(&ev_handler, state_rt_event);
+	if (shm_path)
+		event_register(&ev_handler, shm_rt_event);
+	if (sknl80211 != -1 && (filter & RTMGRP_LINK)) {
+		event_register(&ev_handler, nl80211_rt_event);
+		nl80211_links = 1;
+	}
 
-	// Install signal handlers
-	signal(SIGHUP, signal_handler);
-	signal(SIGTERM, signal_handler);
-	signal(SIGINT, signal_handler);
+	// Signals are read from the loop, SIGHUP reloads, the others leave it
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGHUP);
+	sigaddset(&sigs, SIGTERM);
+	sigaddset(&sigs, SIGINT);
+	if ( sigprocmask(SIG_BLOCK, &sigs, NULL) == -1
+	     || (sfd = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC)) == -1 ) {
+		printf("Error %d: %s\n", errno, strerror(errno));
+		exit(1);
+	}
 
 	// Register cleanup function
 	atexit(console_exit_cleanup);
+	atexit(fdb_report);
+	if (journal_dir)
+		atexit(journal_close);
+	if (classes)
+		atexit(prio_report);
+	if (latency_interval)
+		atexit(latency_report);
+	if (plugin_dir) {
+		atexit(plugin_close);
+		atexit(plugin_report);
+	}
+	if (hook_enabled())
+		atexit(hook_report);
+	if (state_path)
+		atexit(state_close);
+	if (control_path)
+		atexit(ctl_close);
+	if (shm_path)
+		atexit(shm_close);
+	if (conntrack_enabled())
+		atexit(conntrack_report);
+
+	for (i=0; i<PRIO_CLASSES; i++) {
+		if (class_rcvbuf[i])
+			prio_set_rcvbuf(i, class_rcvbuf[i] << 10);
+	}
 
-	fd_set rfds;
+	if ( loop_init(loop_backend) == -1
+	     || loop_add_fd(tfd, timer_ready, NULL) == -1
+	     || loop_add_fd(sfd, signal_ready, NULL) == -1 ) {
+		printf("Error %d: %s\n", errno, strerror(errno));
+		exit(1);
+	}
 
-	struct timeval tv;
+	if ( plugin_dir && plugin_init(plugin_dir, plugin_budget) == -1 ) {
+		printf("Error %d: %s\n", errno, strerror(errno));
+		exit(1);
+	}
 
-	FD_ZERO(&rfds);
+	if ( hook_enabled() && hook_init(hook_helpers) == -1 ) {
+		printf("Error %d: %s\n", errno, strerror(errno));
+		exit(1);
+	}
 
-	while(1) {
+	if ( stats_interval && stats_init(stats_interval) == -1 ) {
+		printf("Error %d: %s\n", errno, strerror(errno));
+		exit(1);
+	}
 
-		maxfd = 0;
+	if ( cqm_enabled() && cqm_init() == -1 ) {
+		printf("Error %d: %s\n", errno, strerror(errno));
+		exit(1);
+	}
 
-		FD_SET(sknl, &rfds);
-		maxfd = MAXFD(sknl, maxfd);
+	if ( survey_interval && survey_init(survey_interval) == -1 ) {
+		printf("Error %d: %s\n", errno, strerror(errno));
+		exit(1);
+	}
 
-		FD_SET(sknl80211, &rfds);
-		maxfd = MAXFD(sknl80211, maxfd);
+	if ( conntrack_enabled() && conntrack_init() == -1 ) {
+		printf("Error %d: %s\n", errno, strerror(errno));
+		exit(1);
+	}
 
-		tv.tv_sec = 1;
-		tv.tv_usec = 0;
+	if (threaded) {
+		retval = reader_add(src_names[SRC_RTNL], sknl, rtnl_dispatch,
+				    &ev_handler, src_cpu[SRC_RTNL], src_prio[SRC_RTNL]);
+		if (retval == 0 && sknl80211 != -1)
+			retval = reader_add(src_names[SRC_NL80211], sknl80211,
+					    nl80211_feed, NULL,
+					    src_cpu[SRC_NL80211], src_prio[SRC_NL80211]);
+		if (retval == 0)
+			retval = reader_start();
+	} else {
+		if (classes)
+			retval = prio_init(filter, &ev_handler);
+		else
+			retval = loop_add_recv(sknl, rtnl_dispatch, &ev_handler);
+		if (retval == 0 && sknl80211 != -1)
+			retval = loop_add_fd(sknl80211, nl80211_ready, NULL);
+	}
 
-		retval = select(maxfd+1, &rfds, NULL, NULL, &tv);
+	if (retval == -1) {
+		printf("Error %d: %s\n", errno, strerror(errno));
+		exit(1);
+	}
 
-		if (retval == -1) {
-			perror("select()\n");
-			exit(1);
-		}
+	// Sockets are bound, events during the dump wait in their queues
+	if ( (state_path || control_path)
+	     && state_init(state_path, filter, &ev_handler) == -1 ) {
+		printf("Error %d: %s\n", errno, strerror(errno));
+		exit(1);
+	}
 
-		if (retval) {
-			if(FD_ISSET(sknl, &rfds)) {
-				if (recv_rtnl_msg(&ev_handler, sknl) != 0 ) {
-					printf("Error %d: %s\n", errno, strerror(errno));
-					exit(1);
-				}
-			}
+	if ( control_path && ctl_init(control_path, reload_settings) == -1 ) {
+		printf("Error %d: %s\n", errno, strerror(errno));
+		exit(1);
+	}
 
-			if(FD_ISSET(sknl80211, &rfds)) {
-				nl80211_msg_rx(sknl80211);
-			}
+	if ( shm_path && shm_init(shm_path, filter) == -1 ) {
+		printf("Error %d: %s\n", errno, strerror(errno));
+		exit(1);
+	}
 
-		} else {
+	// Cleanup runs from atexit() once the loop is left
+	while (!quit) {
+		if (loop_run_once(-1) == -1) {
+			printf("Error %d: %s\n", errno, strerror(errno));
+			exit(1);
 		}
 	}
 
@@ -0,0 +1,535 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+#include <net/if.h>
+
+#include <netevent/nexthop.h>
+#include <netevent/console.h>
+#include <netevent/utils.h>
+#include <netevent/fmt.h>
+#include <netevent/latency.h>
+
+static struct htable nh_table;
+static struct htable mpath_table;
+static struct htable ref_table;
+static unsigned int mpath_next_id = 1;
+
+/*
+ * Replacing a nexthop makes the kernel re-announce every route using it
+ * with NLM_F_REPLACE, right after the nexthop itself and with the same
+ * nlmsg_pid and nlmsg_seq, unless nexthop_compat_mode is off. The change
+ * is reported once on the nexthop and each dependent route is swallowed
+ * once. The burst ends on the first route message that is not part of it.
+ */
+static uint32_t changed_id;
+static uint32_t changed_pid;
+static uint32_t changed_seq;
+static unsigned long burst;
+
+/* The nexthop object or path set a route holds a reference on */
+struct route_ref
+{
+	struct hnode node;
+	struct route_key key;
+	uint32_t nhid;
+	struct mpath_entry *mp;
+	unsigned long burst;	/* last burst the route was re-announced in */
+};
+
+struct mpath_key
+{
+	unsigned char family;
+	const void *data;
+	int len;
+};
+
+static int nh_cmp(const struct hnode *n, const void *key)
+{
+	const struct nh_entry *nh = hnode_entry(n, struct nh_entry, node);
+
+	return nh->id != *(const uint32_t *) key;
+}
+
+static int mpath_cmp(const struct hnode *n, const void *key)
+{
+	const struct mpath_entry *mp = hnode_entry(n, struct mpath_entry, node);
+	const struct mpath_key *k = key;
+
+	return (mp->family != k->family) || (mp->len != k->len)
+		|| memcmp(mp->data, k->data, k->len);
+}
+
+static int ref_cmp(const struct hnode *n, const void *key)
+{
+	const struct route_ref *ref = hnode_entry(n, struct route_ref, node);
+
+	return memcmp(&ref->key, key, sizeof(ref->key));
+}
+
+int nexthop_init(void)
+{
+	if (htable_init(&nh_table, 64, nh_cmp) < 0
+	    || htable_init(&ref_table, 64, ref_cmp) < 0)
+		return -1;
+
+	return htable_init(&mpath_table, 64, mpath_cmp);
+}
+
+static struct route_ref * ref_lookup(const struct route_key *rk)
+{
+	struct hnode *n;
+
+	if (ref_table.buckets == NULL)
+		return NULL;
+
+	n = htable_find(&ref_table, hash_bytes(rk, sizeof(*rk), 0), rk);
+
+	return n ? hnode_entry(n, struct route_ref, node) : NULL;
+}
+
+static struct route_ref * ref_get(const struct route_key *rk)
+{
+	struct route_ref *ref = ref_lookup(rk);
+
+	if (ref || ref_table.buckets == NULL)
+		return ref;
+
+	if ( (ref = calloc(1, sizeof(*ref))) == NULL )
+		return NULL;
+
+	ref->key = *rk;
+	htable_insert(&ref_table, &ref->node, hash_bytes(rk, sizeof(*rk), 0));
+
+	return ref;
+}
+
+static void mpath_put(struct mpath_entry *mp)
+{
+	if (--mp->routes == 0) {
+		htable_remove(&mpath_table, &mp->node);
+		free(mp);
+	}
+}
+
+/* Drop what ref holds, ref itself stays */
+static void ref_drop(struct route_ref *ref)
+{
+	struct nh_entry *nh;
+
+	if (ref->nhid && (nh = nexthop_lookup(ref->nhid)) != NULL && nh->routes)
+		nh->routes--;
+
+	if (ref->mp)
+		mpath_put(ref->mp);
+
+	ref->nhid = 0;
+	ref->mp = NULL;
+}
+
+void route_ref_release(const struct route_key *rk)
+{
+	struct route_ref *ref;
+
+	changed_id = 0;
+
+	if (ref_table.count == 0 || (ref = ref_lookup(rk)) == NULL)
+		return;
+
+	ref_drop(ref);
+	htable_remove(&ref_table, &ref->node);
+	free(ref);
+}
+
+struct nh_entry * nexthop_lookup(uint32_t id)
+{
+	struct hnode *n;
+
+	if (nh_table.buckets == NULL)
+		return NULL;
+
+	n = htable_find(&nh_table, hash_u32(id), &id);
+
+	return n ? hnode_entry(n, struct nh_entry, node) : NULL;
+}
+
+static int format_nh_entry(char *buf, size_t size, int len,
+			   const struct nh_entry *nh)
+{
+	char gw_str[INET6_ADDRSTRLEN], ifname[IFNAMSIZ];
+	unsigned int i;
+
+	if (nh->ngroup) {
+		len = strappend(buf, size, len, " group%s",
+				nh->group_type == NEXTHOP_GRP_TYPE_RES ?
+				"(resilient)" : "");
+		for (i=0; i<nh->ngroup; i++) {
+			len = strappend(buf, size, len, "%c%u",
+					i ? '/' : ' ', nh->group[i].id);
+			if (nh->group[i].weight)
+				len = strappend(buf, size, len, ",%u",
+						nh->group[i].weight + 1);
+		}
+		return len;
+	}
+
+	if (nh->blackhole)
+		return strappend(buf, size, len, " blackhole");
+
+	if (nh->has_gw) {
+		fmt_inet(gw_str, nh->family, nh->gw);
+		len = strappend(buf, size, len, " via %s", gw_str);
+	}
+
+	if (nh->oif) {
+		fmt_ifname(ifname, nh->oif);
+		len = strappend(buf, size, len, " dev %s", ifname);
+	}
+
+	return len;
+}
+
+int format_nexthop_id(char *buf, size_t size, int len, uint32_t id)
+{
+	struct nh_entry *nh = nexthop_lookup(id);
+
+	len = strappend(buf, size, len, " nhid %u", id);
+
+	if (nh)
+		len = format_nh_entry(buf, size, len, nh);
+
+	return len;
+}
+
+int format_multipath(char *buf, size_t size, int len, int family,
+		     void *data, int plen)
+{
+	struct rtnexthop *rtnh = data;
+	struct rtattr *rta;
+	char gw_str[INET6_ADDRSTRLEN], ifname[IFNAMSIZ];
+	int alen;
+
+	while (RTNH_OK(rtnh, plen)) {
+		len = strappend(buf, size, len, " [");
+
+		alen = rtnh->rtnh_len - sizeof(*rtnh);
+		for (rta = RTNH_DATA(rtnh); RTA_OK(rta, alen);
+		     rta = RTA_NEXT(rta, alen)) {
+			if (rta->rta_type == RTA_GATEWAY) {
+				fmt_inet(gw_str, family, RTA_DATA(rta));
+				len = strappend(buf, size, len, "via %s ", gw_str);
+			}
+		}
+
+		if (rtnh->rtnh_ifindex) {
+			fmt_ifname(ifname, rtnh->rtnh_ifindex);
+			len = strappend(buf, size, len, "dev %s ", ifname);
+		}
+
+		len = strappend(buf, size, len, "weight %d]",
+				rtnh->rtnh_hops + 1);
+
+		plen -= NLMSG_ALIGN(rtnh->rtnh_len);
+		rtnh = RTNH_NEXT(rtnh);
+	}
+
+	return len;
+}
+
+static unsigned int count_paths(void *data, int len)
+{
+	struct rtnexthop *rtnh = data;
+	unsigned int n = 0;
+
+	while (RTNH_OK(rtnh, len)) {
+		n++;
+		len -= NLMSG_ALIGN(rtnh->rtnh_len);
+		rtnh = RTNH_NEXT(rtnh);
+	}
+
+	return n;
+}
+
+struct mpath_entry * mpath_route_ref(const struct route_key *rk, int family,
+				     void *data, int len, int type)
+{
+	struct mpath_key key = { family, data, len };
+	struct mpath_entry *mp;
+	struct route_ref *ref;
+	struct hnode *n;
+	uint32_t hash;
+
+	if (mpath_table.buckets == NULL)
+		return NULL;
+
+	changed_id = 0;
+
+	if (type == RTM_DELROUTE)
+		route_ref_release(rk);
+
+	hash = hash_bytes(data, len, family);
+	n = htable_find(&mpath_table, hash, &key);
+	mp = n ? hnode_entry(n, struct mpath_entry, node) : NULL;
+
+	if (type == RTM_DELROUTE)
+		return mp;
+
+	if ( (ref = ref_get(rk)) == NULL )
+		return mp;
+
+	/* Unchanged path set, a repeated or re-announced route */
+	if (mp && ref->mp == mp)
+		return mp;
+
+	if (mp == NULL) {
+		mp = malloc(sizeof(*mp) + len);
+		if (mp == NULL)
+			return NULL;
+
+		mp->id = mpath_next_id++;
+		mp->family = family;
+		mp->npaths = count_paths(data, len);
+		mp->routes = 0;
+		mp->len = len;
+		memcpy(mp->data, data, len);
+		htable_insert(&mpath_table, &mp->node, hash);
+	}
+
+	mp->routes++;
+	ref_drop(ref);
+	ref->mp = mp;
+
+	return mp;
+}
+
+static int nexthop_depends(const struct nh_entry *nh, uint32_t id)
+{
+	unsigned int i;
+
+	if (nh->id == id)
+		return 1;
+
+	for (i=0; i<nh->ngroup; i++) {
+		if (nh->group[i].id == id)
+			return 1;
+	}
+
+	return 0;
+}
+
+int nexthop_route_ref(const struct route_key *rk, uint32_t id,
+		      const struct nlmsghdr *nlh)
+{
+	struct nh_entry *nh = nexthop_lookup(id);
+	struct route_ref *ref;
+
+	if (nlh->nlmsg_type == RTM_DELROUTE) {
+		route_ref_release(rk);
+		return 0;
+	}
+
+	if ( (ref = ref_get(rk)) == NULL )
+		return 0;
+
+	if (ref->nhid == id) {
+		if ((nlh->nlmsg_flags & NLM_F_REPLACE) && changed_id && nh
+		    && nlh->nlmsg_pid == changed_pid
+		    && nlh->nlmsg_seq == changed_seq
+		    && ref->burst != burst && nexthop_depends(nh, changed_id)) {
+			ref->burst = burst;
+			return 1;
+		}
+		changed_id = 0;
+		return 0;
+	}
+
+	changed_id = 0;
+	ref_drop(ref);
+	ref->nhid = id;
+	if (nh)
+		nh->routes++;
+
+	return 0;
+}
+
+/**
+ * @short Routes affected by a change to nh
+ *
+ * Routes may point at nh directly or at any group that contains it.
+ * The number of nexthop objects is small compared to the number of
+ * routes, so walking the table here is cheap.
+ */
+static unsigned long nexthop_affected_routes(const struct nh_entry *nh)
+{
+	struct hnode *n;
+	struct nh_entry *g;
+	unsigned long total = nh->routes;
+	unsigned int i, j;
+
+	htable_for_each(&nh_table, i, n) {
+		g = hnode_entry(n, struct nh_entry, node);
+		for (j=0; j<g->ngroup; j++) {
+			if (g->group[j].id == nh->id) {
+				total += g->routes;
+				break;
+			}
+		}
+	}
+
+	return total;
+}
+
+/* The routes the kernel flushed along with nexthop id */
+static void nexthop_forget_routes(uint32_t id)
+{
+	struct route_ref *ref;
+	struct hnode *n, *next;
+	unsigned int i;
+
+	for (i=0; i<ref_table.size; i++) {
+		for (n = ref_table.buckets[i]; n; n = next) {
+			next = n->next;
+			ref = hnode_entry(n, struct route_ref, node);
+
+			if (ref->nhid == id) {
+				htable_remove(&ref_table, n);
+				free(ref);
+			}
+		}
+	}
+}
+
+static void nexthop_free(struct nh_entry *nh)
+{
+	free(nh->group);
+	free(nh);
+}
+
+static int nexthop_fill(struct nh_entry *nh, struct nhmsg *nhm,
+			struct rtattr *tb[])
+{
+	struct nexthop_grp *grp = NULL;
+	unsigned int ngroup = 0;
+
+	if (tb[NHA_GROUP]) {
+		ngroup = RTA_PAYLOAD(tb[NHA_GROUP]) / sizeof(struct nexthop_grp);
+		grp = malloc(ngroup * sizeof(struct nexthop_grp));
+		if (grp == NULL)
+			return -1;
+		memcpy(grp, RTA_DATA(tb[NHA_GROUP]),
+		       ngroup * sizeof(struct nexthop_grp));
+	}
+
+	free(nh->group);
+	nh->group = grp;
+	nh->ngroup = ngroup;
+	nh->family = nhm->nh_family;
+	nh->blackhole = tb[NHA_BLACKHOLE] != NULL;
+	nh->group_type = tb[NHA_GROUP_TYPE] ?
+		*(uint16_t *) RTA_DATA(tb[NHA_GROUP_TYPE]) : 0;
+	nh->oif = tb[NHA_OIF] ? *(int *) RTA_DATA(tb[NHA_OIF]) : 0;
+	nh->has_gw = 0;
+
+	if (tb[NHA_GATEWAY] && RTA_PAYLOAD(tb[NHA_GATEWAY]) <= sizeof(nh->gw)) {
+		memcpy(nh->gw, RTA_DATA(tb[NHA_GATEWAY]),
+		       RTA_PAYLOAD(tb[NHA_GATEWAY]));
+		nh->has_gw = 1;
+	}
+
+	return 0;
+}
+
+static void print_nexthop_event(struct nh_entry *nh, char *action, int color)
+{
+	char buf[2048];
+	int len;
+
+	len = snprintf(buf, sizeof(buf), "%s nexthop %u", action, nh->id);
+	len = format_nh_entry(buf, sizeof(buf), len, nh);
+
+	if (nh->routes || strcmp(action, "Added"))
+		len = strappend(buf, sizeof(buf), len, " (%lu routes)",
+				nexthop_affected_routes(nh));
+
+	eprintf(color, "%s\n", buf);
+}
+
+int handle_nexthop_msg(struct nlmsghdr *nlh, int n)
+{
+	struct nhmsg *nhm = NLMSG_DATA(nlh);
+	struct rtattr *tb[NHA_MAX + 1], *rta;
+	struct nh_entry *nh;
+	int len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*nhm));
+	uint32_t id;
+
+	if (len < 0 || nh_table.buckets == NULL)
+		return -1;
+
+	memset(tb, 0, sizeof(tb));
+	rta = (struct rtattr *) ((char *) nhm + NLMSG_ALIGN(sizeof(*nhm)));
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type <= NHA_MAX)
+			tb[rta->rta_type] = rta;
+	}
+	latency_mark(LAT_DECODE);
+
+	if (tb[NHA_ID] == NULL)
+		return -1;
+
+	id = *(uint32_t *) RTA_DATA(tb[NHA_ID]);
+	nh = nexthop_lookup(id);
+
+	if (nlh->nlmsg_type == RTM_DELNEXTHOP) {
+		if (nh == NULL)
+			return 0;
+		/* The kernel flushes dependent routes without notifying */
+		print_nexthop_event(nh, "Removed", RED);
+		nexthop_forget_routes(id);
+		htable_remove(&nh_table, &nh->node);
+		nexthop_free(nh);
+		changed_id = 0;
+		return 0;
+	}
+
+	if (nh) {
+		nexthop_fill(nh, nhm, tb);
+		print_nexthop_event(nh, "Changed", YELLOW);
+		changed_id = id;
+		changed_pid = nlh->nlmsg_pid;
+		changed_seq = nlh->nlmsg_seq;
+		burst++;
+		return 0;
+	}
+
+	nh = calloc(1, sizeof(*nh));
+	if (nh == NULL)
+		return -1;
+
+	nh->id = id;
+	if (nexthop_fill(nh, nhm, tb) < 0) {
+		free(nh);
+		return -1;
+	}
+
+	htable_insert(&nh_table, &nh->node, hash_u32(id));
+	print_nexthop_event(nh, "Added", GREEN);
+	changed_id = 0;
+
+	return 0;
+}
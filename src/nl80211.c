@@ -17,8 +17,23 @@
  *  Author: Alfredo Matos <alfredo.matos@caixamagica.pt>
  */
 
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <net/if.h>
+
 #include <netevent/nl80211.h>
+#include <netevent/rtnl.h>
+#include <netevent/hash.h>
 #include <netevent/console.h>
+#include <netevent/summary.h>
+#include <netevent/latency.h>
+#include <netevent/fmt.h>
+#include <netevent/plugin.h>
+#include <netevent/state.h>
+#include <netevent/cqm.h>
 
 #include <netlink/genl/genl.h>
 #include <netlink/genl/ctrl.h>
@@ -26,11 +41,45 @@
 #include <netlink/netlink.h>
 
 #include <linux/nl80211.h>
+#include <linux/genetlink.h>
 
 #include "nl80211-attrs.h"
+#include "probes.h"
 
 struct nl_sock * gsock;
 
+/* Requests and dumps, kept apart from the multicast socket */
+static struct nl_sock *cmd_sock;
+
+/* Told once the family is known, see nl80211_when_ready() */
+static nl80211_ready_fn ready_fns[NL80211_READY_MAX];
+static int nready;
+static int ready_id = -1;
+
+/* The family as last told by nlctrl, -1 while unknown */
+static int family_id = -1;
+static uint32_t groups[NL80211_GROUPS_MAX];
+static int ngroups;
+static int resolving;	/* CTRL_CMD_GETFAMILY in flight */
+static int absent;	/* not registered, wait for CTRL_CMD_NEWFAMILY */
+static int joined;
+
+/* Links seen in the link table, and how many of them are wireless */
+struct nl80211_link
+{
+	struct hnode node;
+	int ifindex;
+	int wireless;
+};
+
+static struct htable link_table;
+static int nwireless;
+static int lazy;
+
+/* Datagram handed over by a reader thread, see nl80211_feed() */
+static unsigned char *fed_buf;
+static size_t fed_len;
+
 int join_multicast_group(struct nl_sock * nlsk, int id)
 {
 	if (id<0)
@@ -121,6 +170,277 @@ int nl80211_register_multicast_groups(struct nl_sock * nlsk, int fid)
 	return 0;
 }
 
+static int link_cmp(const struct hnode *n, const void *key)
+{
+	return hnode_entry(n, struct nl80211_link, node)->ifindex != *(const int *) key;
+}
+
+static struct nl80211_link * link_find(int ifindex)
+{
+	struct hnode *n = htable_find(&link_table, hash_u32(ifindex), &ifindex);
+
+	return n ? hnode_entry(n, struct nl80211_link, node) : NULL;
+}
+
+/* cfg80211 links its netdevs to their wiphy before announcing them */
+static int link_is_wireless(const char *ifname)
+{
+	char path[64 + IFNAMSIZ];
+
+	snprintf(path, sizeof(path), "/sys/class/net/%s/phy80211", ifname);
+
+	return access(path, F_OK) == 0;
+}
+
+static void link_seen(int ifindex, const char *ifname)
+{
+	struct nl80211_link *l;
+
+	if (link_find(ifindex))
+		return;
+
+	if ( (l = malloc(sizeof(*l))) == NULL )
+		return;
+
+	l->ifindex = ifindex;
+	l->wireless = link_is_wireless(ifname);
+	nwireless += l->wireless;
+
+	htable_insert(&link_table, &l->node, hash_u32(ifindex));
+}
+
+static void link_gone(int ifindex)
+{
+	struct nl80211_link *l;
+
+	if ( (l = link_find(ifindex)) == NULL )
+		return;
+
+	nwireless -= l->wireless;
+	htable_remove(&link_table, &l->node);
+	free(l);
+}
+
+static void links_scan(void)
+{
+	struct if_nameindex *ifs, *i;
+
+	if ( (ifs = if_nameindex()) == NULL )
+		return;
+
+	for (i = ifs; i->if_index; i++)
+		link_seen(i->if_index, i->if_name);
+
+	if_freenameindex(ifs);
+}
+
+static void nl80211_join(void)
+{
+	int i, err;
+
+	for (i=0; i<ngroups; i++) {
+		if ( (err = nl_socket_add_membership(gsock, groups[i])) < 0 )
+			tprintf("nl80211: joining group %u failed: %s\n",
+				groups[i], nl_geterror(err));
+	}
+
+	joined = 1;
+	tprintf("nl80211: family %d, %d groups joined\n", family_id, ngroups);
+}
+
+static void nl80211_leave(void)
+{
+	int i;
+
+	for (i=0; i<ngroups; i++)
+		nl_socket_drop_membership(gsock, groups[i]);
+
+	joined = 0;
+}
+
+/* Answered on gsock, see nl80211_ctrl_msg() and nl80211_ctrl_error() */
+static void nl80211_resolve(void)
+{
+	struct nl_msg *msg;
+	int err = -NLE_NOMEM;
+
+	if ( (msg = nlmsg_alloc()) == NULL )
+		goto out;
+
+	if (genlmsg_put(msg, NL_AUTO_PORT, NL_AUTO_SEQ, GENL_ID_CTRL, 0, 0,
+			CTRL_CMD_GETFAMILY, 1) == NULL
+	    || nla_put_string(msg, CTRL_ATTR_FAMILY_NAME, "nl80211") < 0)
+		goto out;
+
+	if ( (err = nl_send_auto_complete(gsock, msg)) >= 0 )
+		resolving = 1;
+
+out:
+	nlmsg_free(msg);
+
+	if (err < 0)
+		tprintf("nl80211: family lookup failed: %s\n", nl_geterror(err));
+}
+
+/* Bring the memberships in line with the wireless links present */
+static void nl80211_update(void)
+{
+	int want = nl80211_active();
+
+	if (want && !joined) {
+		if (family_id >= 0)
+			nl80211_join();
+		else if (!resolving && !absent)
+			nl80211_resolve();
+	} else if (!want && joined) {
+		nl80211_leave();
+		tprintf("nl80211: groups left, no wireless interface remains\n");
+	}
+}
+
+/* Once per registration of the family */
+static void nl80211_ready(void)
+{
+	int i;
+
+	if (family_id < 0 || family_id == ready_id)
+		return;
+
+	ready_id = family_id;
+
+	for (i=0; i<nready; i++)
+		ready_fns[i](family_id);
+}
+
+int nl80211_when_ready(nl80211_ready_fn fn)
+{
+	if (nready == NL80211_READY_MAX) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	ready_fns[nready++] = fn;
+
+	if (ready_id >= 0)
+		fn(ready_id);
+
+	return 0;
+}
+
+static int nl80211_ctrl_msg(struct nl_msg *msg)
+{
+	struct genlmsghdr *genlh = nlmsg_data(nlmsg_hdr(msg));
+	struct nlattr *tb[CTRL_ATTR_MAX + 1];
+	struct nlattr *grp[CTRL_ATTR_MCAST_GRP_MAX + 1];
+	struct nlattr *mc_attr;
+	int rem;
+
+	nla_parse(tb, CTRL_ATTR_MAX, genlmsg_attrdata(genlh, 0),
+		  genlmsg_attrlen(genlh, 0), NULL);
+
+	if (tb[CTRL_ATTR_FAMILY_NAME] == NULL
+	    || strcmp(nla_get_string(tb[CTRL_ATTR_FAMILY_NAME]), "nl80211") != 0)
+		return NL_SKIP;
+
+	switch (genlh->cmd) {
+	case CTRL_CMD_NEWFAMILY:
+		if (tb[CTRL_ATTR_FAMILY_ID] == NULL)
+			return NL_SKIP;
+
+		/* Both the reply and a notification may come, keep the last */
+		if (joined)
+			nl80211_leave();
+
+		family_id = nla_get_u16(tb[CTRL_ATTR_FAMILY_ID]);
+		ngroups = 0;
+		resolving = 0;
+		absent = 0;
+
+		if (tb[CTRL_ATTR_MCAST_GROUPS]) {
+			nla_for_each_nested(mc_attr, tb[CTRL_ATTR_MCAST_GROUPS], rem) {
+				if (nla_parse_nested(grp, CTRL_ATTR_MCAST_GRP_MAX,
+						     mc_attr, NULL) < 0
+				    || grp[CTRL_ATTR_MCAST_GRP_ID] == NULL
+				    || ngroups == NL80211_GROUPS_MAX)
+					continue;
+				groups[ngroups++] = nla_get_u32(grp[CTRL_ATTR_MCAST_GRP_ID]);
+			}
+		}
+
+		nl80211_update();
+		nl80211_ready();
+		break;
+
+	case CTRL_CMD_DELFAMILY:
+		/* The kernel drops the memberships with the family */
+		family_id = -1;
+		ready_id = -1;
+		ngroups = 0;
+		joined = 0;
+		absent = 1;
+		tprintf("nl80211: family unregistered\n");
+		break;
+	}
+
+	return NL_SKIP;
+}
+
+static int nl80211_ctrl_error(struct sockaddr_nl *nla, struct nlmsgerr *err,
+			      void *arg)
+{
+	if (err->msg.nlmsg_type != GENL_ID_CTRL || err->error == 0)
+		return NL_SKIP;
+
+	resolving = 0;
+
+	if (err->error == -ENOENT) {
+		absent = 1;
+		tprintf("nl80211: family not registered yet\n");
+	} else {
+		tprintf("nl80211: family lookup failed: %s\n", strerror(-err->error));
+	}
+
+	return NL_SKIP;
+}
+
+int nl80211_active(void)
+{
+	/* Without link events every interface may be wireless */
+	return !lazy || nwireless > 0;
+}
+
+int nl80211_rt_event(void *data, size_t len)
+{
+	struct rtattr *tb[IFLA_MAX + 1];
+	struct ifinfomsg *ifi;
+	struct nlmsghdr *nlh;
+	int n = len;
+
+	for (nlh = data; NLMSG_OK(nlh, n); nlh = NLMSG_NEXT(nlh, n)) {
+		if (nlh->nlmsg_type != RTM_NEWLINK && nlh->nlmsg_type != RTM_DELLINK)
+			continue;
+
+		ifi = NLMSG_DATA(nlh);
+
+		/* Bridge port messages come and go with the port, not the link */
+		if (ifi->ifi_family != AF_UNSPEC)
+			continue;
+
+		if (nlh->nlmsg_type == RTM_DELLINK) {
+			link_gone(ifi->ifi_index);
+			continue;
+		}
+
+		parse_rt_attrs(tb, IFLA_MAX + 1, IFLA_RTA(ifi), IFLA_PAYLOAD(nlh));
+		if (tb[IFLA_IFNAME])
+			link_seen(ifi->ifi_index, RTA_DATA(tb[IFLA_IFNAME]));
+	}
+
+	nl80211_update();
+
+	return 0;
+}
+
 int nl_unparsed_ids(struct nlattr * tb[], unsigned int parsed[])
 {
 	int i, count, total, slen=0;
@@ -153,6 +473,7 @@ int nl80211_handle_attrs(unsigned int cmd, struct nlattr * tb[])
 {
 	char ifname[IFNAMSIZ]="null";
 	char addr_str[INET6_ADDRSTRLEN];
+	char cqm_str[128];
 	unsigned int ifindex, status, wiphy;
 
 	unsigned int parsed[NL80211_ATTR_MAX + 1];
@@ -166,7 +487,7 @@ int nl80211_handle_attrs(unsigned int cmd, struct nlattr * tb[])
 
 	if (tb[NL80211_ATTR_IFINDEX]) {
 		ifindex = nla_get_u32(tb[NL80211_ATTR_IFINDEX]);
-		if_indextoname(ifindex, ifname);
+		fmt_ifname(ifname, ifindex);
 		parsed[NL80211_ATTR_IFINDEX] = 1;
 	}
 
@@ -199,25 +520,25 @@ int nl80211_handle_attrs(unsigned int cmd, struct nlattr * tb[])
 		tprintf("mac80211: beacon mgmt\n");
 		break;
 	case NL80211_CMD_GET_STATION:
-		ether_ntoa_r(nla_data(tb[NL80211_ATTR_MAC]), addr_str);
+		fmt_mac(addr_str, nla_data(tb[NL80211_ATTR_MAC]));
 		tprintf("mac80211: station %s on %s get attributes\n",
 			addr_str, ifname);
 		parsed[NL80211_ATTR_MAC] = 1;
 		break;
 	case NL80211_CMD_SET_STATION:
-		ether_ntoa_r(nla_data(tb[NL80211_ATTR_MAC]), addr_str);
+		fmt_mac(addr_str, nla_data(tb[NL80211_ATTR_MAC]));
 		tprintf("mac80211: station %s on %s set attributes\n",
 			addr_str, ifname);
 		parsed[NL80211_ATTR_MAC] = 1;
 		break;
 	case NL80211_CMD_NEW_STATION:
-		ether_ntoa_r(nla_data(tb[NL80211_ATTR_MAC]), addr_str);
+		fmt_mac(addr_str, nla_data(tb[NL80211_ATTR_MAC]));
 		tprintf("mac80211: add station %s on %s\n",
 			addr_str, ifname);
 		parsed[NL80211_ATTR_MAC] = 1;
 		break;
 	case NL80211_CMD_DEL_STATION:
-		ether_ntoa_r(nla_data(tb[NL80211_ATTR_MAC]), addr_str);
+		fmt_mac(addr_str, nla_data(tb[NL80211_ATTR_MAC]));
 		tprintf("mac80211: remove station %s on %s\n",
 			addr_str, ifname);
 		parsed[NL80211_ATTR_MAC] = 1;
@@ -269,7 +590,7 @@ int nl80211_handle_attrs(unsigned int cmd, struct nlattr * tb[])
 		break;
 	case NL80211_CMD_ASSOCIATE:
 		if (tb[NL80211_ATTR_MAC]) {
-			ether_ntoa_r(nla_data(tb[NL80211_ATTR_MAC]), addr_str);
+			fmt_mac(addr_str, nla_data(tb[NL80211_ATTR_MAC]));
 			tprintf("mac80211: associate to %s on %s\n",
 				addr_str,
 				ifname);
@@ -304,7 +625,7 @@ int nl80211_handle_attrs(unsigned int cmd, struct nlattr * tb[])
 			tprintf("mac80211: attribute SSID\n");
 
 		if(tb[NL80211_ATTR_MAC]) {
-			ether_ntoa_r(nla_data(tb[NL80211_ATTR_MAC]), addr_str);
+			fmt_mac(addr_str, nla_data(tb[NL80211_ATTR_MAC]));
 			tprintf("mac80211: connected to %s on %s\n",
 				addr_str, ifname);
 			parsed[NL80211_ATTR_MAC] = 1;
@@ -355,9 +676,18 @@ int nl80211_handle_attrs(unsigned int cmd, struct nlattr * tb[])
 		tprintf("mac80211 power mgmt\n");
 		break;
 	case NL80211_CMD_SET_CQM:
-	case NL80211_CMD_NOTIFY_CQM:
 		tprintf("mac80211 cqm mgmt\n");
 		break;
+	case NL80211_CMD_NOTIFY_CQM:
+		if (cqm_format(cqm_str, sizeof(cqm_str), tb[NL80211_ATTR_CQM],
+			       tb[NL80211_ATTR_MAC]) > 0) {
+			tprintf("mac80211: %s on %s\n", cqm_str, ifname);
+			parsed[NL80211_ATTR_CQM] = 1;
+			parsed[NL80211_ATTR_MAC] = 1;
+		} else {
+			tprintf("mac80211 cqm mgmt\n");
+		}
+		break;
 	case NL80211_CMD_SET_WDS_PEER:
 	case NL80211_CMD_FRAME_WAIT_CANCEL:
 		break;
@@ -392,38 +722,171 @@ int nl80211_handle_event(struct nl_msg * msg, void * arg)
 	struct genlmsghdr * genlh;
 	struct nlattr * tb[NL80211_ATTR_MAX + 1];
 	struct nlattr * attrdata, * nla;
+	struct netevent ev;
 	int attrlen, n, count;
 
+	if (nlmsg_hdr(msg)->nlmsg_type == GENL_ID_CTRL)
+		return nl80211_ctrl_msg(msg);
+
 	genlh = nlmsg_data(nlmsg_hdr(msg));
 
 	attrdata = genlmsg_attrdata(genlh, 0);
 	attrlen = genlmsg_attrlen(genlh, 0);
 
 	nla_parse(tb, NL80211_ATTR_MAX, attrdata, attrlen, NULL);
+	latency_mark(LAT_DECODE);
+
+	PROBE2(nl80211_event, genlh->cmd,
+	       tb[NL80211_ATTR_IFINDEX] ? nla_get_u32(tb[NL80211_ATTR_IFINDEX]) : 0);
+
+	if (plugin_enabled() || state_enabled()) {
+		netevent_decode_wireless(&ev, genlh->cmd, tb);
+		ev.nlh = nlmsg_hdr(msg);
+		if (plugin_enabled())
+			plugin_push(&ev);
+		if (state_enabled())
+			state_wireless_event(&ev);
+	}
+
+	if (cqm_enabled())
+		cqm_event(genlh->cmd, tb);
+
+	if (summary_enabled()) {
+		summary_count(SUMMARY_EV_WIRELESS);
+		if (tb[NL80211_ATTR_IFINDEX])
+			summary_ifindex(nla_get_u32(tb[NL80211_ATTR_IFINDEX]));
+		if (tb[NL80211_ATTR_MAC])
+			summary_mac(nla_data(tb[NL80211_ATTR_MAC]));
+		return NL_OK;
+	}
 
 	n = nl_attr_count(tb);
 
+	console_set_context(NL80211_EVENT_TYPE(genlh->cmd),
+		tb[NL80211_ATTR_IFINDEX] ?
+		nla_get_u32(tb[NL80211_ATTR_IFINDEX]) : 0);
+
+	latency_mark(LAT_DISPATCH);
 	count = nl80211_handle_attrs(genlh->cmd, tb);
 
+	console_set_context(0, 0);
+
 	return NL_OK;
 }
 
-int nl80211_socket_init(void)
+int nl80211_socket_init(int lazy_join)
 {
-        int i, id;
 	struct nl_cb * cb;
 
-        gsock = nl_socket_alloc();
+	lazy = lazy_join;
 
-        genl_connect(gsock);
-        id = genl_ctrl_resolve(gsock, "nl80211");
+	if (htable_init(&link_table, 64, link_cmp) == -1)
+		return -1;
 
-        nl80211_register_multicast_groups(gsock, id);
+	if ( (gsock = nl_socket_alloc()) == NULL ) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	if (genl_connect(gsock) < 0) {
+		errno = ECONNREFUSED;
+		goto fail;
+	}
 
-        nl_socket_disable_seq_check(gsock);
+	nl_socket_disable_seq_check(gsock);
+	nl_socket_disable_auto_ack(gsock);
 	nl_socket_modify_cb(gsock, NL_CB_VALID, NL_CB_CUSTOM, nl80211_handle_event, NULL);
 
-        return nl_socket_get_fd(gsock);
+	cb = nl_socket_get_cb(gsock);
+	nl_cb_err(cb, NL_CB_CUSTOM, nl80211_ctrl_error, NULL);
+	nl_cb_put(cb);
+
+	/* The nlctrl notify group has the id of nlctrl itself, errno is
+	 * left by setsockopt() */
+	if (nl_socket_add_membership(gsock, GENL_ID_CTRL) < 0)
+		goto fail;
+
+	if (lazy)
+		links_scan();
+
+	nl80211_update();
+
+	return nl_socket_get_fd(gsock);
+
+fail:
+	nl_socket_free(gsock);
+	gsock = NULL;
+	return -1;
+}
+
+struct nl_sock * nl80211_cmd_socket(int *family)
+{
+	/* Learnt through the event loop, never asked for here */
+	if (family_id < 0) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	if (cmd_sock == NULL) {
+		if ( (cmd_sock = nl_socket_alloc()) == NULL ) {
+			errno = ENOMEM;
+			return NULL;
+		}
+
+		if (genl_connect(cmd_sock) < 0) {
+			errno = ECONNREFUSED;
+			goto fail;
+		}
+	}
+
+	*family = family_id;
+
+	return cmd_sock;
+
+fail:
+	nl_socket_free(cmd_sock);
+	cmd_sock = NULL;
+	return NULL;
+}
+
+static int nl80211_recv_fed(struct nl_sock *sk, struct sockaddr_nl *nla,
+			    unsigned char **buf, struct ucred **creds)
+{
+	if (fed_buf == NULL)
+		return 0;
+
+	*buf = fed_buf;
+	fed_buf = NULL;
+
+	memset(nla, 0, sizeof(*nla));
+	nla->nl_family = AF_NETLINK;
+
+	return fed_len;
+}
+
+int nl80211_feed(void *data, void *buf, size_t len)
+{
+	struct nl_cb *cb;
+
+	if ( (fed_buf = malloc(len)) == NULL )
+		return -1;
+
+	memcpy(fed_buf, buf, len);
+	fed_len = len;
+
+	/* libnl takes the buffer from us instead of reading the socket */
+	cb = nl_socket_get_cb(gsock);
+	nl_cb_overwrite_recv(cb, nl80211_recv_fed);
+	nl_recvmsgs(gsock, cb);
+	nl_cb_overwrite_recv(cb, NULL);
+	nl_cb_put(cb);
+
+	free(fed_buf);
+	fed_buf = NULL;
+
+	latency_done();
+
+	return 0;
 }
 
 int nl80211_socket_close(struct nl_sock * nlsk)
@@ -434,5 +897,20 @@ int nl80211_socket_close(struct nl_sock * nlsk)
 
 inline int nl80211_msg_rx(int skfd)
 {
+	static unsigned char buf[NL80211_RCVBUF];
+	ssize_t n;
+
+	/* libnl cannot hand us the receive timestamp, read it ourselves */
+	if (latency_enabled()) {
+		PROBE1(recv_entry, skfd);
+		n = latency_recv(skfd, buf, sizeof(buf), 0);
+		PROBE2(recv_exit, skfd, n);
+
+		if (n > 0)
+			nl80211_feed(NULL, buf, n);
+		return 0;
+	}
+
 	nl_recvmsgs_default(gsock);
+	return 0;
 }
@@ -0,0 +1,288 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <unistd.h>
+
+#include <sys/inotify.h>
+
+#include <netevent/plugin.h>
+#include <netevent/loop.h>
+#include <netevent/console.h>
+
+struct plugin
+{
+	char file[NAME_MAX + 1];
+	void *dl;
+	const struct netevent_plugin *p;
+	void *state;
+	int disabled;
+	unsigned int strikes;
+	unsigned long events;
+	unsigned long overruns;
+	uint64_t ns;
+	uint64_t max_ns;
+};
+
+static struct plugin plugins[PLUGIN_MAX];
+static const char *plugin_dir;
+static uint64_t budget_ns;
+static int enabled;
+
+static uint64_t clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int is_plugin_file(const char *name)
+{
+	size_t len = strlen(name);
+
+	return len > 3 && strcmp(name + len - 3, ".so") == 0
+		&& len <= NAME_MAX;
+}
+
+static struct plugin * plugin_find(const char *file)
+{
+	int i;
+
+	for (i=0; i<PLUGIN_MAX; i++) {
+		if (plugins[i].dl && strcmp(plugins[i].file, file) == 0)
+			return &plugins[i];
+	}
+
+	return NULL;
+}
+
+static void plugin_unload(struct plugin *pl)
+{
+	if (pl->p->exit)
+		pl->p->exit(pl->state);
+
+	dlclose(pl->dl);
+	tprintf("Unloaded plugin %s\n", pl->file);
+
+	memset(pl, 0, sizeof(*pl));
+}
+
+static void plugin_load(const char *file)
+{
+	const struct netevent_plugin *p;
+	struct plugin *pl;
+	char path[PATH_MAX];
+	void *dl, *state = NULL;
+	int i;
+
+	if ( (pl = plugin_find(file)) != NULL )
+		plugin_unload(pl);
+
+	for (i=0; i<PLUGIN_MAX && plugins[i].dl; i++)
+		;;
+
+	if (i == PLUGIN_MAX) {
+		tprintf("Plugin %s not loaded, %d plugins already\n",
+			file, PLUGIN_MAX);
+		return;
+	}
+	pl = &plugins[i];
+
+	snprintf(path, sizeof(path), "%s/%s", plugin_dir, file);
+
+	if ( (dl = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL ) {
+		tprintf("Plugin %s: %s\n", file, dlerror());
+		return;
+	}
+
+	p = dlsym(dl, NETEVENT_PLUGIN_SYM);
+	if (p == NULL || p->abi != NETEVENT_PLUGIN_ABI || p->event == NULL) {
+		tprintf("Plugin %s: no netevent_plugin of ABI %d\n",
+			file, NETEVENT_PLUGIN_ABI);
+		dlclose(dl);
+		return;
+	}
+
+	if (p->init && p->init(&state) != 0) {
+		tprintf("Plugin %s: init failed\n", file);
+		dlclose(dl);
+		return;
+	}
+
+	strcpy(pl->file, file);
+	pl->dl = dl;
+	pl->p = p;
+	pl->state = state;
+
+	tprintf("Loaded plugin %s (%s)\n", p->name ? p->name : file, file);
+}
+
+static int plugin_ready(void *data, int fd)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct inotify_event *ie;
+	struct plugin *pl;
+	ssize_t n;
+	char *p;
+
+	while ( (n = read(fd, buf, sizeof(buf))) > 0 ) {
+		for (p = buf; p < buf + n; p += sizeof(*ie) + ie->len) {
+			ie = (struct inotify_event *) p;
+
+			if (ie->len == 0 || !is_plugin_file(ie->name))
+				continue;
+
+			if (ie->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+				plugin_load(ie->name);
+			else if ( (pl = plugin_find(ie->name)) != NULL )
+				plugin_unload(pl);
+		}
+	}
+
+	return 0;
+}
+
+int plugin_init(const char *dir, unsigned int budget_us)
+{
+	struct dirent *de;
+	DIR *d;
+	int fd;
+
+	plugin_dir = dir;
+	budget_ns = (uint64_t) budget_us * 1000;
+
+	if ( (d = opendir(dir)) == NULL )
+		return -1;
+
+	if ( (fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1 ) {
+		closedir(d);
+		return -1;
+	}
+
+	if (inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO
+			      | IN_MOVED_FROM | IN_DELETE) == -1
+	    || loop_add_fd(fd, plugin_ready, NULL) == -1) {
+		close(fd);
+		closedir(d);
+		return -1;
+	}
+
+	while ( (de = readdir(d)) != NULL ) {
+		if (is_plugin_file(de->d_name))
+			plugin_load(de->d_name);
+	}
+
+	closedir(d);
+	enabled = 1;
+
+	return 0;
+}
+
+void plugin_close(void)
+{
+	int i;
+
+	for (i=0; i<PLUGIN_MAX; i++) {
+		if (plugins[i].dl)
+			plugin_unload(&plugins[i]);
+	}
+}
+
+int plugin_enabled(void)
+{
+	return enabled;
+}
+
+static void plugin_call(struct plugin *pl, const struct netevent *ev)
+{
+	uint64_t start, ns;
+
+	start = clock_ns();
+	pl->p->event(pl->state, ev);
+	ns = clock_ns() - start;
+
+	pl->events++;
+	pl->ns += ns;
+	if (ns > pl->max_ns)
+		pl->max_ns = ns;
+
+	if (ns <= budget_ns) {
+		pl->strikes = 0;
+		return;
+	}
+
+	pl->overruns++;
+
+	if (++pl->strikes == PLUGIN_STRIKES) {
+		pl->disabled = 1;
+		tprintf("Plugin %s disabled, %d events in a row over %lluus\n",
+			pl->file, PLUGIN_STRIKES,
+			(unsigned long long) budget_ns / 1000);
+	}
+}
+
+void plugin_push(const struct netevent *ev)
+{
+	struct plugin *pl;
+	int i;
+
+	for (i=0; i<PLUGIN_MAX; i++) {
+		pl = &plugins[i];
+
+		if (pl->dl && !pl->disabled
+		    && (pl->p->interest & NETEVENT_INTEREST(ev->type)))
+			plugin_call(pl, ev);
+	}
+}
+
+int plugin_rt_event(void *data, size_t len)
+{
+	struct nlmsghdr *nlh;
+	struct netevent ev;
+	int n = len;
+
+	for (nlh = data; NLMSG_OK(nlh, n); nlh = NLMSG_NEXT(nlh, n)) {
+		if (netevent_decode(nlh, &ev) == 0)
+			plugin_push(&ev);
+	}
+
+	return 0;
+}
+
+void plugin_report(void)
+{
+	struct plugin *pl;
+	int i;
+
+	for (i=0; i<PLUGIN_MAX; i++) {
+		pl = &plugins[i];
+		if (pl->dl == NULL)
+			continue;
+
+		tprintf("plugin %s: %lu events, avg %lluus max %lluus, "
+			"%lu over budget%s\n", pl->file, pl->events,
+			(unsigned long long) (pl->events ? pl->ns / pl->events / 1000 : 0),
+			(unsigned long long) pl->max_ns / 1000, pl->overruns,
+			pl->disabled ? ", disabled" : "");
+	}
+}
@@ -0,0 +1,225 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/socket.h>
+
+#include <netevent/prio.h>
+#include <netevent/rtnl.h>
+#include <netevent/loop.h>
+#include <netevent/console.h>
+#include <netevent/latency.h>
+#include <netevent/state.h>
+
+#include "probes.h"
+
+struct prio_class
+{
+	int groups;
+	unsigned int types;	/* state types, 1 << NETEVENT_* */
+	int weight;
+	int rcvbuf;
+	int fd;
+	unsigned long datagrams;
+	unsigned long overruns;
+};
+
+const char *prio_names[PRIO_CLASSES] = { "link", "route", "neigh" };
+
+static struct prio_class classes[PRIO_CLASSES] = {
+	[PRIO_LINK] = {
+		.groups = RTMGRP_LINK | RTMGRP_NOTIFY | RTMGRP_IPV4_IFADDR
+			| RTMGRP_IPV6_IFADDR | RTMGRP_IPV6_IFINFO,
+		.types = 1U << NETEVENT_LINK | 1U << NETEVENT_ADDR,
+		.weight = 8,
+		.rcvbuf = 1 << 20,
+		.fd = -1,
+	},
+	[PRIO_ROUTE] = {
+		.groups = RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE
+			| RTMGRP_IPV4_MROUTE | RTMGRP_IPV6_MROUTE,
+		.types = 1U << NETEVENT_ROUTE,
+		.weight = 4,
+		.rcvbuf = 4 << 20,
+		.fd = -1,
+	},
+	[PRIO_NEIGH] = {
+		.groups = RTMGRP_NEIGH,
+		.types = 1U << NETEVENT_NEIGH,
+		.weight = 1,
+		.rcvbuf = 256 << 10,
+		.fd = -1,
+	},
+};
+
+static struct event_handler *handler;
+
+void prio_set_rcvbuf(int class, int bytes)
+{
+	if (class >= 0 && class < PRIO_CLASSES)
+		classes[class].rcvbuf = bytes;
+}
+
+static void prio_overrun(int class)
+{
+	struct prio_class *c = &classes[class];
+
+	c->overruns++;
+
+	/* Storms overrun often, report at powers of two */
+	if ((c->overruns & (c->overruns - 1)) == 0)
+		tprintf("Receive queue overrun on %s socket, %lu so far\n",
+			prio_names[class], c->overruns);
+
+	/* Only the types of this class lost events */
+	state_resync_later(c->types);
+}
+
+/* Read up to the class weight in datagrams, -1 on error */
+static int prio_drain_class(int class, char *buf)
+{
+	struct prio_class *c = &classes[class];
+	int i, bytes, n = 0;
+
+	for (i=0; i<c->weight; i++) {
+		PROBE1(recv_entry, c->fd);
+		bytes = latency_recv(c->fd, buf, RTNL_RCVBUF, MSG_DONTWAIT);
+		PROBE2(recv_exit, c->fd, bytes);
+
+		if (bytes < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			if (errno == ENOBUFS) {
+				prio_overrun(class);
+				continue;
+			}
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		if (bytes == 0) {
+			errno = ECONNRESET;
+			return -1;
+		}
+
+		c->datagrams++;
+		n++;
+
+		if (rtnl_dispatch(handler, buf, bytes))
+			return -1;
+	}
+
+	return n;
+}
+
+static int prio_ready(void *data, int fd)
+{
+	char buf[RTNL_RCVBUF];
+	int round, class, n, busy;
+
+	for (round=0; round<PRIO_ROUNDS; round++) {
+		busy = 0;
+
+		for (class=0; class<PRIO_CLASSES; class++) {
+			if (classes[class].fd == -1)
+				continue;
+
+			if ( (n = prio_drain_class(class, buf)) == -1 )
+				return -1;
+
+			busy += n;
+		}
+
+		if (!busy)
+			break;
+	}
+
+	return 0;
+}
+
+static void prio_set_sockbuf(int fd, int bytes)
+{
+	/* Beyond net.core.rmem_max needs CAP_NET_ADMIN */
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &bytes, sizeof(bytes)) == -1)
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes));
+}
+
+int prio_init(int filter, struct event_handler *h)
+{
+	struct prio_class *c;
+	int class, groups;
+
+	handler = h;
+
+	for (class=0; class<PRIO_CLASSES; class++) {
+		c = &classes[class];
+
+		if ( (groups = filter & c->groups) == 0 )
+			continue;
+
+		if ( (c->fd = setup_rtsocket(groups)) == -1 )
+			return -1;
+
+		prio_set_sockbuf(c->fd, c->rcvbuf);
+		latency_socket(c->fd);
+
+		if (loop_add_fd(c->fd, prio_ready, NULL) == -1)
+			return -1;
+	}
+
+	return 0;
+}
+
+int prio_set_filter(int old, int filter)
+{
+	struct prio_class *c;
+	int class;
+
+	for (class=0; class<PRIO_CLASSES; class++) {
+		if (classes[class].fd == -1 && (filter & classes[class].groups)) {
+			errno = ENOENT;
+			return -1;
+		}
+	}
+
+	for (class=0; class<PRIO_CLASSES; class++) {
+		c = &classes[class];
+
+		if (c->fd != -1 && rtnl_set_filter(c->fd, old & c->groups,
+						   filter & c->groups) == -1)
+			return -1;
+	}
+
+	return 0;
+}
+
+void prio_report(void)
+{
+	int class;
+
+	for (class=0; class<PRIO_CLASSES; class++) {
+		if (classes[class].fd == -1)
+			continue;
+
+		tprintf("%s socket: %lu datagrams, %lu overruns\n",
+			prio_names[class], classes[class].datagrams,
+			classes[class].overruns);
+	}
+}
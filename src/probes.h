@@ -0,0 +1,59 @@
+#ifndef __NETEVENT_PROBES__
+#define __NETEVENT_PROBES__
+
+/*
+ * USDT probes of the "netevent" provider, compiled in with --enable-usdt.
+ * A probe is a single nop until a tracer attaches. Each probe also has a
+ * semaphore the tracer raises while attached, so arguments that cost
+ * something to compute are guarded with PROBE_ENABLED().
+ */
+
+#include <stdint.h>
+#include <time.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define PROBE_LIST(X) \
+	X(recv_entry) \
+	X(recv_exit) \
+	X(event_handler) \
+	X(rt_attrs) \
+	X(nl80211_event) \
+	X(output) \
+	X(sink)
+
+#ifdef ENABLE_USDT
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define PROBE_SEMAPHORE(name)	netevent_##name##_semaphore
+#define PROBE_DECLARE(name)	extern unsigned short PROBE_SEMAPHORE(name);
+
+PROBE_LIST(PROBE_DECLARE)
+
+#define PROBE_ENABLED(name)	__builtin_expect(PROBE_SEMAPHORE(name), 0)
+#define PROBE1(name, a)		STAP_PROBE1(netevent, name, a)
+#define PROBE2(name, a, b)	STAP_PROBE2(netevent, name, a, b)
+#define PROBE3(name, a, b, c)	STAP_PROBE3(netevent, name, a, b, c)
+
+#else
+
+#define PROBE_ENABLED(name)	0
+#define PROBE1(name, a)		do { } while (0)
+#define PROBE2(name, a, b)	do { } while (0)
+#define PROBE3(name, a, b, c)	do { } while (0)
+
+#endif
+
+static inline uint64_t probe_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#endif
@@ -0,0 +1,384 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include <netevent/reader.h>
+#include <netevent/loop.h>
+#include <netevent/latency.h>
+
+#include "probes.h"
+
+struct reader_item
+{
+	uint64_t ts;
+	uint64_t real;		/* receive time, for latency tracking */
+	uint64_t mono;
+	void *data;
+	uint32_t len;
+	int err;
+};
+
+/**
+ * Single producer, single consumer ring. The reader thread only moves
+ * tail, the merge stage only moves head.
+ */
+struct reader
+{
+	const char *name;
+	int fd;
+	reader_fn_t fn;
+	void *data;
+	int cpu;
+	int prio;
+	pthread_t thread;
+	int busy;		/* a datagram received, not queued yet */
+	unsigned long overruns;
+	unsigned int head;
+	unsigned int tail;
+	struct reader_item queue[READER_QUEUE_LEN];
+};
+
+static struct reader *readers[READER_MAX];
+static int nreaders;
+static int evfd = -1;
+static int mfd = -1;
+
+static uint64_t ts_ns(const struct timespec *ts)
+{
+	return (uint64_t) ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts_ns(&ts);
+}
+
+static void reader_push(struct reader *r, struct reader_item *item)
+{
+	uint64_t one = 1;
+	unsigned int tail = r->tail;
+
+	/* Full, let the socket buffer absorb the burst */
+	while (tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == READER_QUEUE_LEN)
+		usleep(50);
+
+	r->queue[tail & (READER_QUEUE_LEN - 1)] = *item;
+	__atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+
+	if (write(evfd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+		perror("write()");
+}
+
+static uint64_t cmsg_timestamp(struct msghdr *msg)
+{
+	struct cmsghdr *cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET
+		    && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+			return ts_ns((struct timespec *) CMSG_DATA(cmsg));
+	}
+
+	return now_ns();
+}
+
+static void * reader_thread(void *arg)
+{
+	struct reader *r = arg;
+	struct reader_item item;
+	char cbuf[CMSG_SPACE(sizeof(struct timespec))];
+	unsigned char *buf;
+	struct msghdr msg;
+	struct iovec iov;
+	struct timespec mono;
+	ssize_t n;
+
+	if ( (buf = malloc(READER_BUF_SIZE)) == NULL ) {
+		memset(&item, 0, sizeof(item));
+		item.err = ENOMEM;
+		reader_push(r, &item);
+		return NULL;
+	}
+
+	while (1) {
+		iov.iov_base = buf;
+		iov.iov_len = READER_BUF_SIZE;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = cbuf;
+		msg.msg_controllen = sizeof(cbuf);
+
+		PROBE1(recv_entry, r->fd);
+		n = recvmsg(r->fd, &msg, 0);
+		PROBE2(recv_exit, r->fd, n);
+
+		if (n == -1 && errno == EINTR)
+			continue;
+
+		__atomic_store_n(&r->busy, 1, __ATOMIC_RELEASE);
+
+		memset(&item, 0, sizeof(item));
+
+		/* Events were lost, the merge stage accounts for it */
+		if (n == -1 && errno == ENOBUFS) {
+			item.ts = now_ns();
+			item.err = ENOBUFS;
+			reader_push(r, &item);
+			__atomic_store_n(&r->busy, 0, __ATOMIC_RELEASE);
+			continue;
+		}
+
+		if (n <= 0) {
+			item.err = (n == 0) ? ECONNRESET : errno;
+			reader_push(r, &item);
+			break;
+		}
+
+		if (msg.msg_flags & MSG_TRUNC) {
+			fprintf(stderr, "%s: truncated datagram\n", r->name);
+			__atomic_store_n(&r->busy, 0, __ATOMIC_RELEASE);
+			continue;
+		}
+
+		item.ts = cmsg_timestamp(&msg);
+		item.len = n;
+
+		if (latency_enabled()) {
+			item.real = now_ns();
+			clock_gettime(CLOCK_MONOTONIC, &mono);
+			item.mono = ts_ns(&mono);
+		}
+
+		if ( (item.data = malloc(n)) == NULL ) {
+			item.err = ENOMEM;
+			reader_push(r, &item);
+			break;
+		}
+		memcpy(item.data, buf, n);
+
+		reader_push(r, &item);
+		__atomic_store_n(&r->busy, 0, __ATOMIC_RELEASE);
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static struct reader_item * reader_peek(struct reader *r)
+{
+	unsigned int head = r->head;
+
+	if (head == __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	return &r->queue[head & (READER_QUEUE_LEN - 1)];
+}
+
+static void merge_arm(uint64_t delay)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = delay / 1000000000ULL;
+	its.it_value.tv_nsec = delay % 1000000000ULL;
+
+	timerfd_settime(mfd, 0, &its, NULL);
+}
+
+/**
+ * Whether an empty source may still deliver a datagram, queued in its
+ * socket or received by its thread. A datagram taken off the socket just
+ * before busy is raised is missed, ordering stays best effort.
+ */
+static int reader_in_flight(struct reader *r)
+{
+	struct pollfd p = { .fd = r->fd, .events = POLLIN };
+
+	if (__atomic_load_n(&r->busy, __ATOMIC_ACQUIRE))
+		return 1;
+
+	return poll(&p, 1, 0) == 1 && (p.revents & POLLIN);
+}
+
+/* Release queued datagrams in receive timestamp order */
+static int merge_ready(void *data, int fd)
+{
+	struct reader_item *item, *best_item;
+	struct reader *best, *empty[READER_MAX];
+	uint64_t val, now = 0;
+	int i, nempty, waiting, ret;
+
+	if (read(fd, &val, sizeof(val)) == -1 && errno != EAGAIN)
+		return -1;
+
+	while (1) {
+		best = NULL;
+		best_item = NULL;
+		nempty = 0;
+
+		for (i=0; i<nreaders; i++) {
+			if ( (item = reader_peek(readers[i])) == NULL ) {
+				empty[nempty++] = readers[i];
+			} else if (best == NULL || item->ts < best_item->ts) {
+				best = readers[i];
+				best_item = item;
+			}
+		}
+
+		if (best == NULL)
+			break;
+
+		/* A source with a datagram in flight may deliver something
+		 * older, idle ones cannot and hold nothing back */
+		waiting = 0;
+		for (i=0; i<nempty && best_item->err == 0; i++)
+			waiting += reader_in_flight(empty[i]);
+
+		if (waiting) {
+			if (now == 0)
+				now = now_ns();
+
+			if (best_item->ts + READER_MERGE_WINDOW > now) {
+				merge_arm(best_item->ts + READER_MERGE_WINDOW - now);
+				break;
+			}
+		}
+
+		if (best_item->err == ENOBUFS) {
+			loop_overrun(best->name, ++best->overruns);
+			ret = 0;
+		} else if (best_item->err) {
+			errno = best_item->err;
+			return -1;
+		} else {
+			latency_received_at(best_item->ts, best_item->real,
+					    best_item->mono);
+			ret = best->fn(best->data, best_item->data, best_item->len);
+			free(best_item->data);
+		}
+
+		__atomic_store_n(&best->head, best->head + 1, __ATOMIC_RELEASE);
+
+		if (ret)
+			return -1;
+	}
+
+	return 0;
+}
+
+int reader_add(const char *name, int fd, reader_fn_t fn, void *data,
+	       int cpu, int prio)
+{
+	struct reader *r;
+	int on = 1;
+
+	if (nreaders == READER_MAX) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == -1)
+		return -1;
+
+	if ( (r = calloc(1, sizeof(struct reader))) == NULL )
+		return -1;
+
+	r->name = name;
+	r->fd = fd;
+	r->fn = fn;
+	r->data = data;
+	r->cpu = cpu;
+	r->prio = prio;
+
+	readers[nreaders++] = r;
+
+	return 0;
+}
+
+static void reader_tune(struct reader *r)
+{
+	struct sched_param sp;
+	cpu_set_t cpus;
+	char name[16];
+	int err;
+
+	snprintf(name, sizeof(name), "rd-%s", r->name);
+	pthread_setname_np(r->thread, name);
+
+	if (r->cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(r->cpu, &cpus);
+
+		if ( (err = pthread_setaffinity_np(r->thread, sizeof(cpus), &cpus)) )
+			fprintf(stderr, "%s: cannot pin to CPU %d: %s\n",
+				r->name, r->cpu, strerror(err));
+	}
+
+	if (r->prio > 0) {
+		memset(&sp, 0, sizeof(sp));
+		sp.sched_priority = r->prio;
+
+		if ( (err = pthread_setschedparam(r->thread, SCHED_FIFO, &sp)) )
+			fprintf(stderr, "%s: cannot set SCHED_FIFO %d: %s\n",
+				r->name, r->prio, strerror(err));
+	}
+}
+
+int reader_start(void)
+{
+	int i, err;
+
+	if ( (evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1 )
+		return -1;
+
+	if ( (mfd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC)) == -1 )
+		return -1;
+
+	if (loop_add_fd(evfd, merge_ready, NULL) == -1
+	    || loop_add_fd(mfd, merge_ready, NULL) == -1)
+		return -1;
+
+	for (i=0; i<nreaders; i++) {
+		if ( (err = pthread_create(&readers[i]->thread, NULL,
+					   reader_thread, readers[i])) ) {
+			errno = err;
+			return -1;
+		}
+
+		reader_tune(readers[i]);
+	}
+
+	return 0;
+}
@@ -21,12 +21,22 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <unistd.h>
+
 #include <netevent/rtnl.h>
 #include <netevent/console.h>
 #include <netevent/iw.h>
 #include <netevent/utils.h>
+#include <netevent/latency.h>
+#include <netevent/fmt.h>
+
+#include "probes.h"
+#include <netevent/nexthop.h>
+#include <netevent/fdb.h>
+#include <netevent/lifetime.h>
+#include <netevent/coalesce.h>
 
-static int parse_rt_attrs(struct rtattr *tb[], int max, struct rtattr *data,
+int parse_rt_attrs(struct rtattr *tb[], int max, struct rtattr *data,
 		   int len)
 {
 	struct rtattr *rta;
@@ -47,19 +57,41 @@ static int parse_rt_attrs(struct rtattr *tb[], int max, struct rtattr *data,
 	if (len > 0)
 		printf("Unparsed bytes in the RTA\n");
 
+	PROBE2(rt_attrs, max, atts);
+
 	return atts;
 }
 
+/* Attributes are indexed, what follows is the printer of the message */
+static void rtnl_decoded(void)
+{
+	latency_mark(LAT_DECODE);
+}
+
+static int coalesce_link(struct ifinfomsg *msg, char *ifname,
+			 char *state, int color)
+{
+	struct coalesce_key key;
+
+	memset(&key, 0, sizeof(key));
+	key.kind = COALESCE_LINK;
+	key.id = msg->ifi_index;
+
+	return coalesce_event(&key, ifname, state, color);
+}
+
 static int parse_ifinfomsg(struct ifinfomsg *msg)
 {
 	char ifname[IFNAMSIZ];
 
-	if_indextoname(msg->ifi_index, ifname);
+	fmt_ifname(ifname, msg->ifi_index);
 
-	if (msg->ifi_change & IFF_UP && (msg->ifi_flags & IFF_UP))
+	if (msg->ifi_change & IFF_UP && (msg->ifi_flags & IFF_UP)
+	    && !coalesce_link(msg, ifname, "UP", GREEN))
 		eprintf(GREEN, "Interface %s changed to UP\n", ifname);
 
-	if (msg->ifi_change & IFF_UP && !(msg->ifi_flags & IFF_UP))
+	if (msg->ifi_change & IFF_UP && !(msg->ifi_flags & IFF_UP)
+	    && !coalesce_link(msg, ifname, "DOWN", RED))
 		eprintf(RED, "Interface %s changed to DOWN\n", ifname);
 
 	return 0;
@@ -67,17 +99,18 @@ static int parse_ifinfomsg(struct ifinfomsg *msg)
 
 static void print_addr_event(void *addr, int family, int ifindex, int event)
 {
-	char str[INET6_ADDRSTRLEN];
-	char ifname[IFNAMSIZ];
+	char line[128], *p;
 
-	if_indextoname(ifindex, ifname);
-	inet_ntop(family, addr, str, INET6_ADDRSTRLEN);
+	if (event != RTM_NEWADDR && event != RTM_DELADDR)
+		return;
 
-	if (event == RTM_NEWADDR)
-		eprintf(GREEN, "Added %s to dev %s\n", str, ifname);
+	p = fmt_str(line, event == RTM_NEWADDR ? "Added " : "Removed ");
+	p = fmt_inet(p, family, addr);
+	p = fmt_str(p, event == RTM_NEWADDR ? " to dev " : " from dev ");
+	p = fmt_ifname(p, ifindex);
+	fmt_str(p, "\n");
 
-	if (event == RTM_DELADDR)
-		eprintf(RED, "Removed %s from dev %s\n", str, ifname, RED);
+	eputs(event == RTM_NEWADDR ? GREEN : RED, line);
 }
 
 static inline valid_family(const int family)
@@ -123,6 +156,10 @@ static int handle_addr_attrs(const struct ifaddrmsg *ifa_msg, struct rtattr *tb[
 	if (ci && addr && valid_family(family) && cache_new_address_ts(ci))
 		print_addr_event(addr, family, ifindex, type);
 
+	if (ci && addr && valid_family(family))
+		lifetime_addr_update(type, family, ifindex,
+				     ifa_msg->ifa_prefixlen, addr, ci);
+
 	return 0;
 }
 
@@ -133,6 +170,7 @@ static int handle_addr_msg(struct nlmsghdr *nlh, int n)
 	struct rtattr *tb[IFA_MAX];
 
 	parse_rt_attrs(tb, IFA_MAX, IFA_RTA(ifa_msg), IFA_PAYLOAD(nlh));
+	rtnl_decoded();
 	handle_addr_attrs(ifa_msg, tb, nlh->nlmsg_type);
 
 	return 0;
@@ -141,59 +179,65 @@ static int handle_addr_msg(struct nlmsghdr *nlh, int n)
 static void print_neigh_attrs(struct ndmsg *ndm, void *addr, void *lladdr,
 		       char *action, int color)
 {
-	char addr_str[INET6_ADDRSTRLEN], ll_str[INET6_ADDRSTRLEN];
-	char ifname[IFNAMSIZ], output[2048];
-	int len;
+	char output[256], *p;
 
-	if_indextoname(ndm->ndm_ifindex, ifname);
+	p = fmt_str(output, action);
+	p = fmt_str(p, " neighbor on ");
+	p = fmt_ifname(p, ndm->ndm_ifindex);
+	p = fmt_str(p, ":");
 
-	if (addr)
-		inet_ntop(ndm->ndm_family, addr, addr_str, INET6_ADDRSTRLEN);
-
-	if (lladdr)
-		ether_ntoa_r(lladdr, ll_str);
-
-	len = sprintf(output, "%s neighbor on %s:", action, ifname);
+	if (addr) {
+		p = fmt_str(p, " [");
+		p = fmt_inet(p, ndm->ndm_family, addr);
+		p = fmt_str(p, "]");
+	}
 
-	if (addr)
-		len += sprintf(output+len, " [%s]", addr_str);
+	if (lladdr) {
+		p = fmt_str(p, " [");
+		p = fmt_mac(p, lladdr);
+		p = fmt_str(p, "]");
+	}
 
-	if (lladdr)
-		len += sprintf(output+len," [%s]", ll_str);
+	fmt_str(p, "\n");
 
-	eprintf(color, "%s\n", output);
+	eputs(color, output);
 }
 
 static void parse_ndm_state(uint16_t state, struct nda_cacheinfo *ci)
 {
-	tprintf("Debug Nud state:");
+	char buf[256];
+	int len;
+
+	len = snprintf(buf, sizeof(buf), "Debug Nud state:");
 
 	if (state & NUD_INCOMPLETE)
-		printf(" NUD_INCOMPLETE");
+		len = strappend(buf, sizeof(buf), len, " NUD_INCOMPLETE");
 
 	if (state & NUD_REACHABLE)
-		printf(" NUD_REACHABLE");
+		len = strappend(buf, sizeof(buf), len, " NUD_REACHABLE");
 
 	if (state & NUD_STALE)
-		printf(" NUD_STALE");
+		len = strappend(buf, sizeof(buf), len, " NUD_STALE");
 
 	if (state & NUD_DELAY)
-		printf(" NUD_DELAY");
+		len = strappend(buf, sizeof(buf), len, " NUD_DELAY");
 
 	if (state & NUD_FAILED)
-		printf(" NUD_FAILED");
+		len = strappend(buf, sizeof(buf), len, " NUD_FAILED");
 
 	if (state & NUD_NOARP)
-		printf(" NUD_NOARP");
+		len = strappend(buf, sizeof(buf), len, " NUD_NOARP");
 
 	if (state & NUD_PERMANENT)
-		printf(" NUD_PERMANENT");
-
+		len = strappend(buf, sizeof(buf), len, " NUD_PERMANENT");
 
 	if (ci)
-		printf("Cache: confirmed %d updated %d used %d refcnt %d\n",
-			ci->ndm_confirmed, ci->ndm_updated, ci->ndm_used,
-			ci->ndm_refcnt);
+		len = strappend(buf, sizeof(buf), len,
+				" Cache: confirmed %d updated %d used %d refcnt %d",
+				ci->ndm_confirmed, ci->ndm_updated, ci->ndm_used,
+				ci->ndm_refcnt);
+
+	tprintf("%s\n", buf);
 }
 
 static inline detect_new_neigh(struct ndmsg *ndm, struct nda_cacheinfo *ci,
@@ -229,11 +273,8 @@ static inline detect_removed_neigh(struct ndmsg *ndm, struct nda_cacheinfo *ci,
 
 static void handle_neigh_attrs(struct ndmsg *ndm, struct rtattr *tb[], int type)
 {
-	char ifname[IFNAMSIZ];
-	void *addr = NULL, *lladdr;
-	struct nda_cacheinfo * ci;
-
-	if_indextoname(ndm->ndm_ifindex, ifname);
+	void *addr = NULL, *lladdr = NULL;
+	struct nda_cacheinfo * ci = NULL;
 
 	if (tb[NDA_DST]) {
 		addr = RTA_DATA(tb[NDA_DST]);
@@ -261,6 +302,8 @@ static void handle_neigh_attrs(struct ndmsg *ndm, struct rtattr *tb[], int type)
 		parse_ndm_state(ndm->ndm_state, ci);
 	}
 
+	lifetime_neigh_update(type, ndm, addr, ci);
+
 }
 
 static int handle_neigh_msg(struct nlmsghdr *nlh, int n)
@@ -268,14 +311,19 @@ static int handle_neigh_msg(struct nlmsghdr *nlh, int n)
 	struct rtattr *tb[NDA_MAX];
 	struct ndmsg *ndm = NLMSG_DATA(nlh);
 
+	/* Bridge and VXLAN forwarding entries carry a MAC, not an IP */
+	if (ndm->ndm_family == AF_BRIDGE)
+		return handle_fdb_msg(nlh, n);
+
 	parse_rt_attrs(tb, NDA_MAX, RTM_RTA(ndm), RTM_PAYLOAD(nlh));
+	rtnl_decoded();
 	handle_neigh_attrs(ndm, tb, nlh->nlmsg_type);
 
 	return 0;
 }
 
 static void print_route_attrs(void *src, void *dst, void *gw, int *iif, int *oif,
-		       struct rtmsg *rtm, char *action)
+		       struct rtmsg *rtm, char *action, int multi, char *extra)
 {
 	char gw_str[INET6_ADDRSTRLEN], dst_str[INET6_ADDRSTRLEN];
 	char src_str[INET6_ADDRSTRLEN], oif_str[IFNAMSIZ],
@@ -287,34 +335,39 @@ static void print_route_attrs(void *src, void *dst, void *gw, int *iif, int *oif
 	color = (strcmp(action, "Added")?RED:GREEN);
 
 	if (dst)
-		inet_ntop(rtm->rtm_family, dst, dst_str, INET6_ADDRSTRLEN);
+		fmt_inet(dst_str, rtm->rtm_family, dst);
 
 	if (src)
-		inet_ntop(rtm->rtm_family, src, src_str, INET6_ADDRSTRLEN);
+		fmt_inet(src_str, rtm->rtm_family, src);
 
 	if (gw)
-		inet_ntop(rtm->rtm_family, gw, gw_str, INET6_ADDRSTRLEN);
+		fmt_inet(gw_str, rtm->rtm_family, gw);
 
 	if (oif)
-		if_indextoname(*oif, oif_str);
+		fmt_ifname(oif_str, *oif);
 
 	if (iif)
-		if_indextoname(*iif, iif_str);
+		fmt_ifname(iif_str, *iif);
 
 	if (dst && src && oif && gw) {
-		eprintf(color, "%s route %s/%d from %s/%d on dev %s via %s\n",
+		eprintf(color, "%s route %s/%d from %s/%d on dev %s via %s%s\n",
 			action, dst_str, rtm->rtm_dst_len,
-			src_str, rtm->rtm_src_len, oif_str, gw_str);
+			src_str, rtm->rtm_src_len, oif_str, gw_str, extra);
 	} else if (dst && oif && gw) {
-		eprintf(color, "%s route %s/%d on dev %s via %s\n",
+		eprintf(color, "%s route %s/%d on dev %s via %s%s\n",
 			action, dst_str, rtm->rtm_dst_len,
-			oif_str, gw_str);
+			oif_str, gw_str, extra);
 	} else if (dst && oif) {
-		eprintf(color, "%s route %s/%d on dev %s\n",
-			action, dst_str, rtm->rtm_dst_len, oif_str);
+		eprintf(color, "%s route %s/%d on dev %s%s\n",
+			action, dst_str, rtm->rtm_dst_len, oif_str, extra);
 	} else if (gw && oif) {
-		eprintf(color, "%s default route via %s on dev %s\n",
-			action, gw_str, oif_str);
+		eprintf(color, "%s default route via %s on dev %s%s\n",
+			action, gw_str, oif_str, extra);
+	} else if (dst && multi) {
+		eprintf(color, "%s route %s/%d%s\n",
+			action, dst_str, rtm->rtm_dst_len, extra);
+	} else if (multi) {
+		eprintf(color, "%s default route%s\n", action, extra);
 	} else {
 		len = sprintf(buf, "%s unknown route type:", action);
 		if (gw)
@@ -331,10 +384,147 @@ static void print_route_attrs(void *src, void *dst, void *gw, int *iif, int *oif
 	}
 }
 
-static int handle_route_attrs(struct rtmsg *rtm, struct rtattr *tb[], int type)
+static int format_route_metrics(char *buf, size_t size, int len,
+				struct rtattr *metrics)
+{
+	struct rtattr *tb[RTAX_MAX + 1];
+
+	parse_rt_attrs(tb, RTAX_MAX + 1, RTA_DATA(metrics),
+		       RTA_PAYLOAD(metrics));
+
+	if (tb[RTAX_MTU])
+		len = strappend(buf, size, len, " mtu %u",
+				*(uint32_t *) RTA_DATA(tb[RTAX_MTU]));
+
+	if (tb[RTAX_ADVMSS])
+		len = strappend(buf, size, len, " advmss %u",
+				*(uint32_t *) RTA_DATA(tb[RTAX_ADVMSS]));
+
+	if (tb[RTAX_HOPLIMIT])
+		len = strappend(buf, size, len, " hoplimit %u",
+				*(uint32_t *) RTA_DATA(tb[RTAX_HOPLIMIT]));
+
+	if (tb[RTAX_WINDOW])
+		len = strappend(buf, size, len, " window %u",
+				*(uint32_t *) RTA_DATA(tb[RTAX_WINDOW]));
+
+	return len;
+}
+
+static void route_key(struct route_key *rk, struct rtmsg *rtm,
+		      struct rtattr *tb[], unsigned int table)
+{
+	memset(rk, 0, sizeof(*rk));
+	rk->family = rtm->rtm_family;
+	rk->dst_len = rtm->rtm_dst_len;
+	rk->tos = rtm->rtm_tos;
+	rk->table = table;
+
+	if (tb[RTA_PRIORITY])
+		rk->prio = *(uint32_t *) RTA_DATA(tb[RTA_PRIORITY]);
+
+	if (tb[RTA_DST] && RTA_PAYLOAD(tb[RTA_DST]) <= sizeof(rk->dst))
+		memcpy(rk->dst, RTA_DATA(tb[RTA_DST]), RTA_PAYLOAD(tb[RTA_DST]));
+}
+
+/**
+ * @short Describe table, metric and nexthops of a route
+ *
+ * Routes using nexthop objects are described by their shared nexthop,
+ * RTA_MULTIPATH sets are interned so identical path sets across routes
+ * are stored once. Each route holds a reference on one of them at most.
+ *
+ * @return 1 if the route has its nexthops in RTA_NH_ID or RTA_MULTIPATH,
+ * -1 if the event is a nexthop change re-announcement to be dropped
+ */
+static int format_route_extra(char *buf, size_t size, struct rtmsg *rtm,
+			      struct rtattr *tb[], const struct nlmsghdr *nlh)
+{
+	struct mpath_entry *mp;
+	struct route_key rk;
+	unsigned int table = rtm->rtm_table;
+	int len = 0, multi = 0, type = nlh->nlmsg_type;
+
+	buf[0] = '\0';
+
+	if (tb[RTA_TABLE])
+		table = *(uint32_t *) RTA_DATA(tb[RTA_TABLE]);
+
+	route_key(&rk, rtm, tb, table);
+
+	if (table != RT_TABLE_MAIN)
+		len = strappend(buf, size, len, " table %u", table);
+
+	if (tb[RTA_PRIORITY])
+		len = strappend(buf, size, len, " metric %u",
+				*(uint32_t *) RTA_DATA(tb[RTA_PRIORITY]));
+
+	if (tb[RTA_NH_ID]) {
+		uint32_t id = *(uint32_t *) RTA_DATA(tb[RTA_NH_ID]);
+
+		if (nexthop_route_ref(&rk, id, nlh))
+			return -1;
+		len = format_nexthop_id(buf, size, len, id);
+		multi = 1;
+	} else if (tb[RTA_MULTIPATH]) {
+		mp = mpath_route_ref(&rk, rtm->rtm_family,
+				     RTA_DATA(tb[RTA_MULTIPATH]),
+				     RTA_PAYLOAD(tb[RTA_MULTIPATH]), type);
+		len = format_multipath(buf, size, len, rtm->rtm_family,
+				       RTA_DATA(tb[RTA_MULTIPATH]),
+				       RTA_PAYLOAD(tb[RTA_MULTIPATH]));
+		if (mp)
+			len = strappend(buf, size, len,
+					" (path set %u, %lu routes)",
+					mp->id, mp->routes);
+		multi = 1;
+	} else {
+		route_ref_release(&rk);
+	}
+
+	if (tb[RTA_METRICS])
+		len = format_route_metrics(buf, size, len, tb[RTA_METRICS]);
+
+	return multi;
+}
+
+static int coalesce_route(struct rtmsg *rtm, struct rtattr *tb[], int type)
+{
+	struct coalesce_key key;
+	char label[INET6_ADDRSTRLEN + 16], *p;
+	int alen = (rtm->rtm_family == AF_INET6) ? 16 : 4;
+
+	if (!coalesce_enabled())
+		return 0;
+
+	memset(&key, 0, sizeof(key));
+	key.kind = COALESCE_ROUTE;
+	key.family = rtm->rtm_family;
+	key.prefixlen = rtm->rtm_dst_len;
+	key.id = tb[RTA_TABLE] ? *(uint32_t *) RTA_DATA(tb[RTA_TABLE])
+		: rtm->rtm_table;
+
+	if (tb[RTA_DST] && RTA_PAYLOAD(tb[RTA_DST]) >= alen)
+		memcpy(key.addr, RTA_DATA(tb[RTA_DST]), alen);
+
+	p = fmt_str(label, "route ");
+	p = fmt_inet(p, rtm->rtm_family, key.addr);
+	p = fmt_str(p, "/");
+	fmt_uint(p, key.prefixlen);
+
+	if (type == RTM_NEWROUTE)
+		return coalesce_event(&key, label, "Added", GREEN);
+
+	return coalesce_event(&key, label, "Removed", RED);
+}
+
+static int handle_route_attrs(struct rtmsg *rtm, struct rtattr *tb[],
+			      const struct nlmsghdr *nlh)
 {
 	void *src = NULL, *dst = NULL, *gw = NULL;
 	int *iif = NULL, *oif = NULL;
+	char extra[1024];
+	int multi, type = nlh->nlmsg_type;
 
 	if (tb[RTA_DST]) {
 		dst = RTA_DATA(tb[RTA_DST]);
@@ -356,10 +546,25 @@ static int handle_route_attrs(struct rtmsg *rtm, struct rtattr *tb[], int type)
 		gw = RTA_DATA(tb[RTA_GATEWAY]);
 	}
 
+	if (type != RTM_NEWROUTE && type != RTM_DELROUTE)
+		return 0;
+
+	multi = format_route_extra(extra, sizeof(extra), rtm, tb, nlh);
+	if (multi < 0 || coalesce_route(rtm, tb, type))
+		return 0;
+
+	/* Nexthop objects and multipath sets supersede the compat expansion */
+	if (multi) {
+		gw = NULL;
+		oif = NULL;
+	}
+
 	if (type == RTM_NEWROUTE) {
-		print_route_attrs(src, dst, gw, iif, oif, rtm, "Added");
-	} else if (type == RTM_DELROUTE) {
-		print_route_attrs(src, dst, gw, iif, oif, rtm, "Removed");
+		print_route_attrs(src, dst, gw, iif, oif, rtm, "Added",
+				  multi, extra);
+	} else {
+		print_route_attrs(src, dst, gw, iif, oif, rtm, "Removed",
+				  multi, extra);
 	}
 
 	return 0;
@@ -391,10 +596,11 @@ static void parse_route_proto(struct rtmsg *rtm)
 static int handle_route_msg(struct nlmsghdr *nlh, int n)
 {
 	struct rtmsg *rtm = NLMSG_DATA(nlh);
-	struct rtattr *tb[RTN_MAX];
+	struct rtattr *tb[RTA_MAX + 1];
 
-	parse_rt_attrs(tb, RTN_MAX, RTM_RTA(rtm), RTM_PAYLOAD(nlh));
-	handle_route_attrs(rtm, tb, nlh->nlmsg_type);
+	parse_rt_attrs(tb, RTA_MAX + 1, RTM_RTA(rtm), RTM_PAYLOAD(nlh));
+	rtnl_decoded();
+	handle_route_attrs(rtm, tb, nlh);
 
 	return 0;
 }
@@ -410,7 +616,7 @@ static int handle_link_attrs(struct ifinfomsg * ifla, struct rtattr *tb[], int t
 
 	if (tb[IFLA_BROADCAST]) {
 		rta = tb[IFLA_BROADCAST];
-		ether_ntoa_r((struct ether_addr *) RTA_DATA(rta), brd);
+		fmt_mac(brd, RTA_DATA(rta));
 	}
 
 	if (tb[IFLA_IFNAME]) {
@@ -420,7 +626,7 @@ static int handle_link_attrs(struct ifinfomsg * ifla, struct rtattr *tb[], int t
 
 	if (tb[IFLA_ADDRESS]) {
 		rta = tb[IFLA_ADDRESS];
-		ether_ntoa_r((struct ether_addr*) RTA_DATA(rta), ll);
+		fmt_mac(ll, RTA_DATA(rta));
 	}
 
 	if (tb[IFLA_MTU]) {
@@ -452,6 +658,11 @@ static int handle_link_msg(struct nlmsghdr *nlh, int n)
 
 
 	int atts = parse_rt_attrs(tb, IFLA_MAX, IFLA_RTA(ifla_msg), IFLA_PAYLOAD(nlh));
+	rtnl_decoded();
+
+	/* Renames and deletions reach the name cache before any output */
+	if (tb[IFLA_IFNAME])
+		fmt_ifname_update(ifla_msg->ifi_index, RTA_DATA(tb[IFLA_IFNAME]));
 
 	parse_ifinfomsg(ifla_msg);
 
@@ -460,10 +671,28 @@ static int handle_link_msg(struct nlmsghdr *nlh, int n)
 	return 0;
 }
 
+static int rtnl_msg_ifindex(struct nlmsghdr *nlh)
+{
+	switch (nlh->nlmsg_type) {
+	case RTM_NEWLINK:
+	case RTM_DELLINK:
+		return ((struct ifinfomsg *) NLMSG_DATA(nlh))->ifi_index;
+	case RTM_NEWADDR:
+	case RTM_DELADDR:
+		return ((struct ifaddrmsg *) NLMSG_DATA(nlh))->ifa_index;
+	case RTM_NEWNEIGH:
+	case RTM_DELNEIGH:
+		return ((struct ndmsg *) NLMSG_DATA(nlh))->ndm_ifindex;
+	}
+
+	return 0;
+}
+
 int parse_rt_event(void *data, size_t n)
 {
 	struct nlmsghdr *nlh = (struct nlmsghdr *)data;
 
+	console_set_context(nlh->nlmsg_type, rtnl_msg_ifindex(nlh));
 
 	switch (nlh->nlmsg_type) {
 	case RTM_NEWLINK:
@@ -486,11 +715,18 @@ int parse_rt_event(void *data, size_t n)
 	case RTM_GETROUTE:
 		handle_route_msg(nlh, n);
 		break;
+	case RTM_NEWNEXTHOP:
+	case RTM_DELNEXTHOP:
+	case RTM_GETNEXTHOP:
+		handle_nexthop_msg(nlh, n);
+		break;
 	default:
 		eprintf(RED, "Unknown netlink event\n");
 		break;
 	}
 
+	console_set_context(0, 0);
+
 	return 0;
 }
 
@@ -505,7 +741,7 @@ int parse_rt_event(void *data, size_t n)
 */
 int setup_rtsocket(int filter)
 {
-	int sknl;
+	int sknl, group;
 	struct sockaddr_nl skaddr;
 
 	sknl = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
@@ -518,31 +754,375 @@ int setup_rtsocket(int filter)
 	skaddr.nl_groups = filter;
 
 	if (bind(sknl, (struct sockaddr *) &skaddr, sizeof(skaddr)) < 0) {
+		close(sknl);
 		return -1;
 	}
 
+	/*
+	 * Nexthop objects have no legacy RTMGRP bit, follow the route
+	 * groups. Older kernels reject the group, which is harmless.
+	 */
+	if (filter & (RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE)) {
+		group = RTNLGRP_NEXTHOP;
+		setsockopt(sknl, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP,
+			   &group, sizeof(group));
+	}
+
 	return sknl;
 }
 
+int rtnl_set_filter(int fd, int old, int filter)
+{
+	const int route = RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE;
+	int group, opt;
+
+	for (group=1; group<=32; group++) {
+		if ( ((old ^ filter) & (1U << (group - 1))) == 0 )
+			continue;
+
+		opt = (filter & (1U << (group - 1))) ? NETLINK_ADD_MEMBERSHIP
+						       : NETLINK_DROP_MEMBERSHIP;
+		if (setsockopt(fd, SOL_NETLINK, opt, &group, sizeof(group)) == -1)
+			return -1;
+	}
+
+	/* Follow setup_rtsocket(), nexthop rides on the route groups */
+	if ( !(old & route) != !(filter & route) ) {
+		group = RTNLGRP_NEXTHOP;
+		opt = (filter & route) ? NETLINK_ADD_MEMBERSHIP
+				       : NETLINK_DROP_MEMBERSHIP;
+		setsockopt(fd, SOL_NETLINK, opt, &group, sizeof(group));
+	}
+
+	return 0;
+}
+
+static const struct {
+	const char *name;
+	int bit;
+} rtnl_groups[] = {
+	{ "RTMGRP_LINK", RTMGRP_LINK },
+	{ "RTMGRP_NOTIFY", RTMGRP_NOTIFY },
+	{ "RTMGRP_NEIGH", RTMGRP_NEIGH },
+	{ "RTMGRP_IPV6_IFADDR", RTMGRP_IPV6_IFADDR },
+	{ "RTMGRP_IPV6_ROUTE", RTMGRP_IPV6_ROUTE },
+	{ "RTMGRP_IPV6_MROUTE", RTMGRP_IPV6_MROUTE },
+	{ "RTMGRP_IPV6_IFINFO", RTMGRP_IPV6_IFINFO },
+	{ "RTMGRP_IPV4_IFADDR", RTMGRP_IPV4_IFADDR },
+	{ "RTMGRP_IPV4_ROUTE", RTMGRP_IPV4_ROUTE },
+	{ "RTMGRP_IPV4_MROUTE", RTMGRP_IPV4_MROUTE },
+};
+
+int rtnl_group_bit(const char *name)
+{
+	unsigned int i;
+
+	for (i=0; i<sizeof(rtnl_groups)/sizeof(rtnl_groups[0]); i++) {
+		if (strcmp(rtnl_groups[i].name, name) == 0)
+			return rtnl_groups[i].bit;
+	}
+
+	return 0;
+}
+
+static size_t rtnl_hdrlen(int type)
+{
+	switch (type) {
+	case RTM_GETLINK:
+		return sizeof(struct ifinfomsg);
+	case RTM_GETADDR:
+		return sizeof(struct ifaddrmsg);
+	case RTM_GETNEIGH:
+		return sizeof(struct ndmsg);
+	}
+
+	return sizeof(struct rtmsg);
+}
+
+static void rtnl_put_u32(struct nlmsghdr *nlh, int type, uint32_t v)
+{
+	struct rtattr *rta = (struct rtattr *) ((char *) nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(sizeof(v));
+	memcpy(RTA_DATA(rta), &v, sizeof(v));
+	nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+}
+
+/* Fill the request for the slice f, -1 if f does not apply to type */
+static int rtnl_request(struct nlmsghdr *nlh, int type, const struct rtnl_filter *f)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+	struct ifaddrmsg *ifa = NLMSG_DATA(nlh);
+	struct rtmsg *rtm = NLMSG_DATA(nlh);
+	struct ndmsg *ndm = NLMSG_DATA(nlh);
+
+	nlh->nlmsg_len = NLMSG_LENGTH(rtnl_hdrlen(type));
+	nlh->nlmsg_type = type;
+	nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+
+	if (f == NULL)
+		return 0;
+
+	switch (type) {
+	case RTM_GETLINK:
+		if (f->table)
+			return -1;
+		ifi->ifi_family = f->family;
+		/* Link dumps take no ifindex, ask for the one link */
+		if (f->ifindex) {
+			ifi->ifi_index = f->ifindex;
+			nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+		} else if (f->master) {
+			rtnl_put_u32(nlh, IFLA_MASTER, f->master);
+		}
+		break;
+	case RTM_GETADDR:
+		if (f->master || f->table)
+			return -1;
+		ifa->ifa_family = f->family;
+		ifa->ifa_index = f->ifindex;
+		break;
+	case RTM_GETROUTE:
+		if (f->master)
+			return -1;
+		rtm->rtm_family = f->family;
+		if (f->table) {
+			rtm->rtm_table = f->table < 256 ? f->table : RT_TABLE_UNSPEC;
+			rtnl_put_u32(nlh, RTA_TABLE, f->table);
+		}
+		if (f->ifindex)
+			rtnl_put_u32(nlh, RTA_OIF, f->ifindex);
+		break;
+	case RTM_GETNEIGH:
+		if (f->table)
+			return -1;
+		ndm->ndm_family = f->family;
+		/* Understood by the bridge fdb dump too, unlike ndm_ifindex */
+		if (f->ifindex)
+			rtnl_put_u32(nlh, NDA_IFINDEX, f->ifindex);
+		if (f->master)
+			rtnl_put_u32(nlh, NDA_MASTER, f->master);
+		break;
+	default:
+		return -1;
+	}
+
+	return 0;
+}
+
+static struct rtattr * rtnl_find_attr(struct rtattr *rta, int len, int type)
+{
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == type && RTA_PAYLOAD(rta) >= sizeof(uint32_t))
+			return rta;
+	}
+
+	return NULL;
+}
+
+static uint32_t rtnl_attr_u32(struct rtattr *rta, int len, int type)
+{
+	uint32_t v = 0;
+
+	if ( (rta = rtnl_find_attr(rta, len, type)) != NULL )
+		memcpy(&v, RTA_DATA(rta), sizeof(v));
+
+	return v;
+}
+
+/* Output interface of a route, or of any of its nexthops */
+static int route_uses_dev(struct rtmsg *rtm, int len, int ifindex)
+{
+	struct rtattr *mp;
+	struct rtnexthop *nh;
+	int left;
+
+	if (rtnl_find_attr(RTM_RTA(rtm), len, RTA_OIF))
+		return rtnl_attr_u32(RTM_RTA(rtm), len, RTA_OIF) == (uint32_t) ifindex;
+
+	if ( (mp = rtnl_find_attr(RTM_RTA(rtm), len, RTA_MULTIPATH)) == NULL )
+		return 0;
+
+	nh = RTA_DATA(mp);
+	left = RTA_PAYLOAD(mp);
+
+	while (RTNH_OK(nh, left)) {
+		if (nh->rtnh_ifindex == ifindex)
+			return 1;
+		left -= RTNH_ALIGN(nh->rtnh_len);
+		nh = RTNH_NEXT(nh);
+	}
+
+	return 0;
+}
+
+int rtnl_filter_match(const struct rtnl_filter *f, const struct nlmsghdr *nlh)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+	struct ifaddrmsg *ifa = NLMSG_DATA(nlh);
+	struct rtmsg *rtm = NLMSG_DATA(nlh);
+	struct ndmsg *ndm = NLMSG_DATA(nlh);
+	uint32_t table;
+	int len;
+
+	if (f == NULL)
+		return 1;
+
+	switch (nlh->nlmsg_type) {
+	case RTM_NEWLINK:
+	case RTM_DELLINK:
+		len = IFLA_PAYLOAD(nlh);
+		return (!f->family || ifi->ifi_family == f->family)
+			&& (!f->ifindex || ifi->ifi_index == f->ifindex)
+			&& (!f->master || rtnl_attr_u32(IFLA_RTA(ifi), len, IFLA_MASTER)
+					  == (uint32_t) f->master);
+	case RTM_NEWADDR:
+	case RTM_DELADDR:
+		return (!f->family || ifa->ifa_family == f->family)
+			&& (!f->ifindex || (int) ifa->ifa_index == f->ifindex);
+	case RTM_NEWROUTE:
+	case RTM_DELROUTE:
+		len = RTM_PAYLOAD(nlh);
+		table = rtnl_attr_u32(RTM_RTA(rtm), len, RTA_TABLE);
+		if (table == 0)
+			table = rtm->rtm_table;
+		return (!f->family || rtm->rtm_family == f->family)
+			&& (!f->table || table == f->table)
+			&& (!f->ifindex || route_uses_dev(rtm, len, f->ifindex));
+	case RTM_NEWNEIGH:
+	case RTM_DELNEIGH:
+		len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*ndm));
+		return (!f->family || ndm->ndm_family == f->family)
+			&& (!f->ifindex || ndm->ndm_ifindex == f->ifindex)
+			&& (!f->master || rtnl_attr_u32((struct rtattr *) ((char *) ndm + NLMSG_ALIGN(sizeof(*ndm))),
+							len, NDA_MASTER) == (uint32_t) f->master);
+	}
+
+	return 0;
+}
+
+int rtnl_dump(int type, rtnl_dump_fn fn, void *data)
+{
+	return rtnl_dump_filter(type, NULL, fn, data);
+}
+
+int rtnl_dump_filter(int type, const struct rtnl_filter *f,
+		     rtnl_dump_fn fn, void *data)
+{
+	struct {
+		struct nlmsghdr nlh;
+		char hdr[sizeof(struct ifinfomsg)];
+		char attrs[2 * RTA_SPACE(sizeof(uint32_t))];
+	} req;
+	char buf[32768] __attribute__((aligned(NLMSG_ALIGNTO)));
+	struct nlmsghdr *nlh;
+	int sk, n, ret = -1, err = 0, bytes = 1 << 20, one = 1;
+	int attempt = 0, intr = 0;
+
+	memset(&req, 0, sizeof(req));
+	if (rtnl_request(&req.nlh, type, f) == -1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ( (sk = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)) == -1 )
+		return -1;
+
+	setsockopt(sk, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes));
+
+	/* Older kernels ignore the filters, rtnl_filter_match() still applies */
+	setsockopt(sk, SOL_NETLINK, NETLINK_GET_STRICT_CHK, &one, sizeof(one));
+
+retry:
+	req.nlh.nlmsg_seq = ++attempt;
+
+	if (send(sk, &req, req.nlh.nlmsg_len, 0) == -1)
+		goto out;
+
+	for (;;) {
+		if ( (n = recv(sk, buf, sizeof(buf), 0)) == -1 ) {
+			if (errno == EINTR)
+				continue;
+			goto out;
+		}
+
+		for (nlh = (struct nlmsghdr *) buf; NLMSG_OK(nlh, n);
+		     nlh = NLMSG_NEXT(nlh, n)) {
+			if (nlh->nlmsg_seq != req.nlh.nlmsg_seq)
+				continue;
+
+			if (nlh->nlmsg_flags & NLM_F_DUMP_INTR)
+				intr = 1;
+
+			if (nlh->nlmsg_type == NLMSG_DONE)
+				goto done;
+
+			if (nlh->nlmsg_type == NLMSG_ERROR) {
+				err = -((struct nlmsgerr *) NLMSG_DATA(nlh))->error;
+				/* The ACK of a single get, or a link that is gone */
+				if (err == 0 || (err == ENODEV && !(req.nlh.nlmsg_flags & NLM_F_DUMP)))
+					goto done;
+				goto out;
+			}
+
+			if (!rtnl_filter_match(f, nlh))
+				continue;
+
+			if (fn(nlh, data) != 0) {
+				ret = 0;
+				goto out;
+			}
+		}
+	}
+
+done:
+	/* Only the slice that was asked for is made again */
+	if (intr && attempt < RTNL_DUMP_RETRIES) {
+		intr = 0;
+		fn(NULL, data);
+		goto retry;
+	}
+
+	ret = 0;
+	err = 0;
+
+out:
+	if (err == 0)
+		err = errno;
+	close(sk);
+	errno = err;
+
+	return ret;
+}
+
 int recv_rtnl_msg(struct event_handler *h, int sknl)
 {
 	int bytes;
-	char buf[2048];
-	struct nlmsghdr *nlh;
+	char buf[RTNL_RCVBUF];
 
-	memset(buf, 0, 2048);
-	bytes = recv(sknl, buf, 2048, 0);
+	memset(buf, 0, RTNL_RCVBUF);
+
+	PROBE1(recv_entry, sknl);
+	bytes = latency_recv(sknl, buf, RTNL_RCVBUF, 0);
+	PROBE2(recv_exit, sknl, bytes);
 
 	if (bytes <= 0) {
 		return -1;
 	}
 
-	nlh = (struct nlmsghdr *) buf;
+	return rtnl_dispatch(h, buf, bytes);
+}
 
-	if (NLMSG_OK(nlh, bytes)) {
-		event_push(h, nlh, bytes);
-		//parse_rt_event(nlh, bytes);
-	}
+int rtnl_dispatch(void *data, void *buf, size_t len)
+{
+	struct event_handler *h = data;
+	struct nlmsghdr *nlh = buf;
+
+	if (NLMSG_OK(nlh, len))
+		event_push(h, nlh, len);
+
+	latency_done();
 
 	return 0;
 }
@@ -0,0 +1,331 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/rtnetlink.h>
+
+#include <netevent/shm.h>
+#include <netevent/ctx.h>
+#include <netevent/rtnl.h>
+#include <netevent/console.h>
+
+static struct shm_header *region;
+static struct shm_link_bucket *links;
+static struct shm_addr_bucket *addrs;
+static struct shm_neigh_bucket *neighs;
+
+static void write_begin(uint32_t *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void write_end(uint32_t *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+	region->generation++;
+}
+
+static void link_update(const struct netevent *ev)
+{
+	struct shm_link_bucket *b;
+	struct shm_link *e = NULL;
+	int i;
+
+	b = &links[shm_hash(ev->ifindex, 0, NULL, 0) & (SHM_LINK_BUCKETS - 1)];
+
+	for (i=0; i<SHM_SLOTS; i++) {
+		if (b->e[i].ifindex == ev->ifindex) {
+			e = &b->e[i];
+			break;
+		}
+		if (e == NULL && b->e[i].ifindex == 0)
+			e = &b->e[i];
+	}
+
+	if (ev->removed) {
+		if (e && e->ifindex == ev->ifindex) {
+			write_begin(&b->seq);
+			memset(e, 0, sizeof(*e));
+			write_end(&b->seq);
+		}
+		return;
+	}
+
+	if (e == NULL) {
+		region->dropped++;
+		return;
+	}
+
+	write_begin(&b->seq);
+	e->ifindex = ev->ifindex;
+	e->flags = ev->u.link.flags;
+	e->mtu = ev->u.link.mtu;
+	memcpy(e->ifname, ev->u.link.ifname, sizeof(e->ifname));
+	if (ev->u.link.lladdr_len == sizeof(e->lladdr))
+		memcpy(e->lladdr, ev->u.link.lladdr, sizeof(e->lladdr));
+	else
+		memset(e->lladdr, 0, sizeof(e->lladdr));
+	write_end(&b->seq);
+}
+
+static void addr_update(const struct netevent *ev)
+{
+	size_t len = shm_addr_len(ev->family);
+	struct shm_addr_bucket *b;
+	struct shm_addr *e = NULL;
+	int i;
+
+	b = &addrs[shm_hash(0, ev->family, ev->u.addr.addr, len)
+		   & (SHM_ADDR_BUCKETS - 1)];
+
+	for (i=0; i<SHM_SLOTS; i++) {
+		if (b->e[i].ifindex == ev->ifindex && b->e[i].family == ev->family
+		    && memcmp(b->e[i].addr, ev->u.addr.addr, len) == 0) {
+			e = &b->e[i];
+			break;
+		}
+		if (e == NULL && b->e[i].ifindex == 0)
+			e = &b->e[i];
+	}
+
+	if (ev->removed) {
+		if (e && e->ifindex) {
+			write_begin(&b->seq);
+			memset(e, 0, sizeof(*e));
+			write_end(&b->seq);
+		}
+		return;
+	}
+
+	if (e == NULL) {
+		region->dropped++;
+		return;
+	}
+
+	write_begin(&b->seq);
+	e->ifindex = ev->ifindex;
+	e->family = ev->family;
+	e->prefixlen = ev->u.addr.prefixlen;
+	memcpy(e->addr, ev->u.addr.addr, sizeof(e->addr));
+	write_end(&b->seq);
+}
+
+static void neigh_update(const struct netevent *ev)
+{
+	size_t len = shm_addr_len(ev->family);
+	struct shm_neigh_bucket *b;
+	struct shm_neigh *e = NULL;
+	int i;
+
+	b = &neighs[shm_hash(ev->ifindex, ev->family, ev->u.neigh.addr, len)
+		    & (SHM_NEIGH_BUCKETS - 1)];
+
+	for (i=0; i<SHM_SLOTS; i++) {
+		if (b->e[i].ifindex == ev->ifindex && b->e[i].family == ev->family
+		    && memcmp(b->e[i].addr, ev->u.neigh.addr, len) == 0) {
+			e = &b->e[i];
+			break;
+		}
+		if (e == NULL && b->e[i].ifindex == 0)
+			e = &b->e[i];
+	}
+
+	if (ev->removed) {
+		if (e && e->ifindex) {
+			write_begin(&b->seq);
+			memset(e, 0, sizeof(*e));
+			write_end(&b->seq);
+		}
+		return;
+	}
+
+	if (e == NULL) {
+		region->dropped++;
+		return;
+	}
+
+	write_begin(&b->seq);
+	e->ifindex = ev->ifindex;
+	e->family = ev->family;
+	e->state = ev->u.neigh.state;
+	memcpy(e->addr, ev->u.neigh.addr, sizeof(e->addr));
+	if (ev->u.neigh.lladdr_len == sizeof(e->lladdr))
+		memcpy(e->lladdr, ev->u.neigh.lladdr, sizeof(e->lladdr));
+	else
+		memset(e->lladdr, 0, sizeof(e->lladdr));
+	write_end(&b->seq);
+}
+
+/* Addresses and neighbors of a vanished interface get no event of their own */
+static void purge_ifindex(int ifindex)
+{
+	unsigned int i;
+	int j;
+
+	for (i=0; i<SHM_ADDR_BUCKETS; i++) {
+		for (j=0; j<SHM_SLOTS; j++) {
+			if (addrs[i].e[j].ifindex != ifindex)
+				continue;
+			write_begin(&addrs[i].seq);
+			memset(&addrs[i].e[j], 0, sizeof(addrs[i].e[j]));
+			write_end(&addrs[i].seq);
+		}
+	}
+
+	for (i=0; i<SHM_NEIGH_BUCKETS; i++) {
+		for (j=0; j<SHM_SLOTS; j++) {
+			if (neighs[i].e[j].ifindex != ifindex)
+				continue;
+			write_begin(&neighs[i].seq);
+			memset(&neighs[i].e[j], 0, sizeof(neighs[i].e[j]));
+			write_end(&neighs[i].seq);
+		}
+	}
+}
+
+static int shm_update(struct nlmsghdr *nlh, void *data)
+{
+	struct netevent ev;
+
+	/* A dump that starts over rewrites the same slots */
+	if (nlh == NULL || netevent_decode(nlh, &ev) == -1 || ev.ifindex <= 0)
+		return 0;
+
+	switch (ev.type) {
+	case NETEVENT_LINK:
+		/* Bridge port messages share the type */
+		if (ev.family != AF_UNSPEC)
+			break;
+		link_update(&ev);
+		if (ev.removed)
+			purge_ifindex(ev.ifindex);
+		break;
+	case NETEVENT_ADDR:
+		if (ev.family == AF_INET || ev.family == AF_INET6)
+			addr_update(&ev);
+		break;
+	case NETEVENT_NEIGH:
+		if (ev.family == AF_INET || ev.family == AF_INET6)
+			neigh_update(&ev);
+		break;
+	}
+
+	return 0;
+}
+
+int shm_rt_event(void *data, size_t len)
+{
+	struct nlmsghdr *nlh;
+	int n = len;
+
+	if (region == NULL)
+		return 0;
+
+	for (nlh = data; NLMSG_OK(nlh, n); nlh = NLMSG_NEXT(nlh, n))
+		shm_update(nlh, NULL);
+
+	return 0;
+}
+
+int shm_init(const char *path, int filter)
+{
+	size_t off, size;
+	char tmp[PATH_MAX];
+	void *map;
+	int fd;
+
+	off = sizeof(*region);
+	size = off + SHM_LINK_BUCKETS * sizeof(*links)
+		+ SHM_ADDR_BUCKETS * sizeof(*addrs)
+		+ SHM_NEIGH_BUCKETS * sizeof(*neighs);
+
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int) sizeof(tmp)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	/* A new inode, readers of the previous one keep a valid mapping */
+	if ( (fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1 )
+		return -1;
+
+	if (ftruncate(fd, size) == -1) {
+		close(fd);
+		unlink(tmp);
+		return -1;
+	}
+
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		unlink(tmp);
+		return -1;
+	}
+
+	region = map;
+	memcpy(region->magic, SHM_MAGIC, sizeof(region->magic));
+	region->version = SHM_VERSION;
+	region->size = size;
+	region->slots = SHM_SLOTS;
+	region->link_buckets = SHM_LINK_BUCKETS;
+	region->addr_buckets = SHM_ADDR_BUCKETS;
+	region->neigh_buckets = SHM_NEIGH_BUCKETS;
+	region->link_off = off;
+	region->addr_off = off += SHM_LINK_BUCKETS * sizeof(*links);
+	region->neigh_off = off += SHM_ADDR_BUCKETS * sizeof(*addrs);
+	region->pid = getpid();
+	region->flags = SHM_LIVE;
+
+	links = (void *) ((char *) region + region->link_off);
+	addrs = (void *) ((char *) region + region->addr_off);
+	neighs = (void *) ((char *) region + region->neigh_off);
+
+	/* Sockets are bound already, what changes during the dump follows */
+	if ( ((filter & RTMGRP_LINK) && rtnl_dump(RTM_GETLINK, shm_update, NULL) == -1)
+	     || ((filter & (RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR))
+		 && rtnl_dump(RTM_GETADDR, shm_update, NULL) == -1)
+	     || ((filter & RTMGRP_NEIGH) && rtnl_dump(RTM_GETNEIGH, shm_update, NULL) == -1)
+	     || rename(tmp, path) == -1 ) {
+		munmap(map, size);
+		region = NULL;
+		unlink(tmp);
+		return -1;
+	}
+
+	if (region->dropped)
+		tprintf("Shared memory: %llu entries did not fit in their bucket\n",
+			(unsigned long long) region->dropped);
+
+	return 0;
+}
+
+void shm_close(void)
+{
+	if (region == NULL)
+		return;
+
+	__atomic_and_fetch(&region->flags, ~SHM_LIVE, __ATOMIC_RELEASE);
+	munmap(region, region->size);
+	region = NULL;
+}
@@ -0,0 +1,968 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#include <linux/neighbour.h>
+#include <linux/nl80211.h>
+
+#include <netevent/state.h>
+#include <netevent/ctx.h>
+#include <netevent/rtnl.h>
+#include <netevent/hash.h>
+#include <netevent/console.h>
+#include <netevent/timer.h>
+
+struct state_entry
+{
+	struct hnode node;
+	struct state_key key;
+	int ifindex;
+	struct nlmsghdr *raw;	/* dump message, while reconciling only */
+	uint32_t len;		/* of msg, normalized */
+	unsigned char msg[];
+};
+
+/* Dumped entries, sorted by key before the merge */
+struct state_dump
+{
+	struct state_entry **v;
+	size_t n;
+	size_t size;
+	size_t mark;		/* where the running rtnl_dump() started */
+	int filter;
+	int err;
+};
+
+static const unsigned short link_volatile[] = {
+	IFLA_STATS, IFLA_STATS64, IFLA_AF_SPEC, IFLA_CARRIER_CHANGES,
+	IFLA_CARRIER_UP_COUNT, IFLA_CARRIER_DOWN_COUNT, 0
+};
+/* Only present in the notification that carries the event */
+static const unsigned short link_event[] = { IFLA_EVENT, 0 };
+static const unsigned short bridge_volatile[] = {
+	IFLA_BR_HELLO_TIMER, IFLA_BR_TCN_TIMER, IFLA_BR_TOPOLOGY_CHANGE_TIMER,
+	IFLA_BR_GC_TIMER, 0
+};
+static const unsigned short brport_volatile[] = {
+	IFLA_BRPORT_MESSAGE_AGE_TIMER, IFLA_BRPORT_FORWARD_DELAY_TIMER,
+	IFLA_BRPORT_HOLD_TIMER, 0
+};
+static const unsigned short addr_volatile[] = { IFA_CACHEINFO, 0 };
+static const unsigned short route_volatile[] = { RTA_CACHEINFO, RTA_EXPIRES, 0 };
+static const unsigned short neigh_volatile[] = { NDA_CACHEINFO, NDA_PROBES, 0 };
+
+static const int dump_requests[] = {
+	[NETEVENT_LINK] = RTM_GETLINK,
+	[NETEVENT_ADDR] = RTM_GETADDR,
+	[NETEVENT_ROUTE] = RTM_GETROUTE,
+	[NETEVENT_NEIGH] = RTM_GETNEIGH,
+};
+
+static const char *type_names[] = {
+	[NETEVENT_LINK] = "links",
+	[NETEVENT_ADDR] = "addresses",
+	[NETEVENT_ROUTE] = "routes",
+	[NETEVENT_NEIGH] = "neighbors",
+};
+
+static struct htable table;
+static const char *state_path;
+static uint64_t generation;
+static int enabled;
+static int dump_filter;
+static struct event_handler *handler;
+static struct timer resync_timer;
+static unsigned int resync_types;
+static state_watch_t watch_fn;
+static void *watch_data;
+
+static int key_cmp(const struct state_key *a, const struct state_key *b)
+{
+	return memcmp(a, b, sizeof(*a));
+}
+
+static int entry_cmp(const struct hnode *n, const void *key)
+{
+	return key_cmp(&hnode_entry(n, struct state_entry, node)->key, key);
+}
+
+static int entry_sort(const void *a, const void *b)
+{
+	return key_cmp(&(*(struct state_entry **) a)->key,
+		       &(*(struct state_entry **) b)->key);
+}
+
+static uint32_t key_hash(const struct state_key *key)
+{
+	return hash_bytes(key, sizeof(*key), 0);
+}
+
+static size_t msg_hdrlen(int type)
+{
+	switch (type) {
+	case NETEVENT_LINK:
+		return sizeof(struct ifinfomsg);
+	case NETEVENT_ADDR:
+		return sizeof(struct ifaddrmsg);
+	case NETEVENT_NEIGH:
+		return sizeof(struct ndmsg);
+	}
+
+	return sizeof(struct rtmsg);
+}
+
+/* The same MAC may be in several VLANs, or flood to several VNIs */
+static void bridge_key(const struct nlmsghdr *nlh, struct state_key *key)
+{
+	struct ndmsg *ndm = NLMSG_DATA(nlh);
+	struct rtattr *tb[NDA_MAX + 1];
+
+	parse_rt_attrs(tb, NDA_MAX + 1, RTM_RTA(ndm), RTM_PAYLOAD(nlh));
+
+	if (tb[NDA_VLAN] && RTA_PAYLOAD(tb[NDA_VLAN]) >= sizeof(uint16_t))
+		key->vlan = htons(*(uint16_t *) RTA_DATA(tb[NDA_VLAN]));
+	if (tb[NDA_VNI] && RTA_PAYLOAD(tb[NDA_VNI]) >= sizeof(uint32_t))
+		key->vni = htonl(*(uint32_t *) RTA_DATA(tb[NDA_VNI]));
+}
+
+static int make_key(const struct nlmsghdr *nlh, struct state_key *key,
+		    int *ifindex)
+{
+	struct netevent ev;
+	uint32_t id = 0;
+	int len;
+
+	if (netevent_decode(nlh, &ev) == -1)
+		return -1;
+
+	memset(key, 0, sizeof(*key));
+	key->type = ev.type;
+	key->family = ev.family;
+	*ifindex = ev.ifindex;
+
+	switch (ev.type) {
+	case NETEVENT_LINK:
+		id = ev.ifindex;
+		break;
+	case NETEVENT_ADDR:
+		id = ev.ifindex;
+		memcpy(key->addr, ev.u.addr.addr, 16);
+		key->plen = ev.u.addr.prefixlen;
+		break;
+	case NETEVENT_ROUTE:
+		/* Multicast routing tables are not tracked */
+		if (ev.family != AF_INET && ev.family != AF_INET6)
+			return -1;
+		id = ev.u.route.table;
+		memcpy(key->addr, ev.u.route.dst, 16);
+		key->plen = ev.u.route.dst_len;
+		key->tos = ((struct rtmsg *) NLMSG_DATA(nlh))->rtm_tos;
+		key->prio = htonl(ev.u.route.priority);
+		break;
+	case NETEVENT_NEIGH:
+		id = ev.ifindex;
+		if (ev.family == AF_BRIDGE) {
+			len = ev.u.neigh.lladdr_len < 16 ? ev.u.neigh.lladdr_len : 16;
+			memcpy(key->addr, ev.u.neigh.lladdr, len);
+			memcpy(key->dst, ev.u.neigh.addr, 16);
+			bridge_key(nlh, key);
+		} else {
+			memcpy(key->addr, ev.u.neigh.addr, 16);
+		}
+		break;
+	}
+
+	key->id = htonl(id);
+
+	return 0;
+}
+
+int state_key(const struct nlmsghdr *nlh, struct state_key *key)
+{
+	int ifindex;
+
+	return make_key(nlh, key, &ifindex);
+}
+
+static int attr_listed(const struct rtattr *rta, const unsigned short *list)
+{
+	for (; *list; list++) {
+		if ((rta->rta_type & NLA_TYPE_MASK) == *list)
+			return 1;
+	}
+
+	return 0;
+}
+
+static void zero_attrs(struct rtattr *rta, int len, const unsigned short *list)
+{
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (attr_listed(rta, list))
+			memset(RTA_DATA(rta), 0, RTA_PAYLOAD(rta));
+	}
+}
+
+/* The timers of a bridge and of its ports run down between two dumps */
+static void linkinfo_normalize(struct rtattr *info)
+{
+	struct rtattr *rta, *data = NULL, *slave = NULL;
+	int len = RTA_PAYLOAD(info), bridge = 0, port = 0;
+
+	for (rta = RTA_DATA(info); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type & NLA_TYPE_MASK) {
+		case IFLA_INFO_KIND:
+			bridge = !strncmp(RTA_DATA(rta), "bridge", RTA_PAYLOAD(rta));
+			break;
+		case IFLA_INFO_SLAVE_KIND:
+			port = !strncmp(RTA_DATA(rta), "bridge", RTA_PAYLOAD(rta));
+			break;
+		case IFLA_INFO_DATA:
+			data = rta;
+			break;
+		case IFLA_INFO_SLAVE_DATA:
+			slave = rta;
+			break;
+		}
+	}
+
+	if (bridge && data)
+		zero_attrs(RTA_DATA(data), RTA_PAYLOAD(data), bridge_volatile);
+	if (port && slave)
+		zero_attrs(RTA_DATA(slave), RTA_PAYLOAD(slave), brport_volatile);
+}
+
+/*
+ * Zero what changes without the object changing, and drop what only a
+ * notification carries. The message may shrink, nlmsg_len follows.
+ */
+static void normalize(struct nlmsghdr *nlh, int type)
+{
+	const unsigned short *volatile_attrs;
+	size_t hdrlen = msg_hdrlen(type);
+	struct rtattr *rta;
+	int len, n;
+
+	nlh->nlmsg_flags = 0;
+	nlh->nlmsg_seq = 0;
+	nlh->nlmsg_pid = 0;
+
+	switch (type) {
+	case NETEVENT_LINK:
+		((struct ifinfomsg *) NLMSG_DATA(nlh))->ifi_change = 0;
+		volatile_attrs = link_volatile;
+		break;
+	case NETEVENT_ADDR:
+		volatile_attrs = addr_volatile;
+		break;
+	case NETEVENT_NEIGH:
+		volatile_attrs = neigh_volatile;
+		break;
+	default:
+		volatile_attrs = route_volatile;
+		break;
+	}
+
+	rta = (struct rtattr *) ((char *) NLMSG_DATA(nlh) + NLMSG_ALIGN(hdrlen));
+	len = nlh->nlmsg_len - NLMSG_LENGTH(hdrlen);
+
+	while (RTA_OK(rta, len)) {
+		if (type == NETEVENT_LINK && attr_listed(rta, link_event)) {
+			n = RTA_ALIGN(rta->rta_len) < len ? RTA_ALIGN(rta->rta_len) : len;
+			memmove(rta, (char *) rta + n, len - n);
+			nlh->nlmsg_len -= n;
+			len -= n;
+			continue;
+		}
+
+		if (attr_listed(rta, volatile_attrs))
+			memset(RTA_DATA(rta), 0, RTA_PAYLOAD(rta));
+		else if (type == NETEVENT_LINK
+			 && (rta->rta_type & NLA_TYPE_MASK) == IFLA_LINKINFO)
+			linkinfo_normalize(rta);
+
+		rta = RTA_NEXT(rta, len);
+	}
+}
+
+static struct state_entry * entry_new(const struct nlmsghdr *nlh,
+				      const struct state_key *key, int ifindex)
+{
+	struct state_entry *e;
+
+	if ( (e = malloc(sizeof(*e) + nlh->nlmsg_len)) == NULL )
+		return NULL;
+
+	e->key = *key;
+	e->ifindex = ifindex;
+	e->raw = NULL;
+	memcpy(e->msg, nlh, nlh->nlmsg_len);
+	normalize((struct nlmsghdr *) e->msg, key->type);
+	e->len = ((struct nlmsghdr *) e->msg)->nlmsg_len;
+
+	return e;
+}
+
+static void entry_changed(const struct state_entry *e, int removed)
+{
+	if (watch_fn)
+		watch_fn(&e->key, e->len ? (const struct nlmsghdr *) e->msg : NULL,
+			 removed, watch_data);
+}
+
+/* Insert e, replacing the entry with the same key */
+static void state_put(struct state_entry *e)
+{
+	uint32_t hash = key_hash(&e->key);
+	struct hnode *n;
+
+	if ( (n = htable_find(&table, hash, &e->key)) != NULL ) {
+		htable_remove(&table, n);
+		free(hnode_entry(n, struct state_entry, node));
+	}
+
+	htable_insert(&table, &e->node, hash);
+	entry_changed(e, 0);
+}
+
+/* The kernel does not notify what goes away with a link */
+static void state_purge(int ifindex)
+{
+	struct state_entry *e;
+	struct hnode *n, *next;
+	unsigned int i;
+
+	for (i=0; i<table.size; i++) {
+		for (n = table.buckets[i]; n; n = next) {
+			next = n->next;
+			e = hnode_entry(n, struct state_entry, node);
+
+			if (e->ifindex == ifindex && e->key.type != NETEVENT_LINK) {
+				htable_remove(&table, n);
+				entry_changed(e, 1);
+				free(e);
+			}
+		}
+	}
+}
+
+static void state_update(const struct nlmsghdr *nlh)
+{
+	struct state_entry *e;
+	struct state_key key;
+	struct hnode *n;
+	int ifindex;
+
+	if (make_key(nlh, &key, &ifindex) == -1)
+		return;
+
+	/* RTM_DEL* is RTM_NEW* + 1 for every tracked type */
+	if (nlh->nlmsg_type & 1) {
+		if ( (n = htable_find(&table, key_hash(&key), &key)) != NULL ) {
+			htable_remove(&table, n);
+			e = hnode_entry(n, struct state_entry, node);
+			entry_changed(e, 1);
+			free(e);
+		}
+
+		if (key.type == NETEVENT_LINK && key.family == AF_UNSPEC)
+			state_purge(ifindex);
+		return;
+	}
+
+	n = htable_find(&table, key_hash(&key), &key);
+	e = n ? hnode_entry(n, struct state_entry, node) : NULL;
+
+	/* Normalizing never grows a message, e->msg fits a raw one of e->len */
+	if (e && e->len == nlh->nlmsg_len) {
+		memcpy(e->msg, nlh, nlh->nlmsg_len);
+		normalize((struct nlmsghdr *) e->msg, key.type);
+		e->len = ((struct nlmsghdr *) e->msg)->nlmsg_len;
+		e->ifindex = ifindex;
+		entry_changed(e, 0);
+		return;
+	}
+
+	if ( (e = entry_new(nlh, &key, ifindex)) != NULL )
+		state_put(e);
+}
+
+void state_wireless_event(const struct netevent *ev)
+{
+	struct state_entry *e;
+	struct state_key key;
+	struct hnode *n;
+
+	if (!ev->u.wireless.has_mac)
+		return;
+
+	memset(&key, 0, sizeof(key));
+	key.type = NETEVENT_WIRELESS;
+	key.id = htonl(ev->ifindex);
+	memcpy(key.addr, ev->u.wireless.mac, 6);
+
+	n = htable_find(&table, key_hash(&key), &key);
+
+	switch (ev->u.wireless.cmd) {
+	case NL80211_CMD_NEW_STATION:
+		if (n || (e = malloc(sizeof(*e))) == NULL)
+			return;
+		memset(e, 0, sizeof(*e));
+		e->key = key;
+		e->ifindex = ev->ifindex;
+		state_put(e);
+		break;
+	case NL80211_CMD_DEL_STATION:
+		if (n) {
+			htable_remove(&table, n);
+			e = hnode_entry(n, struct state_entry, node);
+			entry_changed(e, 1);
+			free(e);
+		}
+		break;
+	}
+}
+
+const struct nlmsghdr * state_find(const struct state_key *key)
+{
+	struct state_entry *e;
+	struct hnode *n;
+
+	if ( (n = htable_find(&table, key_hash(key), key)) == NULL )
+		return NULL;
+
+	e = hnode_entry(n, struct state_entry, node);
+
+	return e->len ? (const struct nlmsghdr *) e->msg : NULL;
+}
+
+void state_foreach(int type, state_fn_t fn, void *data)
+{
+	struct state_entry *e;
+	struct hnode *n;
+	unsigned int i;
+
+	htable_for_each(&table, i, n) {
+		e = hnode_entry(n, struct state_entry, node);
+		if (e->key.type == type)
+			fn(&e->key, e->len ? (const struct nlmsghdr *) e->msg : NULL,
+			   data);
+	}
+}
+
+void state_watch(state_watch_t fn, void *data)
+{
+	watch_fn = fn;
+	watch_data = data;
+}
+
+int state_rt_event(void *data, size_t len)
+{
+	struct nlmsghdr *nlh;
+	int n = len;
+
+	for (nlh = data; NLMSG_OK(nlh, n); nlh = NLMSG_NEXT(nlh, n))
+		state_update(nlh);
+
+	return 0;
+}
+
+static int family_wanted(int type, int family, int filter)
+{
+	switch (type) {
+	case NETEVENT_ADDR:
+		return (family == AF_INET && (filter & RTMGRP_IPV4_IFADDR))
+			|| (family == AF_INET6 && (filter & RTMGRP_IPV6_IFADDR));
+	case NETEVENT_ROUTE:
+		return (family == AF_INET && (filter & RTMGRP_IPV4_ROUTE))
+			|| (family == AF_INET6 && (filter & RTMGRP_IPV6_ROUTE));
+	}
+
+	return 1;
+}
+
+static int dump_add(struct nlmsghdr *nlh, void *data)
+{
+	struct state_dump *d = data;
+	struct state_entry **v, *e;
+	struct state_key key;
+	int ifindex;
+
+	/* An interrupted dump starts over */
+	if (nlh == NULL) {
+		while (d->n > d->mark) {
+			e = d->v[--d->n];
+			free(e->raw);
+			free(e);
+		}
+		return 0;
+	}
+
+	if (make_key(nlh, &key, &ifindex) == -1
+	    || !family_wanted(key.type, key.family, d->filter))
+		return 0;
+
+	if (d->n == d->size) {
+		d->size = d->size ? d->size * 2 : 1024;
+		if ( (v = realloc(d->v, d->size * sizeof(*v))) == NULL ) {
+			d->err = ENOMEM;
+			return 1;
+		}
+		d->v = v;
+	}
+
+	if ( (e = entry_new(nlh, &key, ifindex)) == NULL
+	     || (e->raw = malloc(nlh->nlmsg_len)) == NULL ) {
+		free(e);
+		d->err = ENOMEM;
+		return 1;
+	}
+	memcpy(e->raw, nlh, nlh->nlmsg_len);
+
+	d->v[d->n++] = e;
+
+	return 0;
+}
+
+static unsigned int dump_types(int filter)
+{
+	unsigned int types = 0;
+
+	if (filter & RTMGRP_LINK)
+		types |= 1U << NETEVENT_LINK;
+	if (filter & (RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR))
+		types |= 1U << NETEVENT_ADDR;
+	if (filter & (RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE))
+		types |= 1U << NETEVENT_ROUTE;
+	if (filter & RTMGRP_NEIGH)
+		types |= 1U << NETEVENT_NEIGH;
+
+	return types;
+}
+
+static void dump_sort(struct state_dump *d)
+{
+	size_t i, j;
+
+	qsort(d->v, d->n, sizeof(*d->v), entry_sort);
+
+	/* Keep the last of entries sharing a key */
+	for (i=0, j=0; i<d->n; i++) {
+		if (j > 0 && key_cmp(&d->v[j - 1]->key, &d->v[i]->key) == 0) {
+			free(d->v[j - 1]->raw);
+			free(d->v[j - 1]);
+			j--;
+		}
+		d->v[j++] = d->v[i];
+	}
+	d->n = j;
+}
+
+static void dump_free(struct state_dump *d)
+{
+	size_t i;
+
+	for (i=0; i<d->n; i++) {
+		free(d->v[i]->raw);
+		free(d->v[i]);
+	}
+	free(d->v);
+}
+
+static int state_dump(struct state_dump *d, unsigned int types)
+{
+	int type;
+
+	for (type=NETEVENT_LINK; type<=NETEVENT_NEIGH; type++) {
+		if (!(types & (1U << type)))
+			continue;
+
+		d->mark = d->n;
+		if (rtnl_dump(dump_requests[type], dump_add, d) == -1)
+			return -1;
+
+		if (d->err) {
+			errno = d->err;
+			return -1;
+		}
+	}
+
+	dump_sort(d);
+
+	return 0;
+}
+
+static const char * snapshot_map(const char *path, size_t *size)
+{
+	const struct state_header *hdr;
+	struct stat st;
+	void *map;
+	int fd;
+
+	if ( (fd = open(path, O_RDONLY | O_CLOEXEC)) == -1 )
+		return NULL;
+
+	if (fstat(fd, &st) == -1 || st.st_size < (off_t) sizeof(*hdr)) {
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return NULL;
+
+	hdr = map;
+	if (memcmp(hdr->magic, STATE_MAGIC, sizeof(hdr->magic)) != 0
+	    || hdr->size != st.st_size - sizeof(*hdr)) {
+		tprintf("State %s is not a snapshot, ignored\n", path);
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	generation = hdr->generation;
+	*size = st.st_size;
+
+	return map;
+}
+
+static void emit_removed(const struct state_record *r,
+			 struct event_handler *h)
+{
+	struct nlmsghdr *nlh;
+
+	if ( (nlh = malloc(r->len)) == NULL )
+		return;
+
+	memcpy(nlh, r + 1, r->len);
+	nlh->nlmsg_type++;
+	event_push(h, nlh, r->len);
+
+	free(nlh);
+}
+
+static void reconcile(const char *map, size_t size, struct state_dump *d,
+		     unsigned int types, struct event_handler *h)
+{
+	unsigned long added = 0, changed = 0, removed = 0, kept = 0;
+	const char *p = NULL, *end = NULL;
+	const struct state_record *r;
+	struct state_entry *e;
+	size_t i = 0, rsize = 0;
+	int c;
+
+	if (map) {
+		p = map + sizeof(struct state_header);
+		end = map + size;
+	}
+
+	while (p < end || i < d->n) {
+		r = NULL;
+
+		if (p < end) {
+			r = (const struct state_record *) p;
+			if ((size_t) (end - p) < sizeof(*r)
+			    || r->len < sizeof(struct nlmsghdr)
+			    || (size_t) (end - p) < sizeof(*r) + NLMSG_ALIGN(r->len)) {
+				tprintf("State %s truncated\n", state_path);
+				p = end;
+				continue;
+			}
+
+			rsize = sizeof(*r) + NLMSG_ALIGN(r->len);
+			if (r->key.type > NETEVENT_NEIGH
+			    || !(types & (1U << r->key.type))) {
+				p += rsize;
+				continue;
+			}
+		}
+
+		if (r == NULL)
+			c = 1;
+		else if (i == d->n)
+			c = -1;
+		else
+			c = key_cmp(&r->key, &d->v[i]->key);
+
+		if (c < 0) {
+			emit_removed(r, h);
+			removed++;
+			p += rsize;
+			continue;
+		}
+
+		e = d->v[i++];
+
+		if (c > 0) {
+			event_push(h, e->raw, e->raw->nlmsg_len);
+			added++;
+			continue;
+		}
+
+		if (r->len != e->len || memcmp(r + 1, e->msg, e->len) != 0) {
+			event_push(h, e->raw, e->raw->nlmsg_len);
+			changed++;
+		} else {
+			kept++;
+		}
+		p += rsize;
+	}
+
+	if (map)
+		tprintf("State generation %llu: %lu added, %lu changed, "
+			"%lu removed, %lu unchanged\n",
+			(unsigned long long) generation, added, changed,
+			removed, kept);
+}
+
+int state_resync(int type, const struct rtnl_filter *f)
+{
+	unsigned long added = 0, changed = 0, removed = 0;
+	struct nlmsghdr **gone = NULL, *nlh;
+	struct state_entry *e, *cur;
+	struct state_dump d;
+	struct hnode *n;
+	size_t i, ngone = 0;
+	unsigned int b;
+
+	if (!enabled || type < NETEVENT_LINK || type > NETEVENT_NEIGH) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	memset(&d, 0, sizeof(d));
+	d.filter = dump_filter;
+
+	if (rtnl_dump_filter(dump_requests[type], f, dump_add, &d) == -1 || d.err) {
+		if (d.err)
+			errno = d.err;
+		dump_free(&d);
+		return -1;
+	}
+
+	dump_sort(&d);
+
+	/* What the slice held and the kernel no longer has */
+	if ( (gone = malloc((table.count + 1) * sizeof(*gone))) == NULL ) {
+		dump_free(&d);
+		return -1;
+	}
+
+	htable_for_each(&table, b, n) {
+		cur = hnode_entry(n, struct state_entry, node);
+
+		if (cur->key.type != type || cur->len == 0
+		    || !rtnl_filter_match(f, (struct nlmsghdr *) cur->msg)
+		    || bsearch(&cur, d.v, d.n, sizeof(*d.v), entry_sort))
+			continue;
+
+		if ( (nlh = malloc(cur->len)) == NULL )
+			continue;
+		memcpy(nlh, cur->msg, cur->len);
+		nlh->nlmsg_type++;
+		gone[ngone++] = nlh;
+	}
+
+	/* Pushed events update the table, it is not walked past here */
+	for (i=0; i<ngone; i++) {
+		event_push(handler, gone[i], gone[i]->nlmsg_len);
+		free(gone[i]);
+		removed++;
+	}
+	free(gone);
+
+	for (i=0; i<d.n; i++) {
+		e = d.v[i];
+		n = htable_find(&table, key_hash(&e->key), &e->key);
+		cur = n ? hnode_entry(n, struct state_entry, node) : NULL;
+
+		if (cur == NULL) {
+			event_push(handler, e->raw, e->raw->nlmsg_len);
+			added++;
+		} else if (cur->len != e->len || memcmp(cur->msg, e->msg, e->len) != 0) {
+			event_push(handler, e->raw, e->raw->nlmsg_len);
+			changed++;
+		}
+	}
+
+	dump_free(&d);
+
+	tprintf("Resync of %s: %lu added, %lu changed, %lu removed\n",
+		type_names[type], added, changed, removed);
+
+	return 0;
+}
+
+static void resync_run(struct timer *t)
+{
+	unsigned int types = resync_types;
+	int type;
+
+	resync_types = 0;
+
+	for (type=NETEVENT_LINK; type<=NETEVENT_NEIGH; type++) {
+		if ((types & (1U << type)) && state_resync(type, NULL) == -1)
+			tprintf("Resync of %s failed: %s\n", type_names[type],
+				strerror(errno));
+	}
+}
+
+void state_resync_later(unsigned int types)
+{
+	if (!enabled)
+		return;
+
+	/* Only what the dump filter covers is kept */
+	resync_types |= types & dump_types(dump_filter);
+
+	/* A storm keeps overrunning, one dump covers it */
+	if (!timer_pending(&resync_timer))
+		timer_add(&resync_timer, STATE_RESYNC_DELAY);
+}
+
+int state_init(const char *path, int filter, struct event_handler *h)
+{
+	struct state_dump d;
+	unsigned int types = dump_types(filter);
+	const char *map;
+	size_t size = 0, i;
+	int ret = 0;
+
+	state_path = path;
+	dump_filter = filter;
+	handler = h;
+
+	if (htable_init(&table, 1024, entry_cmp) == -1)
+		return -1;
+
+	timer_setup(&resync_timer, resync_run);
+
+	memset(&d, 0, sizeof(d));
+	d.filter = filter;
+
+	map = path ? snapshot_map(path, &size) : NULL;
+
+	if (state_dump(&d, types) == -1) {
+		ret = -1;
+	} else {
+		reconcile(map, size, &d, types, h);
+	}
+
+	if (map)
+		munmap((void *) map, size);
+
+	for (i=0; i<d.n; i++) {
+		free(d.v[i]->raw);
+		d.v[i]->raw = NULL;
+		if (ret == 0)
+			state_put(d.v[i]);
+		else
+			free(d.v[i]);
+	}
+	free(d.v);
+
+	enabled = (ret == 0);
+
+	return ret;
+}
+
+int state_enabled(void)
+{
+	return enabled;
+}
+
+void state_close(void)
+{
+	static const char zero[NLMSG_ALIGNTO];
+	struct state_header hdr;
+	struct state_record r;
+	struct state_entry **v;
+	struct hnode *n;
+	char tmp[PATH_MAX];
+	unsigned int i;
+	size_t count = 0, k;
+	FILE *f;
+
+	if (state_path == NULL
+	    || (v = malloc((table.count + 1) * sizeof(*v))) == NULL)
+		return;
+
+	/* Stations are relearned from events */
+	htable_for_each(&table, i, n) {
+		if (hnode_entry(n, struct state_entry, node)->len)
+			v[count++] = hnode_entry(n, struct state_entry, node);
+	}
+
+	qsort(v, count, sizeof(*v), entry_sort);
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, STATE_MAGIC, sizeof(hdr.magic));
+	hdr.generation = generation + 1;
+	hdr.count = count;
+	for (k=0; k<count; k++)
+		hdr.size += sizeof(r) + NLMSG_ALIGN(v[k]->len);
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", state_path);
+
+	if ( (f = fopen(tmp, "w")) == NULL ) {
+		tprintf("State %s: %s\n", tmp, strerror(errno));
+		free(v);
+		return;
+	}
+
+	fwrite(&hdr, sizeof(hdr), 1, f);
+
+	for (k=0; k<count; k++) {
+		memset(&r, 0, sizeof(r));
+		r.key = v[k]->key;
+		r.len = v[k]->len;
+		fwrite(&r, sizeof(r), 1, f);
+		fwrite(v[k]->msg, v[k]->len, 1, f);
+		fwrite(zero, NLMSG_ALIGN(v[k]->len) - v[k]->len, 1, f);
+	}
+
+	free(v);
+
+	/* Replace the old snapshot only with a complete one */
+	if (fflush(f) != 0 || fsync(fileno(f)) == -1) {
+		tprintf("State %s: %s\n", tmp, strerror(errno));
+		fclose(f);
+		unlink(tmp);
+		return;
+	}
+	fclose(f);
+
+	if (rename(tmp, state_path) == -1) {
+		tprintf("State %s: %s\n", state_path, strerror(errno));
+		unlink(tmp);
+		return;
+	}
+
+	tprintf("State generation %llu saved, %lu entries\n",
+		(unsigned long long) hdr.generation, (unsigned long) count);
+}
@@ -0,0 +1,405 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <net/if.h>
+#include <sys/socket.h>
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+
+#include <netevent/stats.h>
+#include <netevent/rtnl.h>
+#include <netevent/loop.h>
+#include <netevent/timer.h>
+#include <netevent/hash.h>
+#include <netevent/console.h>
+#include <netevent/fmt.h>
+
+struct stats_entry
+{
+	struct hnode node;
+	int ifindex;
+	unsigned int generation;
+	uint64_t when;		/* ns, CLOCK_MONOTONIC */
+	uint64_t c[STATS_FIELDS];
+	uint32_t above;		/* thresholds currently crossed */
+};
+
+struct stats_threshold
+{
+	int field;
+	uint64_t rate;
+};
+
+static const struct {
+	const char *name;
+	size_t off;
+} fields[STATS_FIELDS] = {
+	[STATS_RX_PACKETS] = { "rx_packets", offsetof(struct rtnl_link_stats64, rx_packets) },
+	[STATS_TX_PACKETS] = { "tx_packets", offsetof(struct rtnl_link_stats64, tx_packets) },
+	[STATS_RX_BYTES] = { "rx_bytes", offsetof(struct rtnl_link_stats64, rx_bytes) },
+	[STATS_TX_BYTES] = { "tx_bytes", offsetof(struct rtnl_link_stats64, tx_bytes) },
+	[STATS_RX_ERRORS] = { "rx_errors", offsetof(struct rtnl_link_stats64, rx_errors) },
+	[STATS_TX_ERRORS] = { "tx_errors", offsetof(struct rtnl_link_stats64, tx_errors) },
+	[STATS_RX_DROPPED] = { "rx_dropped", offsetof(struct rtnl_link_stats64, rx_dropped) },
+	[STATS_TX_DROPPED] = { "tx_dropped", offsetof(struct rtnl_link_stats64, tx_dropped) },
+};
+
+static struct stats_threshold thresholds[STATS_THRESHOLDS_MAX];
+static int nthresholds;
+
+static struct htable stats_table;
+static struct timer sample_timer;
+static unsigned int sample_interval;
+static unsigned int generation;
+static uint32_t dump_seq;
+static int dumping;
+static uint64_t dump_time;
+static int stats_fd = -1;
+
+static int stats_cmp(const struct hnode *n, const void *key)
+{
+	const struct stats_entry *e = hnode_entry(n, struct stats_entry, node);
+
+	return e->ifindex != *(const int *) key;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int parse_rate(const char *s, uint64_t *rate)
+{
+	char *end;
+	double v;
+
+	v = strtod(s, &end);
+	if (end == s || v < 0)
+		return -1;
+
+	switch (*end) {
+	case 'k': v *= 1e3; end++; break;
+	case 'M': v *= 1e6; end++; break;
+	case 'G': v *= 1e9; end++; break;
+	}
+
+	if (*end != '\0')
+		return -1;
+
+	*rate = v;
+
+	return 0;
+}
+
+int stats_add_threshold(const char *spec)
+{
+	const char *eq = strchr(spec, '=');
+	int i;
+
+	if (nthresholds == STATS_THRESHOLDS_MAX) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	if (eq == NULL)
+		goto invalid;
+
+	for (i=0; i<STATS_FIELDS; i++) {
+		if (strlen(fields[i].name) == (size_t) (eq - spec)
+		    && strncmp(fields[i].name, spec, eq - spec) == 0)
+			break;
+	}
+
+	if (i == STATS_FIELDS
+	    || parse_rate(eq + 1, &thresholds[nthresholds].rate) == -1)
+		goto invalid;
+
+	thresholds[nthresholds++].field = i;
+
+	return 0;
+
+invalid:
+	errno = EINVAL;
+	return -1;
+}
+
+/* 1234567 -> "1.2M" */
+static char * fmt_rate(char *p, uint64_t v)
+{
+	static const char units[] = " kMG";
+	double d = v;
+	int u = 0;
+
+	while (d >= 1000 && u < 3) {
+		d /= 1000;
+		u++;
+	}
+
+	if (u == 0)
+		return fmt_uint(p, v);
+
+	p += sprintf(p, "%.1f", d);
+	*p++ = units[u];
+	*p = '\0';
+
+	return p;
+}
+
+static void print_rates(const struct stats_entry *e, const uint64_t *rate)
+{
+	char output[256], *p;
+
+	p = fmt_str(output, "Rates on ");
+	p = fmt_ifname(p, e->ifindex);
+	p = fmt_str(p, ": rx ");
+	p = fmt_rate(p, rate[STATS_RX_BYTES] * 8);
+	p = fmt_str(p, "bit/s ");
+	p = fmt_rate(p, rate[STATS_RX_PACKETS]);
+	p = fmt_str(p, "pps, tx ");
+	p = fmt_rate(p, rate[STATS_TX_BYTES] * 8);
+	p = fmt_str(p, "bit/s ");
+	p = fmt_rate(p, rate[STATS_TX_PACKETS]);
+	p = fmt_str(p, "pps");
+
+	if (rate[STATS_RX_ERRORS] || rate[STATS_TX_ERRORS]) {
+		p = fmt_str(p, ", errors ");
+		p = fmt_rate(p, rate[STATS_RX_ERRORS] + rate[STATS_TX_ERRORS]);
+		p = fmt_str(p, "/s");
+	}
+
+	if (rate[STATS_RX_DROPPED] || rate[STATS_TX_DROPPED]) {
+		p = fmt_str(p, ", drops ");
+		p = fmt_rate(p, rate[STATS_RX_DROPPED] + rate[STATS_TX_DROPPED]);
+		p = fmt_str(p, "/s");
+	}
+
+	fmt_str(p, "\n");
+
+	eputs(NONE, output);
+}
+
+static void print_crossing(const struct stats_entry *e, int i, uint64_t rate,
+			   int above)
+{
+	char output[256], *p;
+
+	p = fmt_str(output, fields[thresholds[i].field].name);
+	p = fmt_str(p, " on ");
+	p = fmt_ifname(p, e->ifindex);
+	p = fmt_str(p, above ? " above " : " back below ");
+	p = fmt_rate(p, thresholds[i].rate);
+	p = fmt_str(p, "/s at ");
+	p = fmt_rate(p, rate);
+	fmt_str(p, "/s\n");
+
+	eputs(above ? RED : GREEN, output);
+}
+
+static void stats_sample(int ifindex, const struct rtnl_link_stats64 *s64)
+{
+	uint64_t c[STATS_FIELDS], rate[STATS_FIELDS], dt, moved = 0;
+	struct stats_entry *e;
+	struct hnode *n;
+	int i, above;
+
+	for (i=0; i<STATS_FIELDS; i++)
+		c[i] = *(const uint64_t *) ((const char *) s64 + fields[i].off);
+
+	n = htable_find(&stats_table, hash_u32(ifindex), &ifindex);
+
+	if (n == NULL) {
+		if ( (e = calloc(1, sizeof(*e))) == NULL )
+			return;
+		e->ifindex = ifindex;
+		e->generation = generation;
+		e->when = dump_time;
+		memcpy(e->c, c, sizeof(c));
+		htable_insert(&stats_table, &e->node, hash_u32(ifindex));
+		return;
+	}
+
+	e = hnode_entry(n, struct stats_entry, node);
+	e->generation = generation;
+	dt = (dump_time - e->when) / 1000;	/* us, keeps the product in 64 bits */
+
+	for (i=0; i<STATS_FIELDS; i++) {
+		/* Counters going back mean the device was reset */
+		rate[i] = (c[i] >= e->c[i] && dt) ?
+			(c[i] - e->c[i]) * 1000000ULL / dt : 0;
+		moved |= rate[i];
+	}
+
+	e->when = dump_time;
+	memcpy(e->c, c, sizeof(c));
+
+	if (moved)
+		print_rates(e, rate);
+
+	for (i=0; i<nthresholds; i++) {
+		above = rate[thresholds[i].field] > thresholds[i].rate;
+		if (above != !!(e->above & (1U << i))) {
+			e->above ^= 1U << i;
+			print_crossing(e, i, rate[thresholds[i].field], above);
+		}
+	}
+}
+
+/* Interfaces missing from a complete dump are gone */
+static void stats_sweep(void)
+{
+	struct stats_entry *e;
+	struct hnode *n, *next;
+	unsigned int i;
+
+	for (i=0; i<stats_table.size; i++) {
+		for (n = stats_table.buckets[i]; n; n = next) {
+			next = n->next;
+			e = hnode_entry(n, struct stats_entry, node);
+			if (e->generation != generation) {
+				htable_remove(&stats_table, n);
+				free(e);
+			}
+		}
+	}
+}
+
+static void stats_msg(struct nlmsghdr *nlh)
+{
+	struct if_stats_msg *ifsm = NLMSG_DATA(nlh);
+	struct rtattr *tb[IFLA_STATS_MAX + 1];
+	int len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*ifsm));
+
+	if (len < 0)
+		return;
+
+	parse_rt_attrs(tb, IFLA_STATS_MAX + 1,
+		       (struct rtattr *) ((char *) ifsm + NLMSG_ALIGN(sizeof(*ifsm))),
+		       len);
+
+	if (tb[IFLA_STATS_LINK_64]
+	    && RTA_PAYLOAD(tb[IFLA_STATS_LINK_64]) >= sizeof(struct rtnl_link_stats64))
+		stats_sample(ifsm->ifindex, RTA_DATA(tb[IFLA_STATS_LINK_64]));
+}
+
+static int stats_ready(void *data, int fd)
+{
+	char buf[32768] __attribute__((aligned(NLMSG_ALIGNTO)));
+	struct nlmsghdr *nlh;
+	int n, err;
+
+	while ( (n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0 ) {
+		for (nlh = (struct nlmsghdr *) buf; NLMSG_OK(nlh, n);
+		     nlh = NLMSG_NEXT(nlh, n)) {
+			if (nlh->nlmsg_seq != dump_seq || !dumping)
+				continue;
+
+			switch (nlh->nlmsg_type) {
+			case NLMSG_DONE:
+				dumping = 0;
+				stats_sweep();
+				break;
+			case NLMSG_ERROR:
+				dumping = 0;
+				err = -((struct nlmsgerr *) NLMSG_DATA(nlh))->error;
+				tprintf("Interface statistics dump failed: %s\n",
+					strerror(err));
+				break;
+			case RTM_NEWSTATS:
+				stats_msg(nlh);
+				break;
+			}
+		}
+	}
+
+	/* An overrun lost part of the dump, the next one starts over */
+	if (n == -1 && errno == ENOBUFS)
+		dumping = 0;
+
+	return 0;
+}
+
+static void stats_request(struct timer *t)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct if_stats_msg ifsm;
+	} req;
+
+	timer_add(t, sample_interval);
+
+	/* A slow dump is left to finish, a lost one is given up */
+	if (dumping && now_ns() - dump_time < STATS_DUMP_TIMEOUT * 1000000000ULL)
+		return;
+
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifsm));
+	req.nlh.nlmsg_type = RTM_GETSTATS;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nlh.nlmsg_seq = ++dump_seq;
+	req.ifsm.filter_mask = IFLA_STATS_FILTER_BIT(IFLA_STATS_LINK_64);
+
+	if (send(stats_fd, &req, req.nlh.nlmsg_len, 0) == -1) {
+		tprintf("Interface statistics request failed: %s\n",
+			strerror(errno));
+		return;
+	}
+
+	dumping = 1;
+	generation++;
+	dump_time = now_ns();
+}
+
+int stats_init(unsigned int interval)
+{
+	int bytes = STATS_RCVBUF;
+
+	if (interval == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	sample_interval = interval;
+
+	if (htable_init(&stats_table, 256, stats_cmp) == -1)
+		return -1;
+
+	if ( (stats_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK,
+				NETLINK_ROUTE)) == -1 )
+		return -1;
+
+	setsockopt(stats_fd, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes));
+
+	if (loop_add_fd(stats_fd, stats_ready, NULL) == -1)
+		return -1;
+
+	timer_setup(&sample_timer, stats_request);
+	stats_request(&sample_timer);
+
+	return 0;
+}
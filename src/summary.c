@@ -0,0 +1,358 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <netinet/ether.h>
+
+#include <netevent/summary.h>
+#include <netevent/rtnl.h>
+#include <netevent/hash.h>
+#include <netevent/timer.h>
+#include <netevent/console.h>
+#include <netevent/utils.h>
+#include <netevent/fmt.h>
+
+struct hh_entry
+{
+	unsigned char key[HH_KEY_LEN];
+	unsigned char len;
+	uint32_t count;
+};
+
+/**
+ * Count-Min sketch for frequency estimates, plus a Space-Saving style
+ * min-heap of the current heavy hitters. A key displaces the smallest
+ * hitter once its estimate exceeds it.
+ */
+struct hh_sketch
+{
+	uint32_t cm[CM_DEPTH][CM_WIDTH];
+	struct hh_entry heap[HH_SLOTS];
+	unsigned int used;
+	unsigned long total;
+};
+
+static struct hh_sketch *sketches;
+static unsigned long ev_count[SUMMARY_EV_TYPES];
+static unsigned int summary_interval;
+static struct timer summary_timer;
+
+static const char *ev_names[SUMMARY_EV_TYPES] = {
+	"link", "addr", "route", "neigh", "nexthop", "other", "wireless"
+};
+
+static const char *class_names[SUMMARY_KEYS] = {
+	"interfaces", "prefixes", "MACs"
+};
+
+static uint32_t cm_update(struct hh_sketch *s, const void *key, size_t len)
+{
+	uint32_t h, est = UINT32_MAX;
+	int d;
+
+	for (d=0; d<CM_DEPTH; d++) {
+		h = hash_bytes(key, len, d * 0x9e3779b9) & (CM_WIDTH - 1);
+		if (++s->cm[d][h] < est)
+			est = s->cm[d][h];
+	}
+
+	return est;
+}
+
+static void heap_sift_down(struct hh_sketch *s, unsigned int i)
+{
+	struct hh_entry tmp;
+	unsigned int l, r, m;
+
+	for (;;) {
+		l = 2 * i + 1;
+		r = l + 1;
+		m = i;
+
+		if (l < s->used && s->heap[l].count < s->heap[m].count)
+			m = l;
+		if (r < s->used && s->heap[r].count < s->heap[m].count)
+			m = r;
+		if (m == i)
+			return;
+
+		tmp = s->heap[i];
+		s->heap[i] = s->heap[m];
+		s->heap[m] = tmp;
+		i = m;
+	}
+}
+
+static void heap_sift_up(struct hh_sketch *s, unsigned int i)
+{
+	struct hh_entry tmp;
+	unsigned int p;
+
+	while (i > 0) {
+		p = (i - 1) / 2;
+		if (s->heap[p].count <= s->heap[i].count)
+			return;
+
+		tmp = s->heap[i];
+		s->heap[i] = s->heap[p];
+		s->heap[p] = tmp;
+		i = p;
+	}
+}
+
+static void sketch_add(struct hh_sketch *s, const void *key, size_t len)
+{
+	struct hh_entry *e;
+	uint32_t est;
+	unsigned int i;
+
+	if (len > HH_KEY_LEN)
+		len = HH_KEY_LEN;
+
+	s->total++;
+	est = cm_update(s, key, len);
+
+	for (i=0; i<s->used; i++) {
+		e = &s->heap[i];
+		if (e->len == len && memcmp(e->key, key, len) == 0) {
+			e->count = est;
+			heap_sift_down(s, i);
+			return;
+		}
+	}
+
+	if (s->used < HH_SLOTS) {
+		i = s->used++;
+	} else if (est > s->heap[0].count) {
+		i = 0;
+	} else {
+		return;
+	}
+
+	e = &s->heap[i];
+	memcpy(e->key, key, len);
+	e->len = len;
+	e->count = est;
+
+	if (i == 0)
+		heap_sift_down(s, 0);
+	else
+		heap_sift_up(s, i);
+}
+
+static int format_key(char *buf, size_t size, int class,
+		      const struct hh_entry *e)
+{
+	char str[INET6_ADDRSTRLEN];
+	uint32_t ifindex;
+
+	switch (class) {
+	case SUMMARY_IF:
+		memcpy(&ifindex, e->key, sizeof(ifindex));
+		fmt_ifname(str, ifindex);
+		return snprintf(buf, size, "%s", str);
+	case SUMMARY_PREFIX:
+		fmt_inet(str, e->key[0], e->key + 2);
+		return snprintf(buf, size, "%s/%u", str, e->key[1]);
+	case SUMMARY_MAC:
+		fmt_mac(str, e->key);
+		return snprintf(buf, size, "%s", str);
+	}
+
+	return 0;
+}
+
+static int entry_cmp(const void *a, const void *b)
+{
+	const struct hh_entry *x = a, *y = b;
+
+	return (x->count < y->count) - (x->count > y->count);
+}
+
+static void summary_report(void)
+{
+	struct hh_entry top[HH_SLOTS];
+	struct hh_sketch *s;
+	unsigned long total = 0;
+	char buf[1024], key[64];
+	int c, i, len;
+
+	for (i=0; i<SUMMARY_EV_TYPES; i++)
+		total += ev_count[i];
+
+	len = snprintf(buf, sizeof(buf), "summary %us: %lu events (%.1f/s)",
+		       summary_interval, total,
+		       (double) total / summary_interval);
+
+	for (i=0; i<SUMMARY_EV_TYPES; i++) {
+		if (ev_count[i])
+			len = strappend(buf, sizeof(buf), len, " %s %lu",
+					ev_names[i], ev_count[i]);
+	}
+
+	tprintf("%s\n", buf);
+
+	for (c=0; c<SUMMARY_KEYS; c++) {
+		s = &sketches[c];
+		if (s->used == 0)
+			continue;
+
+		memcpy(top, s->heap, s->used * sizeof(struct hh_entry));
+		qsort(top, s->used, sizeof(struct hh_entry), entry_cmp);
+
+		len = snprintf(buf, sizeof(buf), "top %s:", class_names[c]);
+		for (i=0; i<SUMMARY_TOP_N && i<(int) s->used; i++) {
+			format_key(key, sizeof(key), c, &top[i]);
+			len = strappend(buf, sizeof(buf), len, "%s %s %u",
+					i ? "," : "", key, top[i].count);
+		}
+
+		tprintf("%s (of %lu)\n", buf, s->total);
+	}
+}
+
+static void summary_expired(struct timer *t)
+{
+	summary_report();
+
+	memset(sketches, 0, SUMMARY_KEYS * sizeof(struct hh_sketch));
+	memset(ev_count, 0, sizeof(ev_count));
+
+	timer_add(t, summary_interval);
+}
+
+int summary_init(unsigned int interval)
+{
+	sketches = calloc(SUMMARY_KEYS, sizeof(struct hh_sketch));
+	if (sketches == NULL)
+		return -1;
+
+	summary_interval = interval;
+	timer_setup(&summary_timer, summary_expired);
+	timer_add(&summary_timer, interval);
+
+	return 0;
+}
+
+int summary_enabled(void)
+{
+	return sketches != NULL;
+}
+
+void summary_count(int type)
+{
+	if (type >= 0 && type < SUMMARY_EV_TYPES)
+		ev_count[type]++;
+}
+
+void summary_key(int class, const void *key, size_t len)
+{
+	if (sketches && class >= 0 && class < SUMMARY_KEYS)
+		sketch_add(&sketches[class], key, len);
+}
+
+void summary_ifindex(int ifindex)
+{
+	uint32_t k = ifindex;
+
+	if (ifindex > 0)
+		summary_key(SUMMARY_IF, &k, sizeof(k));
+}
+
+void summary_prefix(int family, int prefixlen, const void *addr)
+{
+	unsigned char k[HH_KEY_LEN];
+	int alen = (family == AF_INET6) ? 16 : 4;
+
+	memset(k, 0, sizeof(k));
+	k[0] = family;
+	k[1] = prefixlen;
+	if (addr)
+		memcpy(k + 2, addr, alen);
+
+	summary_key(SUMMARY_PREFIX, k, 2 + alen);
+}
+
+void summary_mac(const void *mac)
+{
+	summary_key(SUMMARY_MAC, mac, ETH_ALEN);
+}
+
+int summary_rt_event(void *data, size_t n)
+{
+	struct nlmsghdr *nlh = data;
+	struct rtattr *tb[RTA_MAX + 1];
+	struct ifinfomsg *ifi;
+	struct ifaddrmsg *ifa;
+	struct ndmsg *ndm;
+	struct rtmsg *rtm;
+
+	switch (nlh->nlmsg_type) {
+	case RTM_NEWLINK:
+	case RTM_DELLINK:
+		ifi = NLMSG_DATA(nlh);
+		summary_count(SUMMARY_EV_LINK);
+		summary_ifindex(ifi->ifi_index);
+		break;
+	case RTM_NEWADDR:
+	case RTM_DELADDR:
+		ifa = NLMSG_DATA(nlh);
+		summary_count(SUMMARY_EV_ADDR);
+		summary_ifindex(ifa->ifa_index);
+		parse_rt_attrs(tb, IFA_MAX + 1, IFA_RTA(ifa), IFA_PAYLOAD(nlh));
+		if (tb[IFA_ADDRESS])
+			summary_prefix(ifa->ifa_family, ifa->ifa_prefixlen,
+				       RTA_DATA(tb[IFA_ADDRESS]));
+		break;
+	case RTM_NEWNEIGH:
+	case RTM_DELNEIGH:
+		ndm = NLMSG_DATA(nlh);
+		summary_count(SUMMARY_EV_NEIGH);
+		summary_ifindex(ndm->ndm_ifindex);
+		parse_rt_attrs(tb, NDA_MAX + 1, RTM_RTA(ndm), RTM_PAYLOAD(nlh));
+		if (tb[NDA_DST] && ndm->ndm_family != AF_BRIDGE)
+			summary_prefix(ndm->ndm_family,
+				       ndm->ndm_family == AF_INET6 ? 128 : 32,
+				       RTA_DATA(tb[NDA_DST]));
+		if (tb[NDA_LLADDR] && RTA_PAYLOAD(tb[NDA_LLADDR]) == ETH_ALEN)
+			summary_mac(RTA_DATA(tb[NDA_LLADDR]));
+		break;
+	case RTM_NEWROUTE:
+	case RTM_DELROUTE:
+		rtm = NLMSG_DATA(nlh);
+		summary_count(SUMMARY_EV_ROUTE);
+		parse_rt_attrs(tb, RTA_MAX + 1, RTM_RTA(rtm), RTM_PAYLOAD(nlh));
+		summary_prefix(rtm->rtm_family, rtm->rtm_dst_len,
+			       tb[RTA_DST] ? RTA_DATA(tb[RTA_DST]) : NULL);
+		if (tb[RTA_OIF])
+			summary_ifindex(*(int *) RTA_DATA(tb[RTA_OIF]));
+		break;
+	case RTM_NEWNEXTHOP:
+	case RTM_DELNEXTHOP:
+		summary_count(SUMMARY_EV_NEXTHOP);
+		break;
+	default:
+		summary_count(SUMMARY_EV_OTHER);
+		break;
+	}
+
+	return 0;
+}
@@ -0,0 +1,259 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include <netlink/netlink.h>
+#include <netlink/genl/genl.h>
+
+#include <linux/nl80211.h>
+
+#include <netevent/survey.h>
+#include <netevent/nl80211.h>
+#include <netevent/timer.h>
+#include <netevent/hash.h>
+#include <netevent/console.h>
+#include <netevent/utils.h>
+
+struct survey_chan
+{
+	struct hnode node;
+	uint32_t wiphy;
+	uint32_t freq;
+	uint64_t time;		/* ms, cumulative */
+	uint64_t busy;
+	uint64_t rx;
+	uint64_t tx;
+};
+
+/* First interface of each wiphy, the one the survey is asked through */
+struct survey_radios
+{
+	int n;
+	uint32_t wiphy[SURVEY_WIPHYS_MAX];
+	int ifindex[SURVEY_WIPHYS_MAX];
+};
+
+static struct htable chan_table;
+static struct timer survey_timer;
+static unsigned int survey_interval;
+static struct nl_sock *survey_sock;
+static int nl80211_id;
+
+static int chan_cmp(const struct hnode *n, const void *key)
+{
+	const struct survey_chan *c = hnode_entry(n, struct survey_chan, node);
+	const uint32_t *k = key;
+
+	return c->wiphy != k[0] || c->freq != k[1];
+}
+
+static uint64_t survey_u64(struct nlattr *a)
+{
+	return a ? nla_get_u64(a) : 0;
+}
+
+static unsigned int percent(uint64_t part, uint64_t whole)
+{
+	return part >= whole ? 100 : part * 100 / whole;
+}
+
+static void survey_sample(uint32_t wiphy, struct nlattr *info[])
+{
+	uint32_t key[2] = { wiphy, nla_get_u32(info[NL80211_SURVEY_INFO_FREQUENCY]) };
+	uint64_t time, busy, rx, tx, dt;
+	struct survey_chan *c;
+	struct hnode *n;
+	char buf[256];
+	int len;
+
+	time = survey_u64(info[NL80211_SURVEY_INFO_TIME]);
+	busy = survey_u64(info[NL80211_SURVEY_INFO_TIME_BUSY]);
+	rx = survey_u64(info[NL80211_SURVEY_INFO_TIME_RX]);
+	tx = survey_u64(info[NL80211_SURVEY_INFO_TIME_TX]);
+
+	n = htable_find(&chan_table, hash_bytes(key, sizeof(key), 0), key);
+
+	if (n == NULL) {
+		if ( (c = calloc(1, sizeof(*c))) == NULL )
+			return;
+		c->wiphy = key[0];
+		c->freq = key[1];
+		c->time = time;
+		c->busy = busy;
+		c->rx = rx;
+		c->tx = tx;
+		htable_insert(&chan_table, &c->node, hash_bytes(key, sizeof(key), 0));
+		return;
+	}
+
+	c = hnode_entry(n, struct survey_chan, node);
+
+	/* Not visited, or the driver reset its counters */
+	if (time <= c->time || busy < c->busy || rx < c->rx || tx < c->tx) {
+		dt = 0;
+	} else {
+		dt = time - c->time;
+		len = snprintf(buf, sizeof(buf),
+			       "Survey on phy%u %u MHz: busy %u%%, rx %u%%, tx %u%%",
+			       c->wiphy, c->freq, percent(busy - c->busy, dt),
+			       percent(rx - c->rx, dt), percent(tx - c->tx, dt));
+		if (info[NL80211_SURVEY_INFO_NOISE])
+			len = strappend(buf, sizeof(buf), len, ", noise %d dBm",
+					(int8_t) nla_get_u8(info[NL80211_SURVEY_INFO_NOISE]));
+		if (info[NL80211_SURVEY_INFO_IN_USE])
+			len = strappend(buf, sizeof(buf), len, ", in use");
+		tprintf("%s over %llu ms\n", buf, (unsigned long long) dt);
+	}
+
+	c->time = time;
+	c->busy = busy;
+	c->rx = rx;
+	c->tx = tx;
+}
+
+static int survey_msg(struct nl_msg *msg, void *arg)
+{
+	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+	struct nlattr *tb[NL80211_ATTR_MAX + 1];
+	struct nlattr *info[NL80211_SURVEY_INFO_MAX + 1];
+
+	nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
+		  genlmsg_attrlen(gnlh, 0), NULL);
+
+	if (tb[NL80211_ATTR_SURVEY_INFO] == NULL
+	    || nla_parse_nested(info, NL80211_SURVEY_INFO_MAX,
+				tb[NL80211_ATTR_SURVEY_INFO], NULL) < 0
+	    || info[NL80211_SURVEY_INFO_FREQUENCY] == NULL)
+		return NL_SKIP;
+
+	survey_sample(*(uint32_t *) arg, info);
+
+	return NL_SKIP;
+}
+
+static int interface_msg(struct nl_msg *msg, void *arg)
+{
+	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+	struct nlattr *tb[NL80211_ATTR_MAX + 1];
+	struct survey_radios *r = arg;
+	uint32_t wiphy;
+	int i;
+
+	nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
+		  genlmsg_attrlen(gnlh, 0), NULL);
+
+	if (tb[NL80211_ATTR_WIPHY] == NULL || tb[NL80211_ATTR_IFINDEX] == NULL)
+		return NL_SKIP;
+
+	wiphy = nla_get_u32(tb[NL80211_ATTR_WIPHY]);
+
+	for (i=0; i<r->n; i++) {
+		if (r->wiphy[i] == wiphy)
+			return NL_SKIP;
+	}
+
+	if (r->n < SURVEY_WIPHYS_MAX) {
+		r->wiphy[r->n] = wiphy;
+		r->ifindex[r->n++] = nla_get_u32(tb[NL80211_ATTR_IFINDEX]);
+	}
+
+	return NL_SKIP;
+}
+
+static int survey_dump(int cmd, int ifindex, nl_recvmsg_msg_cb_t fn, void *arg)
+{
+	struct nl_msg *msg;
+	int err = -NLE_NOMEM;
+
+	if ( (msg = nlmsg_alloc()) == NULL )
+		return err;
+
+	if (genlmsg_put(msg, NL_AUTO_PORT, NL_AUTO_SEQ, nl80211_id, 0,
+			NLM_F_DUMP, cmd, 0) == NULL
+	    || (ifindex && nla_put_u32(msg, NL80211_ATTR_IFINDEX, ifindex) < 0))
+		goto out;
+
+	nl_socket_modify_cb(survey_sock, NL_CB_VALID, NL_CB_CUSTOM, fn, arg);
+
+	if ( (err = nl_send_auto_complete(survey_sock, msg)) >= 0 )
+		err = nl_recvmsgs_default(survey_sock);
+
+	/* arg is on the stack of the caller, the socket is shared with cqm */
+	nl_socket_modify_cb(survey_sock, NL_CB_VALID, NL_CB_DEFAULT, NULL, NULL);
+
+out:
+	nlmsg_free(msg);
+
+	return err;
+}
+
+static void survey_run(struct timer *t)
+{
+	struct survey_radios r;
+	int i, err;
+
+	timer_add(t, survey_interval);
+
+	if (!nl80211_active())
+		return;
+
+	r.n = 0;
+	if ( (err = survey_dump(NL80211_CMD_GET_INTERFACE, 0, interface_msg, &r)) < 0 ) {
+		tprintf("Survey: listing interfaces failed: %s\n", nl_geterror(err));
+		return;
+	}
+
+	for (i=0; i<r.n; i++) {
+		err = survey_dump(NL80211_CMD_GET_SURVEY, r.ifindex[i], survey_msg,
+				  &r.wiphy[i]);
+		if (err < 0 && err != -NLE_OPNOTSUPP)
+			tprintf("Survey on phy%u failed: %s\n", r.wiphy[i],
+				nl_geterror(err));
+	}
+}
+
+/* The family is known, from the loop or right from survey_init() */
+static void survey_ready(int family)
+{
+	if ( (survey_sock = nl80211_cmd_socket(&nl80211_id)) == NULL ) {
+		tprintf("Survey: %s\n", strerror(errno));
+		return;
+	}
+
+	if (!timer_pending(&survey_timer))
+		survey_run(&survey_timer);
+}
+
+int survey_init(unsigned int interval)
+{
+	if (interval == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	survey_interval = interval;
+
+	if (htable_init(&chan_table, 64, chan_cmp) == -1)
+		return -1;
+
+	timer_setup(&survey_timer, survey_run);
+
+	return nl80211_when_ready(survey_ready);
+}
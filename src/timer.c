@@ -0,0 +1,218 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <sys/timerfd.h>
+
+#include <netevent/timer.h>
+
+static struct timer *wheel_l0[TW_L0_SIZE];
+static struct timer *wheel_ln[TW_LEVELS - 1][TW_LN_SIZE];
+static uint64_t wheel_now;
+static uint64_t wheel_base;
+static unsigned long wheel_count;
+static int wheel_fd = -1;
+
+static uint64_t monotonic_secs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec;
+}
+
+static void wheel_arm(int on)
+{
+	struct itimerspec its;
+
+	if (wheel_fd < 0)
+		return;
+
+	memset(&its, 0, sizeof(its));
+	if (on) {
+		its.it_value.tv_sec = 1;
+		its.it_interval.tv_sec = 1;
+	}
+
+	timerfd_settime(wheel_fd, 0, &its, NULL);
+}
+
+int timer_init(void)
+{
+	wheel_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	wheel_base = monotonic_secs();
+	wheel_now = 0;
+
+	return wheel_fd;
+}
+
+uint64_t timer_now(void)
+{
+	return wheel_now;
+}
+
+void timer_setup(struct timer *t, timer_fn_t fn)
+{
+	t->next = NULL;
+	t->pprev = NULL;
+	t->expires = 0;
+	t->fn = fn;
+}
+
+static void list_add(struct timer **head, struct timer *t)
+{
+	t->next = *head;
+	if (t->next)
+		t->next->pprev = &t->next;
+	*head = t;
+	t->pprev = head;
+}
+
+static void wheel_insert(struct timer *t)
+{
+	uint64_t expires = t->expires;
+	uint64_t delta;
+	int lvl, shift;
+
+	/* Due now only happens while cascading, right before l0 is run */
+	if (expires < wheel_now)
+		expires = wheel_now;
+
+	delta = expires - wheel_now;
+
+	/* Beyond the wheel, park it in the last slot and re-queue on expiry */
+	if (delta > TW_MAX_DELAY)
+		expires = wheel_now + TW_MAX_DELAY;
+
+	if (delta < TW_L0_SIZE) {
+		list_add(&wheel_l0[expires & (TW_L0_SIZE - 1)], t);
+		return;
+	}
+
+	for (lvl = 0; lvl < TW_LEVELS - 1; lvl++) {
+		shift = TW_L0_BITS + (lvl + 1) * TW_LN_BITS;
+		if (lvl == TW_LEVELS - 2 || delta < (1ULL << shift))
+			break;
+	}
+
+	shift = TW_L0_BITS + lvl * TW_LN_BITS;
+	list_add(&wheel_ln[lvl][(expires >> shift) & (TW_LN_SIZE - 1)], t);
+}
+
+static void list_del(struct timer *t)
+{
+	*t->pprev = t->next;
+	if (t->next)
+		t->next->pprev = t->pprev;
+
+	t->next = NULL;
+	t->pprev = NULL;
+}
+
+void timer_del(struct timer *t)
+{
+	if (!timer_pending(t))
+		return;
+
+	list_del(t);
+
+	if (--wheel_count == 0)
+		wheel_arm(0);
+}
+
+void timer_add(struct timer *t, unsigned int secs)
+{
+	timer_del(t);
+
+	/* An idle wheel does not turn, catch up with the clock first */
+	if (wheel_count == 0)
+		wheel_now = monotonic_secs() - wheel_base;
+
+	t->expires = wheel_now + (secs ? secs : 1);
+	wheel_insert(t);
+
+	if (wheel_count++ == 0)
+		wheel_arm(1);
+}
+
+static void cascade(struct timer **slot)
+{
+	struct timer *t = *slot, *next;
+
+	*slot = NULL;
+
+	for (; t; t = next) {
+		next = t->next;
+		wheel_insert(t);
+	}
+}
+
+static void wheel_tick(void)
+{
+	struct timer *t;
+	unsigned int idx[TW_LEVELS - 1];
+	int lvl, depth = 0;
+
+	wheel_now++;
+
+	/* A level is cascaded when every level below it wrapped */
+	if ((wheel_now & (TW_L0_SIZE - 1)) == 0) {
+		for (depth = 0; depth < TW_LEVELS - 1; depth++) {
+			idx[depth] = (wheel_now >> (TW_L0_BITS + depth * TW_LN_BITS))
+				& (TW_LN_SIZE - 1);
+			if (idx[depth] != 0) {
+				depth++;
+				break;
+			}
+		}
+	}
+
+	/* Top down, so timers land in slots that have not been emptied yet */
+	for (lvl = depth - 1; lvl >= 0; lvl--)
+		cascade(&wheel_ln[lvl][idx[lvl]]);
+
+	while ((t = wheel_l0[wheel_now & (TW_L0_SIZE - 1)]) != NULL) {
+		if (t->expires > wheel_now) {
+			list_del(t);
+			wheel_insert(t);
+			continue;
+		}
+
+		timer_del(t);
+		t->fn(t);
+	}
+}
+
+void timer_run(int fd)
+{
+	uint64_t exp, target;
+
+	/* Expiration count is only used to drain the fd, time comes from the clock */
+	if (read(fd, &exp, sizeof(exp)) != sizeof(exp))
+		return;
+
+	target = monotonic_secs() - wheel_base;
+
+	while (wheel_count && wheel_now < target)
+		wheel_tick();
+
+	if (wheel_now < target)
+		wheel_now = target;
+}
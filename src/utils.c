@@ -18,21 +18,46 @@
  */
 
 #include <stdio.h>
+#include <stdarg.h>
 #include <netevent/utils.h>
+#include <netevent/fmt.h>
 
 int zero_addr(const unsigned char *addr)
 {
         return (addr[0] | addr[1] | addr[2] | addr[3] | addr[4] | addr[5]);
 }
 
+/* At most (buflen - 1) / 2 bytes of data fit with the terminating NUL */
 char * print_binary_stream(char * buf, unsigned int buflen, const unsigned char * data, unsigned int len)
 {
-	unsigned int i;
-	unsigned int offset;
+	if (buflen == 0)
+		return buf;
 
-	for(i=0, offset=0; i<len, offset<buflen; i++) {
-		offset += sprintf((buf+offset), "%02X", data[i]);
-	}
+	if (len > (buflen - 1) / 2)
+		len = (buflen - 1) / 2;
+
+	fmt_hex(buf, data, len);
 
 	return buf;
 }
+
+int strappend(char *buf, size_t size, int len, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (len < 0 || (size_t) len >= size)
+		return len;
+
+	va_start(ap, fmt);
+	n = vsnprintf(buf + len, size - len, fmt, ap);
+	va_end(ap);
+
+	if (n < 0)
+		return len;
+
+	if ((size_t) (len + n) >= size)
+		return size - 1;
+
+	return len + n;
+}